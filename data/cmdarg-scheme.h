@@ -3,13 +3,14 @@
 */
 
 /*
-ffcmdarg_scheme_init
+ffcmdarg_scheme_init ffcmdarg_scheme_destroy
 ffcmdarg_scheme_process
 ffcmdarg_parse_object
 */
 
 #pragma once
 #include "cmdarg.h"
+#include "phash.h"
 
 enum FFCMDARG_SCHEME_T {
 	FFCMDARG_TSWITCH,
@@ -84,12 +85,32 @@ typedef struct ffcmdarg_scheme {
 	void *obj;
 	const char *errmsg;
 	ffuint used_bits[2];
+	ffphash hash; // compiled long names (FFCMDARG_SCF_HASH)
 } ffcmdarg_scheme;
 
 enum FFCMDARG_SCHEME_F {
 	FFCMDARG_SCF_SKIP_UNKNOWN = 1, // skip unknown keys
+
+	/** Compile long names into a perfect hash.
+	User must call ffcmdarg_scheme_destroy(). */
+	FFCMDARG_SCF_HASH = 2,
 };
 
+static inline void _ffcmdarg_scheme_hash(ffcmdarg_scheme *as)
+{
+	ffuint n;
+	for (n = 0;  as->args[n].long_name != NULL;  n++) {}
+
+	ffstr *keys;
+	if (NULL == (keys = (ffstr*)ffmem_alloc((n + 1) * sizeof(ffstr))))
+		return; // use linear search
+	for (ffuint i = 0;  i != n;  i++) {
+		ffstr_setz(&keys[i], as->args[i].long_name);
+	}
+	ffphash_build(&as->hash, keys, n, 0);
+	ffmem_free(keys);
+}
+
 /** Initialize parser object
 args: array of arguments; terminated by NULL entry
 scheme_flags: enum FFCMDARG_SCHEME_F */
@@ -100,6 +121,22 @@ static inline void ffcmdarg_scheme_init(ffcmdarg_scheme *as, const ffcmdarg_arg
 	as->parser = a;
 	as->args = args;
 	as->obj = obj;
+	if (scheme_flags & FFCMDARG_SCF_HASH)
+		_ffcmdarg_scheme_hash(as);
+}
+
+static inline void ffcmdarg_scheme_destroy(ffcmdarg_scheme *as)
+{
+	ffphash_free(&as->hash);
+}
+
+/** Find element by a long name using the compiled table */
+static inline const ffcmdarg_arg* _ffcmdarg_arg_hash_find(const ffcmdarg_scheme *as, ffstr name)
+{
+	int i = ffphash_find(&as->hash, name.ptr, name.len);
+	if (i >= 0 && ffstr_eqz(&name, as->args[i].long_name))
+		return &as->args[i];
+	return NULL;
 }
 
 /** Find element by a long name */
@@ -188,7 +225,10 @@ static inline int ffcmdarg_scheme_process(ffcmdarg_scheme *as, int r)
 			as->arg = _ffcmdarg_arg_find_short(as->args, val.ptr[1]);
 		} else {
 			ffstr v = FFSTR_INITN(val.ptr+2, val.len-2);
-			as->arg = _ffcmdarg_arg_find(as->args, v);
+			if (as->hash.slots != NULL)
+				as->arg = _ffcmdarg_arg_hash_find(as, v);
+			else
+				as->arg = _ffcmdarg_arg_find(as->args, v);
 		}
 
 		if (as->arg == NULL) {
@@ -386,6 +426,7 @@ static inline int ffcmdarg_parse_object(const ffcmdarg_arg *args, void *obj, con
 			, &a.val, err);
 	}
 
+	ffcmdarg_scheme_destroy(&as);
 	return r;
 }
 
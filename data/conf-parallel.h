@@ -0,0 +1,229 @@
+/** ffconf extension: parse a large file on several threads
+2026, Simon Zolin */
+
+/*
+ffconf_parse_file_parallel
+*/
+
+/*
+The file is split into chunks at the lines containing only '}' -
+ these are the possible ends of top-level objects: "key {" ... "}".
+Each chunk is tokenized on a thread pool independently,
+ then the tokens of all chunks are passed to the scheme in order on the calling thread,
+ so the handlers are never called concurrently.
+If a chunk doesn't tokenize cleanly (e.g. '}' closed a nested object),
+ the whole file is parsed again sequentially,
+ which also produces the same error message as ffconf_parse_file().
+Limitation: a quoted value must not contain a line with only '}'.
+*/
+
+#pragma once
+#include "conf-scheme.h"
+#include "../sys/thpool.h"
+#include <ffsys/semaphore.h>
+
+struct _ffconf_tok {
+	int r;
+	ffuint line, col; // line number is relative to the chunk
+	ffsize off, len; // value in _ffconf_chunk.vals
+};
+
+struct _ffconf_chunk {
+	ffstr data;
+	ffsem sem; // signalled when done
+	ffvec toks; // struct _ffconf_tok[]
+	ffvec vals; // char[]
+	ffuint nlines;
+	int err;
+};
+
+/** Find the beginning of the line that follows a line with only '}' */
+static inline ffsize _ffconf_split_next(ffstr d, ffsize off)
+{
+	while (off < d.len) {
+		const char *lf = (char*)ffmem_findbyte(d.ptr + off, d.len - off, '\n');
+		if (lf == NULL)
+			break;
+		off = lf - d.ptr + 1;
+
+		if (off < d.len && d.ptr[off] == '}') {
+			ffsize i = off + 1;
+			while (i < d.len && (d.ptr[i] == ' ' || d.ptr[i] == '\t' || d.ptr[i] == '\r')) {
+				i++;
+			}
+			if (i < d.len && d.ptr[i] == '\n')
+				return i + 1;
+		}
+	}
+	return d.len;
+}
+
+/** Tokenize the chunk */
+static inline void _ffconf_chunk_read(struct _ffconf_chunk *ch)
+{
+	struct ffconf_obj c = {};
+	ffstr in = ch->data, val;
+
+	while (in.len != 0) {
+		int r = ffconf_obj_read(&c, &in, &val);
+		if (r == FFCONF_ERROR) {
+			ch->err = 1;
+			break;
+		}
+		if (r == FFCONF_MORE)
+			continue;
+
+		struct _ffconf_tok *t;
+		if (NULL == (t = ffvec_pushT(&ch->toks, struct _ffconf_tok))
+			|| (val.len != 0 && 0 == ffvec_add2(&ch->vals, &val, 1))) {
+			ch->err = 1;
+			break;
+		}
+		t->r = r;
+		t->line = ffconf_line(&c.lt);
+		t->col = ffconf_col(&c.lt);
+		t->off = ch->vals.len - val.len;
+		t->len = val.len;
+	}
+
+	ch->nlines = ffconf_line(&c.lt) - 1;
+	if (c.buf.len != 0)
+		ch->err = 1; // the chunk ends inside a key or value
+	if (0 != ffconf_obj_fin(&c))
+		ch->err = 1; // the chunk isn't a sequence of complete top-level objects
+}
+
+static void _ffconf_chunk_task(ffthpool_task *t)
+{
+	struct _ffconf_chunk *ch = (struct _ffconf_chunk*)t->udata;
+	_ffconf_chunk_read(ch);
+	ffsem_post(ch->sem);
+}
+
+/** Pass the tokens to the scheme in order
+Return 0 on success */
+static inline int _ffconf_chunks_process(struct _ffconf_chunk *chunks, ffuint n, const ffconf_arg *args, void *obj, ffuint scheme_flags, ffstr *errmsg)
+{
+	int r = 0;
+	ffuint line = 0;
+	ffstr val = {};
+	const struct _ffconf_tok *t = NULL;
+	ffconf_scheme cs = {};
+	cs.flags = scheme_flags;
+	ffconf_scheme_addctx(&cs, args, obj);
+
+	for (ffuint i = 0;  i != n;  i++) {
+		struct _ffconf_chunk *ch = &chunks[i];
+		FFSLICE_WALK(&ch->toks, t) {
+			ffstr_set(&val, ch->vals.ptr + t->off, t->len);
+			if (0 != (r = ffconf_scheme_process(&cs, t->r, val)))
+				goto end;
+		}
+		line += ch->nlines;
+	}
+
+end:
+	ffconf_scheme_destroy(&cs);
+
+	if (r != 0 && errmsg != NULL) {
+		char errbuf[100];
+		const char *err = cs.errmsg;
+		if (r != FFCONF_ERROR) {
+			ffsz_format(errbuf, sizeof(errbuf), "%d", r);
+			err = errbuf;
+		}
+		ffsize cap = 0;
+		ffstr_growfmt(errmsg, &cap, "%u:%u: near \"%S\": %s"
+			, (int)(line + t->line), (int)t->col
+			, &val
+			, err);
+	}
+
+	return r;
+}
+
+/** Parse a large file on several threads.
+tp: thread pool; its queue must fit 'nchunks' tasks
+nchunks: max. number of chunks to split the file into
+Return 0 on success */
+static inline int ffconf_parse_file_parallel(const ffconf_arg *args, void *obj, const char *fn, ffuint scheme_flags, ffstr *errmsg, ffuint64 file_max_size, ffthpool *tp, ffuint nchunks)
+{
+	const ffsize MIN_CHUNK = 1*1024*1024;
+	int r = -1;
+	ffvec buf = {}, chunks = {};
+	ffstr data, d;
+	ffsem sem = FFSEM_NULL;
+	ffuint i, nstarted = 0;
+	struct _ffconf_chunk *ch;
+
+	if (0 != _ffconf_file_map(fn, file_max_size, &data, &buf)) {
+		if (errmsg != NULL) {
+			ffsize cap = 0;
+			errmsg->len = 0;
+			ffstr_growfmt(errmsg, &cap, "%s: %s", fn, fferr_strptr(fferr_last()));
+		}
+		return -1;
+	}
+
+	nchunks = ffmin(nchunks, data.len / MIN_CHUNK);
+	if (nchunks <= 1)
+		goto sequential;
+
+	if (FFSEM_NULL == (sem = ffsem_open(NULL, 0, 0))
+		|| NULL == ffvec_zallocT(&chunks, nchunks, struct _ffconf_chunk))
+		goto sequential;
+
+	for (ffsize off = 0;  off != data.len;  ) {
+		ffsize end = data.len;
+		if (chunks.len + 1 != nchunks)
+			end = _ffconf_split_next(data, off + data.len / nchunks);
+		if (NULL == (ch = ffvec_pushT(&chunks, struct _ffconf_chunk)))
+			goto sequential;
+		ffstr_set(&ch->data, data.ptr + off, end - off);
+		ch->sem = sem;
+		off = end;
+	}
+
+	FFSLICE_WALK(&chunks, ch) {
+		ffthpool_task *t;
+		if (NULL == (t = ffthpool_task_new(0))) {
+			_ffconf_chunk_read(ch);
+			continue;
+		}
+		t->handler = _ffconf_chunk_task;
+		t->udata = ch;
+		if (0 != ffthpool_add(tp, t)) {
+			_ffconf_chunk_read(ch); // not queued
+		} else {
+			nstarted++;
+		}
+		ffthpool_task_free(t);
+	}
+
+	for (i = 0;  i != nstarted;  i++) {
+		ffsem_wait(sem, -1);
+	}
+
+	FFSLICE_WALK(&chunks, ch) {
+		if (ch->err)
+			goto sequential;
+	}
+
+	r = _ffconf_chunks_process((struct _ffconf_chunk*)chunks.ptr, chunks.len, args, obj, scheme_flags, errmsg);
+	goto end;
+
+sequential:
+	d = data;
+	r = ffconf_parse_object(args, obj, &d, scheme_flags, errmsg);
+
+end:
+	FFSLICE_WALK(&chunks, ch) {
+		ffvec_free(&ch->toks);
+		ffvec_free(&ch->vals);
+	}
+	ffvec_free(&chunks);
+	if (sem != FFSEM_NULL)
+		ffsem_close(sem);
+	_ffconf_file_unmap(&data, &buf);
+	return r;
+}
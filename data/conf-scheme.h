@@ -3,6 +3,7 @@
 */
 
 /*
+ffconf_arg_hashes_free
 ffconf_scheme_addctx ffconf_scheme_skipctx
 ffconf_scheme_process
 ffconf_scheme_keyname
@@ -12,6 +13,7 @@ ffconf_parse_file
 
 #pragma once
 #include "conf-obj.h"
+#include "phash.h"
 #include <ffsys/file.h> // optional
 #include <ffsys/error.h>
 #include <ffbase/stringz.h>
@@ -129,11 +131,77 @@ static inline const ffconf_arg* _ffconf_arg_ifind(const ffconf_arg *args, const
 	return NULL;
 }
 
+/** Compiled args table */
+typedef struct ffconf_arg_hash {
+	const ffconf_arg *args;
+	const ffconf_arg *any; // the "*" entry
+	ffuint icase;
+	ffphash ph; // empty if the table couldn't be compiled
+} ffconf_arg_hash;
+
+/** Compiled args tables.
+May be reused by subsequent parsers (not by parallel ones). */
+typedef struct ffconf_arg_hashes {
+	ffvec list; // ffconf_arg_hash*[]
+} ffconf_arg_hashes;
+
+static inline void ffconf_arg_hashes_free(ffconf_arg_hashes *hs)
+{
+	ffconf_arg_hash **it;
+	FFSLICE_WALK(&hs->list, it) {
+		ffphash_free(&(*it)->ph);
+		ffmem_free(*it);
+	}
+	ffvec_free(&hs->list);
+}
+
+/** Build perfect hash for the table of key names.
+"*" entry is not included - it's used when nothing else matches. */
+static inline ffconf_arg_hash* _ffconf_arg_hash_build(const ffconf_arg *args, ffuint icase)
+{
+	ffconf_arg_hash *h;
+	if (NULL == (h = ffmem_new(ffconf_arg_hash)))
+		return NULL;
+	h->args = args;
+	h->icase = icase;
+
+	ffuint i;
+	for (i = 0;  args[i].name != NULL;  i++) {}
+	if (i != 0 && ffsz_eq(args[i-1].name, "*")) {
+		h->any = &args[i-1];
+		i--;
+	}
+
+	ffstr *keys;
+	if (NULL == (keys = (ffstr*)ffmem_alloc((i + 1) * sizeof(ffstr)))) {
+		ffmem_free(h);
+		return NULL;
+	}
+	for (ffuint k = 0;  k != i;  k++) {
+		ffstr_setz(&keys[k], args[k].name);
+	}
+	ffphash_build(&h->ph, keys, i, (icase) ? FFPHASH_ICASE : 0);
+	ffmem_free(keys);
+	return h;
+}
+
+/** Find element by name using the compiled table */
+static inline const ffconf_arg* _ffconf_arg_hash_find(const ffconf_arg_hash *h, const ffstr *name)
+{
+	int i = ffphash_find(&h->ph, name->ptr, name->len);
+	if (i >= 0) {
+		if ((!h->icase) ? ffstr_eqz(name, h->args[i].name) : ffstr_ieqz(name, h->args[i].name))
+			return &h->args[i];
+	}
+	return h->any;
+}
+
 
 struct ffconf_schemectx {
 	const ffconf_arg *args;
 	void *obj;
 	ffuint used_bits[2];
+	const ffconf_arg_hash *hash; // compiled 'args' (FFCONF_SCF_HASH)
 };
 
 typedef struct ffconf_scheme {
@@ -143,6 +211,11 @@ typedef struct ffconf_scheme {
 	ffstr any_keyname; // current key name for the "*" entry
 	ffstr objval; // "key VALUE {"
 	const char *errmsg;
+
+	/** (optional) User's compiled args tables (FFCONF_SCF_HASH).
+	Otherwise the tables are compiled into 'own_hashes' and freed with the parser. */
+	ffconf_arg_hashes *hashes;
+	ffconf_arg_hashes own_hashes;
 } ffconf_scheme;
 
 static inline void ffconf_scheme_destroy(ffconf_scheme *cs)
@@ -150,13 +223,47 @@ static inline void ffconf_scheme_destroy(ffconf_scheme *cs)
 	ffvec_free(&cs->ctxs);
 	ffstr_free(&cs->any_keyname);
 	ffstr_free(&cs->objval);
+	ffconf_arg_hashes_free(&cs->own_hashes);
 }
 
 enum FFCONF_SCHEME_F {
 	/** Case-insensitive key names */
 	FFCONF_SCF_ICASE = 1,
+
+	/** Compile each args table into a perfect hash on its first use.
+	Speeds up key lookup for large tables. */
+	FFCONF_SCF_HASH = 2,
 };
 
+/** Get the compiled table; compile on first use */
+static inline const ffconf_arg_hash* _ffconf_scheme_hash(ffconf_scheme *cs, const ffconf_arg *args)
+{
+	ffconf_arg_hashes *hs = (cs->hashes != NULL) ? cs->hashes : &cs->own_hashes;
+	ffuint icase = !!(cs->flags & FFCONF_SCF_ICASE);
+	ffconf_arg_hash **it, *h;
+	FFSLICE_WALK(&hs->list, it) {
+		if ((*it)->args == args && (*it)->icase == icase) {
+			h = *it;
+			goto done;
+		}
+	}
+
+	if (NULL == (h = _ffconf_arg_hash_build(args, icase)))
+		return NULL;
+	ffconf_arg_hash **ph;
+	if (NULL == (ph = ffvec_pushT(&hs->list, ffconf_arg_hash*))) {
+		ffphash_free(&h->ph);
+		ffmem_free(h);
+		return NULL;
+	}
+	*ph = h;
+
+done:
+	if (h->ph.slots == NULL)
+		return NULL; // use linear search
+	return h;
+}
+
 /** Get the value preceding '{', e.g. "key value {" */
 static inline ffstr* ffconf_scheme_objval(ffconf_scheme *cs)
 {
@@ -176,6 +283,9 @@ static inline void ffconf_scheme_addctx(ffconf_scheme *cs, const ffconf_arg *arg
 	c->args = args;
 	c->obj = obj;
 	ffmem_zero(c->used_bits, sizeof(c->used_bits));
+	c->hash = NULL;
+	if ((cs->flags & FFCONF_SCF_HASH) && args != (ffconf_arg*)-1)
+		c->hash = _ffconf_scheme_hash(cs, args);
 }
 
 /** Skip the object context being opened */
@@ -288,7 +398,9 @@ static inline int ffconf_scheme_process(ffconf_scheme *cs, int r, ffstr val)
 	}
 
 	case FFCONF_KEY: {
-		if (cs->flags & FFCONF_SCF_ICASE)
+		if (ctx->hash != NULL)
+			cs->arg = _ffconf_arg_hash_find(ctx->hash, &val);
+		else if (cs->flags & FFCONF_SCF_ICASE)
 			cs->arg = _ffconf_arg_ifind(ctx->args, &val);
 		else
 			cs->arg = _ffconf_arg_find(ctx->args, &val);
@@ -516,12 +628,71 @@ end:
 
 #ifdef _FFSYS_FILE_H
 
+#ifdef FF_UNIX
+#include <sys/mman.h>
+#endif
+
+/** Get the whole file data.
+UNIX: map the file into memory instead of reading it.
+Free with _ffconf_file_unmap() */
+static inline int _ffconf_file_map(const char *fn, ffuint64 file_max_size, ffstr *data, ffvec *buf)
+{
+#ifdef FF_UNIX
+	(void)buf;
+	int rc = -1;
+	fffd f;
+	if (FFFILE_NULL == (f = fffile_open(fn, FFFILE_READONLY)))
+		return -1;
+
+	ffint64 size = fffile_size(f);
+	if (size < 0)
+		goto end;
+	if ((ffuint64)size > file_max_size) {
+		fferr_set(EFBIG);
+		goto end;
+	}
+
+	ffstr_null(data);
+	if (size != 0) {
+		void *p = mmap(NULL, size, PROT_READ, MAP_PRIVATE, f, 0);
+		if (p == MAP_FAILED)
+			goto end;
+		madvise(p, size, MADV_SEQUENTIAL);
+		ffstr_set(data, p, size);
+	}
+	rc = 0;
+
+end:
+	fffile_close(f);
+	return rc;
+
+#else
+	if (0 != fffile_readwhole(fn, buf, file_max_size))
+		return -1;
+	ffstr_setstr(data, buf);
+	return 0;
+#endif
+}
+
+static inline void _ffconf_file_unmap(ffstr *data, ffvec *buf)
+{
+#ifdef FF_UNIX
+	(void)buf;
+	if (data->len != 0)
+		munmap(data->ptr, data->len);
+#else
+	(void)data;
+	ffvec_free(buf);
+#endif
+}
+
 /**
 Return 0 on success */
 static inline int ffconf_parse_file(const ffconf_arg *args, void *obj, const char *fn, ffuint scheme_flags, ffstr *errmsg, ffuint64 file_max_size)
 {
-	ffvec data = {};
-	if (0 != fffile_readwhole(fn, &data, file_max_size)) {
+	ffvec buf = {};
+	ffstr data, d;
+	if (0 != _ffconf_file_map(fn, file_max_size, &data, &buf)) {
 		if (errmsg != NULL) {
 			ffsize cap = 0;
 			errmsg->len = 0;
@@ -529,10 +700,9 @@ static inline int ffconf_parse_file(const ffconf_arg *args, void *obj, const cha
 		}
 		return -1;
 	}
-	ffstr d;
-	ffstr_setstr(&d, &data);
+	d = data;
 	int r = ffconf_parse_object(args, obj, &d, scheme_flags, errmsg);
-	ffvec_free(&data);
+	_ffconf_file_unmap(&data, &buf);
 	return r;
 }
 
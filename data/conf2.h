@@ -68,6 +68,9 @@ Advantage over YAML:
 #pragma once
 #include <ffbase/string.h>
 #include <ffbase/vector.h>
+#if defined __SSE2__ && !defined FFCONF_NO_FASTPATH
+#include <emmintrin.h>
+#endif
 
 typedef struct ffconf {
 	ffuint state, nextstate;
@@ -162,6 +165,59 @@ static inline int _ffconf_val_add(ffconf *c, const char *d)
 	return 0;
 }
 
+/** Add (reference or copy) N characters */
+static inline int _ffconf_val_addn(ffconf *c, const char *d, ffsize n)
+{
+	if (c->buf.cap == 0) {
+		if (c->buf.len == 0)
+			c->buf.ptr = (char*)d;
+		c->buf.len += n;
+		return 0;
+	}
+
+	if (c->buf.len + n > c->buf.cap
+		&& NULL == ffvec_growtwiceT(&c->buf, n, char))
+		return -1;
+	ffmem_copy(c->buf.ptr + c->buf.len, d, n);
+	c->buf.len += n;
+	return 0;
+}
+
+/** Get N of leading bytes that are just added to a key or value.
+quoted: within quotes whitespace and braces are regular characters */
+static inline ffsize _ffconf_plain_run(const char *d, ffsize n, ffuint quoted)
+{
+	ffsize i = 0;
+
+#if defined __SSE2__ && !defined FFCONF_NO_FASTPATH
+	const __m128i ctl = _mm_set1_epi8((quoted) ? 0x1f : 0x20)
+		, del = _mm_set1_epi8(0x7f)
+		, bsl = _mm_set1_epi8('\\')
+		, c1 = _mm_set1_epi8((quoted) ? '"' : '{')
+		, c2 = _mm_set1_epi8((quoted) ? '"' : '}');
+	for (;  i + 16 <= n;  i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i*)(d + i));
+		__m128i m = _mm_cmpeq_epi8(_mm_min_epu8(v, ctl), v); // v <= ctl
+		m = _mm_or_si128(m, _mm_cmpeq_epi8(v, del));
+		m = _mm_or_si128(m, _mm_cmpeq_epi8(v, bsl));
+		m = _mm_or_si128(m, _mm_cmpeq_epi8(v, c1));
+		m = _mm_or_si128(m, _mm_cmpeq_epi8(v, c2));
+		ffuint mask = _mm_movemask_epi8(m);
+		if (mask != 0)
+			return i + __builtin_ctz(mask);
+	}
+#endif
+
+	for (;  i != n;  i++) {
+		ffuint ch = (ffbyte)d[i];
+		if (ch < 0x20 || ch == 0x7f || ch == '\\')
+			break;
+		if ((quoted) ? ch == '"' : (ch == ' ' || ch == '{' || ch == '}'))
+			break;
+	}
+	return i;
+}
+
 /** Add (copy) a byte */
 static inline int _ffconf_val_add_b(ffconf *c, ffuint b)
 {
@@ -211,6 +267,43 @@ static inline int ffconf_parse(ffconf *c, ffstr *data)
 
 	for (i = 0;  i != data->len;) {
 
+#ifndef FFCONF_NO_FASTPATH
+		// fast path: process the whole run of bytes that don't change state
+		ffsize n = 0;
+		switch (st) {
+		case I_KEY:
+		case I_VAL:
+		case I_KEY_QUOT:
+		case I_VAL_QUOT:
+			n = _ffconf_plain_run(&data->ptr[i], data->len - i, (st == I_KEY_QUOT || st == I_VAL_QUOT));
+			if (n != 0
+				&& 0 != _ffconf_val_addn(c, &data->ptr[i], n))
+				return -FFCONF_ESYS;
+			break;
+
+		case I_SPC_BEFO_KEY:
+		case I_SPC_BEFO_VAL:
+			while (i + n != data->len
+				&& (data->ptr[i + n] == ' ' || data->ptr[i + n] == '\t'))
+				n++;
+			break;
+
+		case I_CMT: {
+			const char *lf = (char*)ffmem_findbyte(&data->ptr[i], data->len - i, '\n');
+			n = (lf != NULL) ? (ffsize)(lf - &data->ptr[i]) : data->len - i;
+			break;
+		}
+		}
+
+		if (n != 0) {
+			// no '\n' within the run;  the byte after the run changes state: process it right away
+			i += n;
+			c->linechar += n;
+			if (i == data->len)
+				break;
+		}
+#endif
+
 		ffuint ch = (ffbyte)data->ptr[i];
 
 		switch (st) {
@@ -1,17 +1,118 @@
 /** Buffer that can be linked with another buffer.
 2017, Simon Zolin */
 
+/*
+ffmbuf_pool_init ffmbuf_pool_destroy
+ffmbuf_pool_alloc
+ffmbuf_avail ffmbuf_add
+ffmbuf_chain_push ffmbuf_chain_push_pool
+ffmbuf_chain_last
+ffmbuf_chain_iovec
+ffmbuf_chain_consume
+ffmbuf_chain_free
+ffmbuf_free
+*/
+
 #pragma once
 #include <ffbase/list.h>
 #include <ffbase/vector.h>
+#ifdef FF_UNIX
+#include <sys/uio.h>
+#endif
+
+typedef struct ffmbuf_pool ffmbuf_pool;
 
 /** Memory block that can be linked with another block.
 BLK0 <-> BLK1 <-> ... */
 typedef struct ffmbuf {
 	ffvec buf;
 	ffchain_item sib;
+	ffsize off; // N of bytes at the beginning of 'buf' already consumed
+	ffmbuf_pool *pool; // The pool this block belongs to.
+		// 'buf' points to the inline data with 'buf.cap' = 0, so ffvec never reallocates or frees it:
+		// ffvec_add() etc. would move the data to a new heap buffer - use ffmbuf_add() instead.
 } ffmbuf;
 
+/** Pool of fixed-size blocks with inline data.
+Each block takes one memory allocation; released blocks are cached and reused. */
+struct ffmbuf_pool {
+	ffmbuf *free; // cached blocks linked via 'sib.next'
+	ffsize block_size; // data size of each block
+	ffuint nfree, max_free;
+};
+
+/**
+block_size: data size of each block
+max_free: max. number of cached blocks */
+static inline void ffmbuf_pool_init(ffmbuf_pool *p, ffsize block_size, ffuint max_free)
+{
+	p->free = NULL;
+	p->block_size = block_size;
+	p->nfree = 0;
+	p->max_free = max_free;
+}
+
+/** Free the cached blocks.
+All blocks taken from the pool must be released before this call. */
+static inline void ffmbuf_pool_destroy(ffmbuf_pool *p)
+{
+	while (p->free != NULL) {
+		ffmbuf *m = p->free;
+		p->free = (ffmbuf*)m->sib.next;
+		ffmem_free(m);
+	}
+	p->nfree = 0;
+}
+
+/** Get a cached block or allocate a new one.
+Return empty block with 'block_size' bytes of inline memory */
+static inline ffmbuf* ffmbuf_pool_alloc(ffmbuf_pool *p)
+{
+	ffmbuf *m;
+	if (p->free != NULL) {
+		m = p->free;
+		p->free = (ffmbuf*)m->sib.next;
+		p->nfree--;
+	} else {
+		if (NULL == (m = (ffmbuf*)ffmem_alloc(sizeof(ffmbuf) + p->block_size)))
+			return NULL;
+		m->pool = p;
+	}
+
+	m->buf.ptr = (char*)(m + 1);
+	m->buf.len = 0;
+	m->buf.cap = 0; // not owned by ffvec
+	m->off = 0;
+	return m;
+}
+
+static inline int _ffmbuf_inline(const ffmbuf *m)
+{
+	return (m->pool != NULL && m->buf.ptr == (char*)(m + 1));
+}
+
+/** Get free space in the block */
+static inline ffsize ffmbuf_avail(const ffmbuf *m)
+{
+	if (_ffmbuf_inline(m))
+		return m->pool->block_size - m->buf.len;
+	return m->buf.cap - m->buf.len;
+}
+
+/** Append data to the block.
+A pooled block is never grown: only the data that fits is copied.
+Return N of bytes copied */
+static inline ffsize ffmbuf_add(ffmbuf *m, const void *data, ffsize len)
+{
+	if (_ffmbuf_inline(m)) {
+		len = ffmin(len, m->pool->block_size - m->buf.len);
+		ffmem_copy((char*)m->buf.ptr + m->buf.len, data, len);
+		m->buf.len += len;
+		return len;
+	}
+	return ffvec_add(&m->buf, data, len, 1);
+}
+
 /** Allocate and add new block into the chain. */
 static inline ffmbuf* ffmbuf_chain_push(fflist *blocks)
 {
@@ -23,6 +124,16 @@ static inline ffmbuf* ffmbuf_chain_push(fflist *blocks)
 	return mblk;
 }
 
+/** Take a block from the pool and add it into the chain. */
+static inline ffmbuf* ffmbuf_chain_push_pool(fflist *blocks, ffmbuf_pool *p)
+{
+	ffmbuf *mblk;
+	if (NULL == (mblk = ffmbuf_pool_alloc(p)))
+		return NULL;
+	fflist_add(blocks, &mblk->sib);
+	return mblk;
+}
+
 /** Get the last block in chain. */
 static inline ffmbuf* ffmbuf_chain_last(fflist *blocks)
 {
@@ -32,8 +143,76 @@ static inline ffmbuf* ffmbuf_chain_last(fflist *blocks)
 	return FF_STRUCTPTR(ffmbuf, sib, blk);
 }
 
+/** Release the block: return it to its pool or free it */
 static inline void ffmbuf_free(ffmbuf *m)
 {
-	ffvec_free(&m->buf);
+	ffmbuf_pool *p = m->pool;
+	ffvec_free(&m->buf); // a pooled block: only if the data was moved to heap by ffvec
+	if (p != NULL) {
+		if (p->nfree < p->max_free) {
+			m->sib.next = (ffchain_item*)p->free;
+			p->free = m;
+			p->nfree++;
+			return;
+		}
+		ffmem_free(m);
+		return;
+	}
+
 	ffmem_free(m);
 }
+
+#ifdef FF_UNIX
+
+/** Describe the unconsumed data of the chain for writev()/sendmsg()
+Return N of elements filled in 'iov' */
+static inline ffuint ffmbuf_chain_iovec(fflist *blocks, struct iovec *iov, ffuint n)
+{
+	ffuint i = 0;
+	ffchain_item *it;
+	for (it = fflist_first(blocks);  it != fflist_sentl(blocks) && i != n;  it = it->next) {
+		ffmbuf *m = FF_STRUCTPTR(ffmbuf, sib, it);
+		if (m->off == m->buf.len)
+			continue;
+		iov[i].iov_base = (char*)m->buf.ptr + m->off;
+		iov[i].iov_len = m->buf.len - m->off;
+		i++;
+	}
+	return i;
+}
+
+#endif
+
+/** Discard data at the beginning of the chain (e.g. after a partial writev()).
+Fully consumed blocks are removed from the chain and released.
+Return N of bytes consumed:
+ <n if the chain doesn't have enough data */
+static inline ffsize ffmbuf_chain_consume(fflist *blocks, ffsize n)
+{
+	ffsize done = 0;
+	while (!fflist_empty(blocks)) {
+		ffmbuf *m = FF_STRUCTPTR(ffmbuf, sib, fflist_first(blocks));
+		ffsize avail = m->buf.len - m->off;
+		if (n - done < avail) {
+			m->off += n - done;
+			return n;
+		}
+
+		done += avail;
+		fflist_rm(blocks, &m->sib);
+		ffmbuf_free(m);
+		if (done == n)
+			break;
+	}
+	return done;
+}
+
+/** Release all blocks in the chain */
+static inline void ffmbuf_chain_free(fflist *blocks)
+{
+	while (!fflist_empty(blocks)) {
+		ffmbuf *m = FF_STRUCTPTR(ffmbuf, sib, fflist_first(blocks));
+		fflist_rm(blocks, &m->sib);
+		ffmbuf_free(m);
+	}
+}
@@ -0,0 +1,176 @@
+/** ff: perfect hash for a static set of keys
+2026, Simon Zolin */
+
+/*
+ffphash_build ffphash_free
+ffphash_find
+*/
+
+/*
+Hash-and-displace:
+ each key's hash selects a bucket and a pair (h1, h2);
+ each bucket stores displacement D chosen at build time so that
+ slot = (h1 + D * h2) % nslots
+ is unique for every key.
+Lookup computes 1 hash over the key and reads 2 array elements.
+The caller must compare the key at the returned index, because an unknown key maps to some slot too.
+*/
+
+#pragma once
+#include <ffbase/string.h>
+
+typedef struct ffphash {
+	ffushort *disp; // bucket -> displacement
+	ffushort *slots; // slot -> key index + 1; 0: empty slot
+	ffuint buckets_mask, slots_mask;
+	ffuint seed;
+	ffuint flags; // enum FFPHASH_F
+} ffphash;
+
+enum FFPHASH_F {
+	FFPHASH_ICASE = 1, // case-insensitive keys (ASCII)
+};
+
+static inline ffuint64 _ffphash_hash(const char *key, ffsize len, ffuint seed, ffuint flags)
+{
+	ffuint64 h = 0xcbf29ce484222325ULL ^ seed; // FNV-1a
+	if (flags & FFPHASH_ICASE) {
+		for (ffsize i = 0;  i != len;  i++) {
+			ffuint c = (ffbyte)key[i];
+			if (c >= 'A' && c <= 'Z')
+				c |= 0x20;
+			h = (h ^ c) * 0x100000001b3ULL;
+		}
+	} else {
+		for (ffsize i = 0;  i != len;  i++) {
+			h = (h ^ (ffbyte)key[i]) * 0x100000001b3ULL;
+		}
+	}
+
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	return h;
+}
+
+#define _FFPHASH_BUCKET(h)  ((ffuint)((h) >> 40))
+#define _FFPHASH_SLOT(h, d)  ((ffuint)(h) + (d) * ((ffuint)((h) >> 20) | 1))
+
+static inline void ffphash_free(ffphash *ph)
+{
+	ffmem_free(ph->disp);
+	ph->disp = NULL;
+	ph->slots = NULL;
+}
+
+/** Build perfect hash over the keys
+n: number of keys (<64k)
+flags: enum FFPHASH_F
+Return 0 on success;
+ -1: can't build (e.g. duplicate keys) */
+static inline int ffphash_build(ffphash *ph, const ffstr *keys, ffuint n, ffuint flags)
+{
+	const ffuint MAX_DISP = 0xffff, MAX_SEEDS = 8;
+	ffuint nb = ffint_align_power2(n / 4 + 1);
+	ffuint ns = ffint_align_power2(n * 2 + 1);
+	ffuint i, j, d, seed;
+	int rc = -1;
+
+	ffmem_zero_obj(ph);
+	if (n >= 0xffff)
+		return -1;
+
+	// temporary: hash[n], next[n], head[nb], order[nb]
+	ffuint64 *hash = (ffuint64*)ffmem_alloc(n * sizeof(ffuint64) + (n + nb * 2) * sizeof(ffuint));
+	if (hash == NULL)
+		return -1;
+	ffuint *next = (ffuint*)(hash + n);
+	ffuint *head = next + n;
+	ffuint *order = head + nb;
+
+	if (NULL == (ph->disp = (ffushort*)ffmem_alloc((nb + ns) * sizeof(ffushort))))
+		goto end;
+	ph->slots = ph->disp + nb;
+	ph->buckets_mask = nb - 1;
+	ph->slots_mask = ns - 1;
+	ph->flags = flags;
+
+	for (seed = 0;  seed != MAX_SEEDS;  seed++) {
+		ffmem_zero(ph->disp, (nb + ns) * sizeof(ffushort));
+		ph->seed = seed;
+
+		for (i = 0;  i != nb;  i++) {
+			head[i] = (ffuint)-1;
+			order[i] = i;
+		}
+
+		for (i = 0;  i != n;  i++) {
+			hash[i] = _ffphash_hash(keys[i].ptr, keys[i].len, seed, flags);
+			ffuint b = _FFPHASH_BUCKET(hash[i]) & ph->buckets_mask;
+			next[i] = head[b];
+			head[b] = i;
+			ph->disp[b]++; // temporarily: N of keys in bucket
+		}
+
+		// place the largest buckets first
+		for (i = 1;  i < nb;  i++) {
+			ffuint b = order[i];
+			for (j = i;  j != 0 && ph->disp[order[j - 1]] < ph->disp[b];  j--) {
+				order[j] = order[j - 1];
+			}
+			order[j] = b;
+		}
+		for (i = 0;  i != nb;  i++) {
+			ph->disp[i] = 0;
+		}
+
+		for (i = 0;  i != nb;  i++) {
+			ffuint b = order[i];
+			if (head[b] == (ffuint)-1)
+				break;
+
+			for (d = 0;  d != MAX_DISP;  d++) {
+				for (j = head[b];  j != (ffuint)-1;  j = next[j]) {
+					ffuint s = _FFPHASH_SLOT(hash[j], d) & ph->slots_mask;
+					if (ph->slots[s] != 0)
+						break;
+					ph->slots[s] = j + 1;
+				}
+				if (j == (ffuint)-1)
+					break; // all keys are placed
+
+				// roll back
+				for (ffuint k = head[b];  k != j;  k = next[k]) {
+					ph->slots[_FFPHASH_SLOT(hash[k], d) & ph->slots_mask] = 0;
+				}
+			}
+			if (d == MAX_DISP)
+				break;
+			ph->disp[b] = d;
+		}
+
+		if (i == nb || head[order[i]] == (ffuint)-1) {
+			rc = 0;
+			goto end;
+		}
+	}
+
+end:
+	ffmem_free(hash);
+	if (rc != 0)
+		ffphash_free(ph);
+	return rc;
+}
+
+/** Get index of the key
+Return index of the only key that may be equal to 'key';
+ -1: no such key */
+static inline int ffphash_find(const ffphash *ph, const char *key, ffsize len)
+{
+	ffuint64 h = _ffphash_hash(key, len, ph->seed, ph->flags);
+	ffuint d = ph->disp[_FFPHASH_BUCKET(h) & ph->buckets_mask];
+	return (int)ph->slots[_FFPHASH_SLOT(h, d) & ph->slots_mask] - 1;
+}
+
+#undef _FFPHASH_BUCKET
+#undef _FFPHASH_SLOT
@@ -4,6 +4,7 @@
 
 /*
 ffstream_realloc ffstream_free
+ffstream_mirror_supported
 ffstream_reset
 ffstream_used
 ffstream_view
@@ -13,15 +14,122 @@ ffstream_consume
 
 #pragma once
 #include <ffbase/string.h>
+#ifdef FF_LINUX
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 
 typedef struct ffstream {
 	char *ptr;
 	ffuint r, w;
 	ffuint cap, mask;
 	ffstr ref;
+
+	/** Set by user before the first ffstream_realloc() to request a double-mapped buffer:
+	 the same physical pages are mapped twice, one after another,
+	 so any region of up to 'cap' bytes is contiguous and no data moving is ever needed.
+	Reset to 0 by ffstream_realloc() if the platform doesn't support it. */
+	ffuint mirror;
+	int mirror_fd; // memfd backing the double-mapped buffer
 } ffstream;
 
+#ifdef FF_LINUX
+
+static inline int ffstream_mirror_supported()
+{
+	return 1;
+}
+
+/** Map 'cap' bytes of the file twice into adjacent regions */
+static inline char* _ffstream_mirror_map(int fd, ffsize cap)
+{
+	char *p = (char*)mmap(NULL, cap * 2, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED)
+		return NULL;
+
+	if (MAP_FAILED == mmap(p, cap, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0)
+		|| MAP_FAILED == mmap(p + cap, cap, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0)) {
+		munmap(p, cap * 2);
+		return NULL;
+	}
+	return p;
+}
+
+/** Grow the double-mapped buffer.
+The backing file is extended in place, so the data stays in the same pages:
+ only the wrapped part of data (if any) is copied. */
+static inline ffsize _ffstream_mirror_realloc(ffstream *s, ffsize newcap)
+{
+	ffsize page = sysconf(_SC_PAGESIZE);
+	if (newcap < page)
+		newcap = page;
+	if (newcap <= s->cap)
+		return s->cap;
+
+	int fd = s->mirror_fd;
+	if (s->ptr == NULL
+		&& -1 == (fd = memfd_create("ffstream", MFD_CLOEXEC)))
+		return 0;
+
+	char *p;
+	if (0 != ftruncate(fd, newcap)
+		|| NULL == (p = _ffstream_mirror_map(fd, newcap))) {
+		if (s->ptr == NULL)
+			close(fd);
+		return 0;
+	}
+
+	if (s->ptr == NULL) {
+		s->mirror_fd = fd;
+
+	} else {
+		if (s->ref.len == 0) {
+			// "DD...DDD" -> "DD...DDDDD......"
+			ffuint used = s->w - s->r;
+			ffuint i = s->r & s->mask;
+			if (i + used > s->cap)
+				ffmem_copy(p + s->cap, p, i + used - s->cap);
+			s->r = i;
+			s->w = i + used;
+		}
+
+		munmap(s->ptr, s->cap * 2);
+	}
+
+	s->ptr = p;
+	s->cap = newcap;
+	s->mask = newcap - 1;
+	return s->cap;
+}
+
+static inline void _ffstream_mirror_free(ffstream *s)
+{
+	munmap(s->ptr, s->cap * 2);
+	close(s->mirror_fd);
+}
+
+#else
+
+static inline int ffstream_mirror_supported()
+{
+	return 0;
+}
+
+static inline ffsize _ffstream_mirror_realloc(ffstream *s, ffsize newcap)
+{
+	(void)s; (void)newcap;
+	return 0;
+}
+
+static inline void _ffstream_mirror_free(ffstream *s)
+{
+	(void)s;
+}
+
+#endif
+
 /** Grow the buffer
+Double-mapped buffer (see 'mirror') is regrown without copying the whole data.
 Return the actual buffer capacity;
  0 on error */
 static inline ffsize ffstream_realloc(ffstream *s, ffsize newcap)
@@ -30,6 +138,12 @@ static inline ffsize ffstream_realloc(ffstream *s, ffsize newcap)
 	if (newcap <= s->cap)
 		return s->cap;
 
+	if (s->mirror) {
+		if (ffstream_mirror_supported())
+			return _ffstream_mirror_realloc(s, newcap);
+		s->mirror = 0;
+	}
+
 	char *p;
 	if (NULL == (p = (char*)ffmem_alloc(newcap)))
 		return 0;
@@ -52,7 +166,12 @@ static inline ffsize ffstream_realloc(ffstream *s, ffsize newcap)
 
 static inline void ffstream_free(ffstream *s)
 {
-	ffmem_free(s->ptr);
+	if (s->mirror) {
+		if (s->ptr != NULL)
+			_ffstream_mirror_free(s);
+	} else {
+		ffmem_free(s->ptr);
+	}
 	s->ptr = NULL;
 }
 
@@ -90,18 +209,25 @@ static inline ffuint ffstream_gather(ffstream *s, ffstr input, ffsize gather, ff
 	if (used < gather) {
 		// need to append data into our buffer
 
-		i = s->r & s->mask;
-		if (i + gather > s->cap) {
-			// not enough space in tail: move tail bytes to front
-			ffmem_move(s->ptr, s->ptr + i, used); // "...DD" -> "DD"
-			s->r -= i;
-			s->w -= i;
-		}
+		if (s->mirror) {
+			// the mirrored view makes the free space contiguous: "D..DD|D..DD" -> "DUUDD|DUU"
+			i = s->w & s->mask;
+			n = s->cap - used;
 
-		// going to append input data to tail as much as we can fit
-		i = s->w & s->mask;
-		ffuint unused_seq = s->cap - i; // "...DDU"
-		n = unused_seq;
+		} else {
+			i = s->r & s->mask;
+			if (i + gather > s->cap) {
+				// not enough space in tail: move tail bytes to front
+				ffmem_move(s->ptr, s->ptr + i, used); // "...DD" -> "DD"
+				s->r -= i;
+				s->w -= i;
+			}
+
+			// going to append input data to tail as much as we can fit
+			i = s->w & s->mask;
+			ffuint unused_seq = s->cap - i; // "...DDU"
+			n = unused_seq;
+		}
 
 		// append input data to tail
 		n = ffmin(n, input.len);
@@ -153,6 +279,11 @@ static inline ffuint ffstream_gather_ref(ffstream *s, ffstr input, ffsize gather
 			n = gather - used;
 			i = s->w;
 
+		} else if (s->mirror) {
+			// the mirrored view makes the free space contiguous
+			i = s->w & s->mask;
+			n = s->cap - used;
+
 		} else {
 			i = s->r & s->mask;
 			if (i + gather > s->cap) {
@@ -0,0 +1,145 @@
+/** conf-parallel.h tester
+2026, Simon Zolin */
+
+#include <ffsys/file.h>
+#include "conf-parallel.h"
+#include <ffbase/../test/test.h>
+#include <ffsys/globals.h>
+
+#define ROUTES  120000
+#define NCHUNKS  4
+
+struct routes {
+	ffuint n, nclose;
+	ffuint64 sum, names; // order-sensitive hashes of the values
+};
+
+static int route_name(ffconf_scheme *cs, struct routes *o, ffstr val)
+{
+	(void)cs;
+	for (ffsize i = 0;  i != val.len;  i++) {
+		o->names = o->names * 31 + (ffbyte)val.ptr[i];
+	}
+	return 0;
+}
+
+static int route_metric(ffconf_scheme *cs, struct routes *o, ffint64 i)
+{
+	(void)cs;
+	o->sum = o->sum * 7 + i;
+	return 0;
+}
+
+static int route_close(ffconf_scheme *cs, struct routes *o)
+{
+	(void)cs;
+	o->nclose++;
+	return 0;
+}
+
+static const ffconf_arg route_args[] = {
+	{ "name",	FFCONF_TSTR,	(ffsize)route_name },
+	{ "metric",	FFCONF_TINT64,	(ffsize)route_metric },
+	{ NULL,	FFCONF_TCLOSE,	(ffsize)route_close },
+};
+
+static int route_open(ffconf_scheme *cs, struct routes *o)
+{
+	o->n++;
+	ffconf_scheme_addctx(cs, route_args, o);
+	return 0;
+}
+
+static const ffconf_arg top_args[] = {
+	{ "route",	FFCONF_TOBJ | FFCONF_FMULTI,	(ffsize)route_open },
+	{}
+};
+
+/** Parse the file sequentially and in parallel and compare the results */
+static int conf_parse_cmp(const char *fn, ffthpool *tp, struct routes *o, ffstr *errmsg)
+{
+	struct routes o1 = {};
+	ffstr e1 = {};
+	int r1 = ffconf_parse_file(top_args, &o1, fn, 0, &e1, 100*1024*1024);
+	int r = ffconf_parse_file_parallel(top_args, o, fn, 0, errmsg, 100*1024*1024, tp, NCHUNKS);
+	xieq(r1, r);
+	x(o1.n == o->n && o1.nclose == o->nclose);
+	x(o1.sum == o->sum && o1.names == o->names);
+	x(ffstr_eq2(&e1, errmsg));
+	ffstr_free(&e1);
+	return r;
+}
+
+/** Generate a config with ROUTES objects.
+bad_line: set to the line number of the error (if 'bad' is set) */
+static void conf_gen(ffvec *data, const char *bad, ffuint *bad_line)
+{
+	ffuint line = 1;
+	data->len = 0;
+	for (ffuint i = 0;  i != ROUTES;  i++) {
+		ffvec_addfmt(data, "route {\n"
+			"\tname \"route-%u.gateway.example.com\"\n"
+			"\tmetric %u\n"
+			, i, i % 100);
+		line += 3;
+		if (bad != NULL && i == ROUTES - 10) {
+			ffvec_addfmt(data, "%s\n", bad);
+			*bad_line = line;
+			line++;
+		}
+		ffvec_addfmt(data, "}\n");
+		line++;
+	}
+}
+
+void test_conf_parallel()
+{
+	const char *fn = "ffconf-parallel.conf";
+	ffvec data = {};
+	ffstr err = {};
+	struct routes o;
+	ffuint line = 0;
+	char buf[32];
+
+	ffthpoolconf tpconf = {};
+	tpconf.maxthreads = NCHUNKS;
+	tpconf.maxqueue = NCHUNKS;
+	ffthpool *tp = ffthpool_create(&tpconf);
+	x(tp != NULL);
+
+	// the same result as a sequential parse
+	conf_gen(&data, NULL, NULL);
+	x(data.len > NCHUNKS * 1024*1024);
+	x(0 == fffile_writewhole(fn, data.ptr, data.len, 0));
+	ffmem_zero_obj(&o);
+	x(0 == conf_parse_cmp(fn, tp, &o, &err));
+	x(o.n == ROUTES && o.nclose == ROUTES);
+
+	// scheme error in the last chunk: the line number counts the lines of the preceding chunks
+	conf_gen(&data, "\tunknown 1", &line);
+	x(0 == fffile_writewhole(fn, data.ptr, data.len, 0));
+	ffmem_zero_obj(&o);
+	ffstr_free(&err);
+	x(0 != conf_parse_cmp(fn, tp, &o, &err));
+	ffs_format_r0(buf, sizeof(buf), "%u:", line);
+	x(ffstr_matchz(&err, buf));
+
+	// a chunk doesn't tokenize cleanly: the file is parsed again sequentially
+	conf_gen(&data, "\t}", &line);
+	x(0 == fffile_writewhole(fn, data.ptr, data.len, 0));
+	ffmem_zero_obj(&o);
+	ffstr_free(&err);
+	x(0 != conf_parse_cmp(fn, tp, &o, &err));
+
+	ffstr_free(&err);
+	ffvec_free(&data);
+	fffile_remove(fn);
+	ffthpool_free(tp);
+}
+
+int main()
+{
+	test_conf_parallel();
+	xlog("DONE");
+	return 0;
+}
@@ -0,0 +1,110 @@
+/** conf2.h tester and benchmark
+2026, Simon Zolin */
+
+#include "conf2.h"
+#include <ffsys/time.h>
+#include <ffbase/../test/test.h>
+#include <ffsys/globals.h>
+
+struct conf_token {
+	int r;
+	const char *val;
+	ffuint line, linechar;
+};
+
+/** Parse the data split into chunks of size 'chunk' and compare with the expected tokens */
+static void conf_check(const char *data, ffsize chunk, const struct conf_token *t)
+{
+	ffconf c;
+	ffconf_init(&c);
+	ffstr in, all = FFSTR_INITZ(data);
+	while (all.len != 0) {
+		ffstr_set(&in, all.ptr, ffmin(chunk, all.len));
+		ffstr_shift(&all, in.len);
+
+		while (in.len != 0) {
+			int r = ffconf_parse(&c, &in);
+			x(r >= 0);
+			if (r == FFCONF_RMORE)
+				continue;
+			xieq(t->r, r);
+			xseq(&c.val, t->val);
+			xieq(t->line, c.line);
+			xieq(t->linechar, c.linechar);
+			t++;
+		}
+	}
+	x(0 == ffconf_fin(&c));
+	x(t->r == 0);
+}
+
+void test_conf_parse()
+{
+	const char *data =
+		"# comment # with hash\n"
+		"key value1 \"value 2 {}\"\n"
+		"long_key_0123456789abcdef\tlong_value_0123456789abcdef {\n"
+		"\tk\\x20ey \"v\\tal\"\n"
+		"}\n";
+	static const struct conf_token t[] = {
+		{ FFCONF_RKEY, "key", 2, 5 },
+		{ FFCONF_RVAL, "value1", 2, 12 },
+		{ FFCONF_RVAL_NEXT, "value 2 {}", 2, 24 },
+		{ FFCONF_RKEY, "long_key_0123456789abcdef", 3, 27 },
+		{ FFCONF_RVAL, "long_value_0123456789abcdef", 3, 55 },
+		{ FFCONF_ROBJ_OPEN, "", 3, 56 },
+		{ FFCONF_RKEY, "k ey", 4, 10 },
+		{ FFCONF_RVAL, "v\tal", 4, 17 },
+		{ FFCONF_ROBJ_CLOSE, "", 5, 2 },
+		{}
+	};
+
+	for (ffsize chunk = 1;  chunk <= 100;  chunk++) {
+		conf_check(data, chunk, t);
+	}
+
+	ffconf c;
+	ffconf_init(&c);
+	ffstr in = FFSTR_INITZ("key\n0123456789abcdef\x01");
+	x(FFCONF_RKEY == ffconf_parse(&c, &in));
+	x(-FFCONF_ESTR == ffconf_parse(&c, &in));
+	xieq(2, c.line);
+	xieq(17, c.linechar);
+	ffconf_fin(&c);
+}
+
+void bench_conf_parse()
+{
+	ffvec data = {};
+	for (ffuint i = 0;  data.len < 64*1024*1024;  i++) {
+		ffvec_addfmt(&data, "\troute_%u {\n"
+			"\t\tdestination \"10.%u.0.0/24 via gateway-long-hostname.example.com\"\n"
+			"\t\tdescription \"generated route entry for the table number %u\"\n"
+			"\t}\n"
+			, i, i % 250, i);
+	}
+
+	fftime t1, t2;
+	fftime_now(&t1);
+	ffconf c;
+	ffconf_init(&c);
+	ffstr in = FFSTR_INITSTR(&data);
+	while (in.len != 0) {
+		x(ffconf_parse(&c, &in) >= 0);
+	}
+	x(0 == ffconf_fin(&c));
+	fftime_now(&t2);
+	fftime_diff(&t1, &t2);
+
+	ffuint64 ms = fftime_sec(&t2) * 1000 + fftime_msec(&t2);
+	xlog("ffconf_parse: %u MB/s", (ffuint)((ms != 0) ? data.len / 1000 / ms : 0));
+	ffvec_free(&data);
+}
+
+int main()
+{
+	test_conf_parse();
+	bench_conf_parse();
+	xlog("DONE");
+	return 0;
+}
@@ -0,0 +1,75 @@
+/** mbuf.h tester
+2026, Simon Zolin */
+
+#include "mbuf.h"
+#include <ffbase/../test/test.h>
+#include <ffsys/globals.h>
+
+void test_mbuf_pool()
+{
+	ffmbuf_pool p;
+	ffmbuf_pool_init(&p, 8, 1);
+	fflist chain;
+	fflist_init(&chain);
+	ffmbuf *m, *m1;
+
+	x(NULL != (m1 = ffmbuf_chain_push_pool(&chain, &p)));
+	x(m1->buf.cap == 0);
+	x(m1->buf.ptr == (char*)(m1 + 1));
+	x(8 == ffmbuf_avail(m1));
+	x(4 == ffmbuf_add(m1, "0123", 4));
+	x(4 == ffmbuf_avail(m1));
+
+	// a pooled block isn't grown
+	x(NULL != (m = ffmbuf_chain_push_pool(&chain, &p)));
+	x(4 == ffmbuf_add(m, "4567", 4));
+	x(4 == ffmbuf_add(m, "xxxxyy", 6));
+	x(0 == ffmbuf_add(m, "z", 1));
+	x(m->buf.ptr == (char*)(m + 1));
+	m->buf.len = 4;
+
+	x(NULL != (m = ffmbuf_chain_push(&chain)));
+	ffvec_addsz(&m->buf, "89ab");
+
+	struct iovec iov[4];
+	x(3 == ffmbuf_chain_iovec(&chain, iov, 4));
+	x(iov[0].iov_len == 4 && !ffmem_cmp(iov[0].iov_base, "0123", 4));
+	x(iov[2].iov_len == 4 && !ffmem_cmp(iov[2].iov_base, "89ab", 4));
+	x(2 == ffmbuf_chain_iovec(&chain, iov, 2));
+
+	// partial consume across blocks
+	x(6 == ffmbuf_chain_consume(&chain, 6));
+	x(2 == ffmbuf_chain_iovec(&chain, iov, 4));
+	x(iov[0].iov_len == 2 && !ffmem_cmp(iov[0].iov_base, "67", 2));
+	x(p.nfree == 1);
+
+	x(6 == ffmbuf_chain_consume(&chain, 10));
+	x(fflist_empty(&chain));
+	x(p.nfree == 1);
+
+	// the cached block is reused
+	x(m1 == ffmbuf_chain_push_pool(&chain, &p));
+	x(m1->buf.len == 0 && m1->off == 0);
+	x(p.nfree == 0);
+
+
+	// ffvec moves the data of a pooled block to heap instead of reallocating the inline memory
+	x(0 != ffvec_addsz(&m1->buf, "0123456789"));
+	x(m1->buf.ptr != (char*)(m1 + 1) && m1->buf.cap != 0);
+	x(ffstr_eqz((ffstr*)&m1->buf, "0123456789"));
+
+	ffmbuf_chain_free(&chain);
+	x(p.nfree == 1);
+	x(m1 == ffmbuf_chain_push_pool(&chain, &p));
+	x(m1->buf.ptr == (char*)(m1 + 1) && m1->buf.cap == 0);
+
+	ffmbuf_chain_free(&chain);
+	ffmbuf_pool_destroy(&p);
+}
+
+int main()
+{
+	test_mbuf_pool();
+	xlog("DONE");
+	return 0;
+}
@@ -0,0 +1,137 @@
+/** phash.h, conf-scheme.h (FFCONF_SCF_HASH) tester and benchmark
+2026, Simon Zolin */
+
+#include "phash.h"
+#include "conf-scheme.h"
+#include "cmdarg-scheme.h"
+#include <ffsys/time.h>
+#include <ffbase/../test/test.h>
+#include <ffsys/globals.h>
+
+void test_phash()
+{
+	char names[200][8];
+	ffstr keys[200];
+	ffphash ph;
+
+	for (ffuint i = 0;  i != 200;  i++) {
+		ffstr_set(&keys[i], names[i], ffs_format_r0(names[i], sizeof(names[i]), "Key%u", i));
+	}
+
+	for (ffuint n = 0;  n <= 200;  n += 25) {
+		x(0 == ffphash_build(&ph, keys, n, 0));
+		for (ffuint i = 0;  i != n;  i++) {
+			x((int)i == ffphash_find(&ph, keys[i].ptr, keys[i].len));
+		}
+		int i = ffphash_find(&ph, "unknown", 7);
+		x(i < (int)n);
+		ffphash_free(&ph);
+	}
+
+	x(0 == ffphash_build(&ph, keys, 200, FFPHASH_ICASE));
+	x(7 == ffphash_find(&ph, "KEY7", 4));
+	ffphash_free(&ph);
+
+	keys[1] = keys[0];
+	x(0 != ffphash_build(&ph, keys, 200, 0));
+}
+
+#define BENCH_KEYS  160
+#define BENCH_LINES  100000
+
+static ffuint bench_nvals;
+
+static int bench_val(ffconf_scheme *cs, void *obj, ffstr val)
+{
+	(void)cs; (void)obj; (void)val;
+	bench_nvals++;
+	return 0;
+}
+
+static int bench_any(ffconf_scheme *cs, void *obj, ffstr val)
+{
+	(void)obj; (void)val;
+	x(ffstr_eqz(ffconf_scheme_keyname(cs), "unknown"));
+	bench_nvals++;
+	return 0;
+}
+
+static void bench_run(const ffconf_arg *args, ffstr data, ffuint flags)
+{
+	fftime t1, t2;
+	ffstr d = data, err = {};
+	bench_nvals = 0;
+	fftime_now(&t1);
+	x(0 == ffconf_parse_object(args, NULL, &d, flags, &err));
+	fftime_now(&t2);
+	fftime_diff(&t1, &t2);
+	x(bench_nvals == BENCH_LINES);
+	xlog("%s: %u.%03u sec", (flags & FFCONF_SCF_HASH) ? "perfect hash" : "linear search"
+		, (int)fftime_sec(&t2), (int)fftime_msec(&t2));
+	ffstr_free(&err);
+}
+
+/** Config with BENCH_LINES lines: "key_NNN value" */
+void bench_conf_scheme_hash()
+{
+	static char names[BENCH_KEYS][16];
+	static ffconf_arg args[BENCH_KEYS + 2];
+	ffuint i;
+	for (i = 0;  i != BENCH_KEYS;  i++) {
+		ffs_format_r0(names[i], sizeof(names[i]), "key_%u%Z", i);
+		args[i].name = names[i];
+		args[i].flags = FFCONF_TSTR | FFCONF_FMULTI;
+		args[i].dst = (ffsize)bench_val;
+	}
+	args[i].name = "*";
+	args[i].flags = FFCONF_TSTR | FFCONF_FMULTI;
+	args[i].dst = (ffsize)bench_any;
+
+	ffvec data = {};
+	for (i = 0;  i != BENCH_LINES;  i++) {
+		if (i % 1000 == 999)
+			ffvec_addfmt(&data, "unknown value\n");
+		else
+			ffvec_addfmt(&data, "%s value\n", names[(i * 7) % BENCH_KEYS]);
+	}
+
+	ffstr d = FFSTR_INITSTR(&data);
+	bench_run(args, d, 0);
+	bench_run(args, d, FFCONF_SCF_HASH);
+	ffvec_free(&data);
+}
+
+struct cmdarg_obj {
+	ffbyte a, b;
+	ffstr s;
+};
+
+void test_cmdarg_scheme_hash()
+{
+	static const ffcmdarg_arg args[] = {
+		{ 0, "alpha",	FFCMDARG_TSWITCH, FF_OFF(struct cmdarg_obj, a) },
+		{ 'b', "beta",	FFCMDARG_TSWITCH, FF_OFF(struct cmdarg_obj, b) },
+		{ 0, "str",	FFCMDARG_TSTR, FF_OFF(struct cmdarg_obj, s) },
+		{}
+	};
+	const char *argv[] = { "--str", "val", "--beta", "--alpha" };
+	struct cmdarg_obj o = {};
+	x(0 == ffcmdarg_parse_object(args, &o, argv, FF_COUNT(argv), FFCMDARG_SCF_HASH, NULL));
+	x(o.a == 1 && o.b == 1);
+	xseq(&o.s, "val");
+	ffstr_free(&o.s);
+
+	const char *argv2[] = { "--gamma" };
+	ffstr err = {};
+	x(0 != ffcmdarg_parse_object(args, &o, argv2, FF_COUNT(argv2), FFCMDARG_SCF_HASH, &err));
+	ffstr_free(&err);
+}
+
+int main()
+{
+	test_phash();
+	test_cmdarg_scheme_hash();
+	bench_conf_scheme_hash();
+	xlog("DONE");
+	return 0;
+}
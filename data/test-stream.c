@@ -90,9 +90,47 @@ void test_stream_ref()
 	ffstream_free(&s);
 }
 
+void test_stream_mirror()
+{
+	if (!ffstream_mirror_supported())
+		return;
+
+	ffstream s = {};
+	s.mirror = 1;
+	x(0 != ffstream_realloc(&s, 8));
+	x(s.mirror);
+	ffuint cap = s.cap;
+	ffstr in, v;
+
+	// fill, then consume from the front
+	char *buf = ffmem_alloc(cap * 2);
+	ffmem_fill(buf, 'a', cap);
+	ffstr_set(&in, buf, cap);
+	xieq(cap, ffstream_gather(&s, in, cap, &v));
+	ffstream_consume(&s, cap - 2); // "...aa"
+
+	// wrap around without moving data
+	ffmem_fill(buf, 'b', cap);
+	ffstr_set(&in, buf, cap);
+	xieq(cap - 2, ffstream_gather(&s, in, cap, &v));
+	x(v.len == cap);
+	x(v.ptr == s.ptr + cap - 2);
+	x(v.ptr[0] == 'a' && v.ptr[1] == 'a' && v.ptr[2] == 'b' && v.ptr[cap - 1] == 'b');
+
+	// grow: the wrapped data is still contiguous
+	x(cap * 2 == ffstream_realloc(&s, cap * 2));
+	v = ffstream_view(&s);
+	x(v.len == cap);
+	x(v.ptr[0] == 'a' && v.ptr[1] == 'a' && v.ptr[2] == 'b' && v.ptr[cap - 1] == 'b');
+
+	ffmem_free(buf);
+	ffstream_free(&s);
+}
+
 int main()
 {
 	test_stream();
 	test_stream_ref();
+	test_stream_mirror();
 	return 0;
 }
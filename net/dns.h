@@ -9,7 +9,15 @@ ffdns_question_destroy
 ffdns_question_read ffdns_question_write
 ffdns_answer_destroy
 ffdns_answer_read ffdns_answer_write
+ffdns_reader_init
+ffdns_reader_next
+ffdns_reader_name
+ffdns_writer_init
+ffdns_writer_edns
+ffdns_writer_question ffdns_writer_rr ffdns_writer_rr_name
+ffdns_writer_fin
 ffdns_isdomain
+ffdns_domain_normalize
 */
 
 /* Message format:
@@ -27,6 +35,10 @@ NAME:
 #include <ffbase/string.h>
 #include <ffbase/vector.h>
 
+#if defined __SSE2__ && !defined FFDNS_NO_SIMD
+#include <emmintrin.h>
+#endif
+
 /** Response code. */
 enum FFDNS_R {
 	FFDNS_NOERROR,
@@ -102,6 +114,7 @@ enum FFDNS_TYPE {
 	FFDNS_A = 1,
 	FFDNS_NS = 2,
 	FFDNS_CNAME = 5,
+	FFDNS_SOA = 6,
 	FFDNS_PTR = 12, // for ip=1.2.3.4 ques.name = 4.3.2.1.in-addr.arpa
 	FFDNS_AAAA = 28,
 	FFDNS_OPT = 41, // EDNS
@@ -302,7 +315,7 @@ static inline int ffdns_name_read(ffvec *dst, ffstr msg, ffuint offset)
 			n = c; // get label length
 
 		} else {
-			if (dst->len == FFDNS_MAXNAME-1)
+			if (dst->len >= FFDNS_MAXNAME-1)
 				goto fail; // too long name
 			d[dst->len++] = c;
 			n--;
@@ -503,6 +516,528 @@ static inline int ffdns_answer_write(void *dst, ffsize cap, const ffdns_answer *
 	return r + sizeof(struct ffdns_ans) + a->data.len;
 }
 
+enum FFDNS_SECTION {
+	FFDNS_SEC_QUESTION,
+	FFDNS_SEC_ANSWER,
+	FFDNS_SEC_AUTHORITY,
+	FFDNS_SEC_ADDITIONAL,
+};
+
+/** Record returned by ffdns_reader_next() */
+typedef struct ffdns_rr {
+	ffuint	section; // enum FFDNS_SECTION
+	ffstr	name; // "name.com." in the user's buffer;  empty if the user's buffer is NULL
+	ffuint	type; // enum FFDNS_TYPE
+	ffuint	clas; // enum FFDNS_CLASS
+	ffuint	ttl; // 0 for question
+	ffstr	data; // RDATA within the message;  empty for question
+	ffuint	data_off; // offset of RDATA in the message: for reading a name inside RDATA
+} ffdns_rr;
+
+#define FFDNS_READER_CACHE  32 // must be a power of 2
+
+/** Cursor-based message reader: records are read without memory allocation.
+Names are decoded into the user's buffers.
+Each decoded name is remembered with the offsets of its labels,
+ so a compression pointer to an already seen name is resolved by one lookup
+ instead of walking the chain of labels and pointers. */
+typedef struct ffdns_reader {
+	ffstr	msg;
+	ffuint	off; // offset of the next record
+	ffuint	sect; // current section: enum FFDNS_SECTION
+	ffuint	left[4]; // records left in each section
+
+	struct {
+		ffushort off; // offset of a label in 'msg';  0: empty slot
+		ffushort pos; // offset of the decoded name suffix in 'names'
+		ffushort len;
+	} cache[FFDNS_READER_CACHE];
+	ffuint	names_len;
+	char	names[512];
+} ffdns_reader;
+
+static inline ffuint _ffdns_reader_slot(ffuint off)
+{
+	return (off * 0x9e3779b1U) >> 16 & (FFDNS_READER_CACHE - 1);
+}
+
+/** Remember the offsets of labels of a decoded name */
+static inline void _ffdns_reader_cache(ffdns_reader *d, const char *name, ffuint len, const ffushort *starts, const ffbyte *pos, ffuint n)
+{
+	if (n == 0 || d->names_len + len - pos[0] > sizeof(d->names))
+		return;
+	if (d->cache[_ffdns_reader_slot(starts[0])].off == starts[0] && starts[0] != 0)
+		return; // already cached
+
+	ffuint base = d->names_len - pos[0];
+	ffmem_copy(&d->names[d->names_len], &name[pos[0]], len - pos[0]);
+	d->names_len += len - pos[0];
+
+	for (ffuint k = 0;  k != n;  k++) {
+		if (starts[k] > 0x3fff)
+			continue; // can't be referenced by compression pointer
+		ffuint i = _ffdns_reader_slot(starts[k]);
+		d->cache[i].off = starts[k];
+		d->cache[i].pos = base + pos[k];
+		d->cache[i].len = len - pos[k];
+	}
+}
+
+/** Read name from DNS message.
+dst: buffer of at least FFDNS_MAXNAME bytes for "name.com.";  NULL: just skip data
+dst_len: (output) name length
+Return N of bytes read at 'offset';
+  -1 on error */
+static inline int ffdns_reader_name(ffdns_reader *d, ffuint offset, char *dst, ffuint *dst_len)
+{
+	const ffstr msg = d->msg;
+	ffuint i = offset, n = 0, jumps = 0, nlabels = 0, rd = 0;
+	ffushort starts[FFDNS_MAXNAME / 2]; // offsets of labels in 'msg'
+	ffbyte pos[FFDNS_MAXNAME / 2]; // offsets of labels in 'dst'
+
+	for (;;) {
+		if (i >= msg.len)
+			return -1; // incomplete data
+		ffuint c = (ffbyte)msg.ptr[i];
+
+		if ((c & 0xc0) == 0xc0) { // compressed
+			if (i + 1 >= msg.len)
+				return -1; // incomplete data
+			if (jumps == 0)
+				rd = i + 2 - offset;
+			if (dst == NULL)
+				break;
+			if (++jumps == 30)
+				return -1; // too many jumps
+
+			i = ((c & 0x3f) << 8) | (ffbyte)msg.ptr[i + 1];
+			ffuint k = _ffdns_reader_slot(i);
+			if (d->cache[k].off == i && i != 0) {
+				ffuint len = d->cache[k].len;
+				if (n + len > FFDNS_MAXNAME - 1)
+					return -1; // too long name
+				const char *src = &d->names[d->cache[k].pos];
+				for (ffuint j = 0;  j != len;  j++) {
+					dst[n + j] = src[j];
+				}
+				_ffdns_reader_cache(d, dst, n + len, starts, pos, nlabels);
+				n += len;
+				goto done;
+			}
+			continue;
+
+		} else if (c & 0xc0) {
+			return -1; // unsupported label type
+		}
+
+		if (c == 0x00) {
+			if (jumps == 0)
+				rd = i + 1 - offset;
+			break;
+		}
+
+		if (i + 1 + c > msg.len)
+			return -1; // incomplete data
+		if (dst != NULL) {
+			if (n + c + 1 > FFDNS_MAXNAME - 1)
+				return -1; // too long name
+			starts[nlabels] = i;
+			pos[nlabels] = n;
+			nlabels++;
+			for (ffuint j = 0;  j != c;  j++) {
+				dst[n++] = msg.ptr[i + 1 + j]; // names are short: faster than memcpy() call
+			}
+			dst[n++] = '.';
+		}
+		i += 1 + c;
+	}
+
+	if (dst != NULL) {
+		if (n == 0)
+			dst[n++] = '.'; // root
+		else
+			_ffdns_reader_cache(d, dst, n, starts, pos, nlabels);
+	}
+
+done:
+	if (dst_len != NULL)
+		*dst_len = n;
+	return rd;
+}
+
+/** Prepare to read records from DNS message.
+h: (optional) parsed header
+Return 0 on success;
+  <0 on error: ffdns_reader_next() returns no records, but ffdns_reader_name() can be used */
+static inline int ffdns_reader_init(ffdns_reader *d, ffstr msg, ffdns_header *h)
+{
+	ffmem_zero_obj(&d->cache);
+	d->names_len = 0;
+	d->left[0] = d->left[1] = d->left[2] = d->left[3] = 0;
+	d->msg = msg;
+	d->off = sizeof(struct ffdns_hdr);
+	d->sect = FFDNS_SEC_QUESTION;
+	if (msg.len < sizeof(struct ffdns_hdr))
+		return -1; // too small message
+
+	const struct ffdns_hdr *hn = (struct ffdns_hdr*)msg.ptr;
+	d->left[0] = ffint_be_cpu16_ptr(hn->qdcount);
+	d->left[1] = ffint_be_cpu16_ptr(hn->ancount);
+	d->left[2] = ffint_be_cpu16_ptr(hn->nscount);
+	d->left[3] = ffint_be_cpu16_ptr(hn->arcount);
+
+	if (h != NULL)
+		ffdns_header_read(h, msg);
+	return 0;
+}
+
+/** Read the next record.
+name: buffer of at least FFDNS_MAXNAME bytes;  NULL: don't decode the name
+Return 1: record is read;
+  0: no more records;
+  -1 on error */
+static inline int ffdns_reader_next(ffdns_reader *d, ffdns_rr *rr, char *name)
+{
+	while (d->left[d->sect] == 0) {
+		if (d->sect == FFDNS_SEC_ADDITIONAL)
+			return 0;
+		d->sect++;
+	}
+
+	ffuint nlen = 0;
+	int r = ffdns_reader_name(d, d->off, name, &nlen);
+	if (r < 0)
+		return -1;
+	ffuint off = d->off + r;
+	ffstr_set(&rr->name, name, nlen);
+	rr->section = d->sect;
+
+	if (d->sect == FFDNS_SEC_QUESTION) {
+		if (off + sizeof(struct ffdns_ques) > d->msg.len)
+			return -1; // too small message
+		const struct ffdns_ques *qn = (struct ffdns_ques*)(d->msg.ptr + off);
+		rr->type = ffint_be_cpu16_ptr(qn->type);
+		rr->clas = ffint_be_cpu16_ptr(qn->clas);
+		rr->ttl = 0;
+		ffstr_null(&rr->data);
+		rr->data_off = 0;
+		d->off = off + sizeof(struct ffdns_ques);
+		d->left[d->sect]--;
+		return 1;
+	}
+
+	if (off + sizeof(struct ffdns_ans) > d->msg.len)
+		return -1; // too small message
+	const struct ffdns_ans *an = (struct ffdns_ans*)(d->msg.ptr + off);
+	ffuint len = ffint_be_cpu16_ptr(an->len);
+	off += sizeof(struct ffdns_ans);
+	if (off + len > d->msg.len)
+		return -1; // too small message
+
+	rr->type = ffint_be_cpu16_ptr(an->type);
+	rr->clas = ffint_be_cpu16_ptr(an->clas);
+	rr->ttl = ffint_be_cpu32_ptr(an->ttl);
+	if ((int)rr->ttl < 0)
+		rr->ttl = 0;
+	ffstr_set(&rr->data, d->msg.ptr + off, len);
+	rr->data_off = off;
+	d->off = off + len;
+	d->left[d->sect]--;
+	return 1;
+}
+
+#define FFDNS_OPTLEN  (1 + sizeof(struct ffdns_opt)) // OPT record with empty RDATA
+#define FFDNS_WRITER_CACHE  64 // must be a power of 2
+
+/** DNS message builder.
+Names are compressed (RFC 1035 4.1.4):
+ each written name suffix is stored in a hash table with its offset in the message,
+ so the longest suffix of a new name that is already in the message is replaced with a pointer.
+Records must be added in order of sections.
+If a record doesn't fit into the buffer (e.g. the UDP limit), it isn't added, and:
+ . question, answer, authority section: the message is marked as truncated (TC bit),
+    no more records are added;
+ . additional section: the record is just skipped (RFC 2181 9). */
+typedef struct ffdns_writer {
+	char	*buf;
+	ffuint	cap; // max. message size (excluding the space reserved for OPT record)
+	ffuint	len;
+	ffuint	sect; // current section: enum FFDNS_SECTION
+	ffuint	n[4]; // records in each section
+	ffuint	opt_size; // UDP payload size for OPT record;  0: no EDNS
+	ffuint	truncated :1;
+
+	struct {
+		ffuint hash;
+		ffushort off; // offset of the name suffix in the message;  0: empty slot
+	} sfx[FFDNS_WRITER_CACHE];
+} ffdns_writer;
+
+/**
+buf: message buffer
+cap: max. message size: 512 for UDP without EDNS (FFDNS_MAXMSG) */
+static inline void ffdns_writer_init(ffdns_writer *w, void *buf, ffuint cap)
+{
+	ffmem_zero_obj(w);
+	w->buf = (char*)buf;
+	w->cap = ffmin(cap, 0xffff);
+	w->len = sizeof(struct ffdns_hdr);
+}
+
+/** Add OPT record (EDNS0) to the additional section in ffdns_writer_fin().
+The space is reserved now, so the record is never truncated.
+udp_size: UDP payload size to advertise.
+ Response to a query with OPT record may use max(512, ffdns_rr.clas) of the query's OPT record as 'cap'.
+Return 0 on success;
+  -1: no space */
+static inline int ffdns_writer_edns(ffdns_writer *w, ffuint udp_size)
+{
+	if (w->opt_size == 0) {
+		if (w->len + FFDNS_OPTLEN > w->cap)
+			return -1;
+		w->cap -= FFDNS_OPTLEN;
+	}
+	w->opt_size = ffmax(udp_size, FFDNS_MAXMSG);
+	return 0;
+}
+
+/** Hash of a name suffix: label in lower case and the hash of the next suffix */
+static inline ffuint _ffdns_writer_hash(const char *label, ffuint len, ffuint next)
+{
+	ffuint h = (next ^ len) * 0x01000193;
+	for (ffuint i = 0;  i != len;  i++) {
+		ffuint c = (ffbyte)label[i];
+		if (c >= 'A' && c <= 'Z')
+			c |= 0x20;
+		h = (h ^ c) * 0x01000193;
+	}
+	return h;
+}
+
+/** Compare the name at 'off' in the message with labels [k..n) of the new name */
+static inline int _ffdns_writer_match(const ffdns_writer *w, ffuint off, const char *name, const ffbyte *lpos, const ffbyte *llen, ffuint k, ffuint n)
+{
+	for (;;) {
+		ffuint c = (ffbyte)w->buf[off];
+		if ((c & 0xc0) == 0xc0) {
+			off = ((c & 0x3f) << 8) | (ffbyte)w->buf[off + 1]; // always points back to our own data
+			continue;
+		}
+		if (k == n)
+			return (c == 0x00);
+		if (c != llen[k]
+			|| 0 != ffs_icmp(&w->buf[off + 1], &name[lpos[k]], c))
+			return 0;
+		off += 1 + c;
+		k++;
+	}
+}
+
+/** Write compressed name.
+Return N of bytes written;
+  0: no space;
+  -1: invalid name */
+static inline int _ffdns_writer_name(ffdns_writer *w, ffstr name)
+{
+	ffbyte lpos[FFDNS_MAXNAME / 2], llen[FFDNS_MAXNAME / 2];
+	ffuint hash[FFDNS_MAXNAME / 2];
+	ffuint n = 0, i, k, ptr = 0;
+
+	if (name.len != 0 && name.ptr[name.len - 1] == '.')
+		name.len--; // "name." or "."
+	if (name.len + 2 > FFDNS_MAXNAME)
+		return -1; // too long name
+
+	// split into labels
+	for (i = 0;  i < name.len;  ) {
+		ffuint start = i;
+		while (i != name.len && name.ptr[i] != '.') {
+			i++;
+		}
+		if (i == start || i - start > FFDNS_MAXLABEL)
+			return -1; // empty or too long label
+		lpos[n] = start;
+		llen[n] = i - start;
+		n++;
+		i++; // skip '.'
+		if (i == name.len)
+			return -1; // ".." at the end
+	}
+
+	for (i = n;  i != 0;  i--) {
+		hash[i - 1] = _ffdns_writer_hash(&name.ptr[lpos[i - 1]], llen[i - 1], (i != n) ? hash[i] : 0);
+	}
+
+	// find the longest suffix which is already in the message
+	for (k = 0;  k != n;  k++) {
+		const ffuint slot = hash[k] & (FFDNS_WRITER_CACHE - 1);
+		if (w->sfx[slot].off != 0
+			&& w->sfx[slot].hash == hash[k]
+			&& _ffdns_writer_match(w, w->sfx[slot].off, name.ptr, lpos, llen, k, n)) {
+			ptr = w->sfx[slot].off;
+			break;
+		}
+	}
+
+	ffuint size = (ptr != 0) ? 2 : 1;
+	for (i = 0;  i != k;  i++) {
+		size += 1 + llen[i];
+	}
+	if (w->len + size > w->cap)
+		return 0;
+
+	char *d = &w->buf[w->len];
+	for (i = 0;  i != k;  i++) {
+		if (w->len < 0x4000) {
+			const ffuint slot = hash[i] & (FFDNS_WRITER_CACHE - 1);
+			w->sfx[slot].hash = hash[i];
+			w->sfx[slot].off = w->len;
+		}
+		*d++ = llen[i];
+		for (ffuint j = 0;  j != llen[i];  j++) {
+			*d++ = name.ptr[lpos[i] + j];
+		}
+		w->len += 1 + llen[i];
+	}
+
+	if (ptr != 0) {
+		d[0] = (char)(0xc0 | (ptr >> 8));
+		d[1] = (char)ptr;
+	} else {
+		d[0] = 0x00;
+	}
+	w->len += (ptr != 0) ? 2 : 1;
+	return size;
+}
+
+/** Remove the data of the record that doesn't fit */
+static inline void _ffdns_writer_rollback(ffdns_writer *w, ffuint len)
+{
+	w->len = len;
+	for (ffuint i = 0;  i != FFDNS_WRITER_CACHE;  i++) {
+		if (w->sfx[i].off >= len)
+			w->sfx[i].off = 0;
+	}
+}
+
+/**
+target: (optional) RDATA is a name that should be compressed: CNAME, NS, PTR */
+static inline int _ffdns_writer_add(ffdns_writer *w, ffuint section, ffstr name, ffuint type, ffuint clas, ffuint ttl, ffstr data, const ffstr *target)
+{
+	if (section < w->sect || section > FFDNS_SEC_ADDITIONAL)
+		return -1; // invalid order
+	w->sect = section;
+	if (w->truncated)
+		return 1;
+
+	ffuint off = w->len;
+	int r = _ffdns_writer_name(w, name);
+	if (r <= 0)
+		goto fail;
+
+	if (section == FFDNS_SEC_QUESTION) {
+		if (w->len + sizeof(struct ffdns_ques) > w->cap) {
+			r = 0;
+			goto fail;
+		}
+		struct ffdns_ques *qn = (struct ffdns_ques*)&w->buf[w->len];
+		*(ffushort*)qn->type = ffint_be_cpu16(type);
+		*(ffushort*)qn->clas = ffint_be_cpu16(clas);
+		w->len += sizeof(struct ffdns_ques);
+		w->n[section]++;
+		return 0;
+	}
+
+	if (w->len + sizeof(struct ffdns_ans) > w->cap) {
+		r = 0;
+		goto fail;
+	}
+	struct ffdns_ans *an = (struct ffdns_ans*)&w->buf[w->len];
+	w->len += sizeof(struct ffdns_ans);
+
+	if (target != NULL) {
+		if (0 >= (r = _ffdns_writer_name(w, *target)))
+			goto fail;
+		data.len = r;
+	} else {
+		if (w->len + data.len > w->cap) {
+			r = 0;
+			goto fail;
+		}
+		ffmem_copy(&w->buf[w->len], data.ptr, data.len);
+		w->len += data.len;
+	}
+
+	*(ffushort*)an->type = ffint_be_cpu16(type);
+	*(ffushort*)an->clas = ffint_be_cpu16(clas);
+	*(ffuint*)an->ttl = ffint_be_cpu32(ttl);
+	*(ffushort*)an->len = ffint_be_cpu16(data.len);
+	w->n[section]++;
+	return 0;
+
+fail:
+	_ffdns_writer_rollback(w, off);
+	if (r < 0)
+		return -1;
+	if (section != FFDNS_SEC_ADDITIONAL)
+		w->truncated = 1;
+	return 1;
+}
+
+/** Add question.
+Return 0: added;
+  1: no space: the message is truncated;
+  -1: invalid name or order of sections */
+static inline int ffdns_writer_question(ffdns_writer *w, ffstr name, ffuint type, ffuint clas)
+{
+	ffstr data = {};
+	return _ffdns_writer_add(w, FFDNS_SEC_QUESTION, name, type, clas, 0, data, NULL);
+}
+
+/** Add resource record.
+section: enum FFDNS_SECTION
+name: "name.com" or "name.com."
+Return 0: added;
+  1: no space: the record isn't added;
+  -1: invalid name or order of sections */
+static inline int ffdns_writer_rr(ffdns_writer *w, ffuint section, ffstr name, ffuint type, ffuint clas, ffuint ttl, ffstr data)
+{
+	return _ffdns_writer_add(w, section, name, type, clas, ttl, data, NULL);
+}
+
+/** Add resource record whose data is a name: CNAME, NS, PTR.
+The name in RDATA is compressed too. */
+static inline int ffdns_writer_rr_name(ffdns_writer *w, ffuint section, ffstr name, ffuint type, ffuint clas, ffuint ttl, ffstr target)
+{
+	ffstr data = {};
+	return _ffdns_writer_add(w, section, name, type, clas, ttl, data, &target);
+}
+
+/** Complete the message: write OPT record and header.
+h: ID, flags and response code;
+ the record counters are set by the writer, and TC flag is set if the message is truncated.
+Return message length */
+static inline ffuint ffdns_writer_fin(ffdns_writer *w, const ffdns_header *h)
+{
+	if (w->opt_size != 0) {
+		ffdns_opt_init(&w->buf[w->len], w->opt_size);
+		w->len += FFDNS_OPTLEN;
+		w->cap += FFDNS_OPTLEN;
+		w->n[FFDNS_SEC_ADDITIONAL]++;
+		w->opt_size = 0;
+	}
+
+	ffdns_header hdr = *h;
+	hdr.questions = w->n[FFDNS_SEC_QUESTION];
+	hdr.answers = w->n[FFDNS_SEC_ANSWER];
+	hdr.nss = w->n[FFDNS_SEC_AUTHORITY];
+	hdr.additionals = w->n[FFDNS_SEC_ADDITIONAL];
+	if (w->truncated)
+		hdr.truncation = 1;
+	ffdns_header_write(w->buf, sizeof(struct ffdns_hdr), &hdr);
+	return w->len;
+}
+
 /** Check if domain name is valid.
 Syntax: [label.]... label.label
   . Max length of ascii hostname including dots is 253 characters
@@ -510,7 +1045,7 @@ Syntax: [label.]... label.label
     . ASCII letters a-z and A-Z
     . digits 0-9
     . hyphen ('-')
-  . Labels may be in "xn--[a-zA-Z0-9]+" format
+  . Labels may be in "xn--[a-zA-Z0-9]+" format (the prefix is case-insensitive)
   . Labels cannot start or end with hyphens
 Return domain level;
   <0 on error */
@@ -563,7 +1098,7 @@ static inline int ffdns_isdomain(const char *name, ffsize len)
 
 			if (xn > 0) {
 				if (xn < FFS_LEN("xn--")) {
-					if (c == "xn--"[xn])
+					if (ffchar_lower(c) == "xn--"[xn])
 						xn++;
 					else
 						xn = 0;
@@ -584,3 +1119,144 @@ static inline int ffdns_isdomain(const char *name, ffsize len)
 
 	return level;
 }
+
+/** Get index of the next set bit starting at 'i'
+Return 'n' if not found */
+static inline ffsize _ffdns_next_bit(const ffuint64 *m, ffsize i, ffsize n)
+{
+	for (;  i < n;  i = (i & ~63) + 64) {
+		ffuint64 w = m[i / 64] >> (i % 64);
+		if (w != 0)
+			return ffmin(i + __builtin_ctzll(w), n);
+	}
+	return n;
+}
+
+/** Validate, lowercase and hash domain name in one pass.
+The name is processed by 16-byte blocks (SSE2 if available):
+ the block is converted to lower case, its character classes are checked
+ and the positions of dots are saved in a bit mask;
+ then the labels are checked using the bit mask without touching every byte again.
+Syntax rules are the same as in ffdns_isdomain().
+dst: buffer for the name in lower case;  size >= len
+hash: (optional) hash of the name in lower case:
+ the same value for the names that differ only by case
+Return domain level;
+  <0 on error (the contents of 'dst' and 'hash' are undefined) */
+static inline int ffdns_domain_normalize(char *dst, const char *name, ffsize len, ffuint *hash)
+{
+	if (len == 0 || len > 253)
+		return -1;
+
+	ffuint64 dots[4] = {}, h = len;
+	ffuint bad = 0;
+	union {
+		ffbyte b[16];
+		ffuint64 w[2];
+	} blk;
+
+	for (ffsize i = 0;  i < len;  i += 16) {
+		ffsize n = ffmin(len - i, 16);
+		ffuint m = 0xffff >> (16 - n), dot;
+
+#if defined __SSE2__ && !defined FFDNS_NO_SIMD
+		__m128i v;
+		if (n == 16) {
+			v = _mm_loadu_si128((const __m128i*)(name + i));
+		} else {
+			blk.w[0] = blk.w[1] = 0;
+			for (ffsize j = 0;  j != n;  j++) {
+				blk.b[j] = name[i + j];
+			}
+			v = _mm_loadu_si128((const __m128i*)blk.b);
+		}
+		// v is within [lo..hi]  <=>  (v - lo) <= (hi - lo)  (unsigned)
+		__m128i x = _mm_sub_epi8(v, _mm_set1_epi8('A'));
+		__m128i upper = _mm_cmpeq_epi8(_mm_min_epu8(x, _mm_set1_epi8('Z' - 'A')), x);
+		v = _mm_or_si128(v, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+		x = _mm_sub_epi8(v, _mm_set1_epi8('a'));
+		__m128i ok = _mm_cmpeq_epi8(_mm_min_epu8(x, _mm_set1_epi8('z' - 'a')), x);
+		x = _mm_sub_epi8(v, _mm_set1_epi8('0'));
+		ok = _mm_or_si128(ok, _mm_cmpeq_epi8(_mm_min_epu8(x, _mm_set1_epi8('9' - '0')), x));
+		__m128i d = _mm_cmpeq_epi8(v, _mm_set1_epi8('.'));
+		ok = _mm_or_si128(ok, _mm_or_si128(d, _mm_cmpeq_epi8(v, _mm_set1_epi8('-'))));
+		bad |= ~_mm_movemask_epi8(ok) & m;
+		dot = _mm_movemask_epi8(d) & m;
+		_mm_storeu_si128((__m128i*)blk.b, v);
+		if (n == 16)
+			_mm_storeu_si128((__m128i*)(dst + i), v);
+
+#else
+		blk.w[0] = blk.w[1] = 0;
+		dot = 0;
+		for (ffsize j = 0;  j != n;  j++) {
+			ffuint c = (ffbyte)name[i + j];
+			if (c >= 'A' && c <= 'Z')
+				c |= 0x20;
+			if (c == '.')
+				dot |= 1U << j;
+			else if (!((c >= 'a' && c <= 'z')
+				|| (c >= '0' && c <= '9')
+				|| c == '-'))
+				bad = 1;
+			blk.b[j] = c;
+		}
+#endif
+
+		dots[i / 64] |= (ffuint64)dot << (i % 64);
+
+#if defined __SSE2__ && !defined FFDNS_NO_SIMD
+		if (n != 16)
+#endif
+		{
+			for (ffsize j = 0;  j != n;  j++) {
+				dst[i + j] = blk.b[j];
+			}
+		}
+
+		if (hash != NULL) {
+			// the bytes after the name are 0
+			h = (h ^ ffint_le_cpu64(blk.w[0])) * 0x9e3779b97f4a7c15ULL;
+			h ^= h >> 29;
+			if (n > 8) {
+				h = (h ^ ffint_le_cpu64(blk.w[1])) * 0x9e3779b97f4a7c15ULL;
+				h ^= h >> 29;
+			}
+		}
+	}
+
+	if (bad)
+		return -1;
+
+	ffuint level = 1;
+	ffsize start = 0, end;
+	for (;;) {
+		end = _ffdns_next_bit(dots, start, len);
+		if (end == start // empty label
+			|| end - start > FFDNS_MAXLABEL
+			|| dst[start] == '-')
+			return -1;
+		if (end == len)
+			break;
+		if (dst[end - 1] == '-')
+			return -1;
+		level++;
+		start = end + 1;
+	}
+
+	// top-level label "xn--..." must have at least 4 characters after the prefix
+	ffsize n = len - start;
+	if (dst[start] == 'x' && n < FFS_LEN("xn--wwww")) {
+		ffsize k;
+		for (k = 1;  k != ffmin(n, 4);  k++) {
+			if (dst[start + k] != "xn--"[k])
+				break;
+		}
+		if (k == ffmin(n, 4))
+			return -1;
+	}
+
+	if (hash != NULL)
+		*hash = (ffuint)(h ^ (h >> 32));
+	return level;
+}
@@ -0,0 +1,60 @@
+/** ff: dns.h message reader fuzz target (libFuzzer)
+Build:
+ clang -g -O1 -fsanitize=fuzzer,address,undefined -I<directory with ffbase/> fuzz-dns.c -o fuzz-dns
+Run:
+ ./fuzz-dns CORPUS_DIR
+2026, Simon Zolin
+*/
+
+#include "dns.h"
+#include <stdlib.h>
+
+/** Read all records;  compare each name with the result of ffdns_name_read() */
+int LLVMFuzzerTestOneInput(const ffbyte *data, ffsize size)
+{
+	ffdns_reader d;
+	ffdns_rr rr;
+	char name[FFDNS_MAXNAME], name2[FFDNS_MAXNAME];
+	ffuint n, off;
+	ffvec v = {};
+	ffstr msg = FFSTR_INITN(data, size);
+
+	ffdns_reader_init(&d, msg, NULL);
+	for (;;) {
+		off = d.off;
+		if (1 != ffdns_reader_next(&d, &rr, name))
+			break;
+
+		if (rr.name.len == 0 || rr.name.len > FFDNS_MAXNAME - 1)
+			abort();
+		if (rr.data.ptr + rr.data.len > msg.ptr + msg.len)
+			abort();
+
+		int r = ffdns_name_read(&v, msg, off);
+		if (r >= 0
+			&& !(v.len == rr.name.len && !ffmem_cmp(v.ptr, rr.name.ptr, v.len)))
+			abort();
+
+		// names inside RDATA
+		if (rr.type == FFDNS_CNAME || rr.type == FFDNS_NS || rr.type == FFDNS_PTR) {
+			int r1 = ffdns_reader_name(&d, rr.data_off, name2, &n);
+			int r2 = ffdns_reader_name(&d, rr.data_off, NULL, NULL);
+			if (r1 >= 0 && r1 != r2)
+				abort();
+		}
+	}
+
+	// names at any offset, decoded twice: the second time from cache
+	ffdns_reader_init(&d, msg, NULL);
+	for (off = 0;  off < size && off < 64;  off++) {
+		int r1 = ffdns_reader_name(&d, off, name, &n);
+		ffuint n2;
+		int r2 = ffdns_reader_name(&d, off, name2, &n2);
+		if (r1 >= 0
+			&& !(r1 == r2 && n == n2 && !ffmem_cmp(name, name2, n)))
+			abort();
+	}
+
+	ffvec_free(&v);
+	return 0;
+}
@@ -6,8 +6,10 @@
 http_req_parse http_req_write
 http_resp_parse http_resp_write
 http_hdr_parse http_hdr_write
+http_hdrs_parse http_hdrs_find
+http_hdr_known
 http_range_parse http_range_write
-httpchunked_parse httpchunked_write
+httpchunked_parse httpchunked_parse_v httpchunked_write
 httpurl_escape httpurl_unescape
 httpurl_split
 */
@@ -87,6 +89,69 @@ Multi-range partial content example:
 #pragma once
 #include <ffbase/string.h>
 
+#if defined __SSE2__ && !defined HTTP1_NO_SIMD
+#include <emmintrin.h>
+#endif
+
+/** Get index of the first byte not within the ranges (same as ffs_skip_ranges()).
+ranges: pairs of bytes "LoHi..." (<=8 pairs)
+Return -1 if all bytes are within the ranges */
+static inline ffssize _http_skip_ranges(const char *d, ffsize len, const char *ranges, ffsize ranges_len)
+{
+	ffsize i = 0;
+
+#if defined __SSE2__ && !defined HTTP1_NO_SIMD
+	// v is within [lo..hi]  <=>  (v - lo) <= (hi - lo)  (unsigned)
+	__m128i lo[8], span[8];
+	ffsize nr = ranges_len / 2;
+	for (ffsize j = 0;  j != nr;  j++) {
+		lo[j] = _mm_set1_epi8(ranges[j*2]);
+		span[j] = _mm_set1_epi8((ffbyte)ranges[j*2+1] - (ffbyte)ranges[j*2]);
+	}
+	for (;  i + 16 <= len;  i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i*)(d + i));
+		__m128i in = _mm_setzero_si128();
+		for (ffsize j = 0;  j != nr;  j++) {
+			__m128i x = _mm_sub_epi8(v, lo[j]);
+			in = _mm_or_si128(in, _mm_cmpeq_epi8(_mm_min_epu8(x, span[j]), x));
+		}
+		ffuint mask = ~_mm_movemask_epi8(in) & 0xffff;
+		if (mask != 0)
+			return i + __builtin_ctz(mask);
+	}
+#endif
+
+	ffssize r = ffs_skip_ranges(d + i, len - i, ranges, ranges_len);
+	if (r < 0)
+		return -1;
+	return i + r;
+}
+
+/** Get index of the first CR or LF byte
+Return -1 if not found */
+static inline ffssize _http_find_crlf(const char *d, ffsize len)
+{
+	ffsize i = 0;
+
+#if defined __SSE2__ && !defined HTTP1_NO_SIMD
+	const __m128i cr = _mm_set1_epi8('\r')
+		, lf = _mm_set1_epi8('\n');
+	for (;  i + 16 <= len;  i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i*)(d + i));
+		__m128i m = _mm_or_si128(_mm_cmpeq_epi8(v, cr), _mm_cmpeq_epi8(v, lf));
+		ffuint mask = _mm_movemask_epi8(m);
+		if (mask != 0)
+			return i + __builtin_ctz(mask);
+	}
+#endif
+
+	for (;  i != len;  i++) {
+		if (d[i] == '\r' || d[i] == '\n')
+			return i;
+	}
+	return -1;
+}
+
 static int httpurl_escape(char *buf, ffsize cap, ffstr url);
 
 /** Parse HTTP request line, e.g. "GET /file HTTP/1.1\r\n"
@@ -100,7 +165,7 @@ static inline int http_req_parse(ffstr req, ffstr *method, ffstr *path, ffstr *p
 {
 	const char *d = req.ptr, *end = req.ptr + req.len;
 
-	int r = ffs_skip_ranges(d, end - d, "\x41\x5a", 2); // "A-Z"
+	int r = _http_skip_ranges(d, end - d, "\x41\x5a", 2); // "A-Z"
 	if (r < 0)
 		return 0;
 	if (r == 0 || d[r] != ' ')
@@ -116,7 +181,7 @@ static inline int http_req_parse(ffstr req, ffstr *method, ffstr *path, ffstr *p
 		d++;
 	}
 
-	r = ffs_skip_ranges(d, end - d, "\x21\x7e", 2); // printable ANSI
+	r = _http_skip_ranges(d, end - d, "\x21\x7e", 2); // printable ANSI
 	if (r < 0)
 		return 0;
 	if (r == 0 || d[r] != ' ')
@@ -135,7 +200,7 @@ static inline int http_req_parse(ffstr req, ffstr *method, ffstr *path, ffstr *p
 	if (d+8 <= end
 		&& (ffint_be_cpu64(*(ffuint64*)d) & ~1ULL) != 0x485454502f312e30) // "HTTP/1.0|1"
 		return -1;
-	r = ffs_skip_ranges(d, end - d, "\x21\x7e", 2); // printable ANSI
+	r = _http_skip_ranges(d, end - d, "\x21\x7e", 2); // printable ANSI
 	if (r < 0) {
 		if (d+8 < end)
 			return -1;
@@ -175,7 +240,7 @@ static inline int http_resp_parse(ffstr resp, ffstr *proto, ffuint *code, ffstr
 {
 	const char *d = resp.ptr, *end = resp.ptr + resp.len;
 
-	int r = ffs_skip_ranges(d, end - d, "\x21\x7e", 2); // printable ANSI
+	int r = _http_skip_ranges(d, end - d, "\x21\x7e", 2); // printable ANSI
 	if (r < 0)
 		return 0;
 	if (r == 0 || d[r] != ' ')
@@ -183,7 +248,7 @@ static inline int http_resp_parse(ffstr resp, ffstr *proto, ffuint *code, ffstr
 	ffstr_set(proto, d, r);
 	d += r+1;
 
-	r = ffs_skip_ranges(d, end - d, "\x30\x39", 2); // "0-9"
+	r = _http_skip_ranges(d, end - d, "\x30\x39", 2); // "0-9"
 	if (r < 0)
 		return 0;
 	else if (r != 3 || d[r] != ' ')
@@ -191,7 +256,7 @@ static inline int http_resp_parse(ffstr resp, ffstr *proto, ffuint *code, ffstr
 	*code = (d[0] - '0') * 100 + (d[1] - '0') * 10 + d[2] - '0';
 	d += 4;
 
-	r = ffs_skip_ranges(d, end - d, "\x20\x7e", 2); // basic latin
+	r = _http_skip_ranges(d, end - d, "\x20\x7e", 2); // basic latin
 	if (r < 0)
 		return 0;
 	ffstr_set(msg, d, r);
@@ -221,7 +286,7 @@ static inline int http_hdr_parse(ffstr data, ffstr *name, ffstr *value)
 {
 	const char *d = data.ptr, *end = data.ptr+data.len;
 
-	int r = ffs_skip_ranges(d, end - d, "\x2d\x2d\x30\x39\x41\x5a\x61\x7a", 8); // "-0-9A-Za-z"
+	int r = _http_skip_ranges(d, end - d, "\x2d\x2d\x30\x39\x41\x5a\x61\x7a", 8); // "-0-9A-Za-z"
 	if (r < 0)
 		return 0;
 	else if (r == 0)
@@ -251,7 +316,7 @@ static inline int http_hdr_parse(ffstr data, ffstr *name, ffstr *value)
 		d++;
 	}
 
-	r = ffs_findany(d, end - d, "\r\n", 2);
+	r = _http_find_crlf(d, end - d);
 	if (r < 0)
 		return 0;
 	ffstr_set(value, d, r);
@@ -275,6 +340,212 @@ crlf:
 }
 
 
+/** Header field within the header block */
+struct http_hdr_ent {
+	ffuint name_off, name_len; // offset from the beginning of the block
+	ffuint val_off, val_len;
+};
+
+/** Parse the whole header block in one pass, e.g. "Key: Value\r\n...\r\n"
+The syntax is the same as for http_hdr_parse().
+tbl: [output] offset table; only the first 'cap' fields are stored
+n: [output] total N of header fields
+Return N of bytes processed (including the last CRLF)
+ =0 if need more data
+ <0 on error */
+static inline int http_hdrs_parse(ffstr data, struct http_hdr_ent *tbl, ffuint cap, ffuint *n)
+{
+	const char *d = data.ptr, *end = data.ptr+data.len, *name, *val;
+	ffuint k = 0;
+
+	for (;;) {
+		if (d == end)
+			return 0;
+
+		ffssize r = _http_skip_ranges(d, end - d, "\x2d\x2d\x30\x39\x41\x5a\x61\x7a", 8); // "-0-9A-Za-z"
+		if (r < 0)
+			return 0;
+		else if (r == 0)
+			break;
+		if (*d == '-')
+			return -1;
+		name = d;
+		d += r;
+
+		while (*d == ' ') {
+			if (++d == end)
+				return 0;
+		}
+		if (*d != ':')
+			return -1;
+		do {
+			if (++d == end)
+				return 0;
+		} while (*d == ' ');
+
+		ffssize vl = _http_find_crlf(d, end - d);
+		if (vl < 0)
+			return 0;
+		val = d;
+		d += vl;
+		while (vl != 0 && val[vl-1] == ' ') {
+			vl--;
+		}
+
+		if (*d == '\r') {
+			if (++d == end)
+				return 0;
+		}
+		if (*d != '\n')
+			return -1;
+		d++;
+
+		if (k < cap) {
+			tbl[k].name_off = name - data.ptr;
+			tbl[k].name_len = r;
+			tbl[k].val_off = val - data.ptr;
+			tbl[k].val_len = vl;
+		}
+		k++;
+	}
+
+	// last CRLF
+	if (*d == '\r') {
+		if (++d == end)
+			return 0;
+	}
+	if (*d != '\n')
+		return -1;
+	d++;
+
+	*n = k;
+	return d - data.ptr;
+}
+
+/** Find header field in the table filled by http_hdrs_parse()
+block: header block
+Return field index (case-insensitive name match);
+ -1: not found */
+static inline int http_hdrs_find(ffstr block, const struct http_hdr_ent *tbl, ffuint n, const char *name, ffsize namelen, ffstr *value)
+{
+	for (ffuint i = 0;  i != n;  i++) {
+		ffstr nm = FFSTR_INITN(block.ptr + tbl[i].name_off, tbl[i].name_len);
+		if (ffstr_ieq(&nm, name, namelen)) {
+			ffstr_set(value, block.ptr + tbl[i].val_off, tbl[i].val_len);
+			return i;
+		}
+	}
+	return -1;
+}
+
+
+/** Well-known header fields */
+enum HTTP_H {
+	HTTP_H_UNKNOWN,
+	HTTP_H_ACCEPT,
+	HTTP_H_ACCEPT_ENCODING,
+	HTTP_H_ACCEPT_RANGES,
+	HTTP_H_AGE,
+	HTTP_H_AUTHORIZATION,
+	HTTP_H_CACHE_CONTROL,
+	HTTP_H_CONNECTION,
+	HTTP_H_CONTENT_DISPOSITION,
+	HTTP_H_CONTENT_ENCODING,
+	HTTP_H_CONTENT_LENGTH,
+	HTTP_H_CONTENT_RANGE,
+	HTTP_H_CONTENT_TYPE,
+	HTTP_H_COOKIE,
+	HTTP_H_DATE,
+	HTTP_H_ETAG,
+	HTTP_H_EXPIRES,
+	HTTP_H_HOST,
+	HTTP_H_IF_MODIFIED_SINCE,
+	HTTP_H_IF_NONE_MATCH,
+	HTTP_H_KEEP_ALIVE,
+	HTTP_H_LAST_MODIFIED,
+	HTTP_H_LOCATION,
+	HTTP_H_RANGE,
+	HTTP_H_REFERER,
+	HTTP_H_RETRY_AFTER,
+	HTTP_H_SERVER,
+	HTTP_H_SET_COOKIE,
+	HTTP_H_TRANSFER_ENCODING,
+	HTTP_H_UPGRADE,
+	HTTP_H_USER_AGENT,
+	HTTP_H_VARY,
+	HTTP_H_WWW_AUTHENTICATE,
+	_HTTP_H_END,
+};
+static const char http_hdr_name[][20] = {
+	"",
+	"Accept",
+	"Accept-Encoding",
+	"Accept-Ranges",
+	"Age",
+	"Authorization",
+	"Cache-Control",
+	"Connection",
+	"Content-Disposition",
+	"Content-Encoding",
+	"Content-Length",
+	"Content-Range",
+	"Content-Type",
+	"Cookie",
+	"Date",
+	"ETag",
+	"Expires",
+	"Host",
+	"If-Modified-Since",
+	"If-None-Match",
+	"Keep-Alive",
+	"Last-Modified",
+	"Location",
+	"Range",
+	"Referer",
+	"Retry-After",
+	"Server",
+	"Set-Cookie",
+	"Transfer-Encoding",
+	"Upgrade",
+	"User-Agent",
+	"Vary",
+	"WWW-Authenticate",
+};
+
+/** Get ID of a well-known header field (case-insensitive)
+Return enum HTTP_H;
+ 0: unknown field */
+static inline ffuint http_hdr_known(const char *name, ffsize len)
+{
+	// perfect hash of the lowercased name: (len - name[0] + name[len-1] * 4) % 64
+	static const ffbyte slots[64] = {
+		0, 0, 0, 0,
+		HTTP_H_IF_NONE_MATCH, 0, 0, 0,
+		0, HTTP_H_CONTENT_ENCODING, HTTP_H_ACCEPT_ENCODING, HTTP_H_CONTENT_LENGTH,
+		0, 0, 0, 0,
+		0, 0, 0, 0,
+		HTTP_H_LOCATION, 0, 0, 0,
+		0, 0, HTTP_H_CACHE_CONTROL, HTTP_H_SERVER,
+		0, HTTP_H_REFERER, 0, HTTP_H_CONNECTION,
+		0, HTTP_H_RETRY_AFTER, 0, 0,
+		HTTP_H_AUTHORIZATION, HTTP_H_USER_AGENT, HTTP_H_UPGRADE, HTTP_H_RANGE,
+		HTTP_H_CONTENT_DISPOSITION, 0, 0, HTTP_H_SET_COOKIE,
+		HTTP_H_HOST, HTTP_H_WWW_AUTHENTICATE, HTTP_H_EXPIRES, 0,
+		0, HTTP_H_LAST_MODIFIED, HTTP_H_VARY, HTTP_H_KEEP_ALIVE,
+		HTTP_H_DATE, HTTP_H_ACCEPT, HTTP_H_AGE, HTTP_H_COOKIE,
+		HTTP_H_ACCEPT_RANGES, HTTP_H_TRANSFER_ENCODING, 0, HTTP_H_ETAG,
+		HTTP_H_IF_MODIFIED_SINCE, HTTP_H_CONTENT_TYPE, HTTP_H_CONTENT_RANGE, 0,
+	};
+	if (len == 0 || len >= sizeof(http_hdr_name[0]))
+		return HTTP_H_UNKNOWN;
+	ffuint h = (len - (name[0] | 0x20) + (name[len-1] | 0x20) * 4) & 63;
+	ffuint id = slots[h];
+	ffstr s = FFSTR_INITN(name, len);
+	if (id == 0 || !ffstr_ieqz(&s, http_hdr_name[id]))
+		return HTTP_H_UNKNOWN;
+	return id;
+}
+
 /** Write HTTP request line, e.g. "GET /path HTTP/1.1\r\n"
 Return N of bytes written
  <0 if not enough space */
@@ -410,16 +681,78 @@ struct httpchunked {
 	ffuint state;
 	ffuint last_chunk;
 	ffuint64 size;
+	ffsize done_len; // N of bytes processed by the call that returned -1
 };
 
+/** Parse up to 8 hex digits at once (SWAR)
+w: 8 input bytes (the first byte is the least significant)
+val: [output] value of the digits
+Return N of leading hex digits */
+static inline ffuint _http_hex8(ffuint64 w, ffuint *val)
+{
+	const ffuint64 ones = 0x0101010101010101ULL, hi = ones * 0x80;
+	ffuint64 x = w | (ones * 0x20); // 'A-F' -> 'a-f'
+	// high bit of each byte: m < byte < n
+#define _HTTP_BETWEEN(b, m, n) \
+	((ones * (127 + (n)) - ((b) & (ones * 0x7f))) & ~(b) & (((b) & (ones * 0x7f)) + ones * (127 - (m))) & hi)
+	// digits are checked on the raw bytes: the case folding would turn 0x10..0x19 into '0'..'9'
+	ffuint64 digit = _HTTP_BETWEEN(w, '0' - 1, '9' + 1)
+		, alpha = _HTTP_BETWEEN(x, 'a' - 1, 'f' + 1);
+#undef _HTTP_BETWEEN
+	ffuint64 bad = ~(digit | alpha) & hi;
+	ffuint n = (bad != 0) ? __builtin_ctzll(bad) / 8 : 8;
+	if (n == 0)
+		return 0;
+
+	ffuint64 v = (x & (ones * 0x0f)) + (alpha >> 7) * 9; // byte -> nibble
+	v <<= (8 - n) * 8; // drop the bytes after the digits
+	v = ((v << 4) + (v >> 8)) & 0x00ff00ff00ff00ffULL;
+	v = ((v << 8) + (v >> 16)) & 0x0000ffff0000ffffULL;
+	v = ((v << 16) + (v >> 32)) & 0xffffffffULL;
+	*val = v;
+	return n;
+}
+
+/** Parse chunk size line, e.g. "1a\r\n"
+Return N of bytes processed;
+ 0: not enough data or the line needs the generic parser */
+static inline ffuint _httpchunked_size_line(const char *d, ffsize len, ffuint64 *size)
+{
+	ffuint64 w;
+	ffuint n, n2, v, v2;
+
+	if (len < 18)
+		return 0;
+	ffmem_copy(&w, d, 8);
+	if (0 == (n = _http_hex8(ffint_le_cpu64(w), &v)))
+		return 0;
+	ffuint64 sz = v;
+	if (n == 8) {
+		ffmem_copy(&w, d + 8, 8);
+		n2 = _http_hex8(ffint_le_cpu64(w), &v2);
+		if (n2 == 8)
+			return 0; // too many digits
+		if (n2 != 0)
+			sz = (sz << (n2 * 4)) | v2;
+		n += n2;
+	}
+
+	if (d[n] == '\r')
+		n++;
+	if (d[n] != '\n')
+		return 0;
+	*size = sz;
+	return n + 1;
+}
+
 /** Parse chunked data
 Return N of bytes processed, `output` contains unchunked data (if any)
- -1 if done
+ -1 if done;  c->done_len: N of bytes processed
  <0 on error */
 static inline ffssize httpchunked_parse(struct httpchunked *c, ffstr input, ffstr *output)
 {
 	char *d = input.ptr;
-	ffsize i, len = input.len;
+	ffsize i, n, n2, len = input.len;
 	int st = c->state;
 	enum { I_SZ1, I_SZ, I_SZ_CR, I_DAT, I_DAT_CR };
 	output->len = 0;
@@ -429,9 +762,14 @@ static inline ffssize httpchunked_parse(struct httpchunked *c, ffstr input, ffst
 
 		switch (st) {
 		case I_SZ1:
+			if (0 != (n = _httpchunked_size_line(&d[i], len - i, &c->size))) {
+				i += n - 1;
+				goto size_done;
+			}
+			// fallthrough
 		case I_SZ: {
-			int n = ffchar_tohex(ch);
-			if (n < 0) {
+			int h = ffchar_tohex(ch);
+			if (h < 0) {
 				if (st == I_SZ1)
 					return -2;
 
@@ -448,7 +786,7 @@ static inline ffssize httpchunked_parse(struct httpchunked *c, ffstr input, ffst
 			}
 			if (c->size & 0xf000000000000000ULL)
 				return -4;
-			c->size = (c->size << 4) | n;
+			c->size = (c->size << 4) | h;
 			st = I_SZ;
 			break;
 		}
@@ -461,10 +799,22 @@ static inline ffssize httpchunked_parse(struct httpchunked *c, ffstr input, ffst
 
 		case I_DAT: {
 			if (c->size == 0) {
+				if (!c->last_chunk) {
+					// "\r\n" + next size line
+					n = (ch == '\n') ? 1
+						: (ch == '\r' && i + 1 != len && d[i + 1] == '\n') ? 2 : 0;
+					if (n != 0
+						&& 0 != (n2 = _httpchunked_size_line(&d[i + n], len - i - n, &c->size))) {
+						i += n + n2 - 1;
+						goto size_done;
+					}
+				}
+
 				if (ch == '\r') {
 					st = I_DAT_CR;
 				} else if (ch == '\n') {
 					if (c->last_chunk) {
+						c->done_len = i + 1;
 						i = -1;
 						goto end;
 					}
@@ -474,7 +824,7 @@ static inline ffssize httpchunked_parse(struct httpchunked *c, ffstr input, ffst
 				}
 				continue;
 			}
-			ffsize n = ffmin64(c->size, len - i);
+			n = ffmin64(c->size, len - i);
 			ffstr_set(output, &d[i], n);
 			i += n;
 			c->size -= n;
@@ -485,12 +835,19 @@ static inline ffssize httpchunked_parse(struct httpchunked *c, ffstr input, ffst
 			if (ch != '\n')
 				return -7;
 			if (c->last_chunk) {
+				c->done_len = i + 1;
 				i = -1;
 				goto end;
 			}
 			st = I_SZ;
 			break;
 		}
+		continue;
+
+size_done:
+		if (c->size == 0)
+			c->last_chunk = 1;
+		st = I_DAT;
 	}
 
 end:
@@ -498,6 +855,36 @@ end:
 	return i;
 }
 
+/** Parse all complete chunks within the input at once
+spans: [output] unchunked data regions within 'input'
+cap: max N of spans
+n: [output] N of spans
+Return N of bytes processed
+ -1 if done;  c->done_len: N of bytes processed within 'input'
+ <0 on error */
+static inline ffssize httpchunked_parse_v(struct httpchunked *c, ffstr input, ffstr *spans, ffuint cap, ffuint *n)
+{
+	ffstr in = input, out;
+	ffuint k = 0;
+	ffssize r;
+
+	while (in.len != 0 && k != cap) {
+		r = httpchunked_parse(c, in, &out);
+		if (r < 0) {
+			if (r == -1)
+				c->done_len += in.ptr - input.ptr;
+			*n = k;
+			return r;
+		}
+		ffstr_shift(&in, r);
+		if (out.len != 0)
+			spans[k++] = out;
+	}
+
+	*n = k;
+	return in.ptr - input.ptr;
+}
+
 
 /** Prepare chunked data
 buf: buffer of at least 18 bytes for header and trailer */
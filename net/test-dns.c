@@ -4,6 +4,8 @@
 
 #include <FF/net/dns.h>
 #include <FFOS/test.h>
+#include <FFOS/time.h>
+#include "test_dns_isdomain.c"
 
 static void test_dns_name_read()
 {
@@ -155,9 +157,309 @@ void test_dns_rw()
 	ffdns_answer_destroy(&a);
 }
 
+/* Response: question www.example.com A;  answers: CNAME web.example.com, A 1.2.3.4, A 5.6.7.8 */
+static const char dns_resp[] = "\x12\x34\x81\x80\x00\x01\x00\x03\x00\x00\x00\x00"
+	"\x03" "www" "\x07" "example" "\x03" "com" "\x00" "\x00\x01\x00\x01"
+	"\xc0\x0c" "\x00\x05\x00\x01\x00\x00\x00\x3c\x00\x06" "\x03" "web" "\xc0\x10"
+	"\xc0\x2d" "\x00\x01\x00\x01\x00\x00\x01\x00\x00\x04" "\x01\x02\x03\x04"
+	"\xc0\x2d" "\x00\x01\x00\x01\x00\x00\x01\x00\x00\x04" "\x05\x06\x07\x08";
+
+static void test_dns_reader()
+{
+	ffdns_reader d;
+	ffdns_header h;
+	ffdns_rr rr;
+	char name[FFDNS_MAXNAME];
+	ffuint n;
+	ffstr s, msg = FFSTR_INITN(dns_resp, sizeof(dns_resp) - 1);
+
+	x(0 == ffdns_reader_init(&d, msg, &h));
+	xieq(0x1234, h.id);
+	xieq(3, h.answers);
+
+	x(1 == ffdns_reader_next(&d, &rr, name));
+	xieq(FFDNS_SEC_QUESTION, rr.section);
+	xseq(&rr.name, "www.example.com.");
+	xieq(FFDNS_A, rr.type);
+
+	x(1 == ffdns_reader_next(&d, &rr, name));
+	xieq(FFDNS_SEC_ANSWER, rr.section);
+	xseq(&rr.name, "www.example.com.");
+	xieq(FFDNS_CNAME, rr.type);
+	xieq(60, rr.ttl);
+	x(0 < ffdns_reader_name(&d, rr.data_off, name, &n));
+	ffstr_set(&s, name, n);
+	xseq(&s, "web.example.com.");
+
+	// the name is resolved from cache
+	x(1 == ffdns_reader_next(&d, &rr, name));
+	xseq(&rr.name, "web.example.com.");
+	xieq(FFDNS_A, rr.type);
+	xieq(256, rr.ttl);
+	x(ffstr_eq(&rr.data, "\x01\x02\x03\x04", 4));
+
+	// the name isn't needed
+	x(1 == ffdns_reader_next(&d, &rr, NULL));
+	xieq(0, rr.name.len);
+	x(ffstr_eq(&rr.data, "\x05\x06\x07\x08", 4));
+
+	x(0 == ffdns_reader_next(&d, &rr, name));
+
+	// compression: backward x2, the same result with the name cache
+	ffstr_setcz(&msg, "\3dot\3com\0\2my\xc0\0\3www\xc0\x09");
+	ffdns_reader_init(&d, msg, NULL);
+	xieq(9, ffdns_reader_name(&d, 0, name, &n));
+	xieq(5, ffdns_reader_name(&d, 9, name, &n));
+	ffstr_set(&s, name, n);
+	xseq(&s, "my.dot.com.");
+	for (int i = 0;  i != 2;  i++) {
+		xieq(6, ffdns_reader_name(&d, 14, name, &n));
+		ffstr_set(&s, name, n);
+		xseq(&s, "www.my.dot.com.");
+	}
+
+	// errors
+	ffstr_setcz(&msg, "\3www\xc0\0\0");
+	ffdns_reader_init(&d, msg, NULL);
+	xieq(-1, ffdns_reader_name(&d, 0, name, &n)); // dead loop
+	ffstr_setcz(&msg, "\x40");
+	ffdns_reader_init(&d, msg, NULL);
+	xieq(-1, ffdns_reader_name(&d, 0, name, &n)); // unsupported label type
+
+	// truncated message
+	ffstr_set(&msg, dns_resp, sizeof(dns_resp) - 1 - 2);
+	ffdns_reader_init(&d, msg, NULL);
+	while (1 == (n = ffdns_reader_next(&d, &rr, name))) {
+	}
+	xieq(-1, (int)n);
+}
+
+static void test_dns_writer()
+{
+	ffdns_writer w;
+	ffdns_reader d;
+	ffdns_header h = {}, h2;
+	ffdns_rr rr;
+	char buf[FFDNS_MAXMSG], name[FFDNS_MAXNAME];
+	ffstr s, ip = FFSTR_INITN("\x01\x02\x03\x04", 4);
+	ffuint n, i;
+
+	h.id = 0x1234;
+	h.response = 1;
+	h.recursion_desired = 1;
+	h.recursion_available = 1;
+
+	// the same compression as a real server does
+	ffdns_writer_init(&w, buf, sizeof(buf));
+	x(0 == ffdns_writer_question(&w, FFSTR_Z("www.example.com"), FFDNS_A, FFDNS_IN));
+	x(0 == ffdns_writer_rr_name(&w, FFDNS_SEC_ANSWER, FFSTR_Z("www.EXAMPLE.com."), FFDNS_CNAME, FFDNS_IN, 60, FFSTR_Z("web.example.com")));
+	x(0 == ffdns_writer_rr(&w, FFDNS_SEC_ANSWER, FFSTR_Z("web.example.com"), FFDNS_A, FFDNS_IN, 256, ip));
+	ffstr_set(&ip, "\x05\x06\x07\x08", 4);
+	x(0 == ffdns_writer_rr(&w, FFDNS_SEC_ANSWER, FFSTR_Z("web.example.com"), FFDNS_A, FFDNS_IN, 256, ip));
+	n = ffdns_writer_fin(&w, &h);
+	ffstr_set(&s, buf, n);
+	x(ffstr_eq(&s, dns_resp, sizeof(dns_resp) - 1));
+
+	// invalid name;  invalid order of sections
+	ffdns_writer_init(&w, buf, sizeof(buf));
+	x(-1 == ffdns_writer_question(&w, FFSTR_Z("www..com"), FFDNS_A, FFDNS_IN));
+	x(-1 == ffdns_writer_question(&w, FFSTR_Z(".com"), FFDNS_A, FFDNS_IN));
+	x(0 == ffdns_writer_rr(&w, FFDNS_SEC_ANSWER, FFSTR_Z("."), FFDNS_A, FFDNS_IN, 1, ip));
+	x(-1 == ffdns_writer_question(&w, FFSTR_Z("www.com"), FFDNS_A, FFDNS_IN));
+	xieq(sizeof(struct ffdns_hdr) + 1 + sizeof(struct ffdns_ans) + 4, ffdns_writer_fin(&w, &h));
+
+	// UDP limit: answers don't fit -> TC;  the message is still valid
+	ffdns_writer_init(&w, buf, sizeof(buf));
+	x(0 == ffdns_writer_question(&w, FFSTR_Z("many.example.com"), FFDNS_A, FFDNS_IN));
+	for (i = 0;  i != 100;  i++) {
+		if (0 != ffdns_writer_rr(&w, FFDNS_SEC_ANSWER, FFSTR_Z("many.example.com"), FFDNS_A, FFDNS_IN, 60, ip))
+			break;
+	}
+	xieq(29, i); // (512 - 12 - 22) / 16
+	x(1 == ffdns_writer_rr(&w, FFDNS_SEC_ADDITIONAL, FFSTR_Z("ns.example.com"), FFDNS_A, FFDNS_IN, 60, ip));
+	n = ffdns_writer_fin(&w, &h);
+	x(n <= sizeof(buf));
+	ffstr_set(&s, buf, n);
+	x(0 == ffdns_reader_init(&d, s, &h2));
+	x(h2.truncation);
+	xieq(29, h2.answers);
+	xieq(0, h2.additionals);
+	i = 0;
+	while (1 == ffdns_reader_next(&d, &rr, name)) {
+		i++;
+	}
+	xieq(30, i);
+	x(d.off == n);
+
+	// additional records that don't fit are skipped without TC
+	ffdns_writer_init(&w, buf, sizeof(buf));
+	x(0 == ffdns_writer_question(&w, FFSTR_Z("many.example.com"), FFDNS_A, FFDNS_IN));
+	x(0 == ffdns_writer_rr(&w, FFDNS_SEC_ANSWER, FFSTR_Z("many.example.com"), FFDNS_A, FFDNS_IN, 60, ip));
+	for (i = 0;  i != 100;  i++) {
+		if (0 != ffdns_writer_rr(&w, FFDNS_SEC_ADDITIONAL, FFSTR_Z("many.example.com"), FFDNS_A, FFDNS_IN, 60, ip))
+			break;
+	}
+	xieq(28, i);
+	n = ffdns_writer_fin(&w, &h);
+	ffstr_set(&s, buf, n);
+	x(0 == ffdns_reader_init(&d, s, &h2));
+	x(!h2.truncation);
+	xieq(1, h2.answers);
+	xieq(28, h2.additionals);
+
+	// EDNS: OPT record is the last one and it always fits
+	ffdns_writer_init(&w, buf, sizeof(buf));
+	x(0 == ffdns_writer_edns(&w, 1232));
+	x(0 == ffdns_writer_question(&w, FFSTR_Z("many.example.com"), FFDNS_A, FFDNS_IN));
+	for (i = 0;  i != 100;  i++) {
+		if (0 != ffdns_writer_rr(&w, FFDNS_SEC_ANSWER, FFSTR_Z("many.example.com"), FFDNS_A, FFDNS_IN, 60, ip))
+			break;
+	}
+	xieq(29, i);
+	n = ffdns_writer_fin(&w, &h);
+	x(n <= sizeof(buf));
+	ffstr_set(&s, buf, n);
+	x(0 == ffdns_reader_init(&d, s, &h2));
+	x(h2.truncation);
+	xieq(1, h2.additionals);
+	while (1 == ffdns_reader_next(&d, &rr, NULL)) {
+	}
+	xieq(FFDNS_SEC_ADDITIONAL, rr.section);
+	xieq(FFDNS_OPT, rr.type);
+	xieq(1232, rr.clas);
+	x(d.off == n);
+}
+
 void test_dns()
 {
 	test_dns_name_read();
 	test_dns_name_write();
 	test_dns_rw();
+	test_dns_reader();
+	test_dns_writer();
+	test_dns_isdomain();
+	test_dns_domain_normalize();
+}
+
+static void bench_dns_print(const char *name, fftime t, ffuint n)
+{
+	ffuint64 us = (ffuint64)fftime_sec(&t) * 1000000 + fftime_usec(&t);
+	fflog("%s: %u msg/sec", name, (ffuint)((us != 0) ? (ffuint64)n * 1000000 / us : 0));
+}
+
+/** Decode throughput: ffdns_answer_read() vs ffdns_reader */
+void bench_dns_reader()
+{
+	const ffuint N = 1000000;
+	ffstr msg = FFSTR_INITN(dns_resp, sizeof(dns_resp) - 1);
+	fftime t1, t2;
+	ffuint i, k, naddrs = 0;
+
+	fftime_now(&t1);
+	for (i = 0;  i != N;  i++) {
+		ffdns_header h;
+		ffdns_question q = {};
+		ffdns_answer a = {};
+		int r, off = ffdns_header_read(&h, msg);
+		off += ffdns_question_read(&q, msg);
+		for (k = 0;  k != h.answers;  k++) {
+			ffdns_answer_destroy(&a);
+			r = ffdns_answer_read(&a, msg, off);
+			off += r;
+			naddrs += (a.type == FFDNS_A);
+		}
+		ffdns_question_destroy(&q);
+		ffdns_answer_destroy(&a);
+	}
+	fftime_now(&t2);
+	fftime_diff(&t1, &t2);
+	bench_dns_print("ffdns_answer_read", t2, N);
+
+	fftime_now(&t1);
+	for (i = 0;  i != N;  i++) {
+		ffdns_reader d;
+		ffdns_rr rr;
+		char name[FFDNS_MAXNAME];
+		ffdns_reader_init(&d, msg, NULL);
+		while (1 == ffdns_reader_next(&d, &rr, name)) {
+			naddrs += (rr.type == FFDNS_A && rr.section == FFDNS_SEC_ANSWER);
+		}
+	}
+	fftime_now(&t2);
+	fftime_diff(&t1, &t2);
+	bench_dns_print("ffdns_reader", t2, N);
+
+	xieq(N * 2 * 2, naddrs);
+}
+
+/** Encode throughput: response with 1 question, CNAME and 2 A records */
+void bench_dns_writer()
+{
+	const ffuint N = 1000000;
+	ffdns_header h = {};
+	ffstr ip = FFSTR_INITN("\x01\x02\x03\x04", 4);
+	char buf[FFDNS_MAXMSG];
+	fftime t1, t2;
+	ffuint i, n = 0;
+
+	h.response = 1;
+	fftime_now(&t1);
+	for (i = 0;  i != N;  i++) {
+		ffdns_writer w;
+		ffdns_writer_init(&w, buf, sizeof(buf));
+		ffdns_writer_edns(&w, 1232);
+		ffdns_writer_question(&w, FFSTR_Z("www.example.com"), FFDNS_A, FFDNS_IN);
+		ffdns_writer_rr_name(&w, FFDNS_SEC_ANSWER, FFSTR_Z("www.example.com"), FFDNS_CNAME, FFDNS_IN, 60, FFSTR_Z("web.example.com"));
+		ffdns_writer_rr(&w, FFDNS_SEC_ANSWER, FFSTR_Z("web.example.com"), FFDNS_A, FFDNS_IN, 256, ip);
+		ffdns_writer_rr(&w, FFDNS_SEC_ANSWER, FFSTR_Z("web.example.com"), FFDNS_A, FFDNS_IN, 256, ip);
+		h.id = i;
+		n += ffdns_writer_fin(&w, &h);
+	}
+	fftime_now(&t2);
+	fftime_diff(&t1, &t2);
+	bench_dns_print("ffdns_writer", t2, N);
+
+	xieq(N * (sizeof(dns_resp) - 1 + FFDNS_OPTLEN), n);
+}
+
+/** Validate, lowercase and hash domain names:
+ ffdns_isdomain() + byte loop vs ffdns_domain_normalize() */
+void bench_dns_isdomain()
+{
+	const ffuint N = 200000;
+	const ffuint n = FF_COUNT(dns_isdomain_names);
+	char buf[253];
+	fftime t1, t2;
+	ffuint i, k, hash, valid = 0;
+
+	fftime_now(&t1);
+	for (i = 0;  i != N;  i++) {
+		for (k = 0;  k != n;  k++) {
+			ffstr s = FFSTR_INITZ(dns_isdomain_names[k]);
+			if (ffdns_isdomain(s.ptr, s.len) < 0)
+				continue;
+			hash = 0x811c9dc5;
+			for (ffsize j = 0;  j != s.len;  j++) {
+				buf[j] = ffchar_lower(s.ptr[j]);
+				hash = (hash ^ (ffbyte)buf[j]) * 0x01000193;
+			}
+			valid += (hash != 0);
+		}
+	}
+	fftime_now(&t2);
+	fftime_diff(&t1, &t2);
+	bench_dns_print("ffdns_isdomain", t2, N * n);
+
+	fftime_now(&t1);
+	for (i = 0;  i != N;  i++) {
+		for (k = 0;  k != n;  k++) {
+			ffstr s = FFSTR_INITZ(dns_isdomain_names[k]);
+			valid += (ffdns_domain_normalize(buf, s.ptr, s.len, &hash) >= 0);
+		}
+	}
+	fftime_now(&t2);
+	fftime_diff(&t1, &t2);
+	bench_dns_print("ffdns_domain_normalize", t2, N * n);
+
+	x(valid != 0);
 }
@@ -1,6 +1,7 @@
 /** http1.h tester */
 
 #include <ffsys/test.h>
+#include <ffsys/time.h>
 #include <ffbase/vector.h>
 #include "http1.h"
 
@@ -73,6 +74,41 @@ void test_http1_chunked()
 	ffstr_setz(&in, "123\rx");
 	x(httpchunked_parse(&c, in, &out) < -1);
 
+	// control bytes aren't digits (both the fast path and the generic parser)
+	ffmem_zero_obj(&c);
+	ffstr_setz(&in, "1\x12\r\n0123456789abcdef0123456789");
+	xieq(-3, httpchunked_parse(&c, in, &out));
+	ffmem_zero_obj(&c);
+	ffstr_setz(&in, "1\x12\r\n");
+	xieq(-3, httpchunked_parse(&c, in, &out));
+
+	// vectored: all chunks at once (size lines are parsed via the fast path)
+	ffmem_zero_obj(&c);
+	ffstr sp[4];
+	ffuint n;
+	ffstr_setz(&in, "0000000A\r\n0123456789\r\n1a\nabcdefghijklmnopqrstuvwxyz\n0000000000000002\r\nhi\r\n0\r\n\r\n");
+	x(-1 == httpchunked_parse_v(&c, in, sp, 4, &n));
+	xieq(3, n);
+	xseq(&sp[0], "0123456789");
+	xseq(&sp[1], "abcdefghijklmnopqrstuvwxyz");
+	xseq(&sp[2], "hi");
+
+	ffmem_zero_obj(&c);
+	ffstr_setz(&in, "3\r\nabc\r\n3\r\ndef\r\n3\r\nghi\r\n0\r\n\r\n");
+	xieq(14, httpchunked_parse_v(&c, in, sp, 2, &n));
+	xieq(2, n);
+	xseq(&sp[1], "def");
+	ffstr_shift(&in, 14);
+	x(-1 == httpchunked_parse_v(&c, in, sp, 2, &n));
+	xieq(1, n);
+	xseq(&sp[0], "ghi");
+
+	// the data after the last chunk is left intact
+	ffmem_zero_obj(&c);
+	ffstr_setz(&in, "3\r\nabc\r\n0\r\n\r\nHTTP/1.1");
+	x(-1 == httpchunked_parse_v(&c, in, sp, 2, &n));
+	xieq(13, c.done_len);
+
 	ffstr h, t;
 	char buf[99];
 	httpchunked_write(buf, 0xa, &h, &t);
@@ -296,6 +332,132 @@ void test_http1_hdr()
 	xieq(-1, http_hdr_parse(s, &k, &v));
 }
 
+void test_http1_hdrs()
+{
+	struct http_hdr_ent t[2];
+	ffuint n;
+	ffstr v;
+	ffstr s = FFSTR_INITZ("Key: Value\r\nKey-Key  :  My Value  \r\nLong-Header-Name-0123456789: long value 0123456789abcdef\n\r\nBODY");
+	xieq(s.len - 4, http_hdrs_parse(s, t, 2, &n));
+	xieq(3, n);
+	xieq(0, http_hdrs_find(s, t, 2, FFSTR("key"), &v));
+	xseq(&v, "Value");
+	xieq(1, http_hdrs_find(s, t, 2, FFSTR("KEY-KEY"), &v));
+	xseq(&v, "My Value");
+	xieq(-1, http_hdrs_find(s, t, 2, FFSTR("Long-Header-Name-0123456789"), &v)); // didn't fit into the table
+
+	ffstr_setz(&s, "\r\n");
+	xieq(2, http_hdrs_parse(s, t, 2, &n));
+	xieq(0, n);
+
+	// the result is the same as with http_hdr_parse() for every prefix
+	ffstr all = FFSTR_INITZ("Content-Type: text/html; charset=utf-8\r\nX-Long-Header-Name-0123456789:   v\r\nA:b\n\r\n");
+	for (ffsize i = 0;  i < all.len;  i++) {
+		ffstr_set(&s, all.ptr, i);
+		xieq(0, http_hdrs_parse(s, t, 2, &n));
+	}
+
+	ffstr_setz(&s, "Key: Value\r\n-Key-Key: My Value \r\n\r\n");
+	x(0 > http_hdrs_parse(s, t, 2, &n));
+	ffstr_setz(&s, "Key: Value\r\nKey Value\r\n\r\n");
+	x(0 > http_hdrs_parse(s, t, 2, &n));
+	ffstr_setz(&s, "Key: Value\r\r\n");
+	x(0 > http_hdrs_parse(s, t, 2, &n));
+}
+
+void test_http1_hdr_known()
+{
+	char buf[32];
+	for (ffuint i = 1;  i != _HTTP_H_END;  i++) {
+		ffsize n = ffsz_len(http_hdr_name[i]);
+		xieq(i, http_hdr_known(http_hdr_name[i], n));
+		for (ffsize k = 0;  k != n;  k++) {
+			buf[k] = ffchar_lower(http_hdr_name[i][k]);
+		}
+		xieq(i, http_hdr_known(buf, n));
+	}
+	xieq(HTTP_H_UNKNOWN, http_hdr_known(FFSTR("X-Content-Type")));
+	xieq(HTTP_H_UNKNOWN, http_hdr_known(FFSTR("Content-Typ")));
+	xieq(HTTP_H_UNKNOWN, http_hdr_known(FFSTR("")));
+}
+
+static const char bench_hdrs[] =
+	"Date: Mon, 19 Oct 2026 10:00:00 GMT\r\n"
+	"Server: nginx/1.25.3\r\n"
+	"Content-Type: text/html; charset=utf-8\r\n"
+	"Content-Length: 162345\r\n"
+	"Connection: keep-alive\r\n"
+	"Vary: Accept-Encoding\r\n"
+	"Cache-Control: private, max-age=0, must-revalidate\r\n"
+	"Set-Cookie: session=0123456789abcdef0123456789abcdef; Path=/; HttpOnly; Secure\r\n"
+	"Strict-Transport-Security: max-age=31536000; includeSubDomains\r\n"
+	"X-Content-Type-Options: nosniff\r\n"
+	"X-Frame-Options: SAMEORIGIN\r\n"
+	"Last-Modified: Sun, 18 Oct 2026 09:00:00 GMT\r\n"
+	"ETag: \"5f3a-1b2c3d4e5f\"\r\n"
+	"Accept-Ranges: bytes\r\n"
+	"\r\n";
+
+static void bench_http1_hdrs_print(const char *name, fftime t, ffsize total)
+{
+	ffuint64 ms = fftime_sec(&t) * 1000 + fftime_msec(&t);
+	fflog("%s: %u MB/s", name, (ffuint)((ms != 0) ? total / 1000 / ms : 0));
+}
+
+/** Header block throughput: parse + 3 lookups */
+void bench_http1_hdrs()
+{
+	const ffuint N = 1000000;
+	ffstr blk = FFSTR_INITN(bench_hdrs, sizeof(bench_hdrs) - 1), nm, v;
+	struct http_hdr_ent t[32];
+	const char *names[] = { "Content-Length", "Connection", "Content-Type" };
+	fftime t1, t2;
+	ffuint i, k, n, found = 0;
+
+	fftime_now(&t1);
+	for (i = 0;  i != N;  i++) {
+		// one header per call, re-parse the block for each lookup
+		ffstr d = blk;
+		for (;;) {
+			int r = http_hdr_parse(d, &nm, &v);
+			x(r > 0);
+			ffstr_shift(&d, r);
+			if (r <= 2)
+				break;
+		}
+		for (k = 0;  k != FF_COUNT(names);  k++) {
+			d = blk;
+			for (;;) {
+				int r = http_hdr_parse(d, &nm, &v);
+				ffstr_shift(&d, r);
+				if (r <= 2)
+					break;
+				if (ffstr_ieqz(&nm, names[k])) {
+					found++;
+					break;
+				}
+			}
+		}
+	}
+	fftime_now(&t2);
+	fftime_diff(&t1, &t2);
+	bench_http1_hdrs_print("http_hdr_parse", t2, N * blk.len);
+
+	fftime_now(&t1);
+	for (i = 0;  i != N;  i++) {
+		x((int)blk.len == http_hdrs_parse(blk, t, FF_COUNT(t), &n));
+		for (k = 0;  k != FF_COUNT(names);  k++) {
+			if (0 <= http_hdrs_find(blk, t, n, names[k], ffsz_len(names[k]), &v))
+				found++;
+		}
+	}
+	fftime_now(&t2);
+	fftime_diff(&t1, &t2);
+	bench_http1_hdrs_print("http_hdrs_parse", t2, N * blk.len);
+
+	xieq(N * 3 * 2, found);
+}
+
 static void test_range()
 {
 #if 0
@@ -325,6 +487,8 @@ void test_http1()
 {
 	test_http1_req();
 	test_http1_hdr();
+	test_http1_hdrs();
+	test_http1_hdr_known();
 
 	{
 	ffstr t, m;
@@ -21,6 +21,8 @@ void test_dns_isdomain()
 	xieq(-1, ffdns_isdomain(FFSTR("a.cc#")));
 	xieq(-1, ffdns_isdomain(FFSTR("abc.xn--")));
 	xieq(-1, ffdns_isdomain(FFSTR("abc.xn--asd")));
+	xieq(-1, ffdns_isdomain(FFSTR("abc.XN--asd")));
+	xieq(-1, ffdns_isdomain(FFSTR("abc.xN--asd")));
 
 	xieq(-1, ffdns_isdomain(FFSTR(".a.cc")));
 	xieq(-1, ffdns_isdomain(FFSTR("a.cc.")));
@@ -30,3 +32,50 @@ void test_dns_isdomain()
 
 	xieq(-1, ffdns_isdomain(FFSTR("1234567890123456789012345678901234567890123456789012345678901234.cc")));
 }
+
+static const char *const dns_isdomain_names[] = {
+	"cc1", "com", "a.c", "1.cc", "a.c-c", "a.1cc", "a.cc1", "1.2.cc", "a.b.cc",
+	"abc.abc.abc", "a-bc.ab--c.abc", "abc.xn--p1ai", "xn--p1ai.xn--p1ai", "xn--asd.xn--p1ai",
+	"abc.XN--P1AI", "Xn--asd.xN--p1ai",
+	"123456789012345678901234567890123456789012345678901234567890123.cc",
+	"WWW.Example.COM", "www.xn--80ak6aa92e.com", "cdn-1.static.images.example-domain.co.uk",
+	"#cc", "a.cc#", "abc.xn--", "abc.xn--asd", "abc.XN--asd", "abc.Xn--asd", "xn--ab", "XN--ab",
+	".a.cc", "a.cc.", "-a.cc", "a-.cc", "a..cc",
+	"1234567890123456789012345678901234567890123456789012345678901234.cc",
+	"www.ex\xc3\xa4mple.com", "www.example.com/", "a.b.c.d.e.f.g.h.i.j.k.l.m.n.o.p.q.r.s.t.u.v.w.x.y.z",
+};
+
+void test_dns_domain_normalize()
+{
+	char buf[253], lower[253];
+	ffuint hash, hash2;
+
+	for (ffuint i = 0;  i != FF_COUNT(dns_isdomain_names);  i++) {
+		ffstr s = FFSTR_INITZ(dns_isdomain_names[i]);
+		int r = ffdns_isdomain(s.ptr, s.len);
+		xieq(r, ffdns_domain_normalize(buf, s.ptr, s.len, &hash));
+		if (r < 0)
+			continue;
+
+		for (ffsize k = 0;  k != s.len;  k++) {
+			lower[k] = ffchar_lower(s.ptr[k]);
+		}
+		x(!ffmem_cmp(buf, lower, s.len));
+		xieq(r, ffdns_domain_normalize(buf, lower, s.len, &hash2));
+		xieq(hash, hash2);
+	}
+
+	xieq(2, ffdns_domain_normalize(buf, FFSTR("a.cc"), NULL));
+	xieq(-1, ffdns_domain_normalize(buf, "", 0, NULL));
+
+	// max. length: 4 labels by 63 characters
+	char name[254];
+	ffmem_fill(name, 'A', sizeof(name));
+	name[63] = name[127] = name[191] = '.';
+	xieq(4, ffdns_domain_normalize(buf, name, 253, &hash));
+	x(buf[0] == 'a' && buf[252] == 'a');
+	xieq(-1, ffdns_domain_normalize(buf, name, 254, NULL));
+	name[200] = '-';
+	name[191] = '_';
+	xieq(-1, ffdns_domain_normalize(buf, name, 253, NULL));
+}
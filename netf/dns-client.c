@@ -4,25 +4,72 @@ Copyright 2019 Simon Zolin
 
 #include "dns-client.h"
 #include "dns.h"
-#include "crc.h"
 #include "ipaddr.h"
 #include "time.h"
 #include <FFOS/random.h>
+#ifdef FF_LINUX
+#include <sys/socket.h>
+#endif
+
+
+#define DNS_BATCH_MAX  64 //max. datagrams per sendmmsg()/recvmmsg()
+#define DNS_SOCKS_MAX  64 //max. sockets per server (bits in dns_query.sockmask)
+#define DNS_BIND_TRIES  8 //attempts to bind to a random source port
+#define DNS_TCP_MAXMSG  (2 + 0xffff) //TCP: length prefix + max. message size
+#define DNS_RTO_MIN  50 //min. retry timeout (msec) computed from RTT
+#define DNS_LOSS_UNHEALTHY  500 //servers with loss rate higher than this (per-mille) aren't chosen
+#define DNS_PROBE_EVERY  16 //every Nth server choice is round-robin to probe the servers with bad stats
+#define DNS_HIST_N  24 //RTT histogram: bucket #i covers [2^i..2^(i+1)) usec
+#define DNS_HIST_MIN_SAMPLES  16 //min. samples in the histogram to compute percentile
+#define DNS_PREFETCH_WINDOW  10 //cache: refresh an entry when 1/N of its TTL is left
+
+
+/** UDP socket connected to a DNS server */
+struct dns_sock {
+	struct ffdnscl_serv *serv;
+	ffskt sk;
+	ffaio_task aiotask;
+	uint i; //index in ffdnscl_serv.socks[]
+	uint tcp :1;
+};
 
+enum DNS_TCP {
+	DNS_TCP_NONE,
+	DNS_TCP_CONNECTING,
+	DNS_TCP_CONNECTED,
+};
 
 struct ffdnscl_serv {
 	fflist_item sib;
 	ffdnsclient *r;
 
-	ffskt sk;
-	ffaio_task aiotask;
+	struct dns_sock *socks; //[serv_sockets]
+	uint qsock; //index of the socket for the queued datagrams
 	ffaddr addr;
 	char saddr_s[FF_MAXIP4];
 	ffstr saddr;
-	char *ansbuf;
+	char *ansbuf; //[recv_batch][buf_size]
+	ffvec sendbuf; //queued datagrams
+	ffvec sendlen; //ushort[]: length of each datagram in 'sendbuf'
 	unsigned connected :1;
 
 	uint nqueries;
+
+	// health
+	uint srtt; //smoothed RTT (usec).  0: no samples
+	uint rttvar; //RTT variation (usec)
+	uint loss; //smoothed loss rate (per-mille)
+	uint inflight; //queries waiting for response from this server
+	ushort rtt_hist[DNS_HIST_N]; //RTT samples;  halved when the total reaches 512
+	uint rtt_hist_total;
+	uint64 st_queries, st_answers, st_timeouts, st_hedged, st_truncated;
+
+	// persistent TCP connection for the queries with truncated responses
+	struct dns_sock tcp;
+	uint tcp_state; //enum DNS_TCP
+	ffvec tcp_wbuf; //length-prefixed queries to send
+	size_t tcp_woff; //bytes sent from 'tcp_wbuf'
+	ffvec tcp_rbuf; //received data: length-prefixed responses
 };
 
 typedef struct dns_quser {
@@ -30,12 +77,35 @@ typedef struct dns_quser {
 	void *udata;
 } dns_quser;
 
+struct dns_query;
+
+/** Entry in the index of queries by transaction ID */
+struct dns_txlink {
+	struct dns_txlink *next; //next entry in the same slot
+	struct dns_query *q;
+	ushort txid;
+};
+
+/** Query is sent to a server and waits for response */
+struct dns_attempt {
+	ffdnscl_serv *serv; //NULL: unused
+	uint64 sendtime; //usec
+};
+
 typedef struct dns_query {
 	ffdnsclient *r;
-	ffrbt_node rbtnod;
+	struct dns_query *next; //next query in the same slot of ffdnsclient.queries
+	uint hash;
+	struct dns_txlink tx[2]; //[0]:A, [1]:AAAA
 	fftimerqueue_node tmr;
 	uint tries_left;
 	ffstr name; //hostname to be resolved
+	struct dns_attempt att[2]; //[0]: the current try;  [1]: hedged query to another server
+	uint rto_rest; //msec left until the current try times out after the hedging timer
+	unsigned hedge_pending :1; //the timer is set for sending a hedged query
+	unsigned tcp :1; //the query was sent over TCP
+	unsigned prefetch :1; //the query refreshes a cached entry before it expires
+	uint64 sockmask; //sockets (by index) the query was sent from
 
 	ffdnscl_res *res[2];
 	uint ttl[2];
@@ -48,6 +118,7 @@ typedef struct dns_query {
 	unsigned need4 :1
 		, need6 :1;
 	byte nres; //number of elements in res[2]
+	ushort ques_sec_len; //length of question section (the same for A and AAAA)
 	ushort ques_len4;
 	ushort ques_len6;
 	char question[0];
@@ -62,6 +133,26 @@ struct ffdnscl_res {
 	};
 };
 
+/** Cached response for (name, type) */
+typedef struct dns_centry {
+	fflist_item lru_sib;
+	struct dns_centry *next; //next entry in the same slot
+	uint hash;
+	uint type; //FFDNS_A or FFDNS_AAAA
+	int status; //FFDNS_NOERROR or FFDNS_NXDOMAIN
+	uint expire; //time (in sec) when the entry becomes stale
+	uint ttl; //TTL (in sec) the entry was added with
+	uint hits; //requests answered from this entry
+	unsigned prefetch :1; //refresh query has been started for this entry
+	uint size; //memory used by this entry
+	ffstr name; //lower-case hostname.  Points to the data after addrs
+	uint naddrs;
+	union {
+		ffip4 addrs4[0];
+		ffip6 addrs6[0];
+	};
+} dns_centry;
+
 
 #define syserrlog_x(r, ...) \
 	(r)->log(FFDNSCL_LOG_ERR | FFDNSCL_LOG_SYS, NULL, __VA_ARGS__)
@@ -88,30 +179,100 @@ do { \
 } while (0)
 
 
+#define ROTL64(x, n)  (((x) << (n)) | ((x) >> (64 - (n))))
+#define SIPROUND(v0, v1, v2, v3) \
+do { \
+	v0 += v1;  v1 = ROTL64(v1, 13);  v1 ^= v0;  v0 = ROTL64(v0, 32); \
+	v2 += v3;  v3 = ROTL64(v3, 16);  v3 ^= v2; \
+	v0 += v3;  v3 = ROTL64(v3, 21);  v3 ^= v0; \
+	v2 += v1;  v1 = ROTL64(v1, 17);  v1 ^= v2;  v2 = ROTL64(v2, 32); \
+} while (0)
+
+/** SipHash-1-3 of the lower-case name.
+The key is random for each client object so that the remote side can't choose names which fall into one slot. */
+static uint64 name_hash(const uint64 key[2], const ffstr *name)
+{
+	uint64 v0 = key[0] ^ 0x736f6d6570736575ULL
+		, v1 = key[1] ^ 0x646f72616e646f6dULL
+		, v2 = key[0] ^ 0x6c7967656e657261ULL
+		, v3 = key[1] ^ 0x7465646279746573ULL
+		, m = 0;
+	size_t i;
+
+	for (i = 0;  i != name->len;  i++) {
+		m |= (uint64)(byte)ffchar_lower(name->ptr[i]) << ((i & 7) * 8);
+		if ((i & 7) == 7) {
+			v3 ^= m;
+			SIPROUND(v0, v1, v2, v3);
+			v0 ^= m;
+			m = 0;
+		}
+	}
+
+	m |= (uint64)(name->len & 0xff) << 56;
+	v3 ^= m;
+	SIPROUND(v0, v1, v2, v3);
+	v0 ^= m;
+
+	v2 ^= 0xff;
+	SIPROUND(v0, v1, v2, v3);
+	SIPROUND(v0, v1, v2, v3);
+	SIPROUND(v0, v1, v2, v3);
+	return v0 ^ v1 ^ v2 ^ v3;
+}
+
+
 // SERVER
 static int serv_init(ffdnscl_serv *serv);
-static ffdnscl_serv * serv_next(ffdnsclient *r);
+static void serv_close(ffdnscl_serv *serv);
+static struct dns_sock * serv_sock(ffdnscl_serv *serv);
+static ffdnscl_serv * serv_next(ffdnsclient *r, const ffdnscl_serv *exclude);
+static int serv_send(ffdnscl_serv *serv, const char *d, size_t n);
+static void serv_rtt(ffdnscl_serv *serv, uint64 rtt);
+static void serv_lost(ffdnscl_serv *serv);
+static uint serv_rto(const ffdnscl_serv *serv);
+static uint serv_rtt_percentile(const ffdnscl_serv *serv, uint pct);
+static void serv_flush(ffdnscl_serv *serv);
 static void serv_fin(ffdnscl_serv *serv);
 
+// TCP
+static int tcp_query(ffdnscl_serv *serv, dns_query *q, int is4);
+static void tcp_onconnect(void *udata);
+static void tcp_write(void *udata);
+static void tcp_read(void *udata);
+static void tcp_close(ffdnscl_serv *serv);
+
 // QUERY
-#define query_sib(pnod)  FF_GETPTR(dns_query, rbtnod, pnod)
+static dns_query* query_find(ffdnsclient *r, const ffstr *name, uint hash);
+static int query_link(dns_query *q);
+static void query_unlink(dns_query *q);
+static int query_start(ffdnsclient *r, const ffstr *host, uint hash, ffdnscl_onresolve ondone, void *udata);
 static int query_addusr(dns_query *q, ffdnscl_onresolve ondone, void *udata);
 static int query_rmuser(ffdnsclient *r, const ffstr *host, ffdnscl_onresolve ondone, void *udata);
 static size_t query_prep(ffdnsclient *r, char *buf, size_t cap, uint txid, const ffstr *nm, int type);
 static void query_send(dns_query *q, int resend);
 static int query_send1(dns_query *q, ffdnscl_serv *serv, int resend);
 static void query_onexpire(void *param);
+static void query_hedge(dns_query *q);
+static void query_att_close(dns_query *q, int lost);
 static void query_fin(dns_query *q, int status, ffdnscl_serv *serv);
 static void query_free(void *param);
 
 // ANSWER
 static void ans_read(void *udata);
-static void ans_proc(ffdnscl_serv *serv, const ffstr *resp);
-static dns_query * ans_find_query(ffdnscl_serv *serv, ffdns_header *h, const ffstr *resp);
-static uint ans_nrecs(dns_query *q, ffdns_header *h, const ffstr *resp, const char *pbuf, int is4);
+static void ans_proc(struct dns_sock *sk, const ffstr *resp);
+static dns_query * ans_find_query(struct dns_sock *sk, ffdns_header *h, const ffstr *resp);
+static uint ans_nrecs(dns_query *q, ffdns_header *h, const ffstr *resp, int is4);
 static ffdnscl_res* ans_proc_resp(dns_query *q, ffdns_header *h, const ffstr *resp, int is4);
+static uint ans_negttl(dns_query *q, const ffdns_header *h, const ffstr *resp);
 static void res_free(ffdnscl_res *dr);
 
+// CACHE
+static int cache_resolve(ffdnsclient *r, const ffstr *name, ffdnscl_onresolve ondone, void *udata);
+static int cache_result(ffdnsclient *r, const ffstr *name, uint stale, ffdnscl_result *res);
+static void cache_add(dns_query *q, uint type, int status, const ffdnscl_res *res, uint ttl);
+static void cache_free(ffdnsclient *r);
+
 // DUMMY CALLBACKS
 static int oncomplete_dummy(ffdnsclient *r, ffdnscl_res *res, const ffstr *name, uint refcount, uint ttl)
 {
@@ -136,6 +297,10 @@ void ffdnscl_conf_init(ffdnscl_conf *c)
 	c->edns = 1;
 	c->max_tries = 1;
 	c->buf_size = 4*1024;
+	c->recv_batch = 16;
+	c->serv_sockets = 1;
+	c->hedge_percentile = 0;
+	c->cache_ttl_max = 24*60*60;
 
 	c->log = &log_dummy;
 	c->time = &time_dummy;
@@ -151,35 +316,55 @@ ffdnsclient* ffdnscl_new(ffdnscl_conf *conf)
 
 	fflist_init(&r->servs);
 	r->curserv = NULL;
-	ffrbt_init(&r->queries);
+	r->queries = NULL;
+	r->txids = NULL;
+	r->query_slots = r->queries_n = 0;
+	fflist_init(&r->cache_lru);
+	r->cache = NULL;
+	r->cache_slots = r->cache_n = 0;
+	r->cache_used = 0;
+	r->cache_hits = r->cache_misses = 0;
+	r->cache_prefetches = r->cache_stale = 0;
+	r->sent = r->send_calls = r->received = r->recv_calls = 0;
+	r->serv_choices = 0;
+	r->hedge_percentile = ffmin(r->hedge_percentile, 100);
+	r->serv_sockets = ffmax(r->serv_sockets, 1);
+	r->serv_sockets = ffmin(r->serv_sockets, DNS_SOCKS_MAX);
+
+#ifdef FF_LINUX
+	r->recv_batch = ffmax(r->recv_batch, 1);
+	r->recv_batch = ffmin(r->recv_batch, DNS_BATCH_MAX);
+#else
+	r->recv_batch = 1;
+	r->batch = 0;
+#endif
+	if (r->time == &time_dummy)
+		r->cache_size = 0;
+
+	fftime t;
+	fftime_now(&t);
+	r->hash_key[0] = ((uint64)ffrnd_get() << 32) ^ ffrnd_get() ^ (size_t)r;
+	r->hash_key[1] = ((uint64)ffrnd_get() << 32) ^ ffrnd_get() ^ ((uint64)fftime_sec(&t) << 20) ^ fftime_usec(&t);
 	return r;
 }
 
 int ffdnscl_resolve(ffdnsclient *r, ffstr name, ffdnscl_onresolve ondone, void *udata, uint flags)
 {
-	uint namecrc;
-	char buf4[FFDNS_MAXMSG], buf6[FFDNS_MAXMSG];
-	size_t ibuf4, ibuf6 = 0;
-	ffrbt_node *found_query;
-	dns_query *q = NULL;
+	uint hash;
+	dns_query *q;
 	ffstr host = name;
-	ushort txid4, txid6 = 0;
 
 	if (flags & FFDNSCL_CANCEL)
 		return query_rmuser(r, &host, ondone, udata);
 
-	namecrc = ffcrc32_iget(name.ptr, name.len);
-
-	// determine whether the needed query is already pending and if so, attach to it
-	found_query = ffrbt_find(&r->queries, namecrc);
-	if (found_query != NULL) {
-		q = query_sib(found_query);
+	if (r->cache_size != 0
+		&& 0 == cache_resolve(r, &host, ondone, udata))
+		return 0;
 
-		if (!ffstr_eq2(&q->name, &host)) {
-			errlog_x(r, "%S: CRC collision with %S", &host, &q->name);
-			goto fail;
-		}
+	hash = (uint)name_hash(r->hash_key, &host);
 
+	// determine whether the needed query is already pending and if so, attach to it
+	if (NULL != (q = query_find(r, &host, hash))) {
 		dbglog_q(q, LOG_DBGFLOW, "query hit", 0);
 		if (0 != query_addusr(q, ondone, udata))
 			goto nomem;
@@ -187,17 +372,46 @@ int ffdnscl_resolve(ffdnsclient *r, ffstr name, ffdnscl_onresolve ondone, void *
 		return 0;
 	}
 
+	if (r->cache_size != 0)
+		r->cache_misses++;
+	return query_start(r, &host, hash, ondone, udata);
+
+nomem:
+	syserrlog_x(r, "ffmem_alloc", 0);
+	ffdnscl_result res = {};
+	res.name = host;
+	res.status = -1;
+	ondone(udata, &res);
+	return 0;
+}
+
+/** Create a new query and send it.
+ondone: NULL: the query has no users initially (prefetch)
+Return 0 */
+static int query_start(ffdnsclient *r, const ffstr *host, uint hash, ffdnscl_onresolve ondone, void *udata)
+{
+	int rc;
+	char buf4[FFDNS_MAXMSG], buf6[FFDNS_MAXMSG];
+	size_t ibuf4, ibuf6 = 0;
+	ffstr msg;
+	dns_query *q = NULL;
+	ushort txid4, txid6 = 0;
+
 	// prepare DNS queries: A and AAAA
 	txid4 = ffrnd_get() & 0xffff;
-	ibuf4 = query_prep(r, buf4, FF_COUNT(buf4), txid4, &host, FFDNS_A);
-	if (ibuf4 == 0) {
-		errlog_x(r, "invalid hostname: %S", &host);
+	ibuf4 = query_prep(r, buf4, FF_COUNT(buf4), txid4, host, FFDNS_A);
+	ffstr_set(&msg, buf4, ibuf4);
+	if (ibuf4 == 0
+		|| 0 > (rc = ffdns_name_read(NULL, msg, sizeof(struct ffdns_hdr)))) {
+		errlog_x(r, "invalid hostname: %S", host);
 		goto fail;
 	}
 
 	if (r->enable_ipv6) {
-		txid6 = ffrnd_get() & 0xffff;
-		ibuf6 = query_prep(r, buf6, FF_COUNT(buf6), txid6, &host, FFDNS_AAAA);
+		do {
+			txid6 = ffrnd_get() & 0xffff;
+		} while (txid6 == txid4);
+		ibuf6 = query_prep(r, buf6, FF_COUNT(buf6), txid6, host, FFDNS_AAAA);
 	}
 
 	// initialize DNS query object
@@ -207,12 +421,16 @@ int ffdnscl_resolve(ffdnsclient *r, ffstr name, ffdnscl_onresolve ondone, void *
 	ffmem_zero(q, sizeof(dns_query));
 	q->r = r;
 
-	if (0 != query_addusr(q, ondone, udata))
+	if (ondone == NULL)
+		q->prefetch = 1;
+	else if (0 != query_addusr(q, ondone, udata))
 		goto nomem;
 
-	if (NULL == ffstr_dupstr(&q->name, &name))
+	if (NULL == ffstr_dupstr(&q->name, host))
 		goto nomem;
 
+	q->hash = hash;
+	q->ques_sec_len = rc + sizeof(struct ffdns_ques);
 	q->need4 = 1;
 	ffmemcpy(q->question, buf4, ibuf4);
 	q->ques_len4 = (ushort)ibuf4;
@@ -225,8 +443,8 @@ int ffdnscl_resolve(ffdnsclient *r, ffstr name, ffdnscl_onresolve ondone, void *
 		q->txid6 = txid6;
 	}
 
-	q->rbtnod.key = namecrc;
-	ffrbt_insert(&r->queries, &q->rbtnod, NULL);
+	if (0 != query_link(q))
+		goto nomem;
 	q->tries_left = r->max_tries;
 	q->firstsend = r->time();
 
@@ -240,23 +458,13 @@ fail:
 	if (q != NULL)
 		query_free(q);
 
-	ffdnscl_result res = {};
-	res.name = host;
-	res.status = -1;
-	ondone(udata, &res);
-	return 0;
-}
-
-static void ffrbt_freeall(ffrbtree *tr, void(*func)(void*), size_t off)
-{
-	ffrbt_node *n, *next;
-	FFRBT_FOR(tr, n) {
-		next = ffrbt_node_successor(n, &tr->sentl);
-		ffrbt_rm(tr, n);
-		void *p = FF_PTR(n, -(ssize_t)off);
-		func(p);
-		n = next;
+	if (ondone != NULL) {
+		ffdnscl_result res = {};
+		res.name = *host;
+		res.status = -1;
+		ondone(udata, &res);
 	}
+	return 0;
 }
 
 void ffdnscl_free(ffdnsclient *r)
@@ -264,8 +472,17 @@ void ffdnscl_free(ffdnsclient *r)
 	if (r == NULL)
 		return;
 
-	ffrbt_freeall(&r->queries, &query_free, FFOFF(dns_query, rbtnod));
+	for (uint i = 0;  i != r->query_slots;  i++) {
+		dns_query *q, *next;
+		for (q = r->queries[i];  q != NULL;  q = next) {
+			next = q->next;
+			query_free(q);
+		}
+	}
+	ffmem_free(r->queries);
+	ffmem_free(r->txids);
 	FFLIST_ENUMSAFE(&r->servs, serv_fin, ffdnscl_serv, sib);
+	cache_free(r);
 	ffmem_free(r);
 }
 
@@ -283,8 +500,14 @@ static void query_onexpire(void *param)
 {
 	dns_query *q = param;
 
+	if (q->hedge_pending) {
+		query_hedge(q);
+		return;
+	}
+
 	if (q->tries_left == 0) {
 		errlog_q(q, "reached max_tries limit", 0);
+		query_att_close(q, 1);
 		query_fin(q, -1, NULL);
 		return;
 	}
@@ -308,25 +531,15 @@ static int query_addusr(dns_query *q, ffdnscl_onresolve ondone, void *udata)
 /** User doesn't want to wait for this query anymore. */
 static int query_rmuser(ffdnsclient *r, const ffstr *host, ffdnscl_onresolve ondone, void *udata)
 {
-	ffrbt_node *found;
 	dns_query *q;
 	dns_quser *quser;
-	uint namecrc;
 
-	namecrc = ffcrc32_iget(host->ptr, host->len);
-	found = ffrbt_find(&r->queries, namecrc);
-	if (found == NULL) {
+	q = query_find(r, host, (uint)name_hash(r->hash_key, host));
+	if (q == NULL) {
 		errlog_x(r, "cancel: no query for %S", host);
 		return 1;
 	}
 
-	q = query_sib(found);
-
-	if (!ffstr_eq2(&q->name, host)) {
-		errlog_x(r, "%S: CRC collision with %S", host, &q->name);
-		return 1;
-	}
-
 	FFSLICE_WALK(&q->users, quser) {
 
 		if (udata == quser->udata && ondone == quser->ondone) {
@@ -340,9 +553,155 @@ static int query_rmuser(ffdnsclient *r, const ffstr *host, ffdnscl_onresolve ond
 	return 1;
 }
 
+/** Find active query by hostname (case-insensitive) */
+static dns_query* query_find(ffdnsclient *r, const ffstr *name, uint hash)
+{
+	dns_query *q;
+
+	if (r->queries_n == 0)
+		return NULL;
+
+	for (q = r->queries[hash & (r->query_slots - 1)];  q != NULL;  q = q->next) {
+		if (q->hash == hash && ffstr_ieq2(&q->name, name))
+			return q;
+	}
+	return NULL;
+}
+
+static void txid_link(ffdnsclient *r, struct dns_txlink *l)
+{
+	struct dns_txlink **slot = &r->txids[l->txid & (r->query_slots*2 - 1)];
+	l->next = *slot;
+	*slot = l;
+}
+
+/** Double the number of slots in both indexes */
+static int query_grow(ffdnsclient *r)
+{
+	uint n = (r->query_slots != 0) ? r->query_slots * 2 : 64;
+	dns_query **slots, *q, *next;
+	struct dns_txlink **txids;
+
+	if (NULL == (slots = ffmem_calloc(n, sizeof(dns_query*))))
+		return -1;
+	if (NULL == (txids = ffmem_calloc(n * 2, sizeof(struct dns_txlink*)))) {
+		ffmem_free(slots);
+		return -1;
+	}
+
+	ffmem_free(r->txids);
+	r->txids = txids;
+
+	for (uint i = 0;  i != r->query_slots;  i++) {
+		for (q = r->queries[i];  q != NULL;  q = next) {
+			next = q->next;
+			q->next = slots[q->hash & (n - 1)];
+			slots[q->hash & (n - 1)] = q;
+		}
+	}
+	ffmem_free(r->queries);
+	r->queries = slots;
+	r->query_slots = n;
+
+	for (uint i = 0;  i != n;  i++) {
+		for (q = slots[i];  q != NULL;  q = q->next) {
+			for (uint k = 0;  k != 2;  k++) {
+				if (q->tx[k].q != NULL)
+					txid_link(r, &q->tx[k]);
+			}
+		}
+	}
+	return 0;
+}
+
+/** Add query to the index by name and to the index by transaction ID */
+static int query_link(dns_query *q)
+{
+	ffdnsclient *r = q->r;
+
+	if (r->queries_n == r->query_slots
+		&& 0 != query_grow(r))
+		return -1;
+
+	q->next = r->queries[q->hash & (r->query_slots - 1)];
+	r->queries[q->hash & (r->query_slots - 1)] = q;
+	r->queries_n++;
+
+	q->tx[0].q = q;
+	q->tx[0].txid = q->txid4;
+	txid_link(r, &q->tx[0]);
+	if (q->need6) {
+		q->tx[1].q = q;
+		q->tx[1].txid = q->txid6;
+		txid_link(r, &q->tx[1]);
+	}
+	return 0;
+}
+
+static void query_unlink(dns_query *q)
+{
+	ffdnsclient *r = q->r;
+
+	dns_query **pq = &r->queries[q->hash & (r->query_slots - 1)];
+	while (*pq != q) {
+		pq = &(*pq)->next;
+	}
+	*pq = q->next;
+	r->queries_n--;
+
+	for (uint k = 0;  k != 2;  k++) {
+		if (q->tx[k].q == NULL)
+			continue;
+		struct dns_txlink **pl = &r->txids[q->tx[k].txid & (r->query_slots*2 - 1)];
+		while (*pl != &q->tx[k]) {
+			pl = &(*pl)->next;
+		}
+		*pl = q->tx[k].next;
+		q->tx[k].q = NULL;
+	}
+}
+
+static uint64 time_usec(ffdnsclient *r)
+{
+	fftime t = r->time();
+	return (uint64)fftime_sec(&t) * 1000000 + fftime_usec(&t);
+}
+
+/** Start waiting for response from the server */
+static void query_att_start(dns_query *q, uint i, ffdnscl_serv *serv)
+{
+	q->att[i].serv = serv;
+	q->att[i].sendtime = time_usec(q->r);
+	serv->inflight++;
+	serv->st_queries++;
+}
+
+/** Stop waiting for responses.
+lost: the servers didn't respond in time */
+static void query_att_close(dns_query *q, int lost)
+{
+	for (uint i = 0;  i != FF_COUNT(q->att);  i++) {
+		ffdnscl_serv *serv = q->att[i].serv;
+		if (serv == NULL)
+			continue;
+		serv->inflight--;
+		if (lost)
+			serv_lost(serv);
+		q->att[i].serv = NULL;
+	}
+}
+
+/** Send query to the best server and set timer:
+ either for the retry timeout computed from the server's RTT,
+ or for the hedging deadline (RTT percentile) if it's earlier. */
 static void query_send(dns_query *q, int resend)
 {
+	ffdnsclient *r = q->r;
 	ffdnscl_serv *serv;
+	uint rto, hd;
+
+	query_att_close(q, resend);
+	q->hedge_pending = 0;
 
 	for (;;) {
 
@@ -353,74 +712,91 @@ static void query_send(dns_query *q, int resend)
 		}
 
 		q->tries_left--;
-		serv = serv_next(q->r);
+		serv = serv_next(r, NULL);
 		if (0 == query_send1(q, serv, resend))
-			return;
+			break;
+		serv_lost(serv);
+	}
+
+	query_att_start(q, 0, serv);
+
+	q->tmr.func = query_onexpire;
+	q->tmr.param = q;
+	rto = serv_rto(serv);
+	if (r->hedge_percentile != 0
+		&& r->servs.len > 1
+		&& 0 != (hd = serv_rtt_percentile(serv, r->hedge_percentile))
+		&& hd < rto) {
+		q->hedge_pending = 1;
+		q->rto_rest = rto - hd;
+		rto = hd;
+	}
+	r->timer(&q->tmr, rto);
+}
+
+/** The hedging deadline is reached: send the same query to another server.
+The response from either server is accepted. */
+static void query_hedge(dns_query *q)
+{
+	ffdnsclient *r = q->r;
+	ffdnscl_serv *serv;
+
+	q->hedge_pending = 0;
+	if (NULL != (serv = serv_next(r, q->att[0].serv))
+		&& 0 == query_send1(q, serv, 1)) {
+		query_att_start(q, 1, serv);
+		serv->st_hedged++;
+		dbglog_q(q, LOG_DBGNET, "%S: hedged query after %ums", &serv->saddr
+			, (int)((time_usec(r) - q->att[0].sendtime) / 1000));
 	}
+
+	r->timer(&q->tmr, q->rto_rest);
 }
 
 /** Send query to server. */
 static int query_send1(dns_query *q, ffdnscl_serv *serv, int resend)
 {
-	ssize_t rc;
 	const char *er;
 	ffdnsclient *r = q->r;
 
 	if (!serv->connected) {
 		if (0 != serv_init(serv))
 			return 1;
-
-		if (0 != ffskt_connect(serv->sk, &serv->addr.a, serv->addr.len)) {
-			er = "ffskt_connect";
-			goto fail;
-		}
-		serv->connected = 1;
-		ans_read(serv);
 	}
 
+	q->sockmask |= (uint64)1 << serv_sock(serv)->i;
+
 	if (q->need6) {
-		rc = ffskt_send(serv->sk, q->question + q->ques_len4, q->ques_len6, 0);
-		if (rc != q->ques_len6) {
+		if (0 != serv_send(serv, q->question + q->ques_len4, q->ques_len6)) {
 			er = "ffskt_send";
 			goto fail_send;
 		}
 
 		serv->nqueries++;
 
-		dbglog_q(q, LOG_DBGNET, "%S: %ssent %s query #%u (%u).  [%L]"
+		dbglog_q(q, LOG_DBGNET, "%S: %s%s %s query #%u (%u).  [%L]"
 			, &serv->saddr
-			, (resend ? "re" : ""), "AAAA", (int)q->txid6, serv->nqueries, (size_t)r->queries.len);
+			, (resend ? "re" : ""), (r->batch ? "queued" : "sent"), "AAAA", (int)q->txid6, serv->nqueries, (size_t)r->queries_n);
 	}
 
 	if (q->need4) {
-		rc = ffskt_send(serv->sk, q->question, q->ques_len4, 0);
-		if (rc != q->ques_len4) {
+		if (0 != serv_send(serv, q->question, q->ques_len4)) {
 			er = "ffskt_send";
 			goto fail_send;
 		}
 
 		serv->nqueries++;
 
-		dbglog_q(q, LOG_DBGNET, "%S: %ssent %s query #%u (%u).  [%L]"
+		dbglog_q(q, LOG_DBGNET, "%S: %s%s %s query #%u (%u).  [%L]"
 			, &serv->saddr
-			, (resend ? "re" : ""), "A", (int)q->txid4, serv->nqueries, (size_t)r->queries.len);
+			, (resend ? "re" : ""), (r->batch ? "queued" : "sent"), "A", (int)q->txid4, serv->nqueries, (size_t)r->queries_n);
 	}
 
-	q->tmr.func = query_onexpire;
-	q->tmr.param = q;
-	r->timer(&q->tmr, r->retry_timeout);
 	return 0;
 
-fail:
-	syserrlog_srv(serv, "%s", er);
-	return 1;
-
 fail_send:
 	syserrlog_srv(serv, "%s", er);
-	ffskt_close(serv->sk);
-	serv->sk = FF_BADSKT;
-	ffaio_fin(&serv->aiotask);
-	serv->connected = 0;
+	serv_close(serv);
 	return 1;
 }
 
@@ -455,41 +831,121 @@ static size_t query_prep(ffdnsclient *r, char *buf, size_t cap, uint txid, const
 }
 
 
-/** Receive data from DNS server. */
+#ifdef FF_LINUX
+/** Receive several datagrams into 'ansbuf' with one syscall and process them.
+Return the number of datagrams;  0: no data;  -1: error */
+static int ans_recv_batch(struct dns_sock *sk)
+{
+	ffdnscl_serv *serv = sk->serv;
+	ffdnsclient *r = serv->r;
+	struct mmsghdr msgs[DNS_BATCH_MAX];
+	struct iovec iov[DNS_BATCH_MAX];
+	ffstr resp;
+	int i, n;
+
+	for (i = 0;  i != (int)r->recv_batch;  i++) {
+		iov[i].iov_base = serv->ansbuf + i * r->buf_size;
+		iov[i].iov_len = r->buf_size;
+		ffmem_zero_obj(&msgs[i]);
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	n = recvmmsg(sk->sk, msgs, r->recv_batch, MSG_DONTWAIT, NULL);
+	r->recv_calls++;
+	if (n < 0) {
+		if (fferr_again(fferr_last()))
+			return 0;
+		syserrlog_srv(serv, "recvmmsg", 0);
+		return -1;
+	}
+	r->received += n;
+
+	dbglog_srv(serv, LOG_DBGNET, "received %u responses", n);
+
+	for (i = 0;  i != n;  i++) {
+		ffstr_set(&resp, iov[i].iov_base, msgs[i].msg_len);
+		ans_proc(sk, &resp);
+	}
+	return n;
+}
+#endif
+
+/** Receive data from DNS server.
+All sockets of the pool use this handler and share the server's receive buffer.
+With 'recv_batch' > 1 the socket is drained by recvmmsg();
+ ffaio_recv() is called only when the socket is likely empty to wait for the next signal. */
 static void ans_read(void *udata)
 {
-	ffdnscl_serv *serv = udata;
+	struct dns_sock *sk = udata;
+	ffdnscl_serv *serv = sk->serv;
 	ssize_t r;
 	ffstr resp;
 
 	for (;;) {
-		r = ffaio_recv(&serv->aiotask, &ans_read, serv->ansbuf, serv->r->buf_size);
+#ifdef FF_LINUX
+		if (serv->r->recv_batch > 1) {
+			r = ans_recv_batch(sk);
+			if (r < 0)
+				return;
+			else if (r == (ssize_t)serv->r->recv_batch)
+				continue; // there may be more data
+		}
+#endif
+
+		r = ffaio_recv(&sk->aiotask, &ans_read, serv->ansbuf, serv->r->buf_size);
+		serv->r->recv_calls++;
 		if (r == FFAIO_ASYNC)
 			return;
 		else if (r == FFAIO_ERROR) {
 			syserrlog_srv(serv, "ffaio_recv", 0);
 			return;
 		}
+		serv->r->received++;
 
 		dbglog_srv(serv, LOG_DBGNET, "received response (%L bytes)", r);
 
 		ffstr_set(&resp, serv->ansbuf, r);
-		ans_proc(serv, &resp);
+		ans_proc(sk, &resp);
 	}
 }
 
-/** Process response and notify users waiting for it. */
-static void ans_proc(ffdnscl_serv *serv, const ffstr *resp)
+/** Process response (UDP or TCP) and notify users waiting for it.
+A truncated UDP response makes the query be sent again over TCP. */
+static void ans_proc(struct dns_sock *sk, const ffstr *resp)
 {
 	ffdns_header h;
 	dns_query *q;
 	int is4;
+	ffdnscl_res *res;
+	ffdnscl_serv *serv = sk->serv;
 	ffdnsclient *r = serv->r;
 
-	q = ans_find_query(serv, &h, resp);
+	q = ans_find_query(sk, &h, resp);
 	if (q == NULL)
 		return;
 
+	if (h.truncation && !sk->tcp
+		&& ((q->need4 && h.id == q->txid4) || (q->need6 && h.id == q->txid6))) {
+		serv->st_truncated++;
+		if (0 == tcp_query(serv, q, (q->need4 && h.id == q->txid4))) {
+			dbglog_q(q, LOG_DBGNET, "#%u: truncated response: sent query over TCP", h.id);
+			q->hedge_pending = 0;
+			r->timer(&q->tmr, r->retry_timeout);
+			return;
+		}
+		// use the truncated response
+	}
+
+	serv->st_answers++;
+	serv->loss -= serv->loss / 8;
+	for (uint i = 0;  i != FF_COUNT(q->att) && !sk->tcp;  i++) {
+		if (q->att[i].serv == serv) {
+			serv_rtt(serv, time_usec(r) - q->att[i].sendtime);
+			break;
+		}
+	}
+
 	if (q->need4 && h.id == q->txid4) {
 		q->need4 = 0;
 		is4 = 1;
@@ -509,10 +965,20 @@ static void ans_proc(ffdnscl_serv *serv, const ffstr *resp)
 		if (q->nres == 0)
 			q->status = h.rcode; //set error only from the first response
 
-	} else if (NULL != ans_proc_resp(q, &h, resp, is4))
+		if (h.rcode == FFDNS_NXDOMAIN && r->cache_size != 0)
+			cache_add(q, (is4) ? FFDNS_A : FFDNS_AAAA, FFDNS_NXDOMAIN, NULL, ans_negttl(q, &h, resp));
+
+	} else if (NULL != (res = ans_proc_resp(q, &h, resp, is4))) {
 		q->status = FFDNS_NOERROR;
-	else if (q->nres == 0)
-		q->status = -1;
+		cache_add(q, (is4) ? FFDNS_A : FFDNS_AAAA, FFDNS_NOERROR, res, q->ttl[q->nres - 1]);
+
+	} else {
+		if (q->nres == 0)
+			q->status = -1;
+
+		if (r->cache_size != 0)
+			cache_add(q, (is4) ? FFDNS_A : FFDNS_AAAA, FFDNS_NOERROR, NULL, ans_negttl(q, &h, resp));
+	}
 
 	if (log_checkdbglevel(q, LOG_DBGNET)) {
 		fftime t = r->time();
@@ -534,16 +1000,27 @@ static void ans_proc(ffdnscl_serv *serv, const ffstr *resp)
 	query_fin(q, q->status, serv);
 }
 
-/** Find query by a response from DNS server. */
-static dns_query * ans_find_query(ffdnscl_serv *serv, ffdns_header *h, const ffstr *resp)
+/** Find query by a response from DNS server.
+The query is found by transaction ID,
+ then the question section is compared with the one we've sent,
+ and the response must arrive on a socket the query was sent from. */
+/** Return 1 if the query waits for a response from the server */
+static int query_sent_to(const dns_query *q, const ffdnscl_serv *serv)
 {
-	dns_query *q;
+	for (uint i = 0;  i != FF_COUNT(q->att);  i++) {
+		if (q->att[i].serv == serv)
+			return 1;
+	}
+	return 0;
+}
+
+static dns_query * ans_find_query(struct dns_sock *sk, ffdns_header *h, const ffstr *resp)
+{
+	ffdnscl_serv *serv = sk->serv;
+	ffdnsclient *r = serv->r;
 	const char *errmsg = NULL;
-	uint namecrc;
-	ffstr name;
-	ffrbt_node *found_query;
+	const struct dns_txlink *l;
 	uint resp_id = 0;
-	ffdns_question qh = {};
 
 	if (0 > ffdns_header_read(h, *resp)) {
 		errmsg = "too small response";
@@ -561,77 +1038,62 @@ static dns_query * ans_find_query(ffdnscl_serv *serv, ffdns_header *h, const ffs
 		goto fail;
 	}
 
-	if (0 > ffdns_question_read(&qh, *resp)) {
-		errmsg = "too small response";
-		goto fail;
-	}
-	if (qh.name.len == 0) {
-		errmsg = "invalid name in question";
-		goto fail;
-	}
-	ffstr_set2(&name, &qh.name);
-	name.len--;
-
-	serv->r->log(FFDNSCL_LOG_DBG /*LOG_DBGNET*/
-		, "%S: DNS response #%u.  Status: %u.  AA: %u, RA: %u.  Q: %u, A: %u, N: %u, R: %u."
-		, &name
-		, h->id, h->rcode, h->authoritive, h->recursion_available
-		, h->questions, h->answers, h->nss, h->additionals);
-
-	if (qh.clas != FFDNS_IN) {
-		serv->r->log(FFDNSCL_LOG_ERR
-			, "%S: #%u: invalid class %u in DNS response"
-			, &name, h->id, qh.clas);
-		goto fail;
-	}
-
-	namecrc = ffcrc32_get(name.ptr, name.len);
-
-	found_query = ffrbt_find(&serv->r->queries, namecrc);
-	if (found_query == NULL) {
+	if (r->queries_n == 0) {
 		errmsg = "unexpected DNS response";
 		goto fail;
 	}
 
-	q = query_sib(found_query);
-	if (!ffstr_eq2(&q->name, &name)) {
-		errmsg = "unexpected DNS response";
-		goto fail;
+	for (l = r->txids[h->id & (r->query_slots*2 - 1)];  l != NULL;  l = l->next) {
+		const dns_query *q = l->q;
+		const char *ques = (l == &q->tx[0]) ? q->question : q->question + q->ques_len4;
+
+		if (l->txid == h->id
+			&& ((sk->tcp) ? q->tcp : (q->sockmask & ((uint64)1 << sk->i)))
+			&& query_sent_to(q, serv) // 'sockmask' is shared by all servers
+			&& sizeof(struct ffdns_hdr) + q->ques_sec_len <= resp->len
+			&& !ffs_icmp(resp->ptr + sizeof(struct ffdns_hdr), ques + sizeof(struct ffdns_hdr), q->ques_sec_len)) {
+
+			dbglog_q(q, LOG_DBGNET
+				, "DNS response #%u.  Status: %u.  AA: %u, RA: %u.  Q: %u, A: %u, N: %u, R: %u."
+				, h->id, h->rcode, h->authoritive, h->recursion_available
+				, h->questions, h->answers, h->nss, h->additionals);
+			return l->q;
+		}
 	}
 
-	return q;
+	errmsg = "unexpected DNS response";
 
 fail:
-	if (errmsg != NULL)
-		errlog_srv(serv, "%s. ID: #%u. Name: %S", errmsg, resp_id, &name);
-
-	ffdns_question_destroy(&qh);
+	errlog_srv(serv, "%s. ID: #%u", errmsg, resp_id);
 	return NULL;
 }
 
 /** Get the number of useful records.  Print debug info about the records in response. */
-static uint ans_nrecs(dns_query *q, ffdns_header *h, const ffstr *resp, const char *pbuf, int is4)
+static uint ans_nrecs(dns_query *q, ffdns_header *h, const ffstr *resp, int is4)
 {
 	uint nrecs = 0;
-	uint ir;
-	ffdns_answer ans = {};
-	ffstr name;
+	ffdns_reader rd;
+	ffdns_rr ans;
+	ffstr name = {};
+	char namebuf[FFDNS_MAXNAME], *pname = NULL;
 	int rr;
 
-	for (ir = 0;  ir < h->answers;  ir++) {
-		ffdns_answer_destroy(&ans);
-		if (0 > (rr = ffdns_answer_read(&ans, *resp, pbuf - resp->ptr))) {
+	if (log_checkdbglevel(q, LOG_DBGFLOW))
+		pname = namebuf; // names are needed only for logging
+
+	ffdns_reader_init(&rd, *resp, NULL);
+	for (;;) {
+		if (0 > (rr = ffdns_reader_next(&rd, &ans, pname))) {
 			dbglog_q(q, LOG_DBGNET, "#%u: incomplete response", h->id);
 			break;
 		}
-		pbuf += rr;
-
-		ffstr_set2(&name, &ans.name);
-		if (name.len == 0) {
-			warnlog_q(q, "#%u: invalid name in answer", h->id);
+		if (rr == 0 || ans.section > FFDNS_SEC_ANSWER)
 			break;
-		}
-		name.len--;
+		if (ans.section != FFDNS_SEC_ANSWER)
+			continue;
+
+		if (pname != NULL)
+			ffstr_set(&name, ans.name.ptr, ans.name.len - 1);
 
 		switch (ans.type) {
 
@@ -645,7 +1107,7 @@ static uint ans_nrecs(dns_query *q, ffdns_header *h, const ffstr *resp, const ch
 				continue;
 			}
 
-			if (log_checkdbglevel(q, LOG_DBGFLOW)) {
+			if (pname != NULL) {
 				char ip[FFIP4_STRLEN];
 				size_t iplen = ffip4_tostr((void*)ans.data.ptr, ip, FF_COUNT(ip));
 				dbglog_q(q, LOG_DBGFLOW, "%s for %S : %*s, TTL:%u"
@@ -666,7 +1128,7 @@ static uint ans_nrecs(dns_query *q, ffdns_header *h, const ffstr *resp, const ch
 				continue;
 			}
 
-			if (log_checkdbglevel(q, LOG_DBGFLOW)) {
+			if (pname != NULL) {
 				char ip[FFIP6_STRLEN];
 				size_t iplen = ffip6_tostr((void*)ans.data.ptr, ip, FF_COUNT(ip));
 				dbglog_q(q, LOG_DBGFLOW, "%s for %S : %*s, TTL:%u"
@@ -678,20 +1140,14 @@ static uint ans_nrecs(dns_query *q, ffdns_header *h, const ffstr *resp, const ch
 			break;
 
 		case FFDNS_CNAME:
-			if (log_checkdbglevel(q, LOG_DBGFLOW)) {
-				/*ffstr scname;
-				char cname[NI_MAXHOST];
-				const char *tbuf = pbuf;
-
-				scname.len = ffdns_name(cname, sizeof(cname), resp->ptr, resp->len, &tbuf);
-				if (scname.len == 0 || tbuf > pbuf + ans.data.len) {
+			if (pname != NULL) {
+				char cname[FFDNS_MAXNAME];
+				uint n;
+				if (0 > ffdns_reader_name(&rd, ans.data_off, cname, &n)) {
 					errlog_q(q, "invalid CNAME", 0);
 					continue;
 				}
-				scname.ptr = cname;
-				scname.len--;
-
-				dbglog_q(q, LOG_DBGFLOW, "CNAME for %S : %S", &name, &scname);*/
+				dbglog_q(q, LOG_DBGFLOW, "CNAME for %S : %*s", &name, (size_t)n - 1, cname);
 			}
 			break;
 
@@ -701,29 +1157,20 @@ static uint ans_nrecs(dns_query *q, ffdns_header *h, const ffstr *resp, const ch
 		}
 	}
 
-	ffdns_answer_destroy(&ans);
 	return nrecs;
 }
 
 /** Create DNS resource object. */
 static ffdnscl_res* ans_proc_resp(dns_query *q, ffdns_header *h, const ffstr *resp, int is4)
 {
-	const char *pbuf;
 	ffdnscl_res *res = NULL;
 	ffip4 *acur;
 	ffip6 *a6cur;
 	uint minttl = (uint)-1;
-	int r;
-
-	ffdns_question qh = {};
-	if (0 > (r = ffdns_question_read(&qh, *resp))) {
-		dbglog_q(q, LOG_DBGFLOW, "#%u: invalid message", h->id);
-		return NULL;
-	}
-	ffdns_question_destroy(&qh);
-	pbuf = resp->ptr + sizeof(struct ffdns_hdr) + r;
+	ffdns_reader rd;
+	ffdns_rr ans;
 
-	uint nrecs = ans_nrecs(q, h, resp, pbuf, is4);
+	uint nrecs = ans_nrecs(q, h, resp, is4);
 
 	if (nrecs == 0) {
 		dbglog_q(q, LOG_DBGFLOW, "#%u: no useful records in response", h->id);
@@ -744,14 +1191,11 @@ static ffdnscl_res* ans_proc_resp(dns_query *q, ffdns_header *h, const ffstr *re
 	}
 
 	// set addresses and get the minimum TTL value
-	uint ir;
-	for (ir = 0;  ir < h->answers;  ir++) {
-		ffdns_answer ans = {};
-		if (0 > (r = ffdns_answer_read(&ans, *resp, pbuf - resp->ptr)))
-			break;
-		ffdns_answer_destroy(&ans);
-		pbuf += r;
-		if (ans.clas != FFDNS_IN)
+	ffdns_reader_init(&rd, *resp, NULL);
+	while (1 == ffdns_reader_next(&rd, &ans, NULL)
+		&& ans.section <= FFDNS_SEC_ANSWER) {
+		if (ans.section != FFDNS_SEC_ANSWER
+			|| ans.clas != FFDNS_IN)
 			continue;
 
 		switch (ans.type) {
@@ -777,21 +1221,57 @@ static ffdnscl_res* ans_proc_resp(dns_query *q, ffdns_header *h, const ffstr *re
 		}
 	}
 
-	ir = q->nres++;
+	uint ir = q->nres++;
 	q->res[ir] = res;
 	q->ttl[ir] = minttl;
 	return res;
 }
 
-/** Notify users, waiting for this question.  Free query object. */
+/** Get TTL for a negative response (NXDOMAIN or no data)
+ from SOA record in the authority section (RFC 2308 section 5):
+ min(TTL, SOA.MINIMUM).
+Return 0 if there's no SOA record: the response must not be cached. */
+static uint ans_negttl(dns_query *q, const ffdns_header *h, const ffstr *resp)
+{
+	ffdns_reader rd;
+	ffdns_rr ans;
+	uint ttl = 0;
+
+	ffdns_reader_init(&rd, *resp, NULL);
+	while (1 == ffdns_reader_next(&rd, &ans, NULL)
+		&& ans.section <= FFDNS_SEC_AUTHORITY) {
+
+		// MNAME RNAME SERIAL REFRESH RETRY EXPIRE MINIMUM
+		if (ans.section == FFDNS_SEC_AUTHORITY && ans.type == FFDNS_SOA && ans.data.len >= 2 + 5*4) {
+			uint minimum = ffint_be_cpu32_ptr(ans.data.ptr + ans.data.len - 4);
+			ttl = ffmin(ans.ttl, minimum);
+			break;
+		}
+	}
+
+	return ttl;
+}
+
+/** Notify users, waiting for this question.  Free query object.
+If the servers have failed, the users get an expired cached response (serve-stale, RFC 8767). */
 static void query_fin(dns_query *q, int status, ffdnscl_serv *serv)
 {
 	dns_quser *quser;
 	uint i, i4 = 0, total = 0;
 
-	ffrbt_rm(&q->r->queries, &q->rbtnod);
+	query_unlink(q);
+	query_att_close(q, 0);
 
 	ffdnscl_result res = {};
+	if ((status < 0 || status == FFDNS_SERVFAIL)
+		&& q->r->cache_stale_max != 0
+		&& q->users.len != 0
+		&& 0 == cache_result(q->r, &q->name, 1, &res)) {
+		q->r->cache_stale++;
+		warnlog_q(q, "servers failed: using stale cached response", 0);
+		goto done;
+	}
+
 	res.name = q->name;
 	res.status = status;
 	for (i = 0;  i != q->nres;  i++) {
@@ -837,32 +1317,284 @@ done:
 		res_free(q->res[i]);
 	}
 
-	dbglog_q(q, LOG_DBGFLOW, "query done [%L]"
-		, q->r->queries.len);
+	dbglog_q(q, LOG_DBGFLOW, "query done%s [%u]"
+		, (q->prefetch) ? " (prefetch)" : "", q->r->queries_n);
 	query_free(q);
 }
 
 
-/** Split "IP[:PORT]" address string.
-e.g.: "127.0.0.1", "127.0.0.1:80", "[::1]:80", ":80".
-@ip: output address.  Brackets aren't included for IPv6 address.
-@port: output port.
-Return 0 on success. */
-static inline int ffip_split(const char *data, size_t len, ffstr *ip, ffstr *port)
+static uint cache_hash(ffdnsclient *r, const ffstr *name, uint type)
 {
-	const char *pos = ffs_rsplit2by(data, len, ':', ip, port);
+	return (uint)name_hash(r->hash_key, name) ^ type;
+}
 
-	if (ip->len != 0 && ip->ptr[0] == '[') {
-		if (data[len - 1] == ']') {
-			ip->len = len;
-			ffstr_null(port);
-			pos = NULL;
-		}
-		if (!(ip->len >= FFSLEN("[::]") && ip->ptr[ip->len - 1] == ']'))
-			return -1;
-		ip->ptr += FFSLEN("[");
-		ip->len -= FFSLEN("[]");
-	}
+static uint cache_now(ffdnsclient *r)
+{
+	fftime t = r->time();
+	return (uint)fftime_sec(&t);
+}
+
+static void cache_rm(ffdnsclient *r, dns_centry *e)
+{
+	dns_centry **pe = &r->cache[e->hash & (r->cache_slots - 1)];
+	while (*pe != e) {
+		pe = &(*pe)->next;
+	}
+	*pe = e->next;
+
+	fflist_rm(&r->cache_lru, &e->lru_sib);
+	r->cache_n--;
+	r->cache_used -= e->size;
+	ffmem_free(e);
+}
+
+/** Find an entry and mark it as recently used.
+stale: also return an expired entry
+An entry expired for more than 'cache_stale_max' seconds is removed. */
+static dns_centry* cache_find(ffdnsclient *r, const ffstr *name, uint type, uint now, uint stale)
+{
+	dns_centry *e;
+	uint hash;
+
+	if (r->cache_n == 0)
+		return NULL;
+
+	hash = cache_hash(r, name, type);
+	for (e = r->cache[hash & (r->cache_slots - 1)];  e != NULL;  e = e->next) {
+		if (e->hash == hash && e->type == type && ffstr_ieq2(&e->name, name))
+			break;
+	}
+	if (e == NULL)
+		return NULL;
+
+	if (now >= e->expire) {
+		if (now - e->expire >= r->cache_stale_max) {
+			cache_rm(r, e);
+			return NULL;
+		}
+		if (!stale)
+			return NULL;
+	}
+
+	fflist_rm(&r->cache_lru, &e->lru_sib);
+	fflist_add(&r->cache_lru, &e->lru_sib);
+	return e;
+}
+
+/** Double the number of slots */
+static int cache_grow(ffdnsclient *r)
+{
+	uint n = (r->cache_slots != 0) ? r->cache_slots * 2 : 64;
+	dns_centry **slots, *e, *next;
+
+	if (NULL == (slots = ffmem_calloc(n, sizeof(dns_centry*))))
+		return -1;
+
+	for (uint i = 0;  i != r->cache_slots;  i++) {
+		for (e = r->cache[i];  e != NULL;  e = next) {
+			next = e->next;
+			e->next = slots[e->hash & (n - 1)];
+			slots[e->hash & (n - 1)] = e;
+		}
+	}
+
+	ffmem_free(r->cache);
+	r->cache = slots;
+	r->cache_slots = n;
+	return 0;
+}
+
+/** Store the response for (q->name, type).
+res: addresses;  NULL: negative response
+ttl: TTL of the answer records or the negative TTL */
+static void cache_add(dns_query *q, uint type, int status, const ffdnscl_res *res, uint ttl)
+{
+	ffdnsclient *r = q->r;
+	dns_centry *e;
+	uint now, naddrs = (res != NULL) ? res->naddrs : 0;
+	size_t asize = (type == FFDNS_A) ? sizeof(ffip4) : sizeof(ffip6);
+	size_t size = sizeof(dns_centry) + naddrs * asize + q->name.len;
+
+	if (r->cache_size == 0)
+		return;
+	if (res == NULL && ttl == 0)
+		return; // negative response without SOA record (RFC 2308, 5)
+
+	ttl = ffmax(ttl, r->cache_ttl_min);
+	ttl = ffmin(ttl, r->cache_ttl_max);
+	if (ttl == 0 || size > r->cache_size)
+		return;
+
+	now = cache_now(r);
+	if (NULL != (e = cache_find(r, &q->name, type, now, 1)))
+		cache_rm(r, e);
+
+	while (r->cache_used + size > r->cache_size) {
+		e = FF_GETPTR(dns_centry, lru_sib, fflist_first(&r->cache_lru));
+		dbglog_q(q, LOG_DBGFLOW, "cache: evicting %S", &e->name);
+		cache_rm(r, e);
+	}
+
+	if (r->cache_n == r->cache_slots
+		&& 0 != cache_grow(r))
+		return;
+
+	if (NULL == (e = ffmem_alloc(size)))
+		return;
+	e->hash = cache_hash(r, &q->name, type);
+	e->type = type;
+	e->status = status;
+	e->expire = now + ttl;
+	e->ttl = ttl;
+	e->hits = 0;
+	e->prefetch = 0;
+	e->size = size;
+	e->naddrs = naddrs;
+	if (naddrs != 0)
+		ffmemcpy(e->addrs4, res->addrs4, naddrs * asize);
+
+	char *name = (char*)e->addrs4 + naddrs * asize;
+	for (size_t i = 0;  i != q->name.len;  i++) {
+		name[i] = ffchar_lower(q->name.ptr[i]);
+	}
+	ffstr_set(&e->name, name, q->name.len);
+
+	e->next = r->cache[e->hash & (r->cache_slots - 1)];
+	r->cache[e->hash & (r->cache_slots - 1)] = e;
+	fflist_add(&r->cache_lru, &e->lru_sib);
+	r->cache_n++;
+	r->cache_used += size;
+
+	dbglog_q(q, LOG_DBGFLOW, "cache: added %s %s, %u addresses, TTL:%u [%u]"
+		, (type == FFDNS_A) ? "A" : "AAAA", ffdns_rcode_str(status), naddrs, ttl, r->cache_n);
+}
+
+/** Refresh a popular entry in background before it expires (refresh-ahead).
+The query is started once for the entry when it has at least 'cache_prefetch_hits' hits
+ and 1/DNS_PREFETCH_WINDOW of its TTL is left.
+The requests for this name after the entry has expired wait for this query. */
+static void cache_prefetch(ffdnsclient *r, const ffstr *name, dns_centry *e4, dns_centry *e6, uint now)
+{
+	e4->hits++;
+	if (e4->prefetch || e4->hits < r->cache_prefetch_hits)
+		return;
+
+	if (now + ffmax(e4->ttl / DNS_PREFETCH_WINDOW, 1) < e4->expire
+		&& (e6 == NULL || now + ffmax(e6->ttl / DNS_PREFETCH_WINDOW, 1) < e6->expire))
+		return;
+
+	e4->prefetch = 1;
+	uint hash = (uint)name_hash(r->hash_key, name);
+	if (NULL != query_find(r, name, hash))
+		return;
+
+	r->cache_prefetches++;
+	if (r->debug_log)
+		r->log(FFDNSCL_LOG_DBG, "%S: cache: prefetch: %u hits, expires in %us"
+			, name, e4->hits, e4->expire - now);
+	query_start(r, name, hash, NULL, NULL);
+}
+
+/** Get response from cache.
+A hit requires entries for all needed record types, or an NXDOMAIN entry.
+stale: use expired entries
+Return 0 on success: the caller must free res->ip */
+static int cache_result(ffdnsclient *r, const ffstr *name, uint stale, ffdnscl_result *res)
+{
+	dns_centry *e4, *e6 = NULL;
+	uint now = cache_now(r), i;
+
+	if (NULL == (e4 = cache_find(r, name, FFDNS_A, now, stale)))
+		return 1;
+
+	if (e4->status == FFDNS_NOERROR && r->enable_ipv6) {
+		if (NULL == (e6 = cache_find(r, name, FFDNS_AAAA, now, stale)))
+			return 1;
+		if (e6->status != FFDNS_NOERROR)
+			e6 = NULL;
+	}
+
+	res->name = *name;
+	res->status = e4->status;
+	if (NULL == ffslice_allocT(&res->ip, e4->naddrs + ((e6 != NULL) ? e6->naddrs : 0), ffip6))
+		return 1;
+
+	ffip6 *ip = res->ip.ptr;
+	for (i = 0;  i != e4->naddrs;  i++) {
+		ffip6_v4mapped_set(&ip[res->ip.len++], &e4->addrs4[i]);
+	}
+	for (i = 0;  e6 != NULL && i != e6->naddrs;  i++) {
+		ip[res->ip.len++] = e6->addrs6[i];
+	}
+
+	if (!stale && r->cache_prefetch_hits != 0)
+		cache_prefetch(r, name, e4, e6, now);
+	return 0;
+}
+
+/** Answer from cache.
+Return 0 if ondone() has been called */
+static int cache_resolve(ffdnsclient *r, const ffstr *name, ffdnscl_onresolve ondone, void *udata)
+{
+	ffdnscl_result res = {};
+	if (0 != cache_result(r, name, 0, &res))
+		return 1;
+
+	r->cache_hits++;
+	if (r->debug_log)
+		r->log(FFDNSCL_LOG_DBG, "%S: cache hit: %s, %L addresses"
+			, name, ffdns_rcode_str(res.status), res.ip.len);
+
+	ondone(udata, &res);
+	ffslice_free(&res.ip);
+	return 0;
+}
+
+static void cache_free(ffdnsclient *r)
+{
+	fflist_item *it, *next;
+	for (it = fflist_first(&r->cache_lru);  it != fflist_sentl(&r->cache_lru);  it = next) {
+		next = it->next;
+		ffmem_free(FF_GETPTR(dns_centry, lru_sib, it));
+	}
+	ffmem_free(r->cache);
+}
+
+void ffdnscl_stats(ffdnsclient *r, struct ffdnscl_stats *st)
+{
+	st->cache_hits = r->cache_hits;
+	st->cache_misses = r->cache_misses;
+	st->cache_entries = r->cache_n;
+	st->cache_used = r->cache_used;
+	st->cache_prefetches = r->cache_prefetches;
+	st->cache_stale = r->cache_stale;
+	st->sent = r->sent;
+	st->send_calls = r->send_calls;
+	st->received = r->received;
+	st->recv_calls = r->recv_calls;
+}
+
+
+/** Split "IP[:PORT]" address string.
+e.g.: "127.0.0.1", "127.0.0.1:80", "[::1]:80", ":80".
+@ip: output address.  Brackets aren't included for IPv6 address.
+@port: output port.
+Return 0 on success. */
+static inline int ffip_split(const char *data, size_t len, ffstr *ip, ffstr *port)
+{
+	const char *pos = ffs_rsplit2by(data, len, ':', ip, port);
+
+	if (ip->len != 0 && ip->ptr[0] == '[') {
+		if (data[len - 1] == ']') {
+			ip->len = len;
+			ffstr_null(port);
+			pos = NULL;
+		}
+		if (!(ip->len >= FFSLEN("[::]") && ip->ptr[ip->len - 1] == ']'))
+			return -1;
+		ip->ptr += FFSLEN("[");
+		ip->len -= FFSLEN("[]");
+	}
 
 	if (pos != NULL && port->len == 0)
 		return -1; // "ip:"
@@ -877,7 +1609,7 @@ int ffdnscl_serv_add(ffdnsclient *r, const ffstr *saddr)
 		return -1;
 
 	serv->r = r;
-	serv->ansbuf = ffmem_alloc(r->buf_size);
+	serv->ansbuf = ffmem_alloc(r->recv_batch * r->buf_size);
 	if (serv->ansbuf == NULL)
 		goto err;
 
@@ -899,6 +1631,10 @@ int ffdnscl_serv_add(ffdnsclient *r, const ffstr *saddr)
 	char *s = ffs_copy(serv->saddr_s, serv->saddr_s + FF_COUNT(serv->saddr_s), saddr->ptr, saddr->len);
 	ffstr_set(&serv->saddr, serv->saddr_s, s - serv->saddr_s);
 
+	serv->tcp.serv = serv;
+	serv->tcp.sk = FF_BADSKT;
+	serv->tcp.tcp = 1;
+
 	fflist_add(&r->servs, &serv->sib);
 	r->curserv = FF_GETPTR(ffdnscl_serv, sib, fflist_first(&r->servs));
 	return 0;
@@ -908,63 +1644,541 @@ err:
 	return -1;
 }
 
-/** Prepare socket to connect to a DNS server. */
-static int serv_init(ffdnscl_serv *serv)
+/** Bind socket to a random source port (RFC 5452).
+Let the system choose the port if all attempts fail. */
+static int sock_bind(ffskt sk, int family)
 {
+	ffaddr la;
+	ffaddr_init(&la);
+	ffaddr_setany(&la, family);
+
+	for (uint i = 0;  i != DNS_BIND_TRIES;  i++) {
+		ffip_setport(&la, 1024 + ffrnd_get() % (0x10000 - 1024));
+		if (0 == ffskt_bind(sk, &la.a, la.len))
+			return 0;
+	}
+
+	ffip_setport(&la, 0);
+	return ffskt_bind(sk, &la.a, la.len);
+}
+
+/** Create UDP socket and connect it to the server. */
+static int sock_init(struct dns_sock *sk)
+{
+	ffdnscl_serv *serv = sk->serv;
 	const char *er;
-	ffskt sk;
+	int family = ffaddr_family(&serv->addr);
 
-	sk = ffskt_create(ffaddr_family(&serv->addr), SOCK_DGRAM | SOCK_NONBLOCK, IPPROTO_UDP);
-	if (sk == FF_BADSKT) {
+	sk->sk = ffskt_create(family, SOCK_DGRAM | SOCK_NONBLOCK, IPPROTO_UDP);
+	if (sk->sk == FF_BADSKT) {
 		er = "ffskt_create";
 		goto fail;
 	}
 
-	{
-		ffaddr la;
-		ffaddr_init(&la);
-		ffaddr_setany(&la, ffaddr_family(&serv->addr));
-		if (0 != ffskt_bind(sk, &la.a, la.len)) {
-			er = "ffskt_bind";
-			goto fail;
-		}
+	if (0 != sock_bind(sk->sk, family)) {
+		er = "ffskt_bind";
+		goto fail;
 	}
 
-	ffaio_init(&serv->aiotask);
-	serv->aiotask.udata = serv;
-	serv->aiotask.sk = sk;
-	serv->aiotask.udp = 1;
-	if (0 != ffaio_attach(&serv->aiotask, serv->r->kq, FFKQU_READ)) {
+	ffaio_init(&sk->aiotask);
+	sk->aiotask.udata = sk;
+	sk->aiotask.sk = sk->sk;
+	sk->aiotask.udp = 1;
+	if (0 != ffaio_attach(&sk->aiotask, serv->r->kq, FFKQU_READ)) {
 		er = "ffaio_attach";
 		goto fail;
 	}
 
-	serv->sk = sk;
+	if (0 != ffskt_connect(sk->sk, &serv->addr.a, serv->addr.len)) {
+		er = "ffskt_connect";
+		goto fail;
+	}
 	return 0;
 
 fail:
 	syserrlog_srv(serv, "%s", er);
+	FF_SAFECLOSE(sk->sk, FF_BADSKT, ffskt_close);
+	return 1;
+}
 
-	if (sk != FF_BADSKT)
-		ffskt_close(sk);
+/** Prepare the pool of sockets connected to a DNS server.
+All sockets are attached to the same kernel queue with one handler ans_read(). */
+static int serv_init(ffdnscl_serv *serv)
+{
+	ffdnsclient *r = serv->r;
+	uint i;
 
-	return 1;
+	if (serv->socks == NULL) {
+		if (NULL == (serv->socks = ffmem_callocT(r->serv_sockets, struct dns_sock))) {
+			syserrlog_srv(serv, "ffmem_alloc", 0);
+			return 1;
+		}
+		for (i = 0;  i != r->serv_sockets;  i++) {
+			serv->socks[i].serv = serv;
+			serv->socks[i].sk = FF_BADSKT;
+			serv->socks[i].i = i;
+		}
+	}
+
+	for (i = 0;  i != r->serv_sockets;  i++) {
+		if (0 != sock_init(&serv->socks[i])) {
+			serv_close(serv);
+			return 1;
+		}
+	}
+
+	serv->connected = 1;
+	dbglog_srv(serv, LOG_DBGNET, "opened %u sockets", r->serv_sockets);
+
+	for (i = 0;  i != r->serv_sockets;  i++) {
+		ans_read(&serv->socks[i]);
+	}
+	return 0;
+}
+
+/** Close all sockets of the server.  They'll be opened again for the next query. */
+static void serv_close(ffdnscl_serv *serv)
+{
+	if (serv->socks == NULL)
+		return;
+
+	for (uint i = 0;  i != serv->r->serv_sockets;  i++) {
+		struct dns_sock *sk = &serv->socks[i];
+		if (sk->sk != FF_BADSKT) {
+			ffskt_close(sk->sk);
+			sk->sk = FF_BADSKT;
+			ffaio_fin(&sk->aiotask);
+		}
+	}
+	serv->connected = 0;
+	serv->sendbuf.len = 0;
+	serv->sendlen.len = 0;
+}
+
+/** Choose a socket to send a query from.
+A random socket is chosen for each query;
+ with 'batch' enabled all datagrams queued until the next flush use the same socket. */
+static struct dns_sock * serv_sock(ffdnscl_serv *serv)
+{
+	ffdnsclient *r = serv->r;
+	if (!r->batch || serv->sendlen.len == 0)
+		serv->qsock = ffrnd_get() % r->serv_sockets;
+	return &serv->socks[serv->qsock];
 }
 
 static void serv_fin(ffdnscl_serv *serv)
 {
-	FF_SAFECLOSE(serv->sk, FF_BADSKT, ffskt_close);
+	serv_close(serv);
+	tcp_close(serv);
+	ffvec_free(&serv->tcp_wbuf);
+	ffvec_free(&serv->tcp_rbuf);
+	FF_SAFECLOSE(serv->socks, NULL, ffmem_free);
 	FF_SAFECLOSE(serv->ansbuf, NULL, ffmem_free);
+	ffvec_free(&serv->sendbuf);
+	ffvec_free(&serv->sendlen);
 	ffmem_free(serv);
 }
 
-/** Round-robin balancer. */
-static ffdnscl_serv * serv_next(ffdnsclient *r)
+/** Send datagram to the server or add it to the queue if 'batch' is enabled */
+static int serv_send(ffdnscl_serv *serv, const char *d, size_t n)
+{
+	ffdnsclient *r = serv->r;
+	ushort *plen;
+
+	if (!r->batch) {
+		r->send_calls++;
+		if ((ssize_t)n != ffskt_send(serv->socks[serv->qsock].sk, d, n, 0))
+			return -1;
+		r->sent++;
+		return 0;
+	}
+
+	if (NULL == (plen = ffvec_pushT(&serv->sendlen, ushort)))
+		return -1;
+	if (0 == ffvec_add(&serv->sendbuf, d, n, 1)) {
+		serv->sendlen.len--;
+		return -1;
+	}
+	*plen = n;
+	return 0;
+}
+
+/** Send all queued datagrams.
+A datagram that can't be sent is dropped: the query will be sent again by timer. */
+static void serv_flush(ffdnscl_serv *serv)
+{
+	ffdnsclient *r = serv->r;
+	const ushort *len = serv->sendlen.ptr;
+	size_t i = 0, off = 0, n = serv->sendlen.len;
+
+	if (n == 0 || !serv->connected)
+		goto done;
+	ffskt sk = serv->socks[serv->qsock].sk;
+
+#ifdef FF_LINUX
+	struct mmsghdr msgs[DNS_BATCH_MAX];
+	struct iovec iov[DNS_BATCH_MAX];
+
+	while (i != n) {
+		uint k, m = ffmin(n - i, DNS_BATCH_MAX);
+		size_t o = off;
+		for (k = 0;  k != m;  k++) {
+			iov[k].iov_base = (char*)serv->sendbuf.ptr + o;
+			iov[k].iov_len = len[i + k];
+			o += len[i + k];
+			ffmem_zero_obj(&msgs[k]);
+			msgs[k].msg_hdr.msg_iov = &iov[k];
+			msgs[k].msg_hdr.msg_iovlen = 1;
+		}
+
+		int rc = sendmmsg(sk, msgs, m, 0);
+		r->send_calls++;
+		if (rc <= 0) {
+			syserrlog_srv(serv, "sendmmsg", 0);
+			rc = 1; // skip the failed datagram
+		} else {
+			r->sent += rc;
+		}
+
+		for (k = 0;  k != (uint)rc;  k++) {
+			off += len[i + k];
+		}
+		i += rc;
+	}
+
+	dbglog_srv(serv, LOG_DBGNET, "sent %L queries", n);
+
+#else
+	for (;  i != n;  i++) {
+		r->send_calls++;
+		if (len[i] != ffskt_send(sk, (char*)serv->sendbuf.ptr + off, len[i], 0))
+			syserrlog_srv(serv, "ffskt_send", 0);
+		else
+			r->sent++;
+		off += len[i];
+	}
+#endif
+
+done:
+	serv->sendbuf.len = 0;
+	serv->sendlen.len = 0;
+}
+
+void ffdnscl_flush(ffdnsclient *r)
+{
+	fflist_item *it;
+	for (it = fflist_first(&r->servs);  it != fflist_sentl(&r->servs);  it = it->next) {
+		serv_flush(FF_GETPTR(ffdnscl_serv, sib, it));
+	}
+}
+
+
+/** Connect to the server via TCP. */
+static int tcp_connect(ffdnscl_serv *serv)
+{
+	struct dns_sock *sk = &serv->tcp;
+	const char *er;
+
+	if (serv->tcp_rbuf.cap == 0
+		&& NULL == ffvec_alloc(&serv->tcp_rbuf, DNS_TCP_MAXMSG, 1)) {
+		er = "ffmem_alloc";
+		goto fail;
+	}
+
+	sk->sk = ffskt_create(ffaddr_family(&serv->addr), SOCK_STREAM | SOCK_NONBLOCK, IPPROTO_TCP);
+	if (sk->sk == FF_BADSKT) {
+		er = "ffskt_create";
+		goto fail;
+	}
+
+	ffaio_init(&sk->aiotask);
+	sk->aiotask.udata = sk;
+	sk->aiotask.sk = sk->sk;
+	if (0 != ffaio_attach(&sk->aiotask, serv->r->kq, FFKQU_READ | FFKQU_WRITE)) {
+		er = "ffaio_attach";
+		goto fail;
+	}
+
+	dbglog_srv(serv, LOG_DBGNET, "TCP: connecting...", 0);
+	serv->tcp_state = DNS_TCP_CONNECTING;
+	tcp_onconnect(sk);
+	return (serv->tcp_state == DNS_TCP_NONE);
+
+fail:
+	syserrlog_srv(serv, "TCP: %s", er);
+	FF_SAFECLOSE(sk->sk, FF_BADSKT, ffskt_close);
+	return 1;
+}
+
+/** Send query over TCP after a truncated response (RFC 7766).
+The connection is persistent: the queries are pipelined, the responses may come in any order.
+Return 0 on success */
+static int tcp_query(ffdnscl_serv *serv, dns_query *q, int is4)
+{
+	const char *d = (is4) ? q->question : q->question + q->ques_len4;
+	uint n = (is4) ? q->ques_len4 : q->ques_len6;
+	int idle = (serv->tcp_wbuf.len == 0);
+	ushort len = ffint_be_cpu16(n);
+
+	if (0 == ffvec_add(&serv->tcp_wbuf, &len, sizeof(len), 1))
+		return 1;
+	if (0 == ffvec_add(&serv->tcp_wbuf, d, n, 1)) {
+		serv->tcp_wbuf.len -= sizeof(len);
+		return 1;
+	}
+	q->tcp = 1;
+
+	if (serv->tcp_state == DNS_TCP_NONE)
+		return tcp_connect(serv);
+
+	if (serv->tcp_state == DNS_TCP_CONNECTED && idle)
+		tcp_write(&serv->tcp);
+	return 0;
+}
+
+static void tcp_onconnect(void *udata)
+{
+	struct dns_sock *sk = udata;
+	ffdnscl_serv *serv = sk->serv;
+
+	int r = ffaio_connect(&sk->aiotask, &tcp_onconnect, &serv->addr.a, serv->addr.len);
+	if (r == FFAIO_ASYNC)
+		return;
+	else if (r == FFAIO_ERROR) {
+		syserrlog_srv(serv, "TCP: %s", "ffaio_connect");
+		tcp_close(serv);
+		return;
+	}
+
+	dbglog_srv(serv, LOG_DBGNET, "TCP: connected", 0);
+	serv->tcp_state = DNS_TCP_CONNECTED;
+	tcp_write(sk);
+	if (serv->tcp_state == DNS_TCP_CONNECTED)
+		tcp_read(sk);
+}
+
+/** Send the queued queries. */
+static void tcp_write(void *udata)
+{
+	struct dns_sock *sk = udata;
+	ffdnscl_serv *serv = sk->serv;
+
+	while (serv->tcp_woff != serv->tcp_wbuf.len) {
+		ssize_t r = ffaio_send(&sk->aiotask, &tcp_write
+			, (char*)serv->tcp_wbuf.ptr + serv->tcp_woff, serv->tcp_wbuf.len - serv->tcp_woff);
+		if (r == FFAIO_ASYNC)
+			return;
+		else if (r == FFAIO_ERROR) {
+			syserrlog_srv(serv, "TCP: %s", "ffaio_send");
+			tcp_close(serv);
+			return;
+		}
+		dbglog_srv(serv, LOG_DBGNET, "TCP: sent %L bytes", r);
+		serv->tcp_woff += r;
+	}
+
+	serv->tcp_wbuf.len = 0;
+	serv->tcp_woff = 0;
+}
+
+/** Receive data from the server and process each complete response. */
+static void tcp_read(void *udata)
+{
+	struct dns_sock *sk = udata;
+	ffdnscl_serv *serv = sk->serv;
+	ffvec *b = &serv->tcp_rbuf;
+	ffstr resp;
+
+	for (;;) {
+		ssize_t r = ffaio_recv(&sk->aiotask, &tcp_read, (char*)b->ptr + b->len, b->cap - b->len);
+		if (r == FFAIO_ASYNC)
+			return;
+		else if (r == FFAIO_ERROR) {
+			syserrlog_srv(serv, "TCP: %s", "ffaio_recv");
+			tcp_close(serv);
+			return;
+		} else if (r == 0) {
+			dbglog_srv(serv, LOG_DBGNET, "TCP: connection closed by server", 0);
+			tcp_close(serv);
+			return;
+		}
+		b->len += r;
+
+		size_t off = 0;
+		while (b->len - off >= 2) {
+			uint n = ffint_be_cpu16_ptr((char*)b->ptr + off);
+			if (b->len - off < 2 + n)
+				break;
+			ffstr_set(&resp, (char*)b->ptr + off + 2, n);
+			off += 2 + n;
+
+			dbglog_srv(serv, LOG_DBGNET, "TCP: received response (%u bytes)", n);
+			ans_proc(sk, &resp);
+			if (serv->tcp_state != DNS_TCP_CONNECTED)
+				return; // the connection was closed by user's callback
+		}
+		ffmem_move(b->ptr, (char*)b->ptr + off, b->len - off);
+		b->len -= off;
+	}
+}
+
+/** Close TCP connection.
+The queries waiting for response over TCP are sent again by timer. */
+static void tcp_close(ffdnscl_serv *serv)
+{
+	if (serv->tcp.sk != FF_BADSKT) {
+		ffskt_close(serv->tcp.sk);
+		serv->tcp.sk = FF_BADSKT;
+		ffaio_fin(&serv->tcp.aiotask);
+	}
+	serv->tcp_state = DNS_TCP_NONE;
+	serv->tcp_wbuf.len = 0;
+	serv->tcp_woff = 0;
+	serv->tcp_rbuf.len = 0;
+}
+
+
+/** Add RTT sample (usec): update smoothed RTT and variation (RFC 6298) and the histogram */
+static void serv_rtt(ffdnscl_serv *serv, uint64 rtt)
+{
+	uint r = (uint)ffmin(rtt, 0xffffffff), i;
+
+	if (serv->srtt == 0) {
+		serv->srtt = ffmax(r, 1);
+		serv->rttvar = r / 2;
+	} else {
+		uint d = (r > serv->srtt) ? r - serv->srtt : serv->srtt - r;
+		serv->rttvar = serv->rttvar - serv->rttvar / 4 + d / 4;
+		serv->srtt = ffmax(serv->srtt - serv->srtt / 8 + r / 8, 1);
+	}
+
+	for (i = 0;  (r >> 1) != 0 && i != DNS_HIST_N - 1;  i++) {
+		r >>= 1;
+	}
+	serv->rtt_hist[i]++;
+	if (++serv->rtt_hist_total == 512) {
+		serv->rtt_hist_total = 0;
+		for (i = 0;  i != DNS_HIST_N;  i++) {
+			serv->rtt_hist[i] /= 2;
+			serv->rtt_hist_total += serv->rtt_hist[i];
+		}
+	}
+}
+
+/** No response from the server in time */
+static void serv_lost(ffdnscl_serv *serv)
+{
+	serv->st_timeouts++;
+	serv->loss += (1000 - serv->loss) / 8;
+}
+
+/** Get retry timeout (msec): SRTT + 4*RTTVAR within [DNS_RTO_MIN..retry_timeout] */
+static uint serv_rto(const ffdnscl_serv *serv)
+{
+	uint rto = serv->r->retry_timeout;
+	if (serv->srtt != 0) {
+		rto = ffmin((serv->srtt + 4 * serv->rttvar + 999) / 1000, rto);
+		rto = ffmax(rto, DNS_RTO_MIN);
+	}
+	return rto;
+}
+
+/** Get RTT percentile (msec) from the histogram.  The value within a bucket is interpolated linearly.
+Return 0 if there are not enough samples */
+static uint serv_rtt_percentile(const ffdnscl_serv *serv, uint pct)
+{
+	uint i, cum = 0, target;
+
+	if (serv->rtt_hist_total < DNS_HIST_MIN_SAMPLES)
+		return 0;
+
+	target = (serv->rtt_hist_total * pct + 99) / 100;
+	for (i = 0;  i != DNS_HIST_N;  i++) {
+		if (cum + serv->rtt_hist[i] >= target)
+			break;
+		cum += serv->rtt_hist[i];
+	}
+	if (i == DNS_HIST_N)
+		i--;
+
+	uint64 lo = (i != 0) ? 1U << i : 0, hi = 2U << i;
+	uint64 usec = lo + (hi - lo) * (target - cum) / ffmax(serv->rtt_hist[i], 1);
+	return (uint)ffmax((usec + 999) / 1000, 1);
+}
+
+/** Expected response time: retry timeout penalized by loss rate and by the number of queries in progress */
+static uint64 serv_score(const ffdnscl_serv *serv)
 {
-	ffdnscl_serv *serv = r->curserv;
-	fflist_item *next = ((serv->sib.next != fflist_sentl(&r->servs)) ? serv->sib.next : fflist_first(&r->servs));
-	r->curserv = FF_GETPTR(ffdnscl_serv, sib, next);
-	return serv;
+	uint64 t = serv->srtt + 4 * serv->rttvar;
+	if (serv->srtt == 0 && serv->loss != 0)
+		t = (uint64)serv->r->retry_timeout * 1000; // never responded
+	return t * (1000 + 4 * serv->loss) / 1000 + (uint64)serv->inflight * (serv->srtt / 8 + 1);
+}
+
+/** Choose server for a query.
+Normally the healthy server with the lowest score is chosen;
+ a server without RTT samples has the lowest score, so every server gets probed first.
+Every DNS_PROBE_EVERY-th choice (or if there are no healthy servers) is round-robin,
+ so a server can recover from bad stats.
+exclude: server that must not be chosen
+Return NULL if there are no other servers */
+static ffdnscl_serv * serv_next(ffdnsclient *r, const ffdnscl_serv *exclude)
+{
+	ffdnscl_serv *serv, *best = NULL;
+	fflist_item *it;
+	uint64 score, best_score = (uint64)-1;
+
+	if (++r->serv_choices % DNS_PROBE_EVERY != 0) {
+		for (it = fflist_first(&r->servs);  it != fflist_sentl(&r->servs);  it = it->next) {
+			serv = FF_GETPTR(ffdnscl_serv, sib, it);
+			if (serv == exclude || serv->loss > DNS_LOSS_UNHEALTHY)
+				continue;
+			score = serv_score(serv);
+			if (score < best_score) {
+				best = serv;
+				best_score = score;
+			}
+		}
+		if (best != NULL)
+			return best;
+	}
+
+	// round-robin
+	for (uint i = 0;  i != 2;  i++) {
+		serv = r->curserv;
+		fflist_item *next = ((serv->sib.next != fflist_sentl(&r->servs)) ? serv->sib.next : fflist_first(&r->servs));
+		r->curserv = FF_GETPTR(ffdnscl_serv, sib, next);
+		if (serv != exclude)
+			return serv;
+	}
+	return NULL;
+}
+
+int ffdnscl_serv_stats(ffdnsclient *r, uint i, struct ffdnscl_serv_stats *st)
+{
+	fflist_item *it;
+	for (it = fflist_first(&r->servs);  it != fflist_sentl(&r->servs);  it = it->next) {
+		if (i-- != 0)
+			continue;
+
+		const ffdnscl_serv *serv = FF_GETPTR(ffdnscl_serv, sib, it);
+		st->addr = serv->saddr;
+		st->srtt = serv->srtt;
+		st->rttvar = serv->rttvar;
+		st->rtt_p95 = serv_rtt_percentile(serv, 95);
+		st->rto = serv_rto(serv);
+		st->loss = serv->loss;
+		st->inflight = serv->inflight;
+		st->queries = serv->st_queries;
+		st->answers = serv->st_answers;
+		st->timeouts = serv->st_timeouts;
+		st->hedged = serv->st_hedged;
+		st->truncated = serv->st_truncated;
+		st->tcp = (serv->tcp_state == DNS_TCP_CONNECTED);
+		st->sockets = (serv->connected) ? r->serv_sockets : 0;
+		return 0;
+	}
+	return -1;
 }
 
 void res_free(ffdnscl_res *dr)
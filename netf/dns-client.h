@@ -8,13 +8,15 @@ Copyright 2019 Simon Zolin
 #include "list.h"
 #include "ffos-compat/asyncio.h"
 #include <FFOS/timerqueue.h>
-#include <ffbase/rbtree.h>
 
 
 typedef struct ffdnscl_serv ffdnscl_serv;
 typedef struct ffdnsclient ffdnsclient;
 typedef struct ffdnsclient ffdnscl_conf;
 typedef struct ffdnscl_res ffdnscl_res;
+struct dns_query;
+struct dns_txlink;
+struct dns_centry;
 
 typedef struct {
 	ffstr name; // host name
@@ -42,16 +44,69 @@ struct ffdnsclient {
 	ffdnscl_time time;
 
 	uint max_tries; // default:1
-	uint retry_timeout; // in msec.  default:1000
+	uint retry_timeout; // max. retry timeout (msec);  the actual value is computed from server's RTT.  default:1000
 	uint buf_size; // default:4k
 	uint enable_ipv6 :1; // default:1
 	uint edns :1; // default:1
 	uint debug_log :1;
+	uint batch :1; // queue outgoing queries until ffdnscl_flush() (Linux: sent by sendmmsg()).  default:0
+	uint recv_batch; // max. number of responses received by one recvmmsg() (Linux).  default:16
+	/* Number of UDP sockets per server (1..64), each bound to a random source port.
+	Queries are spread across the sockets.  default:1 */
+	uint serv_sockets;
+	/* If there's no response within this percentile of the server's RTT distribution (1..100),
+	 the same query is sent to another server, and the first response is used.
+	0: disabled (default) */
+	uint hedge_percentile;
+
+	/* Responses are cached by (name, type) with TTL from the answer records.
+	NXDOMAIN and empty responses are cached with TTL from SOA record (RFC 2308).
+	The least recently used entries are removed when the memory limit is reached. */
+	size_t cache_size; // max. memory for cached responses (in bytes).  0:disable cache.  Requires 'time'
+	uint cache_ttl_min; // min. TTL for cached responses (in sec).  default:0
+	uint cache_ttl_max; // max. TTL for cached responses (in sec).  default:86400
+	/* Refresh-ahead: an entry that has answered this number of requests
+	 is queried again in background shortly before it expires.
+	0: disabled (default) */
+	uint cache_prefetch_hits;
+	/* Serve-stale (RFC 8767): expired entries are kept for this number of seconds
+	 and are used if the servers don't respond or return SERVFAIL.
+	0: disabled (default) */
+	uint cache_stale_max;
 
 	fflist servs; //ffdnscl_serv[]
-	ffdnscl_serv *curserv;
+	ffdnscl_serv *curserv; //the next server for round-robin choice
+	uint serv_choices;
+
+	uint64 hash_key[2]; //random key for hashing hostnames
+	struct dns_query **queries; //active queries by hostname.  dns_query*[query_slots]
+	struct dns_txlink **txids; //active queries by transaction ID.  dns_txlink*[query_slots * 2]
+	uint query_slots;
+	uint queries_n;
+
+	struct dns_centry **cache; //cached responses by name and type.  dns_centry*[cache_slots]
+	uint cache_slots;
+	uint cache_n;
+	size_t cache_used; //memory used by cached responses
+	fflist cache_lru; //dns_centry[]: the least recently used first
+	uint64 cache_hits;
+	uint64 cache_misses;
+	uint64 cache_prefetches, cache_stale;
+	uint64 sent, send_calls;
+	uint64 received, recv_calls;
+};
 
-	ffrbtree queries; //active queries by hostname.  dns_query[]
+struct ffdnscl_stats {
+	uint64 cache_hits; // requests answered from cache
+	uint64 cache_misses; // requests that started a new query (a request attached to a pending query isn't counted)
+	uint cache_entries;
+	size_t cache_used; // in bytes
+	uint64 cache_prefetches; // queries sent to refresh the entries before they expire
+	uint64 cache_stale; // requests answered with expired entries because the servers failed
+	uint64 sent; // datagrams sent
+	uint64 send_calls; // syscalls for sending
+	uint64 received; // datagrams received
+	uint64 recv_calls; // syscalls for receiving
 };
 
 enum FFDNSCL_LOG {
@@ -72,11 +127,43 @@ FF_EXTERN void ffdnscl_free(ffdnsclient *r);
 addr: "IP[:PORT]" */
 FF_EXTERN int ffdnscl_serv_add(ffdnsclient *r, const ffstr *addr);
 
+/** Server health.
+A query is sent to the healthy server (loss rate <= 50%) with the lowest expected response time;
+ 1 of 16 queries is sent round-robin to probe the other servers. */
+struct ffdnscl_serv_stats {
+	ffstr addr;
+	uint srtt; // smoothed RTT (usec).  0: no responses yet
+	uint rttvar; // RTT variation (usec)
+	uint rtt_p95; // 95th percentile of RTT (msec).  0: not enough samples
+	uint rto; // retry timeout (msec)
+	uint loss; // smoothed loss rate (per-mille)
+	uint inflight; // queries waiting for response
+	uint64 queries; // queries sent (including retries and hedged queries)
+	uint64 answers; // responses received
+	uint64 timeouts;
+	uint64 hedged; // hedged queries sent to this server
+	uint64 truncated; // truncated responses;  the queries are sent again over TCP
+	uint tcp; // TCP connection is established
+	uint sockets; // open sockets
+};
+
+/** Get stats of the server #i (in order of adding).
+Return 0 on success;  -1: no such server */
+FF_EXTERN int ffdnscl_serv_stats(ffdnsclient *r, uint i, struct ffdnscl_serv_stats *st);
+
 enum FFDNSCL_F {
 	FFDNSCL_CANCEL = 1,
 };
 
 /**
+A fresh cached response is passed to ondone() before the function returns.
 flags: enum FFDNSCL_F
 Return 0 on success. */
 FF_EXTERN int ffdnscl_resolve(ffdnsclient *r, ffstr name, ffdnscl_onresolve ondone, void *udata, uint flags);
+
+FF_EXTERN void ffdnscl_stats(ffdnsclient *r, struct ffdnscl_stats *st);
+
+/** Send the queued queries.
+Must be called once per event loop iteration if 'batch' is enabled,
+ so the queries added by ffdnscl_resolve() or resent by timer during this iteration are sent together. */
+FF_EXTERN void ffdnscl_flush(ffdnsclient *r);
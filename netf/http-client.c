@@ -3,10 +3,24 @@
 */
 
 #include "http-client.h"
+#include "dns-client.h"
+#include "dns.h"
+#include "thpool.h"
 #include "url.h"
 #include "list.h"
 #include "ffos-compat/asyncio.h"
+#include <FFOS/file.h>
 #include <ffbase/vector.h>
+#include <ffbase/lock.h>
+#ifdef FF_LINUX
+#include <sys/sendfile.h>
+#endif
+#ifdef FFHTTPCL_ZLIB
+#include <zlib/zlib-ff.h>
+#endif
+#ifdef FFHTTPCL_ZSTD
+#include <zstd/zstd-ff.h>
+#endif
 
 
 static fflist1 recycled_cons;
@@ -16,7 +30,49 @@ struct filter {
 	void *p;
 };
 
-typedef struct http {
+typedef struct http http;
+
+/** TCP connection.
+It may outlive the request and be used by the next requests to the same server.
+The objects are never freed until ffhttpcl_deinit(),
+ because the kernel queue may still hold an event for a closed connection. */
+struct httpcl_conn {
+	ffaio_task aio; // aio.udata: this object
+	ffskt sk;
+	char *key; // "d|host:port" or "p|proxy:port"
+	struct httpcl_conn *next; // next in idle/busy/free list
+	http *first, *last; // requests in flight in order of sending;  'first' is receiving response
+	http *writer; // request which is sending
+	ffuint nreq; // N of requests in flight
+	ffuint64 idle_since; // msec
+	ffvec leftover; // data received after the previous response (pipelined responses)
+	ffuint rcvlowat; // SO_RCVLOWAT value we've set;  0: default
+	ffip6 ip; // server address
+	struct httpcl_pool *pool;
+	ffuint broken :1 // must not be reused
+		, conn_signal :1 // connect() is complete
+		;
+};
+
+/** Keep-alive connections attached to one kernel queue.
+The lists are used only by the thread which services the kernel queue. */
+struct httpcl_pool {
+	struct httpcl_pool *next;
+	fffd kq;
+	struct ffhttpcl_pool_stats st;
+	struct httpcl_conn *idle; // most recently used first
+	struct httpcl_conn *busy; // keep-alive connections with requests in flight
+	struct httpcl_conn *free; // recycled objects
+	ffuint nconn; // connection objects in use
+};
+
+static struct {
+	struct ffhttpcl_pool_conf conf;
+	fflock lock; // protects 'list'
+	struct httpcl_pool *list;
+} httpcl_pools;
+
+struct http {
 	ffuint state;
 
 	char *method;
@@ -26,12 +82,15 @@ typedef struct http {
 	ffvec hostname; // server hostname (may be a proxy)
 	ffuint hostport; // server port (may be a proxy)
 	ffurl url;
-	ffiplist iplist;
 	ffip6 ip;
-	ffaddrinfo *addr;
-	ffip_iter curaddr;
-	ffskt sk;
-	ffaio_task aio;
+	ffvec addrs; // ffip6[] addresses to connect to;  IPv4 addresses are v4-mapped
+	ffuint addr_i; // next address in addrs
+	struct httpcl_conn *attempts[4]; // connection attempts in progress
+	ffuint nattempts;
+	ffthpool_task *gai; // getaddrinfo() task in progress
+	struct httpcl_conn *conn;
+	char *conn_key; // key for the new connection
+	http *pipe_next; // next request in flight on the same connection
 	ffuint reconnects;
 	fftimerqueue_node tmr;
 	ffvec hdrs;
@@ -39,6 +98,8 @@ typedef struct http {
 	ffstr *bufs;
 	ffuint rbuf;
 	ffuint wbuf;
+	ffsize *bufcap; // capacity of each buffer in 'bufs'
+	ffsize bufsize; // size of the next body buffer (grows with 'buffer_max')
 	ffsize curtcp_len;
 	ffuint lowat; //low-watermark number of filled bytes for buffer
 	ffstr data, outdata;
@@ -53,13 +114,30 @@ typedef struct http {
 		, iowait :1 //waiting for I/O, all input data is consumed
 		, async :1
 		, preload :1 //fill all buffers
+		, pipe_wait :1 //waiting until the previous response on the connection is received
+		, dns_wait :1 //waiting for ffdnsclient
+		, dns_sync :1 //inside ffdnscl_resolve()
+		, conn_tmr :1 //connect timer has expired
+		;
+
+	struct ffhttpcl_body body;
+	ffuint64 body_sent;
+	ffuint body_on :1
+		, body_eof :1 //all body data is prepared for sending
 		;
 
 	ffhttpcl_handler handler;
 	void *udata;
 	ffuint status;
 	struct filter f;
-} http;
+
+	struct filter ce; // Content-Encoding decoder
+	ffstr ce_in; // output data of 'f' not yet processed by 'ce'
+	ffuint ce_accept :1 // Accept-Encoding is sent
+		, ce_fin :1 // 'f' has finished
+		, ce_more :1 // 'ce' has more output data for the same input
+		;
+};
 
 
 #define dbglog(...) \
@@ -82,12 +160,15 @@ enum {
 };
 
 enum {
+	FFHTTP_MORE = -3,
 	FFHTTP_OK = -2,
 	FFHTTP_DONE = -1,
 
 	FFHTTP_ECHUNKED = 1,
 	FFHTTP_ECHUNKED_FIN,
 	FFHTTP_ECONTLEN_FIN,
+	FFHTTP_ECE,
+	FFHTTP_ECE_FIN,
 };
 
 #define ffhttp_iserr(e)  ((e) > 0)
@@ -99,6 +180,8 @@ static const char *ffhttp_errstr(int code)
 		"incorrect chunked header",
 		"incomplete chunked data",
 		"incomplete Content-Length data",
+		"bad compressed data",
+		"incomplete compressed data",
 	};
 	return serr[code];
 }
@@ -107,14 +190,20 @@ static int httpcl_prep_url(http *c, const char *url);
 static void httpcl_process(http *c);
 
 static int ip_resolve(http *c);
+static void dns_cancel(http *c);
 
 static int tcp_alloc(http *c, ffsize size);
-static int tcp_prepare(http *c, ffaddr *a);
-static int tcp_connect(http *c, const struct sockaddr *addr, socklen_t addr_size);
+static int conn_get(http *c);
+static void conn_close(http *c);
+static void conn_release(http *c);
+static int tcp_connect(http *c);
+static void he_close(http *c);
 static int tcp_recv(http *c);
 static void tcp_ontmr(void *param);
 static int tcp_recvhdrs(http *c);
 static int tcp_send(http *c);
+static int tcp_send_body(http *c);
+static int body_rewind(http *c);
 static int tcp_ioerr(http *c);
 
 
@@ -140,8 +229,10 @@ static int http_chunked_process(void *p, ffstr *in, ffstr *out)
 
 	struct httpchunked *c = p;
 	int r = httpchunked_parse(c, *in, out);
-	if (r == -1)
+	if (r == -1) {
+		ffstr_shift(in, c->done_len);
 		return FFHTTP_DONE;
+	}
 	else if (r < 0)
 		return FFHTTP_ECHUNKED;
 	ffstr_shift(in, r);
@@ -211,8 +302,9 @@ struct ffhttp_filter {
 	void (*close)(void *obj);
 
 	/** Process data.
-	@in: input data;  NULL: TCP FIN received
+	@in: input data;  NULL: TCP FIN received (or no more input data for a decoder)
 	Return FFHTTP_OK: output data is ready;
+	 FFHTTP_MORE: output data is ready, call again with the same input;
 	 FFHTTP_DONE: output data is ready, filter has finished;
 	 FFHTTP_E*: error */
 	int (*process)(void *obj, ffstr *in, ffstr *out);
@@ -224,11 +316,239 @@ static const struct ffhttp_filter ffhttp_connclose_filter = { &http_connclose_op
 static const struct ffhttp_filter*const http_filters[] = {
 	&ffhttp_chunked_filter, &ffhttp_contlen_filter, &ffhttp_connclose_filter
 };
+
+
+/* Content-Encoding decoder.
+Input is the output of the transfer filter (pointing into the receive buffer),
+ it's decoded directly into the decoder's buffer, which is passed to the user. */
+
+#define HTTP_CE_BUFSIZE  (64 * 1024)
+
+enum HTTP_GZ {
+	GZ_HDR, // fixed 10-byte header
+	GZ_EXTRA_LEN,
+	GZ_EXTRA,
+	GZ_NAME,
+	GZ_COMMENT,
+	GZ_HCRC,
+	GZ_DATA,
+};
+
+struct http_ce {
+	ffuint gz_state; // enum HTTP_GZ
+	ffuint gz_flags;
+	ffuint gz_n; // bytes in gz_hdr[]
+	ffuint gz_skip;
+	ffbyte gz_hdr[10];
+#ifdef FFHTTPCL_ZLIB
+	z_ctx *z;
+#endif
+#ifdef FFHTTPCL_ZSTD
+	zstd_decoder *zst;
+#endif
+	ffuint done :1;
+	char buf[HTTP_CE_BUFSIZE];
+};
+
+/** Get Accept-Encoding value for the supported decoders */
+static const char* http_ce_accept(void)
+{
+#if defined FFHTTPCL_ZLIB && defined FFHTTPCL_ZSTD
+	return "zstd, gzip";
+#elif defined FFHTTPCL_ZSTD
+	return "zstd";
+#elif defined FFHTTPCL_ZLIB
+	return "gzip";
+#else
+	return NULL;
+#endif
+}
+
+/** Create decoder for a single Content-Encoding
+Return NULL: the encoding isn't compiled in: the data is passed through as is;
+ (void*)-1: error */
+static void* http_ce_open(ffhttp_headers *h)
+{
+	struct http_ce *d;
+	ffuint gz = 0, zst = 0;
+#ifdef FFHTTPCL_ZLIB
+	gz = h->ce_gzip;
+#endif
+#ifdef FFHTTPCL_ZSTD
+	zst = h->ce_zstd;
+#endif
+	if (!(gz || zst))
+		return NULL;
+	if (NULL == (d = ffmem_new(struct http_ce)))
+		return (void*)-1;
+
+#ifdef FFHTTPCL_ZLIB
+	if (gz && 0 != z_inflate_init(&d->z, NULL))
+		goto err;
+#endif
+#ifdef FFHTTPCL_ZSTD
+	if (zst && 0 != zstd_decode_init(&d->zst, NULL))
+		goto err;
+#endif
+	return d;
+
+err:
+	ffmem_free(d);
+	return (void*)-1;
+}
+static void http_ce_close(void *p)
+{
+	struct http_ce *d = p;
+#ifdef FFHTTPCL_ZLIB
+	z_inflate_free(d->z);
+#endif
+#ifdef FFHTTPCL_ZSTD
+	zstd_decode_free(d->zst);
+#endif
+	ffmem_free(d);
+}
+
+/** Go to the next gzip header field present in the data */
+static void http_gz_next(struct http_ce *d)
+{
+	static const ffbyte flags[] = { 0, 4, 4, 8, 16, 2 }; // FEXTRA, FNAME, FCOMMENT, FHCRC
+	do {
+		d->gz_state++;
+	} while (d->gz_state != GZ_DATA && !(d->gz_flags & flags[d->gz_state]));
+	d->gz_n = 0;
+	if (d->gz_state == GZ_HCRC)
+		d->gz_skip = 2;
+}
+
+/** Skip gzip header (RFC 1952)
+Return 1: done;  0: need more data;  -1: bad header */
+static int http_gz_hdr(struct http_ce *d, ffstr *in)
+{
+	while (d->gz_state != GZ_DATA) {
+		if (in->len == 0)
+			return 0;
+
+		switch (d->gz_state) {
+		case GZ_HDR:
+		case GZ_EXTRA_LEN: {
+			ffuint need = (d->gz_state == GZ_HDR) ? 10 : 2;
+			ffuint n = ffmin(need - d->gz_n, in->len);
+			ffmem_copy(d->gz_hdr + d->gz_n, in->ptr, n);
+			ffstr_shift(in, n);
+			d->gz_n += n;
+			if (d->gz_n != need)
+				break;
+
+			if (d->gz_state == GZ_HDR) {
+				if (!(d->gz_hdr[0] == 0x1f && d->gz_hdr[1] == 0x8b && d->gz_hdr[2] == 8))
+					return -1;
+				d->gz_flags = d->gz_hdr[3];
+				http_gz_next(d);
+			} else {
+				d->gz_skip = d->gz_hdr[0] | (d->gz_hdr[1] << 8);
+				http_gz_next(d);
+			}
+			break;
+		}
+
+		case GZ_EXTRA:
+		case GZ_HCRC: {
+			ffuint n = ffmin(d->gz_skip, in->len);
+			ffstr_shift(in, n);
+			d->gz_skip -= n;
+			if (d->gz_skip == 0)
+				http_gz_next(d);
+			break;
+		}
+
+		case GZ_NAME:
+		case GZ_COMMENT: {
+			const char *z = ffmem_findbyte(in->ptr, in->len, '\0');
+			if (z == NULL) {
+				in->len = 0;
+				break;
+			}
+			ffstr_shift(in, z + 1 - in->ptr);
+			http_gz_next(d);
+			break;
+		}
+		}
+	}
+	return 1;
+}
+
+static int http_ce_process(void *p, ffstr *in, ffstr *out)
+{
+	struct http_ce *d = p;
+	ffstr empty = {};
+	ffuint fin = (in == NULL);
+	ffsize n = 0;
+	if (fin)
+		in = &empty;
+
+	out->len = 0;
+	if (d->done) {
+		in->len = 0; // gzip trailer
+		return (fin) ? FFHTTP_DONE : FFHTTP_OK;
+	}
+
+#ifdef FFHTTPCL_ZLIB
+	if (d->z != NULL) {
+		int r = http_gz_hdr(d, in);
+		if (r < 0)
+			return FFHTTP_ECE;
+		else if (r == 0)
+			return (fin) ? FFHTTP_ECE_FIN : FFHTTP_OK;
+
+		size_t len = in->len;
+		r = z_inflate(d->z, in->ptr, &len, d->buf, sizeof(d->buf), 0);
+		ffstr_shift(in, len);
+		if (r == Z_DONE) {
+			d->done = 1;
+			in->len = 0;
+			return (fin) ? FFHTTP_DONE : FFHTTP_OK;
+		} else if (r < 0) {
+			return FFHTTP_ECE;
+		}
+		n = r;
+	}
+#endif
+
+#ifdef FFHTTPCL_ZSTD
+	if (d->zst != NULL) {
+		zstd_buf zin = {}, zout = {};
+		zstd_buf_set(&zin, in->ptr, in->len);
+		zstd_buf_set(&zout, d->buf, sizeof(d->buf));
+		int r = zstd_decode(d->zst, &zin, &zout);
+		if (r < 0)
+			return FFHTTP_ECE;
+		ffstr_shift(in, zin.pos);
+		n = zout.pos;
+		if (r == 0 && n != sizeof(d->buf)) {
+			d->done = 1; // the frame is complete and flushed
+			ffstr_set(out, d->buf, n);
+			return (fin) ? FFHTTP_MORE : FFHTTP_OK;
+		}
+	}
+#endif
+
+	ffstr_set(out, d->buf, n);
+	if (n == sizeof(d->buf))
+		return FFHTTP_MORE;
+	if (n == 0 && fin)
+		return FFHTTP_ECE_FIN;
+	return FFHTTP_OK;
+}
+
+static const struct ffhttp_filter ffhttp_ce_filter = { &http_ce_open, &http_ce_close, &http_ce_process };
 static int http_prepreq(http *c, ffstr *dst);
 static int http_parse(http *c);
 static int http_recvbody(http *c, ffuint tcpfin);
 
 
+static void conn_free(struct httpcl_conn *k);
+static void host_addr_free(void);
+
 void ffhttpcl_deinit()
 {
 	http *c;
@@ -236,6 +556,57 @@ void ffhttpcl_deinit()
 		c = FF_GETPTR(http, recycled, c);
 		ffmem_free(c);
 	}
+
+	struct httpcl_conn *k;
+	struct httpcl_pool *p, **pp;
+	fflock_lock(&httpcl_pools.lock);
+	for (pp = &httpcl_pools.list;  NULL != (p = *pp);  ) {
+		while (NULL != (k = p->idle)) {
+			p->idle = k->next;
+			conn_free(k);
+		}
+		p->st.idle = 0;
+		while (NULL != (k = p->free)) {
+			p->free = k->next;
+			ffmem_free(k);
+		}
+
+		if (p->nconn != 0) {
+			pp = &p->next;
+			continue;
+		}
+		*pp = p->next;
+		ffmem_free(p);
+	}
+	fflock_unlock(&httpcl_pools.lock);
+
+	host_addr_free();
+}
+
+void ffhttpcl_pool_conf(const struct ffhttpcl_pool_conf *conf)
+{
+	httpcl_pools.conf = *conf;
+	if (httpcl_pools.conf.idle_timeout == 0)
+		httpcl_pools.conf.idle_timeout = 60000;
+	if (httpcl_pools.conf.max_pipeline == 0)
+		httpcl_pools.conf.max_pipeline = 4;
+	if (httpcl_pools.conf.time == NULL)
+		httpcl_pools.conf.max_idle = 0;
+}
+
+void ffhttpcl_pool_stats(struct ffhttpcl_pool_stats *st)
+{
+	ffmem_zero_obj(st);
+	fflock_lock(&httpcl_pools.lock);
+	for (const struct httpcl_pool *p = httpcl_pools.list;  p != NULL;  p = p->next) {
+		st->requests += p->st.requests;
+		st->hits += p->st.hits;
+		st->pipelined += p->st.pipelined;
+		st->connects += p->st.connects;
+		st->stale += p->st.stale;
+		st->idle += p->st.idle;
+	}
+	fflock_unlock(&httpcl_pools.lock);
 }
 
 
@@ -297,7 +668,6 @@ void* ffhttpcl_request(const char *method, const char *url, ffuint flags)
 		c = FF_GETPTR(http, recycled, c);
 	else if (NULL == (c = ffmem_new(http)))
 		return NULL;
-	c->sk = FF_BADSKT;
 	ffhttp_resp_init(&c->resp);
 	c->conf.log = &log_empty;
 	c->conf.timer = &timer_empty;
@@ -321,6 +691,7 @@ void* ffhttpcl_request(const char *method, const char *url, ffuint flags)
 	c->conf.nbuffers = 2;
 	c->conf.buffer_size = 16 * 1024;
 	c->conf.connect_timeout = 1500;
+	c->conf.connect_delay = 250;
 	c->conf.timeout = 5000;
 	c->conf.max_redirect = 10;
 	c->conf.max_reconnect = 3;
@@ -342,17 +713,17 @@ void ffhttpcl_close(void *con)
 
 	if (c->f.p != NULL)
 		c->f.iface->close(c->f.p);
-
-	FF_SAFECLOSE(c->addr, NULL, ffaddr_free);
-	if (c->sk != FF_BADSKT) {
-		ffskt_fin(c->sk);
-		ffskt_close(c->sk);
-		c->sk = FF_BADSKT;
-	}
+	if (c->ce.p != NULL)
+		c->ce.iface->close(c->ce.p);
+
+	dns_cancel(c);
+	he_close(c);
+	ffvec_free(&c->addrs);
+	conn_close(c);
+	ffmem_free(c->conn_key);
 	ffvec_free(&c->target_url);
 	ffstr_free(&c->orig_target_url);
 	ffmem_free(c->method);
-	ffaio_fin(&c->aio);
 	ffvec_free(&c->hdrs);
 
 	if (c->bufs != NULL) {
@@ -362,12 +733,11 @@ void ffhttpcl_close(void *con)
 		}
 	}
 	ffmem_safefree(c->bufs);
+	ffmem_free(c->bufcap);
 
 	ffstr_free(&c->hbuf);
 
-	ffuint inst = c->aio.instance;
 	ffmem_zero_obj(c);
-	c->aio.instance = inst;
 	fflist1_push(&recycled_cons, &c->recycled);
 }
 
@@ -388,8 +758,8 @@ void ffhttpcl_sethandler(void *con, ffhttpcl_handler func, void *udata)
 }
 
 enum {
-	I_START, I_ADDR, I_NEXTADDR, I_CONN,
-	I_HTTP_REQ, I_HTTP_REQ_SEND, I_HTTP_RESP, I_HTTP_RESP_PARSE, I_HTTP_RECVBODY, I_HTTP_RESPBODY,
+	I_START, I_ADDR, I_DNS_WAIT, I_CONN,
+	I_HTTP_REQ, I_HTTP_REQ_SEND, I_HTTP_REQ_BODY, I_PIPE_WAIT, I_HTTP_RESP, I_HTTP_RESP_PARSE, I_HTTP_RECVBODY, I_HTTP_RESPBODY,
 	I_DONE, I_ERR, I_ERR2, I_NOOP,
 };
 
@@ -403,16 +773,17 @@ static void call_handler(http *c, ffuint status)
 static void httpcl_process(http *c)
 {
 	int r;
-	ffaddr a = {};
 
 	for (;;) {
 	switch (c->state) {
 
 	case I_START:
-		if (NULL == (c->bufs = ffmem_callocT(c->conf.nbuffers, ffstr))) {
+		if (NULL == (c->bufs = ffmem_callocT(c->conf.nbuffers, ffstr))
+			|| NULL == (c->bufcap = ffmem_callocT(c->conf.nbuffers, ffsize))) {
 			c->state = I_ERR;
 			continue;
 		}
+		c->bufsize = c->conf.buffer_size;
 		if (0 != tcp_alloc(c, c->conf.buffer_size)) {
 			c->state = I_ERR;
 			continue;
@@ -422,28 +793,35 @@ static void httpcl_process(http *c)
 		return;
 
 	case I_ADDR:
-		if (0 != ip_resolve(c)) {
+		r = ip_resolve(c);
+		if (r < 0) {
 			c->state = I_ERR;
 			continue;
+		} else if (r == 1) {
+			// keep-alive connection
+			c->state = I_HTTP_REQ;
+			call_handler(c, FFHTTPCL_REQ_WAIT);
+			return;
+		} else if (r == 2) {
+			c->state = I_DNS_WAIT;
+			return;
 		}
-		c->state = I_NEXTADDR;
+		c->state = I_CONN;
 		call_handler(c, FFHTTPCL_IP_WAIT);
 		return;
 
-	case I_NEXTADDR:
-		if (0 != (r = tcp_prepare(c, &a))) {
-			c->state = I_ERR2;
-			continue;
-		}
-		c->state = I_CONN;
-		//fallthrough
+	case I_DNS_WAIT:
+		return; // dns_onresolve() or gai_done() will continue
 
 	case I_CONN:
-		r = tcp_connect(c, &a.a, a.len);
+		r = tcp_connect(c);
 		if (r == R_ASYNC)
 			return;
-		else if (r == R_MORE) {
-			c->state = I_NEXTADDR;
+		else if (r == R_ERR) {
+			tcp_ioerr(c);
+			continue;
+		} else if (r != 0) {
+			c->state = I_ERR2;
 			continue;
 		}
 		c->state = I_HTTP_REQ;
@@ -466,13 +844,37 @@ static void httpcl_process(http *c)
 			tcp_ioerr(c);
 			continue;
 		}
+		c->state = I_HTTP_REQ_BODY;
+		//fallthrough
+
+	case I_HTTP_REQ_BODY:
+		if (c->body_on) {
+			r = tcp_send_body(c);
+			if (r == R_ASYNC || r == R_MORE)
+				return;
+			else if (r == R_ERR) {
+				tcp_ioerr(c);
+				continue;
+			} else if (r != 0) {
+				c->state = I_ERR;
+				continue;
+			}
+		}
 
+		c->conn->writer = NULL;
 		dbglog("receiving response...");
 		ffstr_set(&c->data, c->bufs[0].ptr, c->conf.buffer_size);
 		c->state = I_HTTP_RESP;
+		if (c->conn->first != c)
+			c->state = I_PIPE_WAIT;
 		call_handler(c, FFHTTPCL_RESP_WAIT);
 		return;
 
+	case I_PIPE_WAIT:
+		dbglog("waiting for the previous response on the connection...");
+		c->pipe_wait = 1;
+		return;
+
 	case I_HTTP_RESP:
 		r = tcp_recvhdrs(c);
 		if (r == R_ASYNC)
@@ -502,6 +904,8 @@ static void httpcl_process(http *c)
 			if (c->flags & FFHTTPCL_NOREDIRECT)
 				break;
 			c->state = I_ADDR;
+			if (0 != body_rewind(c))
+				c->state = I_ERR;
 			continue;
 		}
 
@@ -522,6 +926,23 @@ static void httpcl_process(http *c)
 					break;
 				}
 			}
+
+			if (c->ce_accept) {
+				void *d;
+				if (c->resp.h.ce_multi) {
+					errlog("more than 1 Content-Encoding isn't supported");
+					c->state = I_ERR;
+					continue;
+				} else if ((void*)-1 == (d = ffhttp_ce_filter.open(&c->resp.h))) {
+					syserrlog("%s", "Content-Encoding decoder open");
+					c->state = I_ERR;
+					continue;
+				} else if (d != NULL) {
+					dbglog("opened Content-Encoding decoder");
+					c->ce.iface = &ffhttp_ce_filter;
+					c->ce.p = d;
+				}
+			}
 		}
 
 		ffstr_set2(&c->data, &c->bufs[0]);
@@ -547,8 +968,14 @@ static void httpcl_process(http *c)
 			case -1:
 				c->state = I_ERR;
 				continue;
+			case 0:
+				c->state = I_DONE;
+				break;
+			default:
+				c->state = I_HTTP_RESPBODY; // the decoder has more data
+				call_handler(c, FFHTTPCL_RESP_RECV);
+				return;
 			}
-			c->state = I_DONE;
 			call_handler(c, FFHTTPCL_RESP_RECV);
 			continue;
 		} else if (r == R_MORE) {
@@ -572,7 +999,7 @@ static void httpcl_process(http *c)
 			call_handler(c, FFHTTPCL_RESP_RECV);
 			continue;
 		}
-		if (c->data.len == 0)
+		if (c->data.len == 0 && r != 2)
 			c->state = I_HTTP_RECVBODY;
 		call_handler(c, FFHTTPCL_RESP_RECV);
 		return;
@@ -580,6 +1007,10 @@ static void httpcl_process(http *c)
 	case I_ERR:
 	case I_DONE: {
 		ffuint r = (c->state == I_ERR) ? FFHTTPCL_ERR : FFHTTPCL_DONE;
+		if (c->state == I_DONE)
+			conn_release(c);
+		else
+			conn_close(c);
 		c->state = I_NOOP;
 		call_handler(c, r);
 		return;
@@ -610,173 +1041,961 @@ int ffhttpcl_recv(void *con, ffhttp_response **resp, ffstr *data)
 	return c->status;
 }
 
-void ffhttpcl_header(void *con, const ffstr *name, const ffstr *val, ffuint flags)
+/** Point 's' to the same offset in 'to' if it references the memory region of buffer 'from' */
+static void buf_rebase(ffstr *s, const char *from, ffsize cap, char *to)
 {
-	http *c = con;
-	ffvec_addfmt(&c->hdrs, "%S: %S\r\n", name, val);
+	if (from <= s->ptr && s->ptr < from + cap)
+		s->ptr = to + (s->ptr - from);
 }
 
-
-static int ip_resolve(http *c)
+int ffhttpcl_recv_detach(void *con, ffstr *buf)
 {
-	char *hostz;
-	int r;
+	http *c = con;
+	const char *p = c->outdata.ptr;
+	ffuint i;
+	if (p == NULL || c->bufs == NULL)
+		return -1;
 
-	ffurl_init(&c->url);
-	if (0 != (r = ffurl_parse(&c->url, c->target_url.ptr, c->target_url.len))) {
-		errlog("URL parse: %S: %s"
-			, &c->target_url, ffurl_errstr(r));
-		goto done;
+	for (i = 0;  i != c->conf.nbuffers;  i++) {
+		if (c->bufs[i].ptr <= p && p < c->bufs[i].ptr + c->bufcap[i])
+			break;
 	}
-	if (c->url.port == 0)
-		c->url.port = 80;
+	if (i == c->conf.nbuffers)
+		return -1;
 
-	if (c->conf.proxy.host == NULL) {
-		ffstr host = ffurl_get(&c->url, c->target_url.ptr, FFURL_HOST);
-		ffstr_set2(&c->hostname, &host);
-		c->hostport = c->url.port;
-		r = ffurl_parse_ip(&c->url, c->target_url.ptr, &c->ip);
-	} else {
-		ffstr_setz(&c->hostname, c->conf.proxy.host);
-		c->hostport = c->conf.proxy.port;
-		r = ffip_parse(c->hostname.ptr, c->hostname.len, &c->ip);
-		c->flags |= FFHTTPCL_NOREDIRECT;
-	}
+	ffstr *b = &c->bufs[i], nb;
+	ffsize cap = c->bufcap[i];
+	if (i == c->wbuf && c->conn != NULL && c->conn->aio.rpending)
+		return -1; // the buffer is being filled
 
-	if (r < 0) {
-		errlog("bad IP address: %S", &c->hostname);
-		goto done;
-	} else if (r != 0) {
-		ffip_list_set(&c->iplist, r, &c->ip);
-		ffip_iter_set(&c->curaddr, &c->iplist, NULL);
-		return 0;
-	}
+	if (NULL == ffstr_alloc(&nb, cap))
+		return -1;
 
-	if (NULL == (hostz = ffsz_alcopystr(&c->hostname))) {
-		syserrlog("%s", ffmem_alloc_S);
-		goto done;
+	// Copy to the new buffer only the bytes the client still needs;
+	//  the returned data stays in the old buffer.
+	// Received but not yet processed data:
+	ffsize filled = b->len;
+	if (i == c->wbuf)
+		filled = ffmax(filled, c->curtcp_len);
+	if (filled != 0)
+		ffmem_copy(nb.ptr, b->ptr, filled);
+	if (c->data.len != 0 && b->ptr <= c->data.ptr && c->data.ptr < b->ptr + cap) {
+		ffmem_copy(nb.ptr + (c->data.ptr - b->ptr), c->data.ptr, c->data.len);
+		buf_rebase(&c->data, b->ptr, cap, nb.ptr);
 	}
 
-	infolog("resolving host %S...", &c->hostname);
-	r = ffaddr_info(&c->addr, hostz, NULL, 0);
-	ffmem_free(hostz);
-	if (r != 0) {
-		syserrlog("%s", ffaddr_info_S);
-		goto done;
-	}
-	ffip_iter_set(&c->curaddr, NULL, c->addr);
-
-	if (c->conf.debug_log) {
-		ffsize n;
-		char buf[FF_MAXIP6];
-		ffip_iter it;
-		ffip_iter_set(&it, NULL, c->addr);
-		ffuint fam;
-		void *ip;
-		while (0 != (fam = ffip_next(&it, &ip))) {
-			n = ffip_tostr(buf, sizeof(buf), fam, ip, 0);
-			dbglog("%*s", n, buf);
-		}
+	// Response headers: 'resp' references them until the next request
+	if (i == 0 && c->resp.h.len != 0) {
+		ffmem_copy(nb.ptr, b->ptr, c->resp.h.len);
+		buf_rebase(&c->resp.h.raw_headers, b->ptr, c->resp.h.len, nb.ptr);
+		buf_rebase(&c->resp.status, b->ptr, c->resp.h.len, nb.ptr);
+		buf_rebase(&c->resp.content_type, b->ptr, c->resp.h.len, nb.ptr);
 	}
 
+	ffstr_set(buf, b->ptr, cap);
+	nb.len = b->len;
+	*b = nb;
+	c->outdata.ptr = NULL;
 	return 0;
+}
 
-done:
-	return -1;
+void ffhttpcl_header(void *con, const ffstr *name, const ffstr *val, ffuint flags)
+{
+	http *c = con;
+	ffvec_addfmt(&c->hdrs, "%S: %S\r\n", name, val);
+}
+
+void ffhttpcl_body(void *con, const struct ffhttpcl_body *body)
+{
+	http *c = con;
+	FF_ASSERT(body->fd == FF_BADFD || body->len >= 0);
+	c->body = *body;
+	c->body_on = 1;
 }
 
 
-static int tcp_alloc(http *c, ffsize size)
+/** Per-host address which was connected to the last time */
+static struct {
+	struct {
+		char *host;
+		ffip6 ip;
+	} ent[64];
+	ffuint next; // slot to replace
+} httpcl_hosts;
+
+static const ffip6* host_addr_find(const ffstr *host)
 {
-	ffuint i;
-	for (i = 0;  i != c->conf.nbuffers;  i++) {
-		if (NULL == (ffstr_alloc(&c->bufs[i], size))) {
-			syserrlog("%s", ffmem_alloc_S);
-			return -1;
-		}
+	for (ffuint i = 0;  i != FF_COUNT(httpcl_hosts.ent);  i++) {
+		if (httpcl_hosts.ent[i].host != NULL
+			&& ffstr_ieqz(host, httpcl_hosts.ent[i].host))
+			return &httpcl_hosts.ent[i].ip;
 	}
-	return 0;
+	return NULL;
 }
 
-static int tcp_prepare(http *c, ffaddr *a)
+static void host_addr_set(const ffstr *host, const ffip6 *ip)
 {
-	void *ip;
+	ffip6 *p = (ffip6*)host_addr_find(host);
+	if (p == NULL) {
+		char *s;
+		if (NULL == (s = ffsz_dupstr(host)))
+			return;
+		ffuint i = httpcl_hosts.next;
+		httpcl_hosts.next = (i + 1) % FF_COUNT(httpcl_hosts.ent);
+		ffmem_free(httpcl_hosts.ent[i].host);
+		httpcl_hosts.ent[i].host = s;
+		p = &httpcl_hosts.ent[i].ip;
+	}
+	*p = *ip;
+}
+
+static void host_addr_free(void)
+{
+	for (ffuint i = 0;  i != FF_COUNT(httpcl_hosts.ent);  i++) {
+		ffmem_free(httpcl_hosts.ent[i].host);
+		httpcl_hosts.ent[i].host = NULL;
+	}
+}
+
+static void addr_add(http *c, int family, const void *ip)
+{
+	ffip6 *a;
+	if (NULL == (a = ffvec_pushT(&c->addrs, ffip6)))
+		return;
+	if (family == AF_INET)
+		ffip6_v4mapped_set(a, ip);
+	else
+		ffmem_copy(a, ip, sizeof(ffip6));
+}
+
+/** Add addresses returned by getaddrinfo() */
+static void addr_add_info(http *c, ffaddrinfo *ai)
+{
+	ffip_iter it;
+	ffip_iter_set(&it, NULL, ai);
 	int family;
-	while (0 != (family = ffip_next(&c->curaddr, &ip))) {
+	void *ip;
+	while (0 != (family = ffip_next(&it, &ip))) {
+		addr_add(c, family, ip);
+	}
+}
 
-		ffaddr_setip(a, family, ip);
-		ffip_setport(a, c->hostport);
+/** Order addresses to connect to (RFC 8305):
+ the address which worked for this host the last time, then IPv6 and IPv4 interleaved */
+static void addr_sort(http *c)
+{
+	ffvec v = {};
+	const ffip6 *a = (ffip6*)c->addrs.ptr, *best;
+	ffsize n = c->addrs.len, i6 = 0, i4 = 0;
 
-		char saddr[FF_MAXIP6];
-		ffsize n = ffaddr_tostr(a, saddr, sizeof(saddr), FFADDR_USEPORT);
-		infolog("connecting to %S (%*s)...", &c->hostname, n, saddr);
+	if (n <= 1
+		|| NULL == ffvec_allocT(&v, n, ffip6))
+		return;
 
-		if (FF_BADSKT == (c->sk = ffskt_create(family, SOCK_STREAM | SOCK_NONBLOCK, IPPROTO_TCP))) {
-			syswarnlog("%s", ffskt_create_S);
-			ffskt_close(c->sk);
-			c->sk = FF_BADSKT;
-			continue;
+	if (NULL != (best = host_addr_find(&c->hostname))) {
+		for (ffsize i = 0;  i != n;  i++) {
+			if (!ffmem_cmp(&a[i], best, sizeof(ffip6))) {
+				*ffvec_pushT(&v, ffip6) = *best;
+				break;
+			}
 		}
+		if (v.len == 0)
+			best = NULL;
+	}
 
-		if (0 != ffskt_setopt(c->sk, IPPROTO_TCP, TCP_NODELAY, 1))
-			syswarnlog("%s", ffskt_setopt_S);
-
-		ffaio_init(&c->aio);
-		c->aio.sk = c->sk;
-		c->aio.udata = c;
-		if (0 != ffaio_attach(&c->aio, c->conf.kq, FFKQU_READ | FFKQU_WRITE)) {
-			syserrlog("%s", ffkqu_attach_S);
-			return FFHTTPCL_ERR;
+	for (;;) {
+		while (i6 != n && (ffip6_v4mapped(&a[i6]) || (best != NULL && !ffmem_cmp(&a[i6], best, sizeof(ffip6))))) {
+			i6++;
 		}
-		return 0;
+		while (i4 != n && (!ffip6_v4mapped(&a[i4]) || (best != NULL && !ffmem_cmp(&a[i4], best, sizeof(ffip6))))) {
+			i4++;
+		}
+		if (i6 == n && i4 == n)
+			break;
+		if (i6 != n)
+			*ffvec_pushT(&v, ffip6) = a[i6++];
+		if (i4 != n)
+			*ffvec_pushT(&v, ffip6) = a[i4++];
 	}
 
-	errlog("no next address to connect");
-	return FFHTTPCL_ENOADDR;
+	ffvec_free(&c->addrs);
+	c->addrs = v;
+	c->addr_i = 0;
 }
 
-static void tcp_aio(void *udata)
+static void addr_log(http *c)
 {
-	http *c = udata;
-	c->async = 0;
-	c->conf.timer(&c->tmr, 0);
-	httpcl_process(c);
+	if (!c->conf.debug_log)
+		return;
+
+	const ffip6 *ip;
+	FFSLICE_WALK(&c->addrs, ip) {
+		char buf[FFIP6_STRLEN];
+		ffsize n = ffip46_tostr(ip, buf, sizeof(buf));
+		dbglog("%*s", n, buf);
+	}
 }
 
-static int tcp_connect(http *c, const struct sockaddr *addr, socklen_t addr_size)
+static void dns_onresolve(void *udata, const ffdnscl_result *res)
 {
-	int r;
-	r = ffaio_connect(&c->aio, &tcp_aio, addr, addr_size);
-	if (r == FFAIO_ERROR) {
-		syswarnlog("%s", ffskt_connect_S);
-		ffskt_close(c->sk);
-		c->sk = FF_BADSKT;
-		ffaio_fin(&c->aio);
-		return R_MORE;
-
-	} else if (r == FFAIO_ASYNC) {
-		c->async = 1;
-		c->conf.timer(&c->tmr, c->conf.connect_timeout);
-		return R_ASYNC;
+	http *c = udata;
+	c->dns_wait = 0;
+
+	if (res->status != FFDNS_NOERROR) {
+		errlog("%S: DNS: %s"
+			, &c->hostname, (res->status < 0) ? "internal error" : ffdns_rcode_str(res->status));
+	} else if (res->ip.len == 0) {
+		errlog("%S: DNS: no addresses", &c->hostname);
+	} else if (0 == ffvec_add(&c->addrs, res->ip.ptr, res->ip.len, sizeof(ffip6))) {
+		syserrlog("%s", ffmem_alloc_S);
 	}
+	addr_log(c);
+	addr_sort(c);
 
-	dbglog("%s ok", ffskt_connect_S);
-	FF_SAFECLOSE(c->addr, NULL, ffaddr_free);
-	ffmem_zero_obj(&c->curaddr);
-	return 0;
+	if (c->dns_sync)
+		return; // ip_resolve() will check the result
+
+	if (c->addrs.len == 0) {
+		c->state = I_ERR;
+		httpcl_process(c);
+		return;
+	}
+	c->state = I_CONN;
+	call_handler(c, FFHTTPCL_IP_WAIT);
 }
 
-static void tcp_ontmr(void *param)
+/** Resolve hostname via ffdnsclient
+Return 0 on success;  2: in progress;  -1 on error */
+static int dns_resolve(http *c)
 {
-	http *c = param;
-	warnlog("I/O timeout", 0);
-	c->async = 0;
-	tcp_ioerr(c);
-	httpcl_process(c);
+	ffstr host = FFSTR_INITSTR(&c->hostname);
+	c->dns_wait = 1;
+	c->dns_sync = 1;
+	ffdnscl_resolve(c->conf.dns, host, &dns_onresolve, c, 0);
+	c->dns_sync = 0;
+	if (c->dns_wait)
+		return 2;
+	return (c->addrs.len != 0) ? 0 : -1;
 }
 
-static int tcp_recvhdrs(http *c)
-{
+/** getaddrinfo() task data: ffthpool_task.ext */
+struct httpcl_gai {
+	http *c; // NULL: the request is closed
+	ffhttpcl_post post;
+	ffaddrinfo *addr;
+	int err;
+	char host[0];
+};
+
+/** getaddrinfo() is complete: continue on kqueue thread */
+static void gai_done(void *param)
+{
+	ffthpool_task *t = param;
+	struct httpcl_gai *g = (void*)t->ext;
+	http *c = g->c;
+	if (c == NULL) {
+		FF_SAFECLOSE(g->addr, NULL, ffaddr_free);
+		ffthpool_task_free(t);
+		return;
+	}
+
+	c->gai = NULL;
+	int err = g->err;
+	if (err == 0) {
+		addr_add_info(c, g->addr);
+		ffaddr_free(g->addr);
+	}
+	ffthpool_task_free(t);
+
+	if (err != 0) {
+		fferr_set(err);
+		syserrlog("%s", ffaddr_info_S);
+		c->state = I_ERR;
+		httpcl_process(c);
+		return;
+	}
+
+	addr_log(c);
+	addr_sort(c);
+	c->state = I_CONN;
+	call_handler(c, FFHTTPCL_IP_WAIT);
+}
+
+/** Worker thread */
+static void gai_task(ffthpool_task *t)
+{
+	struct httpcl_gai *g = (void*)t->ext;
+	if (0 != ffaddr_info(&g->addr, g->host, NULL, 0))
+		g->err = fferr_last();
+	g->post(&gai_done, t);
+}
+
+/** Call getaddrinfo() on thread pool
+Return 2: in progress;  -1: can't add task */
+static int gai_resolve(http *c)
+{
+	ffthpool_task *t;
+	if (NULL == (t = ffthpool_task_new(sizeof(struct httpcl_gai) + c->hostname.len + 1)))
+		return -1;
+	struct httpcl_gai *g = (void*)t->ext;
+	ffmem_zero_obj(g);
+	g->c = c;
+	g->post = c->conf.post;
+	ffsz_copyn(g->host, c->hostname.len + 1, c->hostname.ptr, c->hostname.len);
+	t->handler = &gai_task;
+
+	if (0 != ffthpool_add(c->conf.thpool, t)) {
+		ffthpool_task_free(t);
+		return -1;
+	}
+	c->gai = t; // our reference is released by gai_done()
+	return 2;
+}
+
+/** Stop waiting for DNS result */
+static void dns_cancel(http *c)
+{
+	if (c->dns_wait) {
+		ffstr host = FFSTR_INITSTR(&c->hostname);
+		ffdnscl_resolve(c->conf.dns, host, &dns_onresolve, c, FFDNSCL_CANCEL);
+		c->dns_wait = 0;
+	}
+
+	if (c->gai != NULL) {
+		struct httpcl_gai *g = (void*)c->gai->ext;
+		g->c = NULL; // gai_done() will free the task
+		c->gai = NULL;
+	}
+}
+
+/**
+Return 0 on success;
+ 1: using keep-alive connection;
+ 2: resolving asynchronously;
+ -1 on error */
+static int ip_resolve(http *c)
+{
+	char *hostz;
+	ffaddrinfo *ai;
+	int r;
+
+	c->addrs.len = 0;
+	c->addr_i = 0;
+
+	ffurl_init(&c->url);
+	if (0 != (r = ffurl_parse(&c->url, c->target_url.ptr, c->target_url.len))) {
+		errlog("URL parse: %S: %s"
+			, &c->target_url, ffurl_errstr(r));
+		goto done;
+	}
+	if (c->url.port == 0)
+		c->url.port = 80;
+
+	if (c->conf.proxy.host == NULL) {
+		ffstr host = ffurl_get(&c->url, c->target_url.ptr, FFURL_HOST);
+		ffstr_set2(&c->hostname, &host);
+		c->hostport = c->url.port;
+		r = ffurl_parse_ip(&c->url, c->target_url.ptr, &c->ip);
+	} else {
+		ffstr_setz(&c->hostname, c->conf.proxy.host);
+		c->hostport = c->conf.proxy.port;
+		r = ffip_parse(c->hostname.ptr, c->hostname.len, &c->ip);
+		c->flags |= FFHTTPCL_NOREDIRECT;
+	}
+
+	if (r < 0) {
+		errlog("bad IP address: %S", &c->hostname);
+		goto done;
+	}
+
+	if (0 == conn_get(c))
+		return 1;
+
+	if (r != 0) {
+		addr_add(c, r, &c->ip);
+		return 0;
+	}
+
+	infolog("resolving host %S...", &c->hostname);
+
+	if (c->conf.dns != NULL && c->conf.dns->curserv != NULL)
+		return dns_resolve(c);
+
+	if (c->conf.thpool != NULL
+		&& 2 == gai_resolve(c))
+		return 2;
+
+	if (NULL == (hostz = ffsz_alcopystr(&c->hostname))) {
+		syserrlog("%s", ffmem_alloc_S);
+		goto done;
+	}
+
+	r = ffaddr_info(&ai, hostz, NULL, 0);
+	ffmem_free(hostz);
+	if (r != 0) {
+		syserrlog("%s", ffaddr_info_S);
+		goto done;
+	}
+	addr_add_info(c, ai);
+	ffaddr_free(ai);
+	addr_log(c);
+	addr_sort(c);
+	return 0;
+
+done:
+	return -1;
+}
+
+
+static int tcp_alloc(http *c, ffsize size)
+{
+	ffuint i;
+	for (i = 0;  i != c->conf.nbuffers;  i++) {
+		if (NULL == (ffstr_alloc(&c->bufs[i], size))) {
+			syserrlog("%s", ffmem_alloc_S);
+			return -1;
+		}
+		c->bufcap[i] = size;
+	}
+	return 0;
+}
+
+static ffuint64 pool_time_ms(void)
+{
+	fftime t = httpcl_pools.conf.time();
+	return (ffuint64)fftime_sec(&t) * 1000 + fftime_msec(&t);
+}
+
+/** Get (create) the pool for the kernel queue */
+static struct httpcl_pool* pool_get(fffd kq)
+{
+	struct httpcl_pool *p;
+	fflock_lock(&httpcl_pools.lock);
+	for (p = httpcl_pools.list;  p != NULL;  p = p->next) {
+		if (p->kq == kq)
+			goto end;
+	}
+	if (NULL == (p = ffmem_new(struct httpcl_pool)))
+		goto end;
+	p->kq = kq;
+	p->next = httpcl_pools.list;
+	httpcl_pools.list = p;
+
+end:
+	fflock_unlock(&httpcl_pools.lock);
+	return p;
+}
+
+static struct httpcl_conn* conn_alloc(http *c)
+{
+	struct httpcl_pool *p;
+	struct httpcl_conn *k;
+	if (NULL == (p = pool_get(c->conf.kq)))
+		return NULL;
+	if (NULL != (k = p->free))
+		p->free = k->next;
+	else if (NULL == (k = ffmem_new(struct httpcl_conn)))
+		return NULL;
+	k->next = NULL;
+	k->sk = FF_BADSKT;
+	k->pool = p;
+	p->nconn++;
+	return k;
+}
+
+/** Close socket and recycle the object */
+static void conn_free(struct httpcl_conn *k)
+{
+	if (k->sk != FF_BADSKT) {
+		ffskt_fin(k->sk);
+		ffskt_close(k->sk);
+	}
+	ffaio_fin(&k->aio);
+	ffmem_free(k->key);
+	ffvec_free(&k->leftover);
+
+	ffuint inst = k->aio.instance;
+	struct httpcl_pool *p = k->pool;
+	ffmem_zero_obj(k);
+	k->aio.instance = inst;
+	k->pool = p;
+	k->next = p->free;
+	p->free = k;
+	p->nconn--;
+}
+
+static void conn_list_rm(struct httpcl_conn **list, struct httpcl_conn *k)
+{
+	for (struct httpcl_conn **pk = list;  *pk != NULL;  pk = &(*pk)->next) {
+		if (*pk == k) {
+			*pk = k->next;
+			k->next = NULL;
+			return;
+		}
+	}
+}
+
+/** Check whether the server hasn't closed the idle connection and hasn't sent anything */
+static int conn_alive(struct httpcl_conn *k)
+{
+	char b;
+	ffssize r = recv(k->sk, &b, 1, MSG_PEEK);
+	return (r < 0 && fferr_again(fferr_last()));
+}
+
+/** Add request to the connection's queue */
+static void conn_attach(http *c, struct httpcl_conn *k)
+{
+	c->conn = k;
+	c->pipe_next = NULL;
+	if (k->last != NULL)
+		k->last->pipe_next = c;
+	else
+		k->first = c;
+	k->last = c;
+	k->writer = c;
+	k->nreq++;
+}
+
+static int http_idempotent(http *c)
+{
+	return (c->flags & FFHTTPCL_PIPELINE)
+		&& !c->body_on
+		&& (ffsz_eq(c->method, "GET") || ffsz_eq(c->method, "HEAD"));
+}
+
+/** Find a keep-alive connection to the server: an idle one or, for pipelining, a busy one
+Return 0: the connection is assigned to 'c' */
+static int conn_get(http *c)
+{
+	struct httpcl_pool *p;
+	struct httpcl_conn *k, **pk;
+	char *key;
+	int rc = -1;
+
+	ffmem_free(c->conn_key);
+	c->conn_key = NULL;
+	if (httpcl_pools.conf.max_idle == 0
+		|| NULL == (p = pool_get(c->conf.kq)))
+		return -1;
+	p->st.requests++;
+
+	if (NULL == (key = ffsz_allocfmt("%c|%S:%u"
+		, (c->conf.proxy.host != NULL) ? 'p' : 'd', &c->hostname, c->hostport)))
+		return -1;
+	ffuint64 now = pool_time_ms();
+
+	for (pk = &p->idle;  NULL != (k = *pk);  ) {
+		ffuint expired = (now - k->idle_since >= httpcl_pools.conf.idle_timeout);
+		if (!expired && !ffsz_eq(k->key, key)) {
+			pk = &k->next;
+			continue;
+		}
+
+		*pk = k->next;
+		p->st.idle--;
+		if (expired || !conn_alive(k)) {
+			dbglog("closing stale connection %s", k->key);
+			p->st.stale++;
+			conn_free(k);
+			continue;
+		}
+
+		dbglog("reusing idle connection %s", key);
+		p->st.hits++;
+		k->next = p->busy;
+		p->busy = k;
+		conn_attach(c, k);
+		rc = 0;
+		goto end;
+	}
+
+	if (http_idempotent(c)) {
+		for (k = p->busy;  k != NULL;  k = k->next) {
+			if (k->writer != NULL || k->broken
+				|| k->nreq >= httpcl_pools.conf.max_pipeline
+				|| !ffsz_eq(k->key, key))
+				continue;
+
+			http *r;
+			for (r = k->first;  r != NULL;  r = r->pipe_next) {
+				if (!http_idempotent(r))
+					break;
+			}
+			if (r != NULL)
+				continue;
+
+			dbglog("pipelining via connection %s", key);
+			p->st.pipelined++;
+			conn_attach(c, k);
+			rc = 0;
+			goto end;
+		}
+	}
+
+	c->conn_key = key;
+	key = NULL;
+
+end:
+	ffmem_free(key);
+	return rc;
+}
+
+/** Close the connection used by the request.
+The other requests in flight on this connection start again. */
+static void conn_close(http *c)
+{
+	struct httpcl_conn *k = c->conn;
+	if (k == NULL)
+		return;
+
+	// unlink all requests and free the connection before any request is processed again:
+	//  the requests that are waiting for us are resumed from a separate list
+	http *r = k->first, *next, *resume = NULL, **presume = &resume;
+	k->first = k->last = k->writer = NULL;
+	conn_list_rm(&k->pool->busy, k);
+	conn_free(k);
+	for (;  r != NULL;  r = next) {
+		next = r->pipe_next;
+		r->conn = NULL;
+		r->pipe_next = NULL;
+		if (r == c)
+			continue;
+
+		ffuint wait = r->pipe_wait || r->async;
+		r->conf.timer(&r->tmr, 0);
+		r->pipe_wait = 0;
+		r->async = 0;
+		tcp_ioerr(r);
+		if (wait) {
+			*presume = r;
+			presume = &r->pipe_next;
+		}
+	}
+
+	for (r = resume;  r != NULL;  r = next) {
+		next = r->pipe_next;
+		r->pipe_next = NULL;
+		httpcl_process(r);
+	}
+}
+
+/** Read data received after the previous response */
+static ffsize conn_leftover_read(struct httpcl_conn *k, void *buf, ffsize cap)
+{
+	ffsize n = ffmin(k->leftover.len, cap);
+	ffmem_copy(buf, k->leftover.ptr, n);
+	ffslice_rm((ffslice*)&k->leftover, 0, n, 1);
+	return n;
+}
+
+/** The response is received completely:
+ pass the connection to the next request in flight or to the idle pool */
+static void conn_release(http *c)
+{
+	struct httpcl_conn *k = c->conn;
+	ffuint i;
+	if (k == NULL)
+		return;
+
+	if (k->broken || c->resp.h.conn_close
+		|| (c->f.p != NULL && c->f.iface == &ffhttp_connclose_filter)
+		|| httpcl_pools.conf.max_idle == 0) {
+		conn_close(c);
+		return;
+	}
+
+	if (k->rcvlowat > 1) {
+		if (0 != ffskt_setopt(k->sk, SOL_SOCKET, SO_RCVLOWAT, 1))
+			syswarnlog("%s", ffskt_setopt_S);
+		k->rcvlowat = 1;
+	}
+
+	// the data after the response belongs to the next response
+	ffvec_add2(&k->leftover, &c->data, 1);
+	c->data.len = 0;
+	for (i = 0;  i != c->conf.nbuffers;  i++) {
+		ffstr *b = &c->bufs[(c->rbuf + i) % c->conf.nbuffers];
+		ffvec_add2(&k->leftover, b, 1);
+		b->len = 0;
+	}
+	ffvec_add(&k->leftover, c->bufs[c->wbuf].ptr, c->curtcp_len, 1);
+	c->curtcp_len = 0;
+
+	k->nreq--;
+	k->first = c->pipe_next;
+	if (k->first == NULL)
+		k->last = NULL;
+	c->conn = NULL;
+	c->pipe_next = NULL;
+
+	http *n = k->first;
+	if (n != NULL) {
+		if (n->state == I_PIPE_WAIT) {
+			n->state = I_HTTP_RESP;
+			if (n->pipe_wait) {
+				n->pipe_wait = 0;
+				httpcl_process(n);
+			}
+		}
+		return;
+	}
+
+	struct httpcl_pool *p = k->pool;
+	conn_list_rm(&p->busy, k);
+	if (k->leftover.len != 0) {
+		warnlog("unexpected data after response: %L bytes", k->leftover.len);
+		conn_free(k);
+		return;
+	}
+
+	if (p->st.idle == httpcl_pools.conf.max_idle) {
+		// close the least recently used connection
+		struct httpcl_conn **pk = &p->idle;
+		while ((*pk)->next != NULL) {
+			pk = &(*pk)->next;
+		}
+		conn_free(*pk);
+		*pk = NULL;
+		p->st.idle--;
+	}
+
+	dbglog("keeping idle connection %s", k->key);
+	k->idle_since = pool_time_ms();
+	k->next = p->idle;
+	p->idle = k;
+	p->st.idle++;
+}
+
+static void tcp_aio(http *c)
+{
+	if (c == NULL)
+		return; // idle connection
+	c->async = 0;
+	c->conf.timer(&c->tmr, 0);
+	httpcl_process(c);
+}
+
+/** Receiving is complete: continue processing the request that receives the response */
+static void tcp_aio_r(void *udata)
+{
+	struct httpcl_conn *k = udata;
+	tcp_aio(k->first);
+}
+
+/** Connecting or sending is complete */
+static void tcp_aio_w(void *udata)
+{
+	struct httpcl_conn *k = udata;
+	tcp_aio(k->writer);
+}
+
+/** Connecting to the address is complete */
+static void tcp_aio_conn(void *udata)
+{
+	struct httpcl_conn *k = udata;
+	k->conn_signal = 1;
+	tcp_aio(k->writer);
+}
+
+/** Close all connection attempts */
+static void he_close(http *c)
+{
+	for (ffuint i = 0;  i != c->nattempts;  i++) {
+		conn_free(c->attempts[i]);
+	}
+	c->nattempts = 0;
+}
+
+static void he_rm(http *c, ffuint i)
+{
+	conn_free(c->attempts[i]);
+	c->nattempts--;
+	ffmem_move(&c->attempts[i], &c->attempts[i + 1], (c->nattempts - i) * sizeof(c->attempts[0]));
+}
+
+/** Connection to attempts[i] is established: close the other attempts */
+static void he_win(http *c, ffuint i)
+{
+	struct httpcl_conn *k = c->attempts[i];
+	c->attempts[i] = c->attempts[--c->nattempts];
+	he_close(c);
+
+	dbglog("%s ok", ffskt_connect_S);
+	host_addr_set(&c->hostname, &k->ip);
+	conn_attach(c, k);
+	k->key = c->conn_key;
+	c->conn_key = NULL;
+	k->pool->st.connects++;
+	if (k->key != NULL) {
+		// the next requests may be pipelined via this connection
+		k->next = k->pool->busy;
+		k->pool->busy = k;
+	}
+
+	c->addrs.len = 0;
+}
+
+/** Start connecting to the next address
+Return 0: connected;
+ R_ASYNC: in progress;
+ R_MORE: failed, try the next address;
+ FFHTTPCL_ENOADDR: no more addresses;
+ FFHTTPCL_ERR: fatal error */
+static int he_start(http *c)
+{
+	ffaddr a = {};
+	struct httpcl_conn *k;
+	int r;
+
+	if (c->addr_i == c->addrs.len)
+		return FFHTTPCL_ENOADDR;
+
+	if (NULL == (k = conn_alloc(c))) {
+		syserrlog("%s", ffmem_alloc_S);
+		return FFHTTPCL_ERR;
+	}
+	k->ip = *((ffip6*)c->addrs.ptr + c->addr_i++);
+	k->writer = c;
+
+	const ffip4 *ip4 = ffip6_tov4(&k->ip);
+	int family = (ip4 != NULL) ? AF_INET : AF_INET6;
+	ffaddr_setip(&a, family, (ip4 != NULL) ? (void*)ip4 : (void*)&k->ip);
+	ffip_setport(&a, c->hostport);
+
+	char saddr[FF_MAXIP6];
+	ffsize n = ffaddr_tostr(&a, saddr, sizeof(saddr), FFADDR_USEPORT);
+	infolog("connecting to %S (%*s)...", &c->hostname, n, saddr);
+
+	if (FF_BADSKT == (k->sk = ffskt_create(family, SOCK_STREAM | SOCK_NONBLOCK, IPPROTO_TCP))) {
+		syswarnlog("%s", ffskt_create_S);
+		conn_free(k);
+		return R_MORE;
+	}
+
+	if (0 != ffskt_setopt(k->sk, IPPROTO_TCP, TCP_NODELAY, 1))
+		syswarnlog("%s", ffskt_setopt_S);
+
+	ffaio_init(&k->aio);
+	k->aio.sk = k->sk;
+	k->aio.udata = k;
+	if (0 != ffaio_attach(&k->aio, c->conf.kq, FFKQU_READ | FFKQU_WRITE)) {
+		syserrlog("%s", ffkqu_attach_S);
+		conn_free(k);
+		return FFHTTPCL_ERR;
+	}
+
+	c->attempts[c->nattempts++] = k;
+	r = ffaio_connect(&k->aio, &tcp_aio_conn, &a.a, a.len);
+	if (r == FFAIO_ERROR) {
+		syswarnlog("%s: %*s", ffskt_connect_S, n, saddr);
+		he_rm(c, c->nattempts - 1);
+		return R_MORE;
+	} else if (r == FFAIO_ASYNC) {
+		return R_ASYNC;
+	}
+
+	he_win(c, c->nattempts - 1);
+	return 0;
+}
+
+/** Connect to one of the server's addresses (Happy Eyeballs, RFC 8305).
+Connection attempts to the next addresses start every 'connect_delay' msec
+ or immediately after an attempt fails.
+The first established connection is used, the others are closed.
+Return 0: connected;
+ R_ASYNC: in progress;
+ R_ERR: timeout;
+ FFHTTPCL_ENOADDR: no more addresses;
+ FFHTTPCL_ERR: fatal error */
+static int tcp_connect(http *c)
+{
+	ffaddr a = {};
+	ffuint i, next = 0;
+	int r;
+
+	for (i = 0;  i != c->nattempts;  ) {
+		struct httpcl_conn *k = c->attempts[i];
+		if (!k->conn_signal) {
+			i++;
+			continue;
+		}
+		k->conn_signal = 0;
+
+		r = ffaio_connect(&k->aio, &tcp_aio_conn, &a.a, a.len);
+		if (r == FFAIO_ASYNC) {
+			i++;
+			continue;
+		} else if (r == FFAIO_ERROR) {
+			char saddr[FFIP6_STRLEN];
+			ffsize n = ffip46_tostr(&k->ip, saddr, sizeof(saddr));
+			syswarnlog("%s: %*s", ffskt_connect_S, n, saddr);
+			he_rm(c, i);
+			next = 1;
+			continue;
+		}
+
+		he_win(c, i);
+		return 0;
+	}
+
+	if (c->conn_tmr) {
+		c->conn_tmr = 0;
+		if (c->addr_i == c->addrs.len) {
+			warnlog("connect timeout", 0);
+			he_close(c);
+			return R_ERR;
+		}
+		if (c->nattempts == FF_COUNT(c->attempts))
+			he_rm(c, 0); // the oldest attempt has timed out
+		next = 1;
+	}
+
+	while (next || c->nattempts == 0) {
+		r = he_start(c);
+		if (r == 0)
+			return 0;
+		else if (r == R_ASYNC)
+			break;
+		else if (r == FFHTTPCL_ENOADDR) {
+			if (c->nattempts != 0)
+				break;
+			errlog("no next address to connect");
+			return FFHTTPCL_ENOADDR;
+		} else if (r == FFHTTPCL_ERR) {
+			he_close(c);
+			return FFHTTPCL_ERR;
+		}
+		// R_MORE: try the next address
+	}
+
+	// wait until the next attempt should start or until all attempts time out
+	ffuint t = c->conf.connect_timeout;
+	if (c->addr_i != c->addrs.len && c->nattempts != FF_COUNT(c->attempts))
+		t = c->conf.connect_delay;
+	c->async = 1;
+	c->conf.timer(&c->tmr, t);
+	return R_ASYNC;
+}
+
+static void tcp_ontmr(void *param)
+{
+	http *c = param;
+	if (c->state == I_CONN) {
+		c->conn_tmr = 1;
+		c->async = 0;
+		httpcl_process(c);
+		return;
+	}
+
+	warnlog("I/O timeout", 0);
+	c->async = 0;
+	tcp_ioerr(c);
+	httpcl_process(c);
+}
+
+static int tcp_recvhdrs(http *c)
+{
 	ffssize r;
 
 	if (c->bufs[0].len == c->conf.buffer_size) {
@@ -785,7 +2004,10 @@ static int tcp_recvhdrs(http *c)
 		return R_MORE;
 	}
 
-	r = ffaio_recv(&c->aio, &tcp_aio, ffslice_end(&c->bufs[0], 1), c->conf.buffer_size - c->bufs[0].len);
+	if (c->conn->leftover.len != 0)
+		r = conn_leftover_read(c->conn, ffslice_end(&c->bufs[0], 1), c->conf.buffer_size - c->bufs[0].len);
+	else
+		r = ffaio_recv(&c->conn->aio, &tcp_aio_r, ffslice_end(&c->bufs[0], 1), c->conf.buffer_size - c->bufs[0].len);
 	if (r == FFAIO_ASYNC) {
 		dbglog("async recv...");
 		c->async = 1;
@@ -814,15 +2036,17 @@ static int tcp_ioerr(http *c)
 		return 1;
 	}
 
-	ffskt_fin(c->sk);
-	ffskt_close(c->sk);
-	c->sk = FF_BADSKT;
-	ffaio_fin(&c->aio);
+	conn_close(c);
+	he_close(c);
+
+	if (0 != body_rewind(c)) {
+		c->state = I_ERR;
+		return 1;
+	}
 
 	ffvec_free(&c->target_url);
 	ffstr_set2(&c->target_url, &c->orig_target_url);
 	ffmem_zero_obj(&c->url);
-	ffmem_zero_obj(&c->iplist);
 	ffmem_zero_obj(&c->ip);
 
 	for (ffuint i = 0;  i != c->conf.nbuffers;  i++) {
@@ -838,21 +2062,75 @@ static int tcp_ioerr(http *c)
 	return 0;
 }
 
+/** Set SO_RCVLOWAT for the response body with Content-Length:
+ the socket is signalled when the whole buffer can be filled,
+ but we never wait for more bytes than the server has yet to send */
+static void tcp_rcvlowat(http *c, ffsize cap)
+{
+	struct httpcl_conn *k = c->conn;
+	ffuint64 v = 1;
+	if (c->f.iface == &ffhttp_contlen_filter && c->f.p != NULL) {
+		const struct http_contlen *cl = c->f.p;
+		ffuint64 buffered = c->data.len + c->curtcp_len;
+		for (ffuint i = 0;  i != c->conf.nbuffers;  i++) {
+			buffered += c->bufs[i].len;
+		}
+		if (cl->len > buffered)
+			v = ffmin(ffmin(c->conf.rcvlowat, cap), cl->len - buffered);
+	}
+
+	if (v == ffmax(k->rcvlowat, 1))
+		return;
+	if (0 != ffskt_setopt(k->sk, SOL_SOCKET, SO_RCVLOWAT, (int)v)) {
+		syswarnlog("%s", ffskt_setopt_S);
+		return;
+	}
+	k->rcvlowat = v;
+}
+
+/** Prepare the buffer for filling: reallocate it if the buffer size has grown */
+static void tcp_buf_grow(http *c)
+{
+	ffuint i = c->wbuf;
+	if (c->curtcp_len != 0 || c->bufs[i].len != 0 || c->bufcap[i] >= c->bufsize)
+		return;
+
+	ffstr b;
+	if (NULL == ffstr_alloc(&b, c->bufsize)) {
+		c->bufsize = c->bufcap[i]; // continue with the current size
+		return;
+	}
+	ffstr_free(&c->bufs[i]);
+	c->bufs[i] = b;
+	c->bufcap[i] = c->bufsize;
+	dbglog("buf #%u size: %L", i, c->bufsize);
+}
+
 static int tcp_recv(http *c)
 {
 	ffssize r;
+	ffsize cap;
 
-	if (c->curtcp_len == c->conf.buffer_size) {
+	if (c->conf.buffer_max != 0)
+		tcp_buf_grow(c);
+
+	if (c->curtcp_len == c->bufcap[c->wbuf]) {
 		errlog("buffer #%u is full", c->wbuf);
 		return R_MORE;
 	}
 
 	for (;;) {
 
-		dbglog("buf #%u recv...  rpending:%u  size:%u"
-			, c->wbuf, c->aio.rpending
-			, (int)c->conf.buffer_size - (int)c->curtcp_len);
-		r = ffaio_recv(&c->aio, &tcp_aio, c->bufs[c->wbuf].ptr + c->curtcp_len, c->conf.buffer_size - c->curtcp_len);
+		cap = c->bufcap[c->wbuf] - c->curtcp_len;
+		dbglog("buf #%u recv...  rpending:%u  size:%L"
+			, c->wbuf, c->conn->aio.rpending, cap);
+		if (c->conn->leftover.len != 0) {
+			r = conn_leftover_read(c->conn, c->bufs[c->wbuf].ptr + c->curtcp_len, cap);
+		} else {
+			if (c->conf.rcvlowat != 0)
+				tcp_rcvlowat(c, cap);
+			r = ffaio_recv(&c->conn->aio, &tcp_aio_r, c->bufs[c->wbuf].ptr + c->curtcp_len, cap);
+		}
 		if (r == FFAIO_ASYNC) {
 			dbglog("buf #%u async recv...", c->wbuf);
 			c->async = 1;
@@ -862,12 +2140,19 @@ static int tcp_recv(http *c)
 
 		if (r == 0) {
 			dbglog("server has closed connection");
+			c->conn->broken = 1;
 			return R_DONE;
 		} else if (r < 0) {
 			syserrlog("%s", ffskt_recv_S);
 			return R_ERR;
 		}
 
+		if ((ffsize)r == cap && c->curtcp_len == 0
+			&& c->bufsize < c->conf.buffer_max) {
+			// there was more data in the socket than we could read at once
+			c->bufsize = ffmin(c->bufsize * 2, c->conf.buffer_max);
+		}
+
 		c->curtcp_len += r;
 		dbglog("buf #%u recv: +%L [%L]", c->wbuf, r, c->curtcp_len);
 		if (c->curtcp_len < c->lowat)
@@ -878,6 +2163,8 @@ static int tcp_recv(http *c)
 		c->wbuf = (c->wbuf + 1) % c->conf.nbuffers;
 		if (c->preload && c->bufs[c->wbuf].len == 0) {
 			// the next buffer is free, so start filling it
+			if (c->conf.buffer_max != 0)
+				tcp_buf_grow(c);
 			continue;
 		}
 
@@ -892,7 +2179,7 @@ static int tcp_send(http *c)
 	int r;
 
 	for (;;) {
-		r = ffaio_send(&c->aio, &tcp_aio, c->data.ptr, c->data.len);
+		r = ffaio_send(&c->conn->aio, &tcp_aio_w, c->data.ptr, c->data.len);
 		if (r == FFAIO_ERROR) {
 			syserrlog("%s", ffskt_send_S);
 			return R_ERR;
@@ -910,6 +2197,140 @@ static int tcp_send(http *c)
 	}
 }
 
+/** Frame the next part of request body in bufs[0]
+Return 0: c->data is set;
+ R_MORE: no data yet;
+ -1: fatal error */
+static int body_read(http *c)
+{
+	ffuint chunked = (c->body.len < 0);
+	ffsize hdr = (chunked) ? 18 : 0;
+	ffsize cap = c->conf.buffer_size - hdr - 2;
+	if (!chunked)
+		cap = ffmin64(cap, c->body.len - c->body_sent);
+	char *d = c->bufs[0].ptr + hdr;
+
+	ffssize n = 0;
+	if (cap != 0)
+		n = c->body.read(c->body.udata, d, cap);
+	if (n == FFHTTPCL_BODY_WAIT) {
+		dbglog("waiting for request body data...");
+		return R_MORE;
+	} else if (n < 0) {
+		errlog("request body: read error");
+		return -1;
+	}
+	c->body_sent += n;
+
+	if (!chunked) {
+		if (n == 0 && (ffuint64)c->body.len != c->body_sent) {
+			errlog("request body: unexpected end of data at %U", c->body_sent);
+			return -1;
+		}
+		c->body_eof = ((ffuint64)c->body.len == c->body_sent);
+		ffstr_set(&c->data, d, n);
+		return 0;
+	}
+
+	// "SIZE CRLF DATA CRLF";  the last chunk is "0 CRLF CRLF"
+	char buf[18];
+	ffstr h, t;
+	httpchunked_write(buf, n, &h, &t);
+	ffmem_copy(d - h.len, h.ptr, h.len);
+	ffmem_copy(d + n, t.ptr, t.len);
+	ffstr_set(&c->data, d - h.len, h.len + n + t.len);
+	c->body_eof = (n == 0);
+	return 0;
+}
+
+/** Send file data directly from page cache while the socket accepts it.
+When the socket is full, the next part is read to bufs[0]
+ so that the I/O layer waits until it can be sent.
+Return 0: c->data is set or body_eof;
+ R_ERR: I/O error;
+ -1: fatal error */
+static int body_sendfile(http *c)
+{
+	while (c->body_sent != (ffuint64)c->body.len) {
+		ffuint64 off = c->body.off + c->body_sent;
+		ffsize n = ffmin64(c->body.len - c->body_sent, 0x7ffff000);
+		ffssize r = -1;
+
+#ifdef FF_LINUX
+		off_t o = off;
+		r = sendfile(c->conn->sk, c->body.fd, &o, n);
+		if (r < 0 && !fferr_again(fferr_last())) {
+			syserrlog("%s", "sendfile");
+			return R_ERR;
+		}
+#endif
+
+		if (r < 0) {
+			n = ffmin(n, c->conf.buffer_size);
+			if (0 > (r = fffile_readat(c->body.fd, c->bufs[0].ptr, n, off))) {
+				syserrlog("%s", "request body: fffile_readat");
+				return -1;
+			}
+			if (r != 0) {
+				c->body_sent += r;
+				c->body_eof = (c->body_sent == (ffuint64)c->body.len);
+				ffstr_set(&c->data, c->bufs[0].ptr, r);
+				return 0;
+			}
+		}
+
+		if (r == 0) {
+			errlog("request body: unexpected end of file at %U", c->body_sent);
+			return -1;
+		}
+		dbglog("sendfile: +%L", r);
+		c->body_sent += r;
+	}
+
+	c->body_eof = 1;
+	return 0;
+}
+
+/** Send request body
+Return 0: done;
+ R_ASYNC: waiting for I/O;
+ R_MORE: waiting for user data;
+ R_ERR: I/O error;
+ -1: fatal error */
+static int tcp_send_body(http *c)
+{
+	int r;
+	for (;;) {
+		if (c->data.len != 0
+			&& 0 != (r = tcp_send(c)))
+			return r;
+		if (c->body_eof)
+			return 0;
+
+		if (c->body.fd != FF_BADFD)
+			r = body_sendfile(c);
+		else
+			r = body_read(c);
+		if (r != 0)
+			return r;
+	}
+}
+
+/** Prepare to send request body again
+Return 0 on success */
+static int body_rewind(http *c)
+{
+	if (!c->body_on)
+		return 0;
+	if (c->body.fd == FF_BADFD && c->body_sent != 0) {
+		errlog("can't send request body again");
+		return -1;
+	}
+	c->body_sent = 0;
+	c->body_eof = 0;
+	return 0;
+}
+
 
 static int http_prepreq(http *c, ffstr *dst)
 {
@@ -935,6 +2356,21 @@ static int http_prepreq(http *c, ffstr *dst)
 
 	v.len = p - (char*)v.ptr;
 	ffvec_addstr(&v, &c->hdrs);
+
+	ffstr hdrs = FFSTR_INITSTR(&c->hdrs);
+	const char *ae = http_ce_accept();
+	c->ce_accept = 0;
+	if (c->conf.decode && ae != NULL
+		&& 0 > ffstr_ifindz(&hdrs, "Accept-Encoding:")) {
+		ffvec_addfmt(&v, "Accept-Encoding: %s\r\n", ae);
+		c->ce_accept = 1;
+	}
+	if (c->body_on) {
+		if (c->body.len >= 0)
+			ffvec_addfmt(&v, "Content-Length: %U\r\n", c->body.len);
+		else
+			ffvec_addsz(&v, "Transfer-Encoding: chunked\r\n");
+	}
 	ffvec_addsz(&v, "\r\n");
 
 	ffstr_setstr(&c->hbuf, &v);
@@ -943,6 +2379,76 @@ static int http_prepreq(http *c, ffstr *dst)
 	return 0;
 }
 
+/** Process response header field
+id: enum HTTP_H */
+static int http_hdr_process(http *c, ffuint id, ffstr val, ffstr *location)
+{
+	switch (id) {
+	case HTTP_H_LOCATION:
+		*location = val;
+		break;
+
+	case HTTP_H_CONTENT_LENGTH:
+		if (c->resp.h.cont_len != -1) {
+			errlog("duplicate Content-Length");
+			return -1;
+		}
+		if (!ffstr_to_uint64(&val, &c->resp.h.cont_len)) {
+			errlog("bad Content-Length");
+			return -1;
+		}
+		break;
+
+	case HTTP_H_TRANSFER_ENCODING:
+		if (ffstr_imatchz(&val, "chunked")) // "chunked [; transfer-extension]"
+			c->resp.h.chunked = 1;
+		c->resp.h.cont_len = -1;
+		break;
+
+	case HTTP_H_CONTENT_TYPE:
+		c->resp.content_type = val;
+		break;
+
+	case HTTP_H_CONTENT_ENCODING:
+		if (c->resp.h.ce_gzip || c->resp.h.ce_zstd || c->resp.h.ce_other
+			|| ffstr_findchar(&val, ',') >= 0)
+			c->resp.h.ce_multi = 1; // e.g. "gzip, zstd"
+		if (ffstr_ieqcz(&val, "gzip") || ffstr_ieqcz(&val, "x-gzip"))
+			c->resp.h.ce_gzip = 1;
+		else if (ffstr_ieqcz(&val, "zstd"))
+			c->resp.h.ce_zstd = 1;
+		else if (!ffstr_ieqcz(&val, "identity"))
+			c->resp.h.ce_other = 1;
+		break;
+
+	case HTTP_H_CONNECTION:
+		if (ffstr_ieqcz(&val, "close"))
+			c->resp.h.conn_close = 1;
+		break;
+	}
+	return 0;
+}
+
+/** Release the connection after a redirect response:
+ the connection stays usable for the requests pipelined behind us
+ if the response body is received completely */
+static void http_redirect_release(http *c, const ffstr *proto)
+{
+	ffsize rest = c->bufs[0].len - c->resp.h.len;
+	int64 body = (ffsz_eq(c->method, "HEAD")) ? 0 : c->resp.h.cont_len;
+	if (!ffstr_eqz(proto, "HTTP/1.1")
+		|| c->resp.h.chunked
+		|| body < 0 || (uint64)body > rest) {
+		conn_close(c);
+		return;
+	}
+
+	// the data after the response belongs to the next response on this connection
+	ffstr_set(&c->data, c->bufs[0].ptr + c->resp.h.len + body, rest - body);
+	c->bufs[0].len = 0;
+	conn_release(c);
+}
+
 /**
 Return 0 on success;
  1 - need more data;
@@ -950,8 +2456,8 @@ Return 0 on success;
  -1 on error. */
 static int http_parse(http *c)
 {
-	ffstr data = c->bufs[0], proto, msg, location = {};
-	ffuint code;
+	ffstr data = c->bufs[0], proto, msg, location = {}, name, val;
+	ffuint code, i, n;
 	int r = http_resp_parse(data, &proto, &code, &msg);
 	if (r == 0) {
 		return 1;
@@ -960,49 +2466,39 @@ static int http_parse(http *c)
 		return -1;
 	}
 	ffstr_shift(&data, r);
-	c->resp.h.raw_headers.ptr = data.ptr;
 	c->resp.h.firstline_len = r;
 
-	for (;;) {
-		ffstr name, val;
-		r = http_hdr_parse(data, &name, &val);
-		if (r == 0) {
-			return 1;
-		} else if (r < 0) {
-			errlog("parse HTTP response");
+	// tokenize the whole header block at once
+	ffhttp_headers *h = &c->resp.h;
+	r = http_hdrs_parse(data, h->fields, FF_COUNT(h->fields), &h->nfields);
+	if (r == 0) {
+		return 1;
+	} else if (r < 0) {
+		errlog("parse HTTP response");
+		return -1;
+	}
+	ffstr_set(&h->raw_headers, data.ptr, r);
+	ffstr_shift(&data, r);
+
+	n = ffmin(h->nfields, FF_COUNT(h->fields));
+	for (i = 0;  i != n;  i++) {
+		ffuint id = ffhttp_hdr_index(h, i);
+		if (id == HTTP_H_UNKNOWN)
+			continue;
+		ffstr_set(&val, h->raw_headers.ptr + h->fields[i].val_off, h->fields[i].val_len);
+		if (0 != http_hdr_process(c, id, val, &location))
 			return -1;
-		}
+	}
 
-		ffstr_shift(&data, r);
-		if (r <= 2) {
+	// the fields that didn't fit into the table
+	ffstr d = _ffhttp_hdrs_rest(h);
+	while (d.len > 2) {
+		r = http_hdr_parse(d, &name, &val);
+		if (r <= 2)
 			break;
-		}
-
-		if (ffstr_ieqcz(&name, "Location")) {
-			location = val;
-
-		} else if (ffstr_ieqcz(&name, "Content-Length")) {
-			if (c->resp.h.cont_len != -1) {
-				errlog("duplicate Content-Length");
-				return -1;
-			}
-			if (!ffstr_to_uint64(&val, &c->resp.h.cont_len)) {
-				errlog("bad Content-Length");
-				return -1;
-			}
-
-		} else if (ffstr_ieqcz(&name, "Transfer-Encoding")) {
-			if (ffstr_imatchz(&val, "chunked")) // "chunked [; transfer-extension]"
-				c->resp.h.chunked = 1;
-			c->resp.h.cont_len = -1;
-
-		} else if (ffstr_ieqcz(&name, "Content-Type")) {
-			c->resp.content_type = val;
-
-		} else if (ffstr_ieqcz(&name, "Connection")) {
-			if (ffstr_ieqcz(&val, "close"))
-				c->resp.h.conn_close = 1;
-		}
+		ffstr_shift(&d, r);
+		if (0 != http_hdr_process(c, http_hdr_known(name.ptr, name.len), val, &location))
+			return -1;
 	}
 
 	c->resp.h.len = data.ptr - c->bufs[0].ptr;
@@ -1013,12 +2509,7 @@ static int http_parse(http *c)
 		&& location.len != 0) {
 
 		infolog("HTTP redirect: %S", &location);
-		if (c->sk != FF_BADSKT) {
-			ffskt_fin(c->sk);
-			ffskt_close(c->sk);
-			c->sk = FF_BADSKT;
-		}
-		ffaio_fin(&c->aio);
+		http_redirect_release(c, &proto);
 		ffvec_free(&c->target_url);
 		if (0 == ffvec_addfmt(&c->target_url, "%S", &location)) {
 			syserrlog("%s", ffmem_alloc_S);
@@ -1040,14 +2531,56 @@ static int http_parse(http *c)
 		|| ffsz_eq(c->method, "HEAD"));
 	if (c->resp.h.has_body && c->resp.h.cont_len == -1 && !c->resp.h.chunked && c->resp.h.conn_close)
 		c->resp.h.body_conn_close = 1;
-	c->resp.h.raw_headers.len = data.ptr - c->resp.h.raw_headers.ptr;
 	return 0;
 }
 
+/** Pass the output of the transfer filter through the Content-Encoding decoder
+Return 0: done;  1: need more input data;  2: more output data is ready;  -1: error */
+static int http_recvbody_ce(http *c, ffuint tcpfin)
+{
+	int r;
+	ffstr s;
+	for (;;) {
+		if (c->ce_in.len == 0 && !c->ce_fin && !c->ce_more) {
+			r = c->f.iface->process(c->f.p, (tcpfin) ? NULL : &c->data, &c->ce_in);
+			if (ffhttp_iserr(r)) {
+				warnlog("filter error: (%d) %s", r, ffhttp_errstr(r));
+				return -1;
+			}
+			if (r == FFHTTP_DONE) {
+				c->ce_fin = 1;
+			} else if (c->ce_in.len == 0) {
+				if (!tcpfin && c->data.len != 0)
+					continue; // chunk header
+				c->outdata.len = 0;
+				return 1;
+			}
+		}
+
+		ffstr *in = (c->ce_fin && c->ce_in.len == 0) ? NULL : &c->ce_in;
+		r = c->ce.iface->process(c->ce.p, in, &s);
+		if (ffhttp_iserr(r)) {
+			warnlog("Content-Encoding: (%d) %s", r, ffhttp_errstr(r));
+			return -1;
+		}
+		c->ce_more = (r == FFHTTP_MORE);
+		c->outdata = s;
+		if (r == FFHTTP_DONE)
+			return 0;
+		if (s.len != 0)
+			return (c->ce_in.len != 0 || c->ce_more || c->ce_fin) ? 2 : 1;
+	}
+}
+
+/**
+Return 0: done;  1: data;  2: more output data is ready without new input;  -1: error */
 static int http_recvbody(http *c, ffuint tcpfin)
 {
 	int r;
 	ffstr s;
+	if (c->ce.p != NULL)
+		return http_recvbody_ce(c, tcpfin);
+
 	if (!tcpfin)
 		r = c->f.iface->process(c->f.p, &c->data, &s);
 	else
@@ -8,14 +8,49 @@ This interface provides an easy way to retrieve a document via HTTP.
 #include <FFOS/string.h>
 #include "http1.h"
 #include <FFOS/timerqueue.h>
+#include <FFOS/time.h>
 
 
-/** Deinitialize recycled connection objects (on kqueue close). */
+/** Deinitialize recycled connection objects and close idle connections (on kqueue close).
+Forget the addresses of the hosts. */
 FF_EXTERN void ffhttpcl_deinit();
 
 
+typedef fftime (*ffhttpcl_time)(void);
+
+/** Keep-alive connection pool configuration.
+There's a separate pool for each kqueue:
+ a connection is reused only by the requests which use the same kqueue as the one it's attached to.
+The configuration is the same for all pools. */
+struct ffhttpcl_pool_conf {
+	ffuint max_idle; /** Max. number of idle connections.  0: don't reuse connections (default) */
+	ffuint idle_timeout; /** Don't reuse connections idle for longer than this (msec).  Default: 60000 */
+	ffuint max_pipeline; /** Max. number of requests in flight on one connection.  Default: 4 */
+	ffhttpcl_time time; /** Get current time.  Required if max_idle != 0 */
+};
+
+/** Keep-alive connection pool statistics. */
+struct ffhttpcl_pool_stats {
+	ffuint64 requests; /** Requests that needed a connection */
+	ffuint64 hits; /** Requests that reused an idle connection */
+	ffuint64 pipelined; /** Requests sent via a connection busy with another request */
+	ffuint64 connects; /** New TCP connections */
+	ffuint64 stale; /** Idle connections closed by health check or timeout */
+	ffuint idle; /** Idle connections now */
+};
+
+/** Configure keep-alive connection pool. */
+FF_EXTERN void ffhttpcl_pool_conf(const struct ffhttpcl_pool_conf *conf);
+
+/** Get keep-alive connection pool statistics (the sum for all pools).
+Hit rate: hits / requests;  connects saved: hits + pipelined. */
+FF_EXTERN void ffhttpcl_pool_stats(struct ffhttpcl_pool_stats *st);
+
+
 enum FFHTTPCL_F {
 	FFHTTPCL_NOREDIRECT = 2, /** Don't follow redirections. */
+	FFHTTPCL_PIPELINE = 4, /** Allow sending GET/HEAD request via a keep-alive connection
+		that is still receiving the previous response (HTTP/1.1 pipelining). */
 };
 
 enum FFHTTPCL_LOG {
@@ -38,6 +73,10 @@ typedef void (*ffhttpcl_log)(void *udata, ffuint level, const char *fmt, ...);
 value_ms: timer value in milliseconds;  0: disable. */
 typedef void (*ffhttpcl_timer)(fftimerqueue_node *tmr, ffuint value_ms);
 
+/** Call func(param) on the thread which processes kqueue events.
+Must be thread-safe. */
+typedef void (*ffhttpcl_post)(void (*func)(void *param), void *param);
+
 /** HTTP client configuration. */
 struct ffhttpcl_conf {
 	fffd kq; /** Kernel queue used for asynchronous events.  Required. */
@@ -46,7 +85,15 @@ struct ffhttpcl_conf {
 	ffuint nbuffers;
 	ffuint buffer_size;
 	ffuint buffer_lowat;
+	ffuint buffer_max; /** Adaptive receive buffers for the response body:
+		when a single read fills the whole buffer (the server sends faster than we read),
+		the next buffers are twice as large, up to this size (bytes).  0: disabled */
+	ffuint rcvlowat; /** Set SO_RCVLOWAT while receiving the response body with Content-Length,
+		so the socket is signalled only when this many bytes (bytes left at most) can be read at once.
+		Reduces the number of wake-ups and syscalls for large downloads.  0: disabled */
 	ffuint connect_timeout; /** msec */
+	ffuint connect_delay; /** Start connecting to the next address of the server
+		if there's no reply from the previous ones after this time (msec).  Default: 250 */
 	ffuint timeout; /** msec */
 	ffuint max_redirect; /** Maximum times to follow redirections. */
 	ffuint max_reconnect; /** Maximum times to reconnect after I/O failure. */
@@ -56,7 +103,21 @@ struct ffhttpcl_conf {
 		const char *host;
 		ffuint port; /** Proxy port */
 	} proxy;
+	/** Asynchronous DNS resolver (netf/dns-client.h).
+	Used if at least 1 server is added to it. */
+	struct ffdnsclient *dns;
+	/** Thread pool for getaddrinfo() calls when 'dns' can't be used.
+	NULL: resolve on the caller's thread (blocking) */
+	struct ffthpool *thpool;
+	ffhttpcl_post post; /** Required with 'thpool' */
 	ffuint debug_log :1; /** Log messages with FFHTTPCL_LOG_DEBUG. */
+	/** Send Accept-Encoding and decode the response body:
+	 gzip (built with FFHTTPCL_ZLIB), zstd (built with FFHTTPCL_ZSTD).
+	ffhttpcl_recv() returns the decoded data;  the response headers are not modified.
+	The data in other encodings is passed through as is.
+	A response with more than 1 encoding is an error.
+	Not used if the user has set Accept-Encoding header. */
+	ffuint decode :1;
 };
 
 enum FFHTTPCL_CONF_F {
@@ -92,9 +153,40 @@ Processing is suspended until user calls send(). */
 FF_EXTERN void ffhttpcl_sethandler(void *con, ffhttpcl_handler func, void *udata);
 
 /** Connect, send request, receive response.
-Note: data must be NULL - sending request body isn't supported. */
+Note: data must be NULL - use ffhttpcl_body() to send request body. */
 FF_EXTERN void ffhttpcl_send(void *con, const ffstr *data);
 
+/** Read the next part of request body.
+Return N of bytes copied to 'buf';
+ 0: end of data;
+ FFHTTPCL_BODY_WAIT: no data yet: call ffhttpcl_send() when it's available;
+ <0 on error */
+typedef ffssize (*ffhttpcl_body_read)(void *udata, void *buf, ffsize cap);
+
+enum {
+	FFHTTPCL_BODY_WAIT = -2,
+};
+
+/** Request body source. */
+struct ffhttpcl_body {
+	/** Content-Length.
+	-1: unknown: send with "Transfer-Encoding: chunked" (not for 'fd') */
+	int64 len;
+
+	ffhttpcl_body_read read; /** Pull data from user */
+	void *udata;
+
+	/** Send data from file with sendfile() directly from page cache, instead of calling read().
+	FF_BADFD: not used */
+	fffd fd;
+	ffuint64 off; /** File offset */
+};
+
+/** Set request body.
+Request with the body isn't retried after I/O error if some data was already read via 'read'.
+May be called only before the first send(). */
+FF_EXTERN void ffhttpcl_body(void *con, const struct ffhttpcl_body *body);
+
 /** Parsed headers information. */
 typedef struct ffhttp_headers {
 	ffushort len;
@@ -105,21 +197,72 @@ typedef struct ffhttp_headers {
 		, chunked : 1 ///< Transfer-Encoding: chunked
 		, body_conn_close : 1 // for response
 		;
-	// ffbyte ce_gzip : 1 ///< Content-Encoding: gzip
-	// 	, ce_identity : 1 ///< no Content-Encoding or Content-Encoding: identity
-	// 	;
+	ffbyte ce_gzip : 1 ///< Content-Encoding: gzip
+		, ce_zstd : 1 ///< Content-Encoding: zstd
+		, ce_other : 1 ///< unsupported Content-Encoding
+		, ce_multi : 1 ///< more than 1 Content-Encoding
+		;
 	int64 cont_len; ///< Content-Length value or -1
 
 	ffstr raw_headers;
+	ffuint nfields; ///< total N of header fields
+	struct http_hdr_ent fields[64]; ///< offsets within raw_headers of the first fields
+	ffbyte known[_HTTP_H_END]; ///< enum HTTP_H -> index+1 in fields[] of the first such field
 } ffhttp_headers;
 
+/** Add field to the table of well-known fields
+i: index in fields[] */
+static inline ffuint ffhttp_hdr_index(ffhttp_headers *h, ffuint i)
+{
+	ffuint id = http_hdr_known(h->raw_headers.ptr + h->fields[i].name_off, h->fields[i].name_len);
+	if (id != HTTP_H_UNKNOWN && h->known[id] == 0)
+		h->known[id] = i + 1;
+	return id;
+}
+
+/** Get value of a well-known header field.
+id: enum HTTP_H
+Return 0 if header is not found. */
+static inline int ffhttp_hdr(const ffhttp_headers *h, ffuint id, ffstr *dst)
+{
+	ffuint i = h->known[id];
+	if (i == 0)
+		return 0;
+	i--;
+	ffstr_set(dst, h->raw_headers.ptr + h->fields[i].val_off, h->fields[i].val_len);
+	return 1;
+}
+
+/** Get the part of header block following the fields stored in the table */
+static inline ffstr _ffhttp_hdrs_rest(const ffhttp_headers *h)
+{
+	ffstr d = h->raw_headers;
+	if (h->nfields <= FF_COUNT(h->fields)) {
+		d.len = 0;
+		return d;
+	}
+	const struct http_hdr_ent *e = &h->fields[FF_COUNT(h->fields) - 1];
+	ffsize off = e->val_off + e->val_len;
+	const char *lf = (char*)ffmem_findbyte(d.ptr + off, d.len - off, '\n');
+	ffstr_shift(&d, lf + 1 - d.ptr);
+	return d;
+}
+
 /** Get header value.
 Return 0 if header is not found. */
 static inline int ffhttp_findhdr(const ffhttp_headers *h, const char *name, size_t namelen, ffstr *dst)
 {
-	ffstr d = h->raw_headers;
-	for (;;) {
-		ffstr nm, val;
+	ffuint id = http_hdr_known(name, namelen);
+	if (id != HTTP_H_UNKNOWN) {
+		if (ffhttp_hdr(h, id, dst))
+			return 1;
+		if (h->nfields <= FF_COUNT(h->fields))
+			return 0; // all fields are indexed
+	} else if (0 <= http_hdrs_find(h->raw_headers, h->fields, ffmin(h->nfields, FF_COUNT(h->fields)), name, namelen, dst))
+		return 1;
+
+	ffstr d = _ffhttp_hdrs_rest(h), nm, val;
+	while (d.len != 0) {
 		int r = http_hdr_parse(d, &nm, &val);
 		if (r <= 0)
 			break;
@@ -156,6 +299,15 @@ static inline void ffhttp_resp_init(ffhttp_response *r) {
 Return enum FFHTTPCL_ST. */
 FF_EXTERN int ffhttpcl_recv(void *con, ffhttp_response **resp, ffstr *data);
 
+/** Take ownership of the receive buffer holding the data returned by the last ffhttpcl_recv() call.
+The data stays valid after ffhttpcl_send();  the user frees the buffer with ffstr_free(buf).
+The client continues with a new buffer:
+ only the response headers and the data not yet processed are copied to it.
+@buf: output buffer (pointer and capacity)
+Return 0 on success;
+ -1: the data isn't in a receive buffer (e.g. it's decoded by Content-Encoding filter) */
+FF_EXTERN int ffhttpcl_recv_detach(void *con, ffstr *buf);
+
 /** Add request header. */
 FF_EXTERN void ffhttpcl_header(void *con, const ffstr *name, const ffstr *val, ffuint flags);
 
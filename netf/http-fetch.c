@@ -0,0 +1,576 @@
+/** HTTP fetch manager
+2026, Simon Zolin
+*/
+
+/*
+HTTP requests use their own kernel queue, which is attached to zzkq:
+ the legacy async I/O events (ffos-compat) carry ffkevent pointers which zzkq can't process,
+ so when the inner kqueue is signalled, we drain it and call the handlers.
+The OS layer is ffsys, as in zzkq.
+One periodic zzkq timer drives the requests' timeouts and the retry delays via fftimerqueue.
+User callbacks may add new jobs, but must not call ffhttpfetch_free().
+*/
+
+#include "http-fetch.h"
+#include "kq.h"
+#include "kq-timer.h"
+#include "ffos-compat/asyncio.h"
+#include <ffbase/vector.h>
+#include <ffbase/list.h>
+
+
+enum JOB_STATE {
+	J_QUEUED, // in 'queue' or in 'host.deferred'
+	J_ACTIVE,
+	J_FIN, // in 'fin'
+	J_RETRY, // waiting for the retry timer
+};
+
+struct fetch_host {
+	struct fetch_host *next; // next in the hash bucket
+	struct fetch_job *deferred; // jobs waiting for a free slot for this host
+	ffuint active; // requests in progress
+	ffuint njobs; // jobs referencing this object
+	ffstr name;
+	char name_data[0];
+};
+
+struct fetch_job {
+	ffchain_item sib; // in ffhttpfetch.jobs
+	struct ffhttpfetch_req req; // 'method', 'url' point to this object's data
+	ffhttpfetch *f;
+	struct fetch_host *host;
+	struct fetch_job *next; // next in 'host.deferred' or 'fin'
+	void *con;
+	fftimerqueue_node tmr;
+	ffuint64 seq;
+	ffuint state; // enum JOB_STATE
+	ffuint tries;
+	int result;
+	ffuint delivered :1 // user received data
+		, retry :1 // start again after a delay
+		;
+	char data[0];
+};
+
+struct ffhttpfetch {
+	struct ffhttpfetch_conf conf;
+	ffkq kq; // kqueue for HTTP requests
+	struct zzkevent *kev;
+	struct zzkq_timer timer;
+	fftimerqueue tq;
+
+	fflist jobs; // all jobs
+	ffuint njobs;
+	ffvec queue; // struct fetch_job*[]: binary heap
+	struct fetch_job *fin; // jobs to finalize
+	struct fetch_host *hosts[64];
+	ffuint active;
+	ffuint64 seq;
+	ffuint processing :1;
+
+	struct ffhttpfetch_stats st;
+	ffuint64 tick_time; // msec
+	ffuint64 busy_ms; // time with active requests
+	ffuint64 rate_time, rate_bytes;
+	ffuint64 rnd; // PRNG state for the retry delays
+};
+
+static ffhttpfetch *fetch_cur; // the object ffhttpcl_timer works with
+
+static void fetch_process(ffhttpfetch *f);
+static void job_onevent(void *param);
+
+
+static ffuint64 time_ms(void)
+{
+	fftime t;
+	fftime_now(&t);
+	return (ffuint64)fftime_sec(&t) * 1000 + fftime_msec(&t);
+}
+
+/** Set a one-shot timer for HTTP request */
+static void http_timer(fftimerqueue_node *tmr, ffuint value_ms)
+{
+	ffhttpfetch *f = fetch_cur;
+	fftimerqueue_remove(&f->tq, tmr);
+	if (value_ms == 0)
+		return;
+	fftimerqueue_add(&f->tq, tmr, time_ms(), -(int)value_ms, tmr->func, tmr->param);
+}
+
+
+/** Get "host[:port]" from URL */
+static ffstr url_host(const char *url)
+{
+	ffstr s = FFSTR_INITZ(url), host;
+	ffssize i;
+	if (0 <= (i = ffstr_find(&s, "://", 3)))
+		ffstr_shift(&s, i + 3);
+	host = s;
+	if (0 <= (i = ffstr_findany(&s, "/?#", 3)))
+		host.len = i;
+	if (0 <= (i = ffstr_rfindchar(&host, '@')))
+		ffstr_shift(&host, i + 1);
+	return host;
+}
+
+/** FNV-1a of the lower-case string */
+static ffuint host_hash(ffstr name)
+{
+	ffuint h = 0x811c9dc5;
+	for (ffsize i = 0;  i != name.len;  i++) {
+		h = (h ^ ffchar_lower(name.ptr[i])) * 0x01000193;
+	}
+	return h;
+}
+
+/** Find host object or create a new one */
+static struct fetch_host* host_get(ffhttpfetch *f, ffstr name)
+{
+	ffuint i = host_hash(name) % FF_COUNT(f->hosts);
+	struct fetch_host *h;
+	for (h = f->hosts[i];  h != NULL;  h = h->next) {
+		if (ffstr_ieq2(&h->name, &name))
+			goto done;
+	}
+
+	if (NULL == (h = ffmem_alloc(sizeof(struct fetch_host) + name.len)))
+		return NULL;
+	ffmem_zero_obj(h);
+	ffmem_copy(h->name_data, name.ptr, name.len);
+	ffstr_set(&h->name, h->name_data, name.len);
+	h->next = f->hosts[i];
+	f->hosts[i] = h;
+
+done:
+	h->njobs++;
+	return h;
+}
+
+static void host_unref(ffhttpfetch *f, struct fetch_host *h)
+{
+	if (--h->njobs != 0)
+		return;
+
+	struct fetch_host **p = &f->hosts[host_hash(h->name) % FF_COUNT(f->hosts)];
+	while (*p != h) {
+		p = &(*p)->next;
+	}
+	*p = h->next;
+	ffmem_free(h);
+}
+
+
+/** Return TRUE if job 'a' must start before job 'b' */
+static int job_before(const struct fetch_job *a, const struct fetch_job *b)
+{
+	if (a->req.priority != b->req.priority)
+		return a->req.priority > b->req.priority;
+	return a->seq < b->seq;
+}
+
+/** Add job to the priority queue.
+The space is reserved by ffhttpfetch_add(). */
+static void queue_push(ffhttpfetch *f, struct fetch_job *j)
+{
+	struct fetch_job **q = f->queue.ptr;
+	ffsize i = f->queue.len++;
+	while (i != 0) {
+		ffsize parent = (i - 1) / 2;
+		if (!job_before(j, q[parent]))
+			break;
+		q[i] = q[parent];
+		i = parent;
+	}
+	q[i] = j;
+	j->state = J_QUEUED;
+}
+
+static struct fetch_job* queue_pop(ffhttpfetch *f)
+{
+	struct fetch_job **q = f->queue.ptr;
+	struct fetch_job *top = q[0], *last = q[--f->queue.len];
+	ffsize n = f->queue.len, i = 0;
+	if (n == 0)
+		return top;
+
+	for (;;) {
+		ffsize child = i * 2 + 1;
+		if (child >= n)
+			break;
+		if (child + 1 < n && job_before(q[child + 1], q[child]))
+			child++;
+		if (!job_before(q[child], last))
+			break;
+		q[i] = q[child];
+		i = child;
+	}
+	q[i] = last;
+	return top;
+}
+
+/** A slot for the host is free: return its deferred jobs to the queue */
+static void host_wake(ffhttpfetch *f, struct fetch_host *h)
+{
+	struct fetch_job *j;
+	while (NULL != (j = h->deferred)) {
+		h->deferred = j->next;
+		queue_push(f, j);
+	}
+}
+
+
+static int method_idempotent(const char *method)
+{
+	static const char *const m[] = { "GET", "HEAD", "PUT", "DELETE", "OPTIONS", "TRACE" };
+	for (ffuint i = 0;  i != FF_COUNT(m);  i++) {
+		if (ffsz_eq(method, m[i]))
+			return 1;
+	}
+	return 0;
+}
+
+static int resp_retriable(ffuint code)
+{
+	switch (code) {
+	case 429:
+	case 502:
+	case 503:
+	case 504:
+		return 1;
+	}
+	return 0;
+}
+
+/** The request is finished: the job will be finalized by fetch_process().
+We don't close the request object here, because the HTTP client may still use it after the handler returns. */
+static void job_fin(struct fetch_job *j, int result, ffuint retry)
+{
+	ffhttpfetch *f = j->f;
+	j->result = result;
+	j->retry = retry;
+	j->state = J_FIN;
+	j->next = f->fin;
+	f->fin = j;
+}
+
+static void job_onevent(void *param)
+{
+	struct fetch_job *j = param;
+	ffhttpfetch *f = j->f;
+	ffhttp_response *resp;
+	ffstr data;
+	int r = ffhttpcl_recv(j->con, &resp, &data);
+
+	switch (r) {
+	case FFHTTPCL_ERR:
+	case FFHTTPCL_ENOADDR:
+		job_fin(j, r, !j->delivered && method_idempotent(j->req.method));
+		return;
+
+	case FFHTTPCL_RESP:
+		if (resp_retriable(resp->code) && j->tries < f->conf.max_tries) {
+			job_fin(j, FFHTTPCL_ERR, 1);
+			return;
+		}
+		j->delivered = 1;
+		j->req.ondata(j->req.udata, resp, data);
+		break;
+
+	default:
+		if (data.len != 0) {
+			f->st.bytes += data.len;
+			j->req.ondata(j->req.udata, resp, data);
+		}
+		if (r == FFHTTPCL_DONE) {
+			job_fin(j, 0, 0);
+			return;
+		}
+	}
+
+	ffhttpcl_send(j->con, NULL);
+}
+
+static void job_start(ffhttpfetch *f, struct fetch_job *j)
+{
+	j->state = J_ACTIVE;
+	j->tries++;
+	j->delivered = 0;
+	f->active++;
+	j->host->active++;
+	f->st.started++;
+
+	if (NULL == (j->con = ffhttpcl_request(j->req.method, j->req.url, j->req.flags))) {
+		job_fin(j, FFHTTPCL_ERR, 0);
+		return;
+	}
+
+	struct ffhttpcl_conf conf;
+	ffhttpcl_conf(j->con, &conf, FFHTTPCL_CONF_GET);
+	conf.kq = f->kq;
+	conf.timer = &http_timer;
+	ffhttpcl_conf(j->con, &conf, FFHTTPCL_CONF_SET);
+	ffhttpcl_sethandler(j->con, &job_onevent, j);
+	if (j->req.prepare != NULL)
+		j->req.prepare(j->req.udata, j->con);
+
+	ffhttpcl_send(j->con, NULL);
+}
+
+static void job_free(ffhttpfetch *f, struct fetch_job *j)
+{
+	if (j->con != NULL)
+		ffhttpcl_close(j->con);
+	if (j->state == J_RETRY)
+		fftimerqueue_remove(&f->tq, &j->tmr);
+	fflist_rm(&f->jobs, &j->sib);
+	f->njobs--;
+	host_unref(f, j->host);
+	ffmem_free(j);
+}
+
+static void job_onretry(void *param)
+{
+	struct fetch_job *j = param;
+	queue_push(j->f, j);
+}
+
+/** Delay before the next attempt: exponential with jitter */
+static ffuint retry_delay(ffhttpfetch *f, ffuint tries)
+{
+	ffuint64 d = f->conf.retry_delay;
+	if (tries > 1)
+		d <<= ffmin(tries - 1, 20);
+	d = ffmin(d, f->conf.retry_delay_max);
+
+	// xorshift64
+	f->rnd ^= f->rnd << 13;
+	f->rnd ^= f->rnd >> 7;
+	f->rnd ^= f->rnd << 17;
+	return d / 2 + (ffuint)(f->rnd % (d / 2 + 1));
+}
+
+static void job_complete(ffhttpfetch *f, struct fetch_job *j)
+{
+	if (j->con != NULL) {
+		ffhttpcl_close(j->con);
+		j->con = NULL;
+	}
+	f->active--;
+	j->host->active--;
+	host_wake(f, j->host);
+
+	if (j->retry && j->tries < f->conf.max_tries
+		&& zzkq_timer_active(&f->timer)) {
+		f->st.retries++;
+		j->state = J_RETRY;
+		fftimerqueue_add(&f->tq, &j->tmr, time_ms(), -(int)retry_delay(f, j->tries), &job_onretry, j);
+		return;
+	}
+
+	if (j->result == 0)
+		f->st.completed++;
+	else
+		f->st.failed++;
+	j->req.ondone(j->req.udata, j->result);
+	job_free(f, j);
+}
+
+
+static void fetch_ontimer(void *param)
+{
+	ffhttpfetch *f = param;
+	ffuint64 now = time_ms();
+
+	if (f->active != 0)
+		f->busy_ms += now - f->tick_time;
+	f->tick_time = now;
+
+	if (now - f->rate_time >= 1000) {
+		f->st.rate = (f->st.bytes - f->rate_bytes) * 1000 / (now - f->rate_time);
+		f->rate_bytes = f->st.bytes;
+		f->rate_time = now;
+	}
+
+	fftimerqueue_process(&f->tq, now);
+	fetch_process(f);
+}
+
+/** Process all signalled events of the inner kqueue */
+static void fetch_onkq(void *param)
+{
+	ffhttpfetch *f = param;
+	ffkq_event ev[64];
+	ffkq_time t;
+	ffkq_time_set(&t, 0);
+
+	for (;;) {
+		int n = ffkq_wait(f->kq, ev, FF_COUNT(ev), t);
+		for (int i = 0;  i < n;  i++) {
+			ffkev_call(&ev[i]);
+		}
+		if (n < (int)FF_COUNT(ev))
+			break;
+	}
+
+	fetch_process(f);
+}
+
+/** Finalize the finished jobs and start the queued jobs while there are free slots */
+static void fetch_process(ffhttpfetch *f)
+{
+	if (f->processing)
+		return;
+	f->processing = 1;
+
+	for (;;) {
+		struct fetch_job *j;
+
+		if (NULL != (j = f->fin)) {
+			f->fin = j->next;
+			job_complete(f, j);
+			continue;
+		}
+
+		if (f->active == f->conf.max_active || f->queue.len == 0)
+			break;
+
+		j = queue_pop(f);
+		if (j->host->active == f->conf.max_per_host) {
+			j->next = j->host->deferred;
+			j->host->deferred = j;
+			continue;
+		}
+		job_start(f, j);
+	}
+
+	f->processing = 0;
+
+	if (f->njobs == 0 && zzkq_timer_active(&f->timer))
+		zzkq_timer_stop(&f->timer, f->conf.kq->kq);
+}
+
+/** Start the timer for the requests' timeouts and the retry delays */
+static int fetch_timer_start(ffhttpfetch *f)
+{
+	if (zzkq_timer_active(&f->timer))
+		return 0;
+	f->tick_time = f->rate_time = time_ms();
+	f->rate_bytes = f->st.bytes;
+	return zzkq_timer_start(&f->timer, f->conf.kq->kq, f->conf.timer_interval, &fetch_ontimer, f);
+}
+
+
+ffhttpfetch* ffhttpfetch_create(const struct ffhttpfetch_conf *conf)
+{
+	ffhttpfetch *f;
+	if (NULL == (f = ffmem_new(ffhttpfetch)))
+		return NULL;
+	f->conf = *conf;
+	if (f->conf.max_active == 0)
+		f->conf.max_active = 64;
+	if (f->conf.max_per_host == 0)
+		f->conf.max_per_host = 6;
+	if (f->conf.max_tries == 0)
+		f->conf.max_tries = 3;
+	if (f->conf.retry_delay == 0)
+		f->conf.retry_delay = 500;
+	if (f->conf.retry_delay_max == 0)
+		f->conf.retry_delay_max = 30000;
+	if (f->conf.timer_interval == 0)
+		f->conf.timer_interval = 50;
+
+	fflist_init(&f->jobs);
+	fftimerqueue_init(&f->tq);
+	zzkq_timer_init(&f->timer);
+	f->kq = FFKQ_NULL;
+	f->rnd = (time_ms() ^ (ffsize)f) | 1;
+
+	if (FFKQ_NULL == (f->kq = ffkq_create())
+		|| 0 != zzkq_timer_create(&f->timer)
+		|| NULL == (f->kev = zzkq_kev_alloc(f->conf.kq)))
+		goto err;
+
+	f->kev->rhandler = &fetch_onkq;
+	f->kev->obj = f;
+	f->kev->rtask.active = 1;
+	if (0 != zzkq_attach(f->conf.kq, f->kq, f->kev, FFKQ_READ))
+		goto err;
+
+	fetch_cur = f;
+	return f;
+
+err:
+	ffhttpfetch_free(f);
+	return NULL;
+}
+
+void ffhttpfetch_free(ffhttpfetch *f)
+{
+	if (f == NULL)
+		return;
+
+	ffchain_item *it;
+	while (fflist_sentl(&f->jobs) != (it = fflist_first(&f->jobs))) {
+		job_free(f, FF_CONTAINER(struct fetch_job, sib, it));
+	}
+	ffvec_free(&f->queue);
+
+	zzkq_timer_destroy(&f->timer, f->conf.kq->kq);
+	zzkq_kev_free(f->conf.kq, f->kev);
+	if (f->kq != FFKQ_NULL)
+		ffkq_close(f->kq);
+	if (fetch_cur == f)
+		fetch_cur = NULL;
+	ffmem_free(f);
+}
+
+fffd ffhttpfetch_kq(ffhttpfetch *f)
+{
+	return f->kq;
+}
+
+int ffhttpfetch_add(ffhttpfetch *f, const struct ffhttpfetch_req *req)
+{
+	struct fetch_job *j;
+	const char *method = (req->method != NULL) ? req->method : "GET";
+	ffsize nmethod = ffsz_len(method) + 1, nurl = ffsz_len(req->url) + 1;
+
+	if (NULL == ffvec_growT(&f->queue, f->njobs + 1 - f->queue.len, struct fetch_job*))
+		return -1;
+
+	// the job can't be completed without the timer: no timeouts, no retries
+	if (0 != fetch_timer_start(f))
+		return -1;
+
+	if (NULL == (j = ffmem_alloc(sizeof(struct fetch_job) + nmethod + nurl)))
+		return -1;
+	ffmem_zero_obj(j);
+	j->req = *req;
+	ffmem_copy(j->data, method, nmethod);
+	ffmem_copy(j->data + nmethod, req->url, nurl);
+	j->req.method = j->data;
+	j->req.url = j->data + nmethod;
+
+	if (NULL == (j->host = host_get(f, url_host(j->req.url)))) {
+		ffmem_free(j);
+		return -1;
+	}
+
+	j->f = f;
+	j->seq = f->seq++;
+	fflist_add(&f->jobs, &j->sib);
+	f->njobs++;
+	queue_push(f, j);
+	fetch_process(f);
+	return 0;
+}
+
+void ffhttpfetch_stats(ffhttpfetch *f, struct ffhttpfetch_stats *st)
+{
+	*st = f->st;
+	st->active = f->active;
+	st->queued = f->njobs - f->active;
+	st->avg_rate = (f->busy_ms != 0) ? f->st.bytes * 1000 / f->busy_ms : 0;
+}
@@ -0,0 +1,86 @@
+/** HTTP fetch manager
+Run many HTTP requests concurrently on one zzkq loop:
+ global and per-host limits, priority queue, retries with backoff.
+2026, Simon Zolin
+*/
+
+/*
+ffhttpfetch_create ffhttpfetch_free
+ffhttpfetch_kq
+ffhttpfetch_add
+ffhttpfetch_stats
+*/
+
+#pragma once
+
+#include "http-client.h"
+
+struct zzkq;
+typedef struct ffhttpfetch ffhttpfetch;
+
+/** Prepare HTTP request object before it's sent: ffhttpcl_header(), ffhttpcl_body(), ffhttpcl_conf().
+Called for each attempt.
+'kq' and 'timer' settings must not be changed. */
+typedef void (*ffhttpfetch_prepare)(void *udata, void *con);
+
+/** Received response headers (data is empty) or response body data. */
+typedef void (*ffhttpfetch_data)(void *udata, ffhttp_response *resp, ffstr data);
+
+/** The job is complete.
+result: 0 on success;  enum FFHTTPCL_ST error */
+typedef void (*ffhttpfetch_done)(void *udata, int result);
+
+struct ffhttpfetch_conf {
+	struct zzkq *kq; /** Required */
+	ffuint max_active; /** Max. number of requests in progress.  Default: 64 */
+	ffuint max_per_host; /** Max. number of requests in progress to one host.  Default: 6 */
+	ffuint max_tries; /** Max. number of attempts for one job.  Default: 3 */
+	ffuint retry_delay; /** Delay before the first retry (msec).  Default: 500.
+		Doubles with each attempt, the actual value is randomized within [delay/2..delay]. */
+	ffuint retry_delay_max; /** msec.  Default: 30000 */
+	ffuint timer_interval; /** Timer resolution for the requests' timeouts (msec).  Default: 50 */
+};
+
+/** Job description.  The strings are copied. */
+struct ffhttpfetch_req {
+	const char *method; /** NULL: "GET" */
+	const char *url;
+	ffuint flags; /** enum FFHTTPCL_F */
+	int priority; /** Jobs with higher priority start first;  jobs with equal priority start in order of adding */
+	ffhttpfetch_prepare prepare; /** Optional */
+	ffhttpfetch_data ondata;
+	ffhttpfetch_done ondone;
+	void *udata;
+};
+
+struct ffhttpfetch_stats {
+	ffuint queued; /** Jobs waiting for a free slot or for a retry */
+	ffuint active; /** Requests in progress */
+	ffuint64 started; /** Requests started (including retries) */
+	ffuint64 retries;
+	ffuint64 completed; /** Jobs completed successfully */
+	ffuint64 failed;
+	ffuint64 bytes; /** Response body bytes received */
+	ffuint64 rate; /** Bytes per second received during the last second */
+	ffuint64 avg_rate; /** Bytes per second received while there were active requests */
+};
+
+/** Create fetch manager.
+Only one object may exist at a time, because ffhttpcl_timer has no user parameter.
+Return NULL on error. */
+FF_EXTERN ffhttpfetch* ffhttpfetch_create(const struct ffhttpfetch_conf *conf);
+
+/** Close all requests and destroy the object.  ondone() isn't called for the unfinished jobs. */
+FF_EXTERN void ffhttpfetch_free(ffhttpfetch *f);
+
+/** Get the kernel queue that HTTP requests use.
+May be passed to ffdnsclient so that its events are processed on the same loop. */
+FF_EXTERN fffd ffhttpfetch_kq(ffhttpfetch *f);
+
+/** Add a job to the queue.
+Network errors are retried only for the idempotent methods and only if no data was passed to the user.
+Responses with status 429, 502, 503, 504 are retried for any method, except for the last attempt.
+Return 0 on success */
+FF_EXTERN int ffhttpfetch_add(ffhttpfetch *f, const struct ffhttpfetch_req *req);
+
+FF_EXTERN void ffhttpfetch_stats(ffhttpfetch *f, struct ffhttpfetch_stats *st);
@@ -8,7 +8,11 @@ Copyright (c) 2019 Simon Zolin
 #include <FF/net/proto.h>
 #include <FFOS/random.h>
 #include <FFOS/timer.h>
+#include <FFOS/thread.h>
 #include <FFOS/test.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
 
 
 static ffdnsclient *ctx;
@@ -46,6 +50,8 @@ void test_dns_client(void)
 	conf.enable_ipv6 = 1;
 	conf.edns = 1;
 	conf.debug_log = 1;
+	conf.cache_size = 64*1024;
+	conf.cache_ttl_max = 60*60;
 
 	ctx = ffdnscl_new(&conf);
 	ffstr s;
@@ -59,6 +65,11 @@ void test_dns_client(void)
 	x(0 == ffdnscl_resolve(ctx, s, &onresolve, (void*)2, 0));
 	x(0 == ffdnscl_resolve(ctx, s, &onresolve, (void*)2, FFDNSCL_CANCEL));
 
+	// hostnames are case-insensitive: the pending query is shared (not counted as a cache miss)
+	x(0 == ffdnscl_resolve(ctx, s, &onresolve, (void*)5, 0));
+	ffstr_setz(&s, "APPLE.com");
+	x(0 == ffdnscl_resolve(ctx, s, &onresolve, (void*)5, FFDNSCL_CANCEL));
+
 	ffkqu_time tm;
 	ffkqu_settm(&tm, 1000);
 	for (;;) {
@@ -77,6 +88,16 @@ void test_dns_client(void)
 
 	x(gflags & 1);
 
+	// the response is cached: ondone() is called synchronously
+	ffstr_setz(&s, "google.com");
+	x(0 == ffdnscl_resolve(ctx, s, &onresolve, (void*)3, 0));
+	x(gflags & 4);
+	struct ffdnscl_stats st;
+	ffdnscl_stats(ctx, &st);
+	x(st.cache_hits == 1);
+	x(st.cache_misses == 2);
+	x(st.cache_entries != 0);
+
 	ffkqu_close(kq);
 	ffdnscl_free(ctx);
 	fftimer_close(timer, kq);
@@ -99,6 +120,11 @@ static void onresolve(void *udata, const ffdnscl_result *res)
 		fffile_write(ffstdout, data.ptr, data.len);
 		fffile_write(ffstdout, "\r\n", 2);
 
+	} else if (udata == (void*)3) {
+		xieq(FFDNS_NOERROR, res->status);
+		x(res->ip.len != 0);
+		gflags |= 4;
+
 	} else {
 		x(0);
 	}
@@ -130,3 +156,716 @@ static fftime dnstime(void)
 	fftime_now(&t);
 	return t;
 }
+
+
+struct dns_stub {
+	int sk;
+	uint nq; // N of queries to answer
+};
+
+/** Convert query (without EDNS) of length 'n' into response with one A or AAAA record.
+Return response length */
+static ssize_t dns_stub_answer(char *buf, ssize_t n)
+{
+	static const char a[] = "\xc0\x0c" "\x00\x01" "\x00\x01" "\x00\x00\x00\x3c" "\x00\x04"
+		"\x7f\x00\x00\x01";
+	static const char aaaa[] = "\xc0\x0c" "\x00\x1c" "\x00\x01" "\x00\x00\x00\x3c" "\x00\x10"
+		"\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00" "\x01";
+
+	ffbool type_a = (buf[n - 3] == FFDNS_A);
+	buf[2] = (char)0x81; // response, recursion desired
+	buf[3] = (char)0x80; // recursion available, NOERROR
+	buf[7] = 1; // answer count
+	buf[9] = buf[11] = 0;
+	if (type_a) {
+		ffmem_copy(&buf[n], a, sizeof(a) - 1);
+		n += sizeof(a) - 1;
+	} else {
+		ffmem_copy(&buf[n], aaaa, sizeof(aaaa) - 1);
+		n += sizeof(aaaa) - 1;
+	}
+	return n;
+}
+
+/** Answer queries (without EDNS) with one A or AAAA record */
+static int FFTHDCALL dns_stub_thread(void *param)
+{
+	struct dns_stub *s = param;
+	char buf[FFDNS_MAXMSG + 64];
+
+	for (uint i = 0;  i != s->nq;  i++) {
+		struct sockaddr_in peer;
+		socklen_t peer_len = sizeof(peer);
+		ssize_t n = recvfrom(s->sk, buf, FFDNS_MAXMSG, 0, (struct sockaddr*)&peer, &peer_len);
+		x(n > (ssize_t)sizeof(struct ffdns_hdr));
+
+		n = dns_stub_answer(buf, n);
+		sendto(s->sk, buf, n, 0, (struct sockaddr*)&peer, peer_len);
+	}
+	return 0;
+}
+
+static uint bench_done;
+
+static void bench_onresolve(void *udata, const ffdnscl_result *res)
+{
+	x(res->status == FFDNS_NOERROR && res->ip.len == 2);
+	bench_done++;
+}
+
+static uint64 bench_msec(void)
+{
+	fftime t;
+	fftime_now(&t);
+	return (uint64)fftime_sec(&t) * 1000 + fftime_msec(&t);
+}
+
+/** Resolve many hostnames via a local stub server: one syscall per datagram vs sendmmsg()/recvmmsg() */
+void bench_dns_client(void)
+{
+	FFTEST_FUNC;
+	enum {
+		NAMES = 50000,
+		WINDOW = 256, // max. hostnames in progress: don't overflow the sockets' buffers
+	};
+	static const struct {
+		const char *name;
+		uint batch, recv_batch, sockets;
+	} modes[] = {
+		{ "send/recv", 0, 1, 1 },
+		{ "sendmmsg/recvmmsg", 1, 64, 1 },
+		{ "sendmmsg/recvmmsg, 4 sockets", 1, 64, 4 },
+	};
+
+	for (uint i = 0;  i != FF_COUNT(modes);  i++) {
+		struct dns_stub s = {};
+		x(0 <= (s.sk = socket(AF_INET, SOCK_DGRAM, 0)));
+		struct sockaddr_in a = {};
+		a.sin_family = AF_INET;
+		a.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		x(0 == bind(s.sk, (struct sockaddr*)&a, sizeof(a)));
+		socklen_t alen = sizeof(a);
+		x(0 == getsockname(s.sk, (struct sockaddr*)&a, &alen));
+		s.nq = NAMES * 2;
+
+		fffd kq = ffkqu_create();
+		ffdnscl_conf conf = {};
+		conf.kq = kq;
+		conf.oncomplete = &oncomplete;
+		conf.log = &dnslog;
+		conf.time = &dnstime;
+		conf.timer = &dnstimer;
+		conf.max_tries = 1;
+		conf.retry_timeout = 5000;
+		conf.buf_size = FFDNS_MAXMSG;
+		conf.enable_ipv6 = 1;
+		conf.batch = modes[i].batch;
+		conf.recv_batch = modes[i].recv_batch;
+		conf.serv_sockets = modes[i].sockets;
+		ffdnsclient *c = ffdnscl_new(&conf);
+
+		char buf[128];
+		ffstr str;
+		ffstr_set(&str, buf, ffs_format_r0(buf, sizeof(buf), "127.0.0.1:%u", (int)ntohs(a.sin_port)));
+		x(0 == ffdnscl_serv_add(c, &str));
+
+		ffthd th;
+		x(FFTHD_INV != (th = ffthd_create(&dns_stub_thread, &s, 0)));
+
+		uint64 t = bench_msec();
+		uint issued = 0;
+		bench_done = 0;
+		ffkqu_time tm;
+		ffkqu_settm(&tm, 1000);
+		while (bench_done != NAMES) {
+			for (;  issued != NAMES && issued - bench_done < WINDOW;  issued++) {
+				ffstr_set(&str, buf, ffs_format_r0(buf, sizeof(buf), "h%u.bench.test", issued));
+				x(0 == ffdnscl_resolve(c, str, &bench_onresolve, NULL, 0));
+			}
+			ffdnscl_flush(c);
+
+			ffkqu_entry ev[64];
+			int n = ffkqu_wait(kq, ev, FF_COUNT(ev), &tm);
+			x(n > 0);
+			for (int k = 0;  k != n;  k++) {
+				ffkev_call(&ev[k]);
+			}
+		}
+		t = bench_msec() - t;
+		ffthd_join(th, -1, NULL);
+
+		struct ffdnscl_stats st;
+		ffdnscl_stats(c, &st);
+		int n = ffs_format_r0(buf, sizeof(buf), "%s: %U names/sec, send: %U datagrams/%U syscalls, recv: %U/%U\n"
+			, modes[i].name, (t != 0) ? (uint64)NAMES * 1000 / t : 0
+			, st.sent, st.send_calls, st.received, st.recv_calls);
+		fffile_write(ffstdout, buf, n);
+
+		ffdnscl_free(c);
+		ffkqu_close(kq);
+		close(s.sk);
+	}
+}
+
+
+/** Timers for the tests that need retries */
+static struct {
+	fftimerqueue_node *node;
+	uint64 deadline;
+} tmrs[8];
+
+static void test_timer(fftimerqueue_node *tmr, uint value_ms)
+{
+	uint free_i = FF_COUNT(tmrs);
+	for (uint i = 0;  i != FF_COUNT(tmrs);  i++) {
+		if (tmrs[i].node == tmr) {
+			free_i = i;
+			break;
+		}
+		if (tmrs[i].node == NULL && free_i == FF_COUNT(tmrs))
+			free_i = i;
+	}
+	x(free_i != FF_COUNT(tmrs));
+	tmrs[free_i].node = (value_ms != 0) ? tmr : NULL;
+	tmrs[free_i].deadline = bench_msec() + value_ms;
+}
+
+static void test_timers_process(void)
+{
+	uint64 now = bench_msec();
+	for (uint i = 0;  i != FF_COUNT(tmrs);  i++) {
+		fftimerqueue_node *tmr = tmrs[i].node;
+		if (tmr != NULL && now >= tmrs[i].deadline) {
+			tmrs[i].node = NULL;
+			tmr->func(tmr->param);
+		}
+	}
+}
+
+static uint health_done;
+
+static void health_onresolve(void *udata, const ffdnscl_result *res)
+{
+	xieq(FFDNS_NOERROR, res->status);
+	health_done++;
+}
+
+/** The first server doesn't respond: the queries go to the second server after the first timeout */
+void test_dns_client_health(void)
+{
+	FFTEST_FUNC;
+	enum { NAMES = 20 };
+	struct dns_stub s = {};
+	int dead;
+	struct sockaddr_in a = {};
+	socklen_t alen = sizeof(a);
+	char buf[128];
+	ffstr str;
+
+	fffd kq = ffkqu_create();
+	ffdnscl_conf conf = {};
+	conf.kq = kq;
+	conf.oncomplete = &oncomplete;
+	conf.log = &dnslog;
+	conf.time = &dnstime;
+	conf.timer = &test_timer;
+	conf.max_tries = 3;
+	conf.retry_timeout = 300;
+	conf.buf_size = FFDNS_MAXMSG;
+	conf.enable_ipv6 = 1;
+	conf.serv_sockets = 4;
+	ffdnsclient *c = ffdnscl_new(&conf);
+
+	x(0 <= (dead = socket(AF_INET, SOCK_DGRAM, 0)));
+	a.sin_family = AF_INET;
+	a.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	x(0 == bind(dead, (struct sockaddr*)&a, sizeof(a)));
+	x(0 == getsockname(dead, (struct sockaddr*)&a, &alen));
+	ffstr_set(&str, buf, ffs_format_r0(buf, sizeof(buf), "127.0.0.1:%u", (int)ntohs(a.sin_port)));
+	x(0 == ffdnscl_serv_add(c, &str));
+
+	x(0 <= (s.sk = socket(AF_INET, SOCK_DGRAM, 0)));
+	a.sin_port = 0;
+	x(0 == bind(s.sk, (struct sockaddr*)&a, sizeof(a)));
+	alen = sizeof(a);
+	x(0 == getsockname(s.sk, (struct sockaddr*)&a, &alen));
+	ffstr_set(&str, buf, ffs_format_r0(buf, sizeof(buf), "127.0.0.1:%u", (int)ntohs(a.sin_port)));
+	x(0 == ffdnscl_serv_add(c, &str));
+
+	s.nq = NAMES * 2;
+	ffthd th;
+	x(FFTHD_INV != (th = ffthd_create(&dns_stub_thread, &s, 0)));
+
+	ffkqu_time tm;
+	ffkqu_settm(&tm, 10);
+	for (uint i = 0;  i != NAMES;  i++) {
+		ffstr_set(&str, buf, ffs_format_r0(buf, sizeof(buf), "h%u.health.test", i));
+		x(0 == ffdnscl_resolve(c, str, &health_onresolve, NULL, 0));
+
+		while (health_done != i + 1) {
+			ffkqu_entry ev[8];
+			int n = ffkqu_wait(kq, ev, FF_COUNT(ev), &tm);
+			for (int k = 0;  k < n;  k++) {
+				ffkev_call(&ev[k]);
+			}
+			test_timers_process();
+		}
+	}
+	ffthd_join(th, -1, NULL);
+
+	struct ffdnscl_serv_stats st;
+	x(0 == ffdnscl_serv_stats(c, 0, &st));
+	x(st.timeouts != 0 && st.timeouts == st.queries);
+	x(st.queries <= 1 + NAMES / 16);
+	x(st.loss != 0);
+	x(st.srtt == 0);
+
+	x(0 == ffdnscl_serv_stats(c, 1, &st));
+	xieq(NAMES * 2, st.answers);
+	x(st.timeouts == 0);
+	x(st.srtt != 0);
+	x(st.rto < conf.retry_timeout);
+	xieq(4, st.sockets);
+
+	x(0 != ffdnscl_serv_stats(c, 2, &st));
+
+	ffdnscl_free(c);
+	ffkqu_close(kq);
+	close(s.sk);
+	close(dead);
+}
+
+
+struct dns_stub_tc {
+	int sk, lsk; // UDP socket, TCP listening socket on the same port
+	uint nq;
+	uint conns; // TCP connections accepted
+};
+
+/** Reply to UDP queries with empty truncated responses, then answer the same queries over one TCP connection */
+static int FFTHDCALL dns_stub_tc_thread(void *param)
+{
+	struct dns_stub_tc *s = param;
+	char buf[FFDNS_MAXMSG + 64];
+	uint i;
+
+	for (i = 0;  i != s->nq;  i++) {
+		struct sockaddr_in peer;
+		socklen_t peer_len = sizeof(peer);
+		ssize_t n = recvfrom(s->sk, buf, FFDNS_MAXMSG, 0, (struct sockaddr*)&peer, &peer_len);
+		x(n > (ssize_t)sizeof(struct ffdns_hdr));
+
+		buf[2] = (char)0x83; // response, truncation, recursion desired
+		buf[3] = (char)0x80;
+		sendto(s->sk, buf, n, 0, (struct sockaddr*)&peer, peer_len);
+	}
+
+	int c = accept(s->lsk, NULL, NULL);
+	x(c >= 0);
+	s->conns++;
+
+	// the queries are pipelined: read them one by one from the stream
+	for (i = 0;  i != s->nq;  i++) {
+		ffbyte len[2];
+		x(2 == recv(c, len, 2, MSG_WAITALL));
+		ssize_t n = len[0] << 8 | len[1];
+		x(n == recv(c, &buf[2], n, MSG_WAITALL));
+
+		n = dns_stub_answer(&buf[2], n);
+		buf[0] = (char)(n >> 8);
+		buf[1] = (char)n;
+		x(n + 2 == send(c, buf, n + 2, 0));
+	}
+
+	// no more connections
+	fcntl(s->lsk, F_SETFL, O_NONBLOCK);
+	x(0 > accept(s->lsk, NULL, NULL));
+	close(c);
+	return 0;
+}
+
+static uint tcp_done;
+
+static void tcp_onresolve(void *udata, const ffdnscl_result *res)
+{
+	xieq(FFDNS_NOERROR, res->status);
+	x(res->ip.len == 2);
+	tcp_done++;
+}
+
+/** Truncated responses: the queries are sent again via one persistent TCP connection */
+void test_dns_client_tcp(void)
+{
+	FFTEST_FUNC;
+	enum { NAMES = 8 };
+	struct dns_stub_tc s = {};
+	struct sockaddr_in a = {};
+	socklen_t alen = sizeof(a);
+	char buf[128];
+	ffstr str;
+
+	x(0 <= (s.sk = socket(AF_INET, SOCK_DGRAM, 0)));
+	a.sin_family = AF_INET;
+	a.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	x(0 == bind(s.sk, (struct sockaddr*)&a, sizeof(a)));
+	x(0 == getsockname(s.sk, (struct sockaddr*)&a, &alen));
+	x(0 <= (s.lsk = socket(AF_INET, SOCK_STREAM, 0)));
+	x(0 == bind(s.lsk, (struct sockaddr*)&a, sizeof(a)));
+	x(0 == listen(s.lsk, 8));
+	s.nq = NAMES * 2;
+
+	fffd kq = ffkqu_create();
+	ffdnscl_conf conf = {};
+	conf.kq = kq;
+	conf.oncomplete = &oncomplete;
+	conf.log = &dnslog;
+	conf.time = &dnstime;
+	conf.timer = &test_timer;
+	conf.max_tries = 1;
+	conf.retry_timeout = 5000;
+	conf.buf_size = FFDNS_MAXMSG;
+	conf.enable_ipv6 = 1;
+	ffdnsclient *c = ffdnscl_new(&conf);
+	ffstr_set(&str, buf, ffs_format_r0(buf, sizeof(buf), "127.0.0.1:%u", (int)ntohs(a.sin_port)));
+	x(0 == ffdnscl_serv_add(c, &str));
+
+	ffthd th;
+	x(FFTHD_INV != (th = ffthd_create(&dns_stub_tc_thread, &s, 0)));
+
+	for (uint i = 0;  i != NAMES;  i++) {
+		ffstr_set(&str, buf, ffs_format_r0(buf, sizeof(buf), "h%u.tcp.test", i));
+		x(0 == ffdnscl_resolve(c, str, &tcp_onresolve, NULL, 0));
+	}
+
+	ffkqu_time tm;
+	ffkqu_settm(&tm, 1000);
+	while (tcp_done != NAMES) {
+		ffkqu_entry ev[8];
+		int n = ffkqu_wait(kq, ev, FF_COUNT(ev), &tm);
+		x(n > 0);
+		for (int k = 0;  k < n;  k++) {
+			ffkev_call(&ev[k]);
+		}
+	}
+	ffthd_join(th, -1, NULL);
+
+	struct ffdnscl_serv_stats st;
+	x(0 == ffdnscl_serv_stats(c, 0, &st));
+	xieq(NAMES * 2, st.truncated);
+	x(st.tcp == 1);
+	xieq(1, s.conns);
+
+	ffdnscl_free(c);
+	ffkqu_close(kq);
+	close(s.sk);
+	close(s.lsk);
+}
+
+
+static uint stale_sec; // the clock is moved forward by this number of seconds
+static uint stale_done, stale_naddrs;
+static int stale_status;
+
+static fftime stale_time(void)
+{
+	fftime t;
+	fftime_now(&t);
+	t.sec += stale_sec;
+	return t;
+}
+
+static void stale_onresolve(void *udata, const ffdnscl_result *res)
+{
+	stale_status = res->status;
+	stale_naddrs = res->ip.len;
+	stale_done++;
+}
+
+static void stale_events(fffd kq)
+{
+	ffkqu_time tm;
+	ffkqu_settm(&tm, 10);
+	ffkqu_entry ev[8];
+	int n = ffkqu_wait(kq, ev, FF_COUNT(ev), &tm);
+	for (int k = 0;  k < n;  k++) {
+		ffkev_call(&ev[k]);
+	}
+	test_timers_process();
+}
+
+/** A popular entry is refreshed before it expires (prefetch);
+an expired entry is used while the server doesn't respond (serve-stale) */
+void test_dns_client_stale(void)
+{
+	FFTEST_FUNC;
+	struct dns_stub s = {};
+	struct sockaddr_in a = {};
+	socklen_t alen = sizeof(a);
+	struct ffdnscl_stats st;
+	char buf[128];
+	ffstr str;
+
+	x(0 <= (s.sk = socket(AF_INET, SOCK_DGRAM, 0)));
+	a.sin_family = AF_INET;
+	a.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	x(0 == bind(s.sk, (struct sockaddr*)&a, sizeof(a)));
+	x(0 == getsockname(s.sk, (struct sockaddr*)&a, &alen));
+	s.nq = 2 * 2; // the first query and the refresh query;  then the server is silent
+
+	fffd kq = ffkqu_create();
+	ffdnscl_conf conf = {};
+	conf.kq = kq;
+	conf.oncomplete = &oncomplete;
+	conf.log = &dnslog;
+	conf.time = &stale_time;
+	conf.timer = &test_timer;
+	conf.max_tries = 1;
+	conf.retry_timeout = 300;
+	conf.buf_size = FFDNS_MAXMSG;
+	conf.enable_ipv6 = 1;
+	conf.cache_size = 64*1024;
+	conf.cache_ttl_max = 60*60;
+	conf.cache_prefetch_hits = 2;
+	conf.cache_stale_max = 600;
+	ffdnsclient *c = ffdnscl_new(&conf);
+	ffstr_set(&str, buf, ffs_format_r0(buf, sizeof(buf), "127.0.0.1:%u", (int)ntohs(a.sin_port)));
+	x(0 == ffdnscl_serv_add(c, &str));
+
+	ffthd th;
+	x(FFTHD_INV != (th = ffthd_create(&dns_stub_thread, &s, 0)));
+
+	// the response is cached with TTL 60
+	ffstr_setz(&str, "hot.stale.test");
+	x(0 == ffdnscl_resolve(c, str, &stale_onresolve, NULL, 0));
+	while (stale_done != 1) {
+		stale_events(kq);
+	}
+	xieq(FFDNS_NOERROR, stale_status);
+	xieq(2, stale_naddrs);
+
+	// 5 seconds before expiration: the second hit starts the refresh query
+	stale_sec = 55;
+	x(0 == ffdnscl_resolve(c, str, &stale_onresolve, NULL, 0));
+	xieq(2, stale_done);
+	ffdnscl_stats(c, &st);
+	x(st.cache_prefetches == 0);
+
+	x(0 == ffdnscl_resolve(c, str, &stale_onresolve, NULL, 0));
+	xieq(3, stale_done);
+	ffdnscl_stats(c, &st);
+	x(st.cache_prefetches == 1);
+
+	while (st.received != 4) {
+		stale_events(kq);
+		ffdnscl_stats(c, &st);
+	}
+	ffthd_join(th, -1, NULL);
+
+	// the refreshed entry is fresh after the original TTL
+	stale_sec = 100;
+	x(0 == ffdnscl_resolve(c, str, &stale_onresolve, NULL, 0));
+	xieq(4, stale_done);
+	ffdnscl_stats(c, &st);
+	x(st.cache_hits == 3);
+	x(st.cache_prefetches == 1);
+
+	// expired 100 seconds ago, the server doesn't respond: the stale entry is used
+	stale_sec = 55 + 60 + 100;
+	x(0 == ffdnscl_resolve(c, str, &stale_onresolve, NULL, 0));
+	xieq(4, stale_done);
+	while (stale_done != 5) {
+		stale_events(kq);
+	}
+	xieq(FFDNS_NOERROR, stale_status);
+	xieq(2, stale_naddrs);
+	ffdnscl_stats(c, &st);
+	x(st.cache_stale == 1);
+
+	// expired beyond 'cache_stale_max'
+	stale_sec = 55 + 60 + 700;
+	x(0 == ffdnscl_resolve(c, str, &stale_onresolve, NULL, 0));
+	while (stale_done != 6) {
+		stale_events(kq);
+	}
+	xieq(-1, stale_status);
+	ffdnscl_stats(c, &st);
+	x(st.cache_stale == 1);
+
+	ffdnscl_free(c);
+	ffkqu_close(kq);
+	close(s.sk);
+}
+
+
+/** Answer by the first label of the name:
+ "tN": one A or AAAA record with TTL N;
+ "nx": NXDOMAIN;  "nodata": no records;  "...nosoa": without SOA record */
+static ssize_t dns_stub_cache_answer(char *buf, ssize_t n)
+{
+	// MNAME, RNAME: root;  SERIAL 1, REFRESH, RETRY, EXPIRE, MINIMUM 120;  TTL 300
+	static const char soa[] = "\xc0\x0c" "\x00\x06" "\x00\x01" "\x00\x00\x01\x2c" "\x00\x16"
+		"\x00" "\x00" "\x00\x00\x00\x01" "\x00\x00\x0e\x10" "\x00\x00\x02\x58" "\x00\x01\x51\x80" "\x00\x00\x00\x78";
+	ffstr label;
+	ffstr_set(&label, &buf[13], (ffbyte)buf[12]);
+
+	if (label.ptr[0] == 't') {
+		uint ttl = 0;
+		ffstr_shift(&label, 1);
+		x(ffstr_toint(&label, &ttl, FFS_INT32));
+		ssize_t rec = n;
+		n = dns_stub_answer(buf, n);
+		buf[rec + 6] = (char)(ttl >> 24);
+		buf[rec + 7] = (char)(ttl >> 16);
+		buf[rec + 8] = (char)(ttl >> 8);
+		buf[rec + 9] = (char)ttl;
+		return n;
+	}
+
+	ffbool nx = ffstr_eqz(&label, "nx") || ffstr_eqz(&label, "nxnosoa");
+	ffbool with_soa = ffstr_eqz(&label, "nx") || ffstr_eqz(&label, "nodata");
+	buf[2] = (char)0x81; // response, recursion desired
+	buf[3] = (char)(0x80 | ((nx) ? FFDNS_NXDOMAIN : FFDNS_NOERROR));
+	buf[7] = 0; // answer count
+	buf[9] = with_soa; // authority count
+	buf[11] = 0;
+	if (with_soa) {
+		ffmem_copy(&buf[n], soa, sizeof(soa) - 1);
+		n += sizeof(soa) - 1;
+	}
+	return n;
+}
+
+static int FFTHDCALL dns_stub_cache_thread(void *param)
+{
+	struct dns_stub *s = param;
+	char buf[FFDNS_MAXMSG + 64];
+
+	for (uint i = 0;  i != s->nq;  i++) {
+		struct sockaddr_in peer;
+		socklen_t peer_len = sizeof(peer);
+		ssize_t n = recvfrom(s->sk, buf, FFDNS_MAXMSG, 0, (struct sockaddr*)&peer, &peer_len);
+		x(n > (ssize_t)sizeof(struct ffdns_hdr));
+
+		n = dns_stub_cache_answer(buf, n);
+		sendto(s->sk, buf, n, 0, (struct sockaddr*)&peer, peer_len);
+	}
+	return 0;
+}
+
+/** Resolve the name and wait for the result
+Return 1 if the result is from cache */
+static int cache_resolve_wait(ffdnsclient *c, fffd kq, const char *name)
+{
+	ffstr str = FFSTR_INITZ(name);
+	uint n = stale_done;
+	x(0 == ffdnscl_resolve(c, str, &stale_onresolve, NULL, 0));
+	if (stale_done != n)
+		return 1;
+	while (stale_done == n) {
+		stale_events(kq);
+	}
+	return 0;
+}
+
+/** Cache: min. and max. TTL;  negative responses (RFC 2308);  the least recently used entries are removed */
+void test_dns_client_cache(void)
+{
+	FFTEST_FUNC;
+	enum { LRU_NAMES = 64 };
+	struct dns_stub s = {};
+	struct sockaddr_in a = {};
+	socklen_t alen = sizeof(a);
+	struct ffdnscl_stats st;
+	char buf[128];
+	ffstr str;
+
+	x(0 <= (s.sk = socket(AF_INET, SOCK_DGRAM, 0)));
+	a.sin_family = AF_INET;
+	a.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	x(0 == bind(s.sk, (struct sockaddr*)&a, sizeof(a)));
+	x(0 == getsockname(s.sk, (struct sockaddr*)&a, &alen));
+	s.nq = (4 + 6) * 2 + (LRU_NAMES + 1) * 2; // A and AAAA for each miss
+
+	fffd kq = ffkqu_create();
+	ffdnscl_conf conf = {};
+	conf.kq = kq;
+	conf.oncomplete = &oncomplete;
+	conf.log = &dnslog;
+	conf.time = &stale_time;
+	conf.timer = &test_timer;
+	conf.max_tries = 1;
+	conf.retry_timeout = 1000;
+	conf.buf_size = FFDNS_MAXMSG;
+	conf.enable_ipv6 = 1;
+	conf.cache_size = 64*1024;
+	conf.cache_ttl_min = 30;
+	conf.cache_ttl_max = 600;
+	ffdnsclient *c = ffdnscl_new(&conf);
+	ffstr_set(&str, buf, ffs_format_r0(buf, sizeof(buf), "127.0.0.1:%u", (int)ntohs(a.sin_port)));
+	x(0 == ffdnscl_serv_add(c, &str));
+
+	ffthd th;
+	x(FFTHD_INV != (th = ffthd_create(&dns_stub_cache_thread, &s, 0)));
+	stale_sec = 0;
+
+	// TTL 5 is cached for 'cache_ttl_min' seconds
+	x(!cache_resolve_wait(c, kq, "t5.ttl.test"));
+	xieq(2, stale_naddrs);
+	stale_sec = 20;
+	x(cache_resolve_wait(c, kq, "t5.ttl.test"));
+	stale_sec = 40;
+	x(!cache_resolve_wait(c, kq, "t5.ttl.test"));
+
+	// TTL 5000 is cached for 'cache_ttl_max' seconds
+	x(!cache_resolve_wait(c, kq, "t5000.ttl.test"));
+	stale_sec = 40 + 500;
+	x(cache_resolve_wait(c, kq, "t5000.ttl.test"));
+	stale_sec = 40 + 700;
+	x(!cache_resolve_wait(c, kq, "t5000.ttl.test"));
+
+	// NXDOMAIN and NODATA are cached with TTL from SOA record;
+	// without SOA record they aren't cached at all, even with 'cache_ttl_min'
+	x(!cache_resolve_wait(c, kq, "nx.neg.test"));
+	xieq(FFDNS_NXDOMAIN, stale_status);
+	x(cache_resolve_wait(c, kq, "nx.neg.test"));
+	xieq(FFDNS_NXDOMAIN, stale_status);
+
+	x(!cache_resolve_wait(c, kq, "nxnosoa.neg.test"));
+	xieq(FFDNS_NXDOMAIN, stale_status);
+	x(!cache_resolve_wait(c, kq, "nxnosoa.neg.test"));
+
+	x(!cache_resolve_wait(c, kq, "nodata.neg.test"));
+	x(cache_resolve_wait(c, kq, "nodata.neg.test"));
+	xieq(0, stale_naddrs);
+
+	x(!cache_resolve_wait(c, kq, "nodatanosoa.neg.test"));
+	x(!cache_resolve_wait(c, kq, "nodatanosoa.neg.test"));
+
+	ffdnscl_stats(c, &st);
+	xieq(4, st.cache_hits);
+	xieq(10, st.cache_misses);
+	ffdnscl_free(c);
+
+	// the cache can't hold all names: the first name is used after each new one and stays,
+	//  the second one is removed
+	conf.cache_size = 4*1024;
+	c = ffdnscl_new(&conf);
+	ffstr_set(&str, buf, ffs_format_r0(buf, sizeof(buf), "127.0.0.1:%u", (int)ntohs(a.sin_port)));
+	x(0 == ffdnscl_serv_add(c, &str));
+	for (uint i = 0;  i != LRU_NAMES;  i++) {
+		ffs_format_r0(buf, sizeof(buf), "t60.h%u.lru.test%Z", i);
+		x(!cache_resolve_wait(c, kq, buf));
+		x(cache_resolve_wait(c, kq, "t60.h0.lru.test"));
+	}
+	ffdnscl_stats(c, &st);
+	x(st.cache_used <= conf.cache_size);
+	x(st.cache_entries < LRU_NAMES * 2);
+	x(cache_resolve_wait(c, kq, "t60.h0.lru.test"));
+	x(!cache_resolve_wait(c, kq, "t60.h1.lru.test"));
+	x(cache_resolve_wait(c, kq, "t60.h63.lru.test"));
+
+	ffthd_join(th, -1, NULL);
+	ffdnscl_free(c);
+	ffkqu_close(kq);
+	close(s.sk);
+}
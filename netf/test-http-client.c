@@ -0,0 +1,1138 @@
+/** HTTP client tester: asynchronous hostname resolution, Happy Eyeballs, request body, Content-Encoding,
+ fetch manager, keep-alive connection pool
+2026, Simon Zolin */
+
+#define ZZKQ_LOG_SYSERR  FFHTTPCL_LOG_ERR
+#define ZZKQ_LOG_ERR  FFHTTPCL_LOG_ERR
+#define ZZKQ_LOG_DEBUG  FFHTTPCL_LOG_DEBUG
+#include <FF/net/http-client.h>
+#include <FF/net/http-fetch.h>
+#include <FF/sys/kq.h>
+#include <FF/net/dns-client.h>
+#include <FF/net/dns.h>
+#include <FF/sys/thpool.h>
+#include <FFOS/thread.h>
+#include <FFOS/timer.h>
+#include <FFOS/test.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <poll.h>
+
+
+#define STUB_DNS_DELAY  300 // msec
+
+static fffd kq;
+static fftimer timer;
+static uint ticks; // timer ticks while the request is in progress
+static uint ticks_resolved; // timer ticks before the address was resolved
+static uint done;
+static void *cur; // the current request
+static uint resume; // call send() for the current request
+static ffvec resp_body; // collect response body instead of checking it
+static uint resp_collect; // 1: collect;  2: count
+static uint64 resp_bytes;
+static uint resp_detach; // take the receive buffers with ffhttpcl_recv_detach();  2: and check the headers
+static uint resp_err; // the request is expected to fail
+static fflock post_lk;
+static void (*post_func)(void*);
+static void *post_param;
+
+/** Bind socket to 127.0.0.N:port;  return port */
+static uint stub_bind(int sk, uint n, uint port)
+{
+	struct sockaddr_in a = {};
+	a.sin_family = AF_INET;
+	a.sin_addr.s_addr = htonl(0x7f000000 | n);
+	a.sin_port = htons(port);
+	x(0 == bind(sk, (struct sockaddr*)&a, sizeof(a)));
+	socklen_t alen = sizeof(a);
+	x(0 == getsockname(sk, (struct sockaddr*)&a, &alen));
+	return ntohs(a.sin_port);
+}
+
+struct stub {
+	int dns, tcp;
+	uint ndns; // max. N of DNS queries to answer
+	uint dns_delay; // msec
+	ffbyte hosts[2]; // A records: 127.0.0.N
+	uint nhosts;
+	uint nhttp; // N of HTTP requests to serve
+	uint n503; // N of the first HTTP requests to respond with 503
+	ffstr resp; // response to send instead of "ok"
+	uint64 body_len; // send a response body of this size instead of "ok"
+	ffvec req; // the last request received
+	uint keepalive; // serve the requests via persistent connections
+	uint npipe; // keep-alive: wait for N requests before responding
+	uint naccept; // N of accepted connections
+};
+
+/** Receive the complete request: headers and body (Content-Length or chunked) */
+static void stub_recv_req(int k, ffvec *req)
+{
+	ffsize hdrs = 0;
+	req->len = 0;
+	for (;;) {
+		ffvec_grow(req, 64 * 1024, 1);
+		ssize_t n = recv(k, ffslice_end(req, 1), req->cap - req->len, 0);
+		x(n > 0);
+		req->len += n;
+
+		ffstr d = FFSTR_INITSTR(req);
+		if (hdrs == 0) {
+			ssize_t i = ffstr_find(&d, "\r\n\r\n", 4);
+			if (i < 0)
+				continue;
+			hdrs = i + 4;
+		}
+		ffstr h;
+		ffstr_set(&h, d.ptr, hdrs);
+		ssize_t i = ffstr_ifindz(&h, "Content-Length: ");
+		if (i >= 0) {
+			uint64 len = 0;
+			x(0 != ffs_toint(h.ptr + i + 16, h.len - i - 16, &len, FFS_INT64));
+			if (d.len == hdrs + len)
+				return;
+			x(d.len < hdrs + len);
+		} else if (0 <= ffstr_ifindz(&h, "Transfer-Encoding: chunked")) {
+			if (d.len >= 7 && !ffmem_cmp(d.ptr + d.len - 7, "\r\n0\r\n\r\n", 7))
+				return;
+		} else {
+			return;
+		}
+	}
+}
+
+static void stub_send_body(int k, uint64 total)
+{
+	char buf[1024 * 1024];
+	int n = ffs_format_r0(buf, sizeof(buf), "HTTP/1.1 200 OK\r\nContent-Length: %U\r\nConnection: close\r\n\r\n", total);
+	x(n == send(k, buf, n, 0));
+	ffmem_fill(buf, 'x', sizeof(buf));
+	while (total != 0) {
+		ssize_t r = send(k, buf, ffmin(total, sizeof(buf)), 0);
+		x(r > 0);
+		total -= r;
+	}
+}
+
+/** Answer A query with 127.0.0.N after a delay */
+static void stub_dns(struct stub *s)
+{
+	char buf[4096];
+	struct sockaddr_in peer;
+	socklen_t peer_len = sizeof(peer);
+	ssize_t n = recvfrom(s->dns, buf, sizeof(buf) - 64, 0, (struct sockaddr*)&peer, &peer_len);
+	x(n > (ssize_t)sizeof(struct ffdns_hdr));
+	ffthd_sleep(s->dns_delay);
+
+	ffbool type_a = (buf[n - 3] == FFDNS_A);
+	buf[2] = (char)0x81; // response, recursion desired
+	buf[3] = (char)0x80; // recursion available, NOERROR
+	buf[7] = (type_a) ? s->nhosts : 0; // answer count
+	buf[9] = buf[11] = 0; // no authority and additional records
+	for (uint j = 0;  type_a && j != s->nhosts;  j++) {
+		static const char ans[] = "\xc0\x0c" "\x00\x01" "\x00\x01" "\x00\x00\x00\x3c" "\x00\x04" "\x7f\x00\x00";
+		ffmem_copy(&buf[n], ans, sizeof(ans) - 1);
+		n += sizeof(ans) - 1;
+		buf[n++] = s->hosts[j];
+	}
+	sendto(s->dns, buf, n, 0, (struct sockaddr*)&peer, peer_len);
+}
+
+/** Serve 1 HTTP connection: respond with "ok" */
+static void stub_http(struct stub *s)
+{
+	int k = accept(s->tcp, NULL, NULL);
+	x(k >= 0);
+	stub_recv_req(k, &s->req);
+	const char *resp = "HTTP/1.1 200 OK\r\nContent-Length: 2\r\nConnection: close\r\n\r\nok";
+	if (s->n503 != 0) {
+		s->n503--;
+		resp = "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+	}
+	ffsize len = ffsz_len(resp);
+	if (s->body_len != 0) {
+		stub_send_body(k, s->body_len);
+		close(k);
+		return;
+	}
+	if (s->resp.len != 0) {
+		resp = s->resp.ptr;
+		len = s->resp.len;
+	}
+	x((ssize_t)len == send(k, resp, len, 0));
+	close(k);
+}
+
+/** Serve 'nhttp' requests via keep-alive connections.
+The requests are responded to in order when 'npipe' of them are received or when no more data arrives.
+Response body is the request path without '/'.
+Exit when the client closes the connection. */
+static void stub_keepalive(struct stub *s)
+{
+	ffvec in = {}, out = {};
+	uint nresp = 0;
+	int k = -1;
+
+	while (nresp != s->nhttp || k >= 0) {
+		if (k < 0) {
+			x(0 <= (k = accept(s->tcp, NULL, NULL)));
+			s->naccept++;
+			in.len = 0;
+		}
+
+		struct pollfd pl = { k, POLLIN, 0 };
+		int r = poll(&pl, 1, (in.len != 0) ? 1000 : -1);
+		x(r >= 0);
+		if (r == 1) {
+			ffvec_grow(&in, 4096, 1);
+			ssize_t n = recv(k, ffslice_end(&in, 1), in.cap - in.len, 0);
+			if (n <= 0) {
+				close(k);
+				k = -1;
+				continue;
+			}
+			in.len += n;
+		}
+
+		// "GET /path HTTP/1.1\r\n...\r\n\r\n"...
+		ffstr d = FFSTR_INITSTR(&in), line, method, rest, path, ver;
+		uint nreq = 0;
+		out.len = 0;
+		for (ssize_t i;  0 <= (i = ffstr_find(&d, "\r\n\r\n", 4));  ) {
+			ffstr_set(&line, d.ptr, i);
+			ffstr_shift(&d, i + 4);
+			ffstr_splitby(&line, ' ', &method, &rest);
+			ffstr_splitby(&rest, ' ', &path, &ver);
+			ffstr_shift(&path, 1);
+			ffvec_addfmt(&out, "HTTP/1.1 200 OK\r\nContent-Length: %L\r\n\r\n%S"
+				, path.len, &path);
+			nreq++;
+		}
+		if (nreq == 0 || (r == 1 && nreq < s->npipe))
+			continue;
+
+		x((ssize_t)out.len == send(k, out.ptr, out.len, 0));
+		nresp += nreq;
+		ffslice_rm((ffslice*)&in, 0, in.len - d.len, 1);
+	}
+
+	ffvec_free(&in);
+	ffvec_free(&out);
+}
+
+/** DNS and HTTP server.
+DNS queries are answered while the HTTP requests are served:
+ the client resolves the host name again for each request.
+Exit after 'nhttp' HTTP connections are served. */
+static int FFTHDCALL stub_thread(void *param)
+{
+	struct stub *s = param;
+	uint idns = 0, ihttp = 0;
+
+	if (s->keepalive) {
+		stub_keepalive(s);
+		return 0;
+	}
+
+	while (ihttp != s->nhttp) {
+		struct pollfd pl[2] = {
+			{ s->tcp, POLLIN, 0 },
+			{ s->dns, POLLIN, 0 },
+		};
+		uint npl = (idns != s->ndns) ? 2 : 1;
+		x(0 < poll(pl, npl, -1));
+
+		if (npl == 2 && (pl[1].revents & POLLIN)) {
+			stub_dns(s);
+			idns++;
+			continue; // if a request is ready too, it's served on the next iteration
+		}
+
+		if (pl[0].revents & POLLIN) {
+			stub_http(s);
+			ihttp++;
+		}
+	}
+	return 0;
+}
+
+static void onhttp(void *param)
+{
+	void *c = param;
+	ffhttp_response *resp;
+	ffstr data;
+	int r = ffhttpcl_recv(c, &resp, &data);
+	switch (r) {
+	case FFHTTPCL_IP_WAIT:
+		ticks_resolved = ticks;
+		break;
+
+	case FFHTTPCL_RESP:
+		xieq(200, resp->code);
+		break;
+
+	case FFHTTPCL_RESP_RECV:
+		if (resp_collect == 2)
+			resp_bytes += data.len;
+		else if (resp_collect)
+			ffvec_add2(&resp_body, &data, 1);
+		else if (data.len != 0)
+			x(ffstr_eqz(&data, "ok"));
+
+		if (resp_detach && data.len != 0) {
+			ffstr buf, val;
+			x(0 == ffhttpcl_recv_detach(c, &buf));
+			if (resp_detach == 2)
+				ffmem_fill(buf.ptr, 'z', buf.len); // nothing may reference the buffer now
+			ffstr_free(&buf);
+			if (resp_detach == 2) {
+				x(ffstr_eqz(&resp->status, "OK"));
+				x(ffhttp_findhdr(&resp->h, "X-Test", 6, &val));
+				x(ffstr_eqz(&val, "value"));
+			}
+		}
+		break;
+
+	case FFHTTPCL_DONE:
+		done = 1;
+		return;
+
+	case FFHTTPCL_ERR:
+	case FFHTTPCL_ENOADDR:
+		x(resp_err);
+		resp_err = 0;
+		done = 1;
+		return;
+	}
+	ffhttpcl_send(c, NULL);
+}
+
+static void httplog(void *udata, uint level, const char *fmt, ...)
+{
+	ffarr a = {};
+	va_list args;
+	va_start(args, fmt);
+	ffstr_catfmtv(&a, fmt, args);
+	va_end(args);
+	fffile_write(ffstdout, a.ptr, a.len);
+	fffile_write(ffstdout, "\r\n", 2);
+	ffarr_free(&a);
+}
+
+static void dnslog(uint level, const char *fmt, ...)
+{
+}
+
+static void emptytimer(fftimerqueue_node *tmr, uint value_ms)
+{
+}
+
+static fftime dnstime(void)
+{
+	fftime t;
+	fftime_now(&t);
+	return t;
+}
+
+static uint64 time_ms(void)
+{
+	fftime t = dnstime();
+	return fftime_sec(&t) * 1000 + fftime_msec(&t);
+}
+
+static struct {
+	fftimerqueue_node *node;
+	uint64 expire; // msec
+} timers[4];
+static uint timers_fired; // N of expired timers
+
+/** One-shot timers for ffhttpcl;  processed by loop() with 50msec resolution */
+static void testtimer(fftimerqueue_node *tmr, uint value_ms)
+{
+	uint i, ifree = FF_COUNT(timers);
+	for (i = 0;  i != FF_COUNT(timers);  i++) {
+		if (timers[i].node == tmr)
+			timers[i].node = NULL;
+		if (timers[i].node == NULL && ifree == FF_COUNT(timers))
+			ifree = i;
+	}
+	if (value_ms == 0)
+		return;
+
+	x(ifree != FF_COUNT(timers));
+	timers[ifree].node = tmr;
+	timers[ifree].expire = time_ms() + value_ms;
+}
+
+static void timers_process(void)
+{
+	uint64 now = time_ms();
+	for (uint i = 0;  i != FF_COUNT(timers);  i++) {
+		fftimerqueue_node *tmr = timers[i].node;
+		if (tmr != NULL && now >= timers[i].expire) {
+			timers[i].node = NULL;
+			timers_fired++;
+			tmr->func(tmr->param);
+		}
+	}
+}
+
+/** Called by a thread pool worker */
+static void post(void (*func)(void*), void *param)
+{
+	fflock_lock(&post_lk);
+	x(post_func == NULL);
+	post_param = param;
+	post_func = func;
+	fflock_unlock(&post_lk);
+}
+
+/** Process kernel events and the posted function until the request is complete */
+static void loop(void)
+{
+	ffkqu_time tm;
+	ffkqu_settm(&tm, 1000);
+	while (!done) {
+		ffkqu_entry ev;
+		int n = ffkqu_wait(kq, &ev, 1, &tm);
+		x(n >= 0);
+		if (n == 1) {
+			if (ffkq_event_data(&ev) == (void*)-1)
+				ticks++;
+			else
+				ffkev_call(&ev);
+		}
+
+		timers_process();
+
+		if (resume) {
+			resume = 0;
+			ffhttpcl_send(cur, NULL);
+		}
+
+		fflock_lock(&post_lk);
+		void (*func)(void*) = post_func;
+		void *param = post_param;
+		post_func = NULL;
+		fflock_unlock(&post_lk);
+		if (func != NULL)
+			func(param);
+	}
+}
+
+static void request_conf(void *c, struct ffhttpcl_conf *conf)
+{
+	struct ffhttpcl_conf cc;
+	ffhttpcl_conf(c, &cc, FFHTTPCL_CONF_GET);
+	cc.kq = kq;
+	cc.log = &httplog;
+	cc.timer = &testtimer;
+	cc.dns = conf->dns;
+	cc.thpool = conf->thpool;
+	cc.post = conf->post;
+	cc.decode = conf->decode;
+	if (conf->buffer_size != 0)
+		cc.buffer_size = conf->buffer_size;
+	cc.buffer_max = conf->buffer_max;
+	cc.rcvlowat = conf->rcvlowat;
+	ffhttpcl_conf(c, &cc, FFHTTPCL_CONF_SET);
+}
+
+static void request(struct ffhttpcl_conf *conf, const char *method, const char *url, const struct ffhttpcl_body *body)
+{
+	void *c = ffhttpcl_request(method, url, 0);
+	x(c != NULL);
+	request_conf(c, conf);
+	ffhttpcl_sethandler(c, &onhttp, c);
+	if (body != NULL)
+		ffhttpcl_body(c, body);
+
+	ticks = ticks_resolved = 0;
+	done = 0;
+	cur = c;
+	ffhttpcl_send(c, NULL);
+	loop();
+	ffhttpcl_close(c);
+	ffmem_zero_obj(&timers);
+}
+
+/** The first address doesn't respond to SYN, the second one accepts the connection */
+static void test_happy_eyeballs(struct stub *s, ffdnsclient *dns, uint port)
+{
+	// 127.0.0.2: listening socket with the full accept queue
+	int dead = socket(AF_INET, SOCK_STREAM, 0);
+	stub_bind(dead, 2, port);
+	x(0 == listen(dead, 0));
+	int fill[2];
+	for (uint i = 0;  i != FF_COUNT(fill);  i++) {
+		struct sockaddr_in a = {};
+		a.sin_family = AF_INET;
+		a.sin_addr.s_addr = htonl(0x7f000002);
+		a.sin_port = htons(port);
+		fill[i] = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+		connect(fill[i], (struct sockaddr*)&a, sizeof(a));
+	}
+
+	s->ndns = 4; // A, AAAA for each request: a NODATA response without SOA isn't cached
+	s->dns_delay = 0;
+	s->hosts[0] = 2;
+	s->hosts[1] = 1;
+	s->nhosts = 2;
+	s->nhttp = 2;
+	ffthd th;
+	x(FFTHD_INV != (th = ffthd_create(&stub_thread, s, 0)));
+
+	struct ffhttpcl_conf conf = {};
+	conf.dns = dns;
+	char url[128];
+	ffs_format_r0(url, sizeof(url), "http://he.test:%u/%Z", port);
+
+	// 127.0.0.1 is tried when 'connect_delay' timer expires
+	timers_fired = 0;
+	request(&conf, "GET", url, NULL);
+	xieq(1, timers_fired);
+
+	// 127.0.0.1 is tried first: no timer expires
+	timers_fired = 0;
+	request(&conf, "GET", url, NULL);
+	xieq(0, timers_fired);
+
+	ffthd_join(th, -1, NULL);
+	for (uint i = 0;  i != FF_COUNT(fill);  i++) {
+		close(fill[i]);
+	}
+	close(dead);
+}
+
+struct body_src {
+	uint64 off, total;
+	uint step; // max. bytes per read
+	uint waited;
+};
+
+static ffssize body_read(void *udata, void *buf, ffsize cap)
+{
+	struct body_src *b = udata;
+	if (!b->waited) {
+		b->waited = 1;
+		resume = 1;
+		return FFHTTPCL_BODY_WAIT;
+	}
+
+	ffsize n = ffmin(cap, b->total - b->off);
+	n = ffmin(n, b->step);
+	for (ffsize i = 0;  i != n;  i++) {
+		((char*)buf)[i] = (char)((b->off + i) % 251);
+	}
+	b->off += n;
+	return n;
+}
+
+/** Check the request body received by the stub server */
+static void body_check(ffvec *req, uint64 total, ffbool chunked)
+{
+	ffstr d = FFSTR_INITSTR(req), out;
+	ssize_t i = ffstr_find(&d, "\r\n\r\n", 4);
+	x(i >= 0);
+	ffstr_shift(&d, i + 4);
+
+	uint64 off = 0;
+	struct httpchunked ch = {};
+	while (d.len != 0) {
+		if (chunked) {
+			ssize_t r = httpchunked_parse(&ch, d, &out);
+			x(r != 0 && r >= -1);
+			if (r == -1) {
+				x(ch.done_len == d.len);
+				break;
+			}
+			ffstr_shift(&d, r);
+		} else {
+			out = d;
+			d.len = 0;
+		}
+
+		for (ffsize j = 0;  j != out.len;  j++) {
+			x((ffbyte)out.ptr[j] == (off + j) % 251);
+		}
+		off += out.len;
+	}
+	xieq(total, off);
+}
+
+/** Request body: Content-Length, chunked, file */
+static void test_http_body(struct stub *s, uint port)
+{
+	struct ffhttpcl_conf conf = {};
+	char url[128];
+	ffs_format_r0(url, sizeof(url), "http://127.0.0.1:%u/%Z", port);
+	ffthd th;
+	s->ndns = 0;
+	s->nhttp = 1;
+
+	struct body_src src = {};
+	struct ffhttpcl_body body = {};
+	body.read = &body_read;
+	body.udata = &src;
+	body.fd = FF_BADFD;
+
+	// Content-Length
+	src.total = 100000;
+	src.step = 7000;
+	body.len = src.total;
+	x(FFTHD_INV != (th = ffthd_create(&stub_thread, s, 0)));
+	request(&conf, "PUT", url, &body);
+	ffthd_join(th, -1, NULL);
+	body_check(&s->req, src.total, 0);
+
+	// chunked
+	ffmem_zero_obj(&src);
+	src.total = 100000;
+	src.step = 3333;
+	body.len = -1;
+	x(FFTHD_INV != (th = ffthd_create(&stub_thread, s, 0)));
+	request(&conf, "POST", url, &body);
+	ffthd_join(th, -1, NULL);
+	body_check(&s->req, src.total, 1);
+
+	// file via sendfile()
+	const char *fn = "/tmp/ffhttpcl-test-body";
+	const uint64 total = 8 * 1024 * 1024, off = 1000;
+	int fd = open(fn, O_RDWR | O_CREAT | O_TRUNC, 0600);
+	x(fd >= 0);
+	ffvec data = {};
+	ffvec_alloc(&data, off + total, 1);
+	for (uint64 j = 0;  j != total;  j++) {
+		((char*)data.ptr)[off + j] = (char)(j % 251);
+	}
+	x((ssize_t)(off + total) == write(fd, data.ptr, off + total));
+	ffvec_free(&data);
+
+	ffmem_zero_obj(&body);
+	body.len = total;
+	body.fd = fd;
+	body.off = off;
+	x(FFTHD_INV != (th = ffthd_create(&stub_thread, s, 0)));
+	request(&conf, "PUT", url, &body);
+	ffthd_join(th, -1, NULL);
+	body_check(&s->req, total, 0);
+	close(fd);
+	unlink(fn);
+}
+
+/** Send chunked response in 2 chunks: the first one ends inside gzip header */
+static void ce_resp(ffvec *buf, const char *ce, const char *data, ffsize len)
+{
+	buf->len = 0;
+	ffvec_addfmt(buf, "HTTP/1.1 200 OK\r\nContent-Encoding: %s\r\nTransfer-Encoding: chunked\r\nConnection: close\r\n\r\n"
+		"5\r\n%*s\r\n"
+		"%xu\r\n%*s\r\n"
+		"0\r\n\r\n"
+		, ce, (ffsize)5, data, (uint)(len - 5), (ffsize)(len - 5), data + 5);
+}
+
+static void ce_check(void)
+{
+	xieq(2000, resp_body.len);
+	for (uint i = 0;  i != 2000;  i += 2) {
+		x(!ffmem_cmp((char*)resp_body.ptr + i, "ok", 2));
+	}
+	resp_body.len = 0;
+}
+
+/** The receive buffers are taken by the user:
+ the headers and the next chunks stay valid after the buffer is freed */
+static void test_http_detach(struct stub *s, uint port)
+{
+	struct ffhttpcl_conf conf = {};
+	char url[128];
+	ffs_format_r0(url, sizeof(url), "http://127.0.0.1:%u/%Z", port);
+	ffthd th;
+	s->ndns = 0;
+	s->nhttp = 1;
+	ffstr_setz(&s->resp, "HTTP/1.1 200 OK\r\nX-Test: value\r\nTransfer-Encoding: chunked\r\nConnection: close\r\n\r\n"
+		"2\r\nok\r\n" "4\r\nokok\r\n" "6\r\nokokok\r\n" "0\r\n\r\n");
+
+	resp_collect = 1;
+	resp_detach = 2;
+	x(FFTHD_INV != (th = ffthd_create(&stub_thread, s, 0)));
+	request(&conf, "GET", url, NULL);
+	ffthd_join(th, -1, NULL);
+	x(ffstr_eqz((ffstr*)&resp_body, "okokokokokok"));
+
+	resp_body.len = 0;
+	resp_collect = 0;
+	resp_detach = 0;
+	ffstr_null(&s->resp);
+}
+
+/** Response body is decoded: gzip, zstd */
+static void test_http_ce(struct stub *s, uint port)
+{
+	struct ffhttpcl_conf conf = {};
+	conf.decode = 1;
+	char url[128];
+	ffs_format_r0(url, sizeof(url), "http://127.0.0.1:%u/%Z", port);
+	ffvec buf = {};
+	ffthd th;
+	s->ndns = 0;
+	s->nhttp = 1;
+	resp_collect = 1;
+
+#ifdef FFHTTPCL_ZLIB
+	static const char gz[] = "\x1f\x8b\x08\x08\x00\x00\x00\x00\x02\xff\x6f\x6b\x2e\x74\x78\x74\x00\xcb\xcf\xce\x1f\x85\xa3\x70\x14\x8e\xc2\x51\x38\x0a\x47\xe1\x10\x87\x00\x46\x77\x15\x50\xd0\x07\x00\x00";
+	ce_resp(&buf, "gzip", gz, sizeof(gz) - 1);
+	ffstr_setstr(&s->resp, &buf);
+	x(FFTHD_INV != (th = ffthd_create(&stub_thread, s, 0)));
+	request(&conf, "GET", url, NULL);
+	ffthd_join(th, -1, NULL);
+	x(0 <= ffstr_ifindz((ffstr*)&s->req, "Accept-Encoding:"));
+	ce_check();
+#endif
+
+#ifdef FFHTTPCL_ZSTD
+	static const char zst[] = "\x28\xb5\x2f\xfd\x04\x68\x4d\x00\x00\x10\x6f\x6b\x01\x00\xcb\xf7\x3b\x2c\x64\x93\xa1\x9d";
+	ce_resp(&buf, "zstd", zst, sizeof(zst) - 1);
+	ffstr_setstr(&s->resp, &buf);
+	x(FFTHD_INV != (th = ffthd_create(&stub_thread, s, 0)));
+	request(&conf, "GET", url, NULL);
+	ffthd_join(th, -1, NULL);
+	ce_check();
+#endif
+
+	// not supported: passed through as is
+	ffvec plain = {};
+	for (uint i = 0;  i != 1000;  i++) {
+		ffvec_add(&plain, "ok", 2, 1);
+	}
+	static const char *const other[] = {
+		"br",
+#ifndef FFHTTPCL_ZSTD
+		"zstd",
+#endif
+	};
+	for (uint i = 0;  i != FF_COUNT(other);  i++) {
+		ce_resp(&buf, other[i], plain.ptr, plain.len);
+		ffstr_setstr(&s->resp, &buf);
+		x(FFTHD_INV != (th = ffthd_create(&stub_thread, s, 0)));
+		request(&conf, "GET", url, NULL);
+		ffthd_join(th, -1, NULL);
+		ce_check();
+	}
+
+	// more than 1 encoding
+	ce_resp(&buf, "gzip, zstd", plain.ptr, plain.len);
+	ffstr_setstr(&s->resp, &buf);
+	x(FFTHD_INV != (th = ffthd_create(&stub_thread, s, 0)));
+	resp_err = 1;
+	request(&conf, "GET", url, NULL);
+	ffthd_join(th, -1, NULL);
+	x(resp_err == 0);
+	resp_body.len = 0;
+	ffvec_free(&plain);
+
+	resp_collect = 0;
+	ffstr_null(&s->resp);
+	ffvec_free(&buf);
+	ffvec_free(&resp_body);
+}
+
+struct pipe_req {
+	void *c;
+	int state; // the last enum FFHTTPCL_ST
+	ffvec body;
+};
+
+static void onpipe(void *param)
+{
+	struct pipe_req *p = param;
+	ffhttp_response *resp;
+	ffstr data;
+	int r = ffhttpcl_recv(p->c, &resp, &data);
+	p->state = r;
+	switch (r) {
+	case FFHTTPCL_RESP_WAIT:
+		done = 1; // the request is sent
+		break;
+
+	case FFHTTPCL_RESP:
+		xieq(200, resp->code);
+		break;
+
+	case FFHTTPCL_RESP_RECV:
+		ffvec_add2(&p->body, &data, 1);
+		break;
+
+	case FFHTTPCL_DONE:
+		done = 1;
+		return;
+
+	case FFHTTPCL_ERR:
+	case FFHTTPCL_ENOADDR:
+		x(0);
+		done = 1;
+		return;
+	}
+	ffhttpcl_send(p->c, NULL);
+}
+
+/** Keep-alive connection pool: reuse, pipelining, eviction of the least recently used idle connection */
+static void test_http_keepalive(struct stub *s, uint port)
+{
+	struct ffhttpcl_conf conf = {};
+	struct ffhttpcl_pool_stats st0, st;
+	char url[128];
+	ffthd th;
+
+	struct ffhttpcl_pool_conf pc = {};
+	pc.max_idle = 2;
+	pc.time = &dnstime;
+	ffhttpcl_pool_conf(&pc);
+
+	s->ndns = 0;
+	s->keepalive = 1;
+
+	// 3 requests, 1 connection
+	s->nhttp = 3;
+	s->npipe = 1;
+	s->naccept = 0;
+	x(FFTHD_INV != (th = ffthd_create(&stub_thread, s, 0)));
+	ffhttpcl_pool_stats(&st0);
+	ffs_format_r0(url, sizeof(url), "http://127.0.0.1:%u/ok%Z", port);
+	for (uint i = 0;  i != 3;  i++) {
+		request(&conf, "GET", url, NULL);
+	}
+	ffhttpcl_pool_stats(&st);
+	xieq(3, st.requests - st0.requests);
+	xieq(2, st.hits - st0.hits);
+	xieq(1, st.connects - st0.connects);
+	xieq(1, st.idle);
+	ffhttpcl_deinit(); // close the idle connection
+	ffthd_join(th, -1, NULL);
+	xieq(1, s->naccept);
+
+	// 3 requests are sent before the first response; the responses arrive in order
+	s->npipe = 3;
+	s->naccept = 0;
+	x(FFTHD_INV != (th = ffthd_create(&stub_thread, s, 0)));
+	ffhttpcl_pool_stats(&st0);
+	struct pipe_req p[3] = {};
+	for (uint i = 0;  i != 3;  i++) {
+		ffs_format_r0(url, sizeof(url), "http://127.0.0.1:%u/%u%Z", port, i);
+		x(NULL != (p[i].c = ffhttpcl_request("GET", url, FFHTTPCL_PIPELINE)));
+		request_conf(p[i].c, &conf);
+		ffhttpcl_sethandler(p[i].c, &onpipe, &p[i]);
+		done = 0;
+		ffhttpcl_send(p[i].c, NULL);
+		loop();
+		xieq(FFHTTPCL_RESP_WAIT, p[i].state);
+	}
+	for (uint i = 0;  i != 3;  i++) {
+		while (p[i].state != FFHTTPCL_DONE) {
+			done = 0;
+			loop();
+		}
+	}
+	for (uint i = 0;  i != 3;  i++) {
+		char b[8];
+		ffs_format_r0(b, sizeof(b), "%u%Z", i);
+		xseq((ffstr*)&p[i].body, b);
+		ffvec_free(&p[i].body);
+		ffhttpcl_close(p[i].c);
+	}
+	ffhttpcl_pool_stats(&st);
+	xieq(3, st.requests - st0.requests);
+	xieq(2, st.pipelined - st0.pipelined);
+	xieq(1, st.connects - st0.connects);
+	ffhttpcl_deinit();
+	ffthd_join(th, -1, NULL);
+	xieq(1, s->naccept);
+
+	// max. 2 idle connections: A, B, C -> A is closed;  B is reused;  A connects again
+	struct stub s2[2] = {};
+	ffthd th2[2];
+	uint ports[3] = { port };
+	s->npipe = 1;
+	s->nhttp = 2;
+	s->naccept = 0;
+	x(FFTHD_INV != (th = ffthd_create(&stub_thread, s, 0)));
+	for (uint i = 0;  i != 2;  i++) {
+		x(0 <= (s2[i].tcp = socket(AF_INET, SOCK_STREAM, 0)));
+		ports[i + 1] = stub_bind(s2[i].tcp, 3 + i, 0);
+		x(0 == listen(s2[i].tcp, 8));
+		s2[i].keepalive = 1;
+		s2[i].npipe = 1;
+		s2[i].nhttp = (i == 0) ? 2 : 1;
+		x(FFTHD_INV != (th2[i] = ffthd_create(&stub_thread, &s2[i], 0)));
+	}
+	ffhttpcl_pool_stats(&st0);
+	static const ffbyte order[] = { 0, 1, 2, 1, 0 };
+	for (uint i = 0;  i != FF_COUNT(order);  i++) {
+		uint h = order[i];
+		ffs_format_r0(url, sizeof(url), "http://127.0.0.%u:%u/ok%Z", (h == 0) ? 1 : 2 + h, ports[h]);
+		request(&conf, "GET", url, NULL);
+	}
+	ffhttpcl_pool_stats(&st);
+	xieq(5, st.requests - st0.requests);
+	xieq(1, st.hits - st0.hits);
+	xieq(4, st.connects - st0.connects);
+	xieq(2, st.idle);
+	ffhttpcl_deinit();
+	ffthd_join(th, -1, NULL);
+	xieq(2, s->naccept);
+	for (uint i = 0;  i != 2;  i++) {
+		ffthd_join(th2[i], -1, NULL);
+		xieq(1, s2[i].naccept);
+		close(s2[i].tcp);
+	}
+
+	s->keepalive = 0;
+	pc.max_idle = 0;
+	ffhttpcl_pool_conf(&pc);
+}
+
+static struct {
+	struct zzkq kq;
+	uint order[8]; // indexes of the completed jobs
+	uint n, total;
+	uint inflight, inflight_max;
+} fetch;
+
+static void kqlog(void *obj, uint flags, const char *ctx, const char *id, const char *fmt, ...)
+{
+}
+
+static void fetch_prepare(void *udata, void *con)
+{
+	fetch.inflight++;
+	fetch.inflight_max = ffmax(fetch.inflight, fetch.inflight_max);
+}
+
+static void fetch_data(void *udata, ffhttp_response *resp, ffstr data)
+{
+	xieq(200, resp->code);
+	if (data.len != 0)
+		x(ffstr_eqz(&data, "ok"));
+}
+
+static void fetch_done(void *udata, int result)
+{
+	xieq(0, result);
+	fetch.inflight--;
+	fetch.order[fetch.n++] = (ffsize)udata;
+	if (fetch.n == fetch.total)
+		zzkq_stop(&fetch.kq);
+}
+
+static void fetch_run(ffhttpfetch *f, struct stub *s, uint n)
+{
+	fetch.kq.stop = 0;
+	fetch.n = 0;
+	fetch.total = n;
+	ffthd th;
+	x(FFTHD_INV != (th = ffthd_create(&stub_thread, s, 0)));
+	zzkq_run(&fetch.kq);
+	ffthd_join(th, -1, NULL);
+}
+
+/** Fetch manager: priority queue, retry, per-host limit */
+static void test_http_fetch(struct stub *s, uint port)
+{
+	struct zzkq_conf kconf = {};
+	kconf.log.func = &kqlog;
+	kconf.max_objects = 16;
+	kconf.events_wait = 16;
+	zzkq_init(&fetch.kq);
+	x(0 == zzkq_create(&fetch.kq, &kconf));
+
+	struct ffhttpfetch_conf conf = {};
+	conf.kq = &fetch.kq;
+	conf.max_active = 1;
+	conf.retry_delay = 10;
+	ffhttpfetch *f = ffhttpfetch_create(&conf);
+	x(f != NULL);
+
+	char url[128];
+	ffs_format_r0(url, sizeof(url), "http://127.0.0.1:%u/%Z", port);
+	struct ffhttpfetch_req req = {};
+	req.url = url;
+	req.prepare = &fetch_prepare;
+	req.ondata = &fetch_data;
+	req.ondone = &fetch_done;
+
+	// #0 starts immediately and is retried after 503;
+	// the others start in order of priority, the retried job is the last
+	static const int prio[] = { 0, 5, 1, 5 };
+	for (uint i = 0;  i != FF_COUNT(prio);  i++) {
+		req.priority = prio[i];
+		req.udata = (void*)(ffsize)i;
+		x(0 == ffhttpfetch_add(f, &req));
+	}
+	s->ndns = 0;
+	s->nhttp = 5;
+	s->n503 = 1;
+	fetch_run(f, s, 4);
+	static const uint order[] = { 1, 3, 2, 0 };
+	for (uint i = 0;  i != FF_COUNT(order);  i++) {
+		xieq(order[i], fetch.order[i]);
+	}
+
+	struct ffhttpfetch_stats st;
+	ffhttpfetch_stats(f, &st);
+	xieq(5, st.started);
+	xieq(1, st.retries);
+	xieq(4, st.completed);
+	xieq(0, st.failed);
+	xieq(8, st.bytes);
+	xieq(0, st.active + st.queued);
+	ffhttpfetch_free(f);
+
+	// not more than 2 requests to the same host at once
+	conf.max_active = 0;
+	conf.max_per_host = 2;
+	f = ffhttpfetch_create(&conf);
+	x(f != NULL);
+	req.priority = 0;
+	fetch.inflight_max = 0;
+	for (uint i = 0;  i != 6;  i++) {
+		x(0 == ffhttpfetch_add(f, &req));
+	}
+	s->nhttp = 6;
+	fetch_run(f, s, 6);
+	xieq(2, fetch.inflight_max);
+	ffhttpfetch_free(f);
+
+	zzkq_destroy(&fetch.kq);
+}
+
+void test_http_client(void)
+{
+	FFTEST_FUNC;
+	char url[128], saddr[32];
+	struct stub s = {};
+	ffthd th;
+	fflock_init(&post_lk);
+
+	kq = ffkqu_create();
+	timer = fftimer_create(0);
+	fftimer_start(timer, kq, (void*)-1, 50);
+
+	x(0 <= (s.dns = socket(AF_INET, SOCK_DGRAM, 0)));
+	x(0 <= (s.tcp = socket(AF_INET, SOCK_STREAM, 0)));
+	uint dns_port = stub_bind(s.dns, 1, 0);
+	uint http_port = stub_bind(s.tcp, 1, 0);
+	x(0 == listen(s.tcp, 8));
+
+	// ffdnsclient: the kernel queue is serviced while the DNS server is slow to respond
+	s.ndns = 2; // A, AAAA
+	s.dns_delay = STUB_DNS_DELAY;
+	s.hosts[0] = 1;
+	s.nhosts = 1;
+	s.nhttp = 1;
+	x(FFTHD_INV != (th = ffthd_create(&stub_thread, &s, 0)));
+
+	ffdnscl_conf dconf;
+	ffdnscl_conf_init(&dconf);
+	dconf.kq = kq;
+	dconf.log = &dnslog;
+	dconf.time = &dnstime;
+	dconf.timer = &emptytimer;
+	dconf.retry_timeout = 5000;
+	dconf.edns = 0;
+	ffdnsclient *dns = ffdnscl_new(&dconf);
+	ffstr addr;
+	ffstr_set(&addr, saddr, ffs_format_r0(saddr, sizeof(saddr), "127.0.0.1:%u", dns_port));
+	x(0 == ffdnscl_serv_add(dns, &addr));
+
+	struct ffhttpcl_conf conf = {};
+	conf.dns = dns;
+	ffs_format_r0(url, sizeof(url), "http://stub.test:%u/%Z", http_port);
+	request(&conf, "GET", url, NULL);
+	x(ticks_resolved >= STUB_DNS_DELAY / 50 / 2);
+	ffthd_join(th, -1, NULL);
+
+	test_happy_eyeballs(&s, dns, http_port);
+	test_http_body(&s, http_port);
+	test_http_ce(&s, http_port);
+	test_http_detach(&s, http_port);
+	test_http_fetch(&s, http_port);
+	test_http_keepalive(&s, http_port);
+
+	// thread pool: getaddrinfo() doesn't block the kernel queue
+	s.ndns = 0;
+	s.nhttp = 1;
+	x(FFTHD_INV != (th = ffthd_create(&stub_thread, &s, 0)));
+	ffthpoolconf tpconf = {};
+	tpconf.maxthreads = 1;
+	tpconf.maxqueue = 4;
+	ffthpool *tp = ffthpool_create(&tpconf);
+	x(tp != NULL);
+	conf.dns = NULL;
+	conf.thpool = tp;
+	conf.post = &post;
+	ffs_format_r0(url, sizeof(url), "http://localhost:%u/%Z", http_port);
+	request(&conf, "GET", url, NULL);
+	ffthd_join(th, -1, NULL);
+
+	ffthpool_free(tp);
+	ffdnscl_free(dns);
+	ffvec_free(&s.req);
+	close(s.dns);
+	close(s.tcp);
+	fftimer_close(timer, kq);
+	ffkqu_close(kq);
+	ffhttpcl_deinit();
+}
+
+/** Download 1GB via loopback: fixed buffers;  adaptive buffers with SO_RCVLOWAT;  + buffer handoff */
+void bench_http_download(void)
+{
+	FFTEST_FUNC;
+	struct stub s = {};
+	kq = ffkqu_create();
+	x(0 <= (s.tcp = socket(AF_INET, SOCK_STREAM, 0)));
+	uint port = stub_bind(s.tcp, 1, 0);
+	x(0 == listen(s.tcp, 8));
+	char url[128];
+	ffs_format_r0(url, sizeof(url), "http://127.0.0.1:%u/%Z", port);
+
+	static const struct {
+		const char *name;
+		uint buffer_max, rcvlowat, detach;
+	} modes[] = {
+		{ "16K buffers", 0, 0, 0 },
+		{ "adaptive", 1024 * 1024, 256 * 1024, 0 },
+		{ "adaptive+detach", 1024 * 1024, 256 * 1024, 1 },
+	};
+	for (uint i = 0;  i != FF_COUNT(modes);  i++) {
+		s.nhttp = 1;
+		s.body_len = 1024 * 1024 * 1024;
+		ffthd th;
+		x(FFTHD_INV != (th = ffthd_create(&stub_thread, &s, 0)));
+
+		struct ffhttpcl_conf conf = {};
+		conf.buffer_max = modes[i].buffer_max;
+		conf.rcvlowat = modes[i].rcvlowat;
+		resp_collect = 2;
+		resp_bytes = 0;
+		resp_detach = modes[i].detach;
+		uint64 t = time_ms();
+		request(&conf, "GET", url, NULL);
+		t = time_ms() - t;
+		ffthd_join(th, -1, NULL);
+		xieq(s.body_len, resp_bytes);
+
+		char buf[128];
+		int n = ffs_format_r0(buf, sizeof(buf), "%s: %U MB/s\n"
+			, modes[i].name, (t != 0) ? s.body_len / 1000 / t : 0);
+		fffile_write(ffstdout, buf, n);
+	}
+
+	resp_collect = 0;
+	resp_detach = 0;
+	close(s.tcp);
+	ffkqu_close(kq);
+	ffhttpcl_deinit();
+}
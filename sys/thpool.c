@@ -119,6 +119,13 @@ int ffthpool_add(ffthpool *p, ffthpool_task *task)
 {
 	ffbool empty = ffring_empty(&p->queue);
 
+	if ((!empty || p->threads.len == 0)
+		&& p->threads.len < p->conf.maxthreads) {
+		if (0 != tp_newthread(p)
+			&& p->threads.len == 0)
+			return -1; // nobody would process the task
+	}
+
 	ffatom32_inc(&task->ref);
 	if (0 != ffring_write(&p->queue, task)) {
 		ffatom32_dec(&task->ref);
@@ -126,12 +133,6 @@ int ffthpool_add(ffthpool *p, ffthpool_task *task)
 		return -1;
 	}
 
-	if ((!empty || p->threads.len == 0)
-		&& p->threads.len < p->conf.maxthreads) {
-		if (0 != tp_newthread(p))
-			return -1;
-	}
-
 	ffsem_post(p->sem);
 	return 0;
 }
@@ -41,5 +41,7 @@ FF_EXTERN ffthpool_task* ffthpool_task_new(uint addsize);
 FF_EXTERN void ffthpool_task_free(ffthpool_task *t);
 
 /** Add task to the queue.  Thread-safe.
-Create additional threads when necessary. */
+Create additional threads when necessary.
+Return 0 if the task is queued;
+ -1: the task isn't queued, the caller still owns it */
 FF_EXTERN int ffthpool_add(ffthpool *p, ffthpool_task *task);